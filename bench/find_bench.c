@@ -0,0 +1,126 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Substring Search Benchmark
+ * Builds a synthetic text file in memory (1 GB by default) out of common
+ * words, with the pattern only at the very end, and measures how fast every
+ * substring searcher the CPU supports gets there - forwards and backwards -
+ * next to the C library's strstr(), in GB/s.
+ *
+ * Usage: find_bench [size_in_mb] [pattern]
+ */
+
+# define BENCH_RUNS 3 // Best of this many runs is reported
+
+/*
+ * Monotonic clock in seconds
+ */
+static double	now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Fill data with lines of random words; the last byte is a NUL for strstr()
+ */
+static void	fill_synthetic(char *data, size_t size)
+{
+    static const char	*words[] = {"the", "search", "log", "line", "with",
+        "payload", "data", "here", "and", "there", "error", "request", "time",
+        "value", "a", "of"};
+    uint32_t			state;
+    size_t				i;
+    size_t				len;
+
+    state = 12345;
+    i = 0;
+    while (i < size - 1)
+    {
+        state = state * 1103515245 + 12345;
+        len = strlen(words[(state >> 16) % 16]);
+        if (len > size - 1 - i)
+            len = size - 1 - i;
+        memcpy(data + i, words[(state >> 16) % 16], len);
+        i += len;
+        if (i < size - 1)
+            data[i++] = ((state >> 8) % 12 == 0) ? '\n' : ' ';
+    }
+    data[size - 1] = '\0';
+}
+
+/*
+ * Best time of BENCH_RUNS searches, checking the offset found every time
+ */
+static double	time_search(size_t (*fn)(const char *, size_t, const char *, size_t),
+    const char *data, size_t size, const char *pat, size_t expected)
+{
+    double	best;
+    double	t;
+    size_t	got;
+
+    best = 1e9;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        t = now();
+        got = fn(data, size, pat, strlen(pat));
+        t = now() - t;
+        if (got != expected)
+            printf("mismatch (%zu != %zu)\n", got, expected);
+        best = t < best ? t : best;
+    }
+    return (best);
+}
+
+int	main(int argc, char **argv)
+{
+    const t_find_impl	*impls;
+    size_t				n_impls;
+    size_t				size;
+    size_t				at;
+    const char			*pat;
+    char				*data;
+    const char			*found;
+    double				t;
+    double				best;
+    double				best_rfind;
+
+    size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1024) << 20;
+    pat = argc > 2 ? argv[2] : "request 4711 timed out";
+    if (size < 2 * strlen(pat) + 2)
+        size = 2 * strlen(pat) + 2;
+    data = malloc(size);
+    if (data == NULL)
+        return (ERR_MEMORY_ALLOCATION);
+    fill_synthetic(data, size);
+    // The pattern once at the end (and, for rfind, once at the start)
+    at = size - 1 - strlen(pat);
+    memcpy(data + at, pat, strlen(pat));
+    memcpy(data, pat, strlen(pat));
+    printf("synthetic file: %zu MB, pattern \"%s\"\n", size >> 20, pat);
+    printf("%-8s %12s %12s\n", "impl", "find GB/s", "rfind GB/s");
+    impls = find_impls(&n_impls);
+    for (size_t i = 0; i < n_impls; i++)
+    {
+        // Skip the copy at the start so find has to cross the whole file
+        best = time_search(impls[i].find, data + 1, size - 2, pat, at - 1);
+        best_rfind = time_search(impls[i].rfind, data, size - 1 - strlen(pat), pat, 0);
+        printf("%-8s %12.2f %12.2f\n", impls[i].name,
+            size / best / 1e9, size / best_rfind / 1e9);
+    }
+    best = 1e9;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        t = now();
+        found = strstr(data + 1, pat);
+        t = now() - t;
+        if (found != data + at)
+            printf("strstr: mismatch\n");
+        best = t < best ? t : best;
+    }
+    printf("%-8s %12.2f %12s\n", "strstr", size / best / 1e9, "-");
+    free(data);
+    return (ERR_NO_ERROR);
+}
@@ -0,0 +1,418 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Keystroke Replay Benchmark
+ * Runs the editor headless: a file is loaded as it would be on the command
+ * line, then the keys of a script are decoded, handled and drawn one frame
+ * per key, exactly as the main loop does, except that frames go to a sink
+ * in memory instead of the terminal. Reports the time to first paint and
+ * to a fully indexed file, then for each script the latency of every key
+ * (decode, edit, draw, flush) as percentiles, the bytes a frame sends, the
+ * writes a frame takes and the read/write system calls made per frame by
+ * the whole process (background saves included).
+ *
+ * A script holds one step per line, "COUNT<TAB>KEYS" or just "KEYS", the
+ * keys being the bytes a terminal sends, with \e, \r, \n, \t, \\ and \xHH
+ * escapes; lines starting with '#' are comments.
+ *
+ * Usage: replay_bench [-s ROWSxCOLS] [-g SIZE] file script.keys...
+ *        -g makes file a synthetic log of SIZE bytes (K, M or G suffix)
+ *        unless it already has that size
+ */
+
+# define BENCH_ROWS 40       // Default terminal size
+# define BENCH_COLS 120
+# define NEEDLE_EVERY 4096   // Lines of synthetic text per "needle" (search scripts)
+
+// Globals the editor's objects expect (defined by main.c in the editor)
+t_mode		current_mode = MODE_INPUT;
+t_buffer	g_buffer;
+t_undo_log	g_undo = {.budget = UNDO_DEFAULT_BUDGET};
+char		current_filename[PATH_MAX] = {0};
+int			g_window_rows = BENCH_ROWS;
+int			g_window_cols = BENCH_COLS;
+
+// In-memory terminal: what the last frame sent, and totals
+static char		*g_term = NULL;
+static size_t	g_term_cap = 0;
+static size_t	g_sink_bytes = 0;
+static size_t	g_sink_writes = 0;
+
+/*
+ * Monotonic clock in microseconds
+ */
+static double	now_us(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e6 + ts.tv_nsec / 1e3);
+}
+
+/*
+ * Frame output: copied to memory as a terminal would take it
+ */
+static ssize_t	sink_writev(int fd, const struct iovec *iov, int n)
+{
+    size_t	total;
+
+    (void)fd;
+    total = 0;
+    for (int i = 0; i < n; i++)
+        total += iov[i].iov_len;
+    if (total > g_term_cap)
+    {
+        g_term_cap = total * 2;
+        g_term = realloc(g_term, g_term_cap);
+        if (g_term == NULL)
+            die("realloc");
+    }
+    total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        memcpy(g_term + total, iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    g_sink_bytes += total;
+    g_sink_writes++;
+    return ((ssize_t)total);
+}
+
+/*
+ * Read and write system calls made so far by the process (all threads)
+ *
+ * @return: The count, or 0 if /proc/self/io cannot be read
+ */
+static size_t	io_syscalls(void)
+{
+    char	line[128];
+    FILE	*f;
+    size_t	total;
+    size_t	n;
+
+    f = fopen("/proc/self/io", "r");
+    if (f == NULL)
+        return (0);
+    total = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, "syscr: %zu", &n) == 1 || sscanf(line, "syscw: %zu", &n) == 1)
+            total += n;
+    }
+    fclose(f);
+    return (total);
+}
+
+/*
+ * Parse a size such as "4096", "64K", "1M" or "1G"
+ */
+static size_t	parse_size(const char *s)
+{
+    char	*end;
+    size_t	size;
+
+    size = strtoul(s, &end, 10);
+    if (*end == 'K' || *end == 'k')
+        size <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        size <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        size <<= 30;
+    return (size);
+}
+
+/*
+ * Write a synthetic log of size bytes: lines of random words with a
+ * numbered "needle" every NEEDLE_EVERY lines. Kept if it already has that
+ * size
+ *
+ * @return: 0 on success, -1 on error
+ */
+static int	generate(const char *path, size_t size)
+{
+    static const char	*words[] = {"the", "request", "log", "line", "with",
+        "payload", "data", "here", "and", "there", "error", "INFO", "time",
+        "value", "a", "of"};
+    struct stat			st;
+    char				block[65536];
+    uint32_t			state;
+    size_t				len;
+    size_t				lines;
+    size_t				done;
+    FILE				*f;
+
+    if (stat(path, &st) == 0 && (size_t)st.st_size == size)
+        return (0);
+    f = fopen(path, "w");
+    if (f == NULL)
+        return (-1);
+    state = 12345;
+    lines = 0;
+    done = 0;
+    while (done < size)
+    {
+        len = 0;
+        while (len < sizeof(block) - 64)
+        {
+            state = state * 1103515245 + 12345;
+            if ((state >> 8) % 10 == 0)
+            {
+                block[len++] = '\n';
+                if (++lines % NEEDLE_EVERY == 0)
+                    len += sprintf(block + len, "needle %zu ", lines / NEEDLE_EVERY);
+            }
+            else
+                len += sprintf(block + len, "%s ", words[(state >> 16) % 16]);
+        }
+        if (len > size - done)
+            len = size - done;
+        if (len > 0 && done + len == size)
+            block[len - 1] = '\n';
+        if (fwrite(block, 1, len, f) != len)
+            break ;
+        done += len;
+    }
+    return ((fclose(f) == 0 && done == size) ? 0 : -1);
+}
+
+/*
+ * Decode the escapes of a script step into out
+ *
+ * @return: Bytes written to out
+ */
+static size_t	unescape(const char *s, char *out)
+{
+    size_t			n;
+    unsigned int	byte;
+
+    n = 0;
+    while (*s != '\0' && *s != '\n')
+    {
+        if (*s != '\\' || s[1] == '\0')
+        {
+            out[n++] = *s++;
+            continue ;
+        }
+        s++;
+        if (*s == 'x' && sscanf(s + 1, "%2x", &byte) == 1)
+        {
+            out[n++] = (char)byte;
+            s += 3;
+            continue ;
+        }
+        if (*s == 'e')
+            out[n++] = '\x1b';
+        else if (*s == 'r')
+            out[n++] = '\r';
+        else if (*s == 'n')
+            out[n++] = '\n';
+        else if (*s == 't')
+            out[n++] = '\t';
+        else
+            out[n++] = *s;
+        s++;
+    }
+    return (n);
+}
+
+/*
+ * Read a script into the bytes a terminal would send
+ *
+ * @param path: Script file
+ * @param len: Receives the number of bytes
+ * @return: The bytes (malloc'd), or NULL if the file cannot be read
+ */
+static char	*load_script(const char *path, size_t *len)
+{
+    char	line[1024];
+    char	keys[1024];
+    char	*text;
+    char	*tab;
+    size_t	count;
+    size_t	n;
+    FILE	*f;
+
+    f = fopen(path, "r");
+    if (f == NULL)
+        return (NULL);
+    text = NULL;
+    *len = 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+            continue ;
+        tab = strchr(line, '\t');
+        count = (tab != NULL) ? strtoul(line, NULL, 10) : 1;
+        n = unescape((tab != NULL) ? tab + 1 : line, keys);
+        text = realloc(text, *len + count * n + 1);
+        if (text == NULL)
+            die("realloc");
+        for (size_t i = 0; i < count; i++)
+        {
+            memcpy(text + *len, keys, n);
+            *len += n;
+        }
+    }
+    fclose(f);
+    return (text != NULL ? text : calloc(1, 1));
+}
+
+/*
+ * Draw one frame as the main loop does
+ */
+static void	frame(t_cursor *cursor)
+{
+    draw_screen(cursor);
+    draw_status_line(cursor);
+    draw_cursor(cursor);
+    screen_flush();
+}
+
+/*
+ * Scenario name of a script: its file name without directory and ".keys"
+ */
+static void	script_name(const char *path, char *out, size_t size)
+{
+    const char	*base;
+
+    base = strrchr(path, '/');
+    base = (base != NULL) ? base + 1 : path;
+    snprintf(out, size, "%.*s", (int)strcspn(base, "."), base);
+}
+
+static int	compare_double(const void *a, const void *b)
+{
+    double	x;
+    double	y;
+
+    x = *(const double *)a;
+    y = *(const double *)b;
+    return ((x > y) - (x < y));
+}
+
+/*
+ * Load the file afresh and replay a script on it, one frame per key
+ *
+ * @param file: File to edit
+ * @param script: Script file
+ * @param report_load: Print the time to first paint and to fully indexed
+ * @return: 0 on success, -1 if the script cannot be read
+ */
+static int	replay(const char *file, const char *script, bool report_load)
+{
+    t_cursor	cursor;
+    char		name[32];
+    char		*keys;
+    size_t		len;
+    size_t		off;
+    double		*lat;
+    size_t		n;
+    size_t		io;
+    double		t0;
+    double		paint;
+    int			c;
+
+    keys = load_script(script, &len);
+    if (keys == NULL)
+        return (-1);
+    lat = malloc((len + 1) * sizeof(*lat));
+    if (lat == NULL)
+        die("malloc");
+    current_mode = MODE_INPUT;
+    cursor = (t_cursor){.cx = 1, .cy = 1, .rx = 1};
+    screen_resize(g_window_rows, g_window_cols);
+    t0 = now_us();
+    load_file(file);
+    frame(&cursor);
+    paint = now_us() - t0;
+    buffer_index_all(&g_buffer);  // Keys then never wait for the indexer
+    if (report_load)
+        printf("  %-8s first paint %.2f ms, fully indexed %.2f ms\n", "load",
+            paint / 1e3, (now_us() - t0) / 1e3);
+    if (index_progress())
+        handle_index_update(&cursor);
+    frame(&cursor);
+
+    g_sink_bytes = 0;
+    g_sink_writes = 0;
+    io = io_syscalls();
+    n = 0;
+    off = 0;
+    while (1)
+    {
+        off += key_feed(keys + off, len - off);
+        t0 = now_us();
+        if ((c = key_decode()) < 0)
+            break ;
+        clear_message();
+        if (current_mode == MODE_INPUT)
+            process_keypress(c, &cursor);
+        else
+            process_command(c, &cursor);
+        if (save_poll())
+            handle_save_finished();
+        matches_poll();
+        if (index_progress())
+            handle_index_update(&cursor);
+        frame(&cursor);
+        lat[n++] = now_us() - t0;
+        loop_wait();  // Timers that fell due (journal commits, idle steps)
+    }
+    t0 = now_us();
+    save_wait();  // A save started by the script finishes in the background
+    io = io_syscalls() - io;
+    qsort(lat, n, sizeof(*lat), compare_double);
+    script_name(script, name, sizeof(name));
+    if (n > 0)
+        printf("  %-8s %6zu keys  p50 %7.1f  p90 %7.1f  p99 %7.1f  max %8.1f us"
+            "  %7.0f B/frame  %.2f writes/frame  %.2f r/w syscalls/frame"
+            "  background %.1f ms\n",
+            name, n, lat[n / 2], lat[n * 9 / 10], lat[n * 99 / 100],
+            lat[n - 1], (double)g_sink_bytes / n, (double)g_sink_writes / n,
+            (double)(io + g_sink_writes) / n, (now_us() - t0) / 1e3);
+    free(lat);
+    free(keys);
+    return (0);
+}
+
+int	main(int argc, char **argv)
+{
+    struct stat	st;
+    size_t		size;
+    int			i;
+    int			fd;
+
+    size = 0;
+    for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+        if (strcmp(argv[i], "-s") == 0)
+            sscanf(argv[i + 1], "%dx%d", &g_window_rows, &g_window_cols);
+        else if (strcmp(argv[i], "-g") == 0)
+            size = parse_size(argv[i + 1]);
+    }
+    if (i + 1 >= argc || g_window_rows < 2 || g_window_cols < 16)
+    {
+        fprintf(stderr, "usage: %s [-s ROWSxCOLS] [-g SIZE] file script.keys...\n", argv[0]);
+        return (ERR_INVALID_ARG);
+    }
+    if (size > 0 && generate(argv[i], size) != 0)
+    {
+        perror(argv[i]);
+        return (ERR_FILE_NOT_FOUND);
+    }
+    // Headless: no terminal to read from, frames go to memory
+    fd = open("/dev/null", O_RDONLY);
+    if (fd >= 0)
+        dup2(fd, STDIN_FILENO);
+    frame_set_output(sink_writev);
+    if (stat(argv[i], &st) == 0)
+        printf("%s: %lld bytes, %dx%d\n", argv[i], (long long)st.st_size,
+            g_window_cols, g_window_rows);
+    for (int s = i + 1; s < argc; s++)
+    {
+        if (replay(argv[i], argv[s], s == i + 1) != 0)
+            perror(argv[s]);
+    }
+    journal_close_all(false);
+    return (ERR_NO_ERROR);
+}
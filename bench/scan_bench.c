@@ -0,0 +1,100 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Newline Scanner Benchmark
+ * Builds a synthetic text file in memory (1 GB by default) with lines of
+ * random length and measures every newline scanner the CPU supports, both
+ * counting and recording offsets, in GB/s.
+ *
+ * Usage: scan_bench [size_in_mb]
+ */
+
+# define BENCH_RUNS 3 // Best of this many runs is reported
+
+/*
+ * Monotonic clock in seconds
+ */
+static double	now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Fill data with printable lines of 0..120 characters
+ */
+static void	fill_synthetic(char *data, size_t size)
+{
+    uint32_t	state;
+    size_t		i;
+    size_t		line_end;
+
+    state = 12345;
+    i = 0;
+    while (i < size)
+    {
+        state = state * 1103515245 + 12345;
+        line_end = i + (state >> 16) % 121;
+        while (i < line_end && i < size)
+        {
+            data[i] = 'a' + i % 26;
+            i++;
+        }
+        if (i < size)
+            data[i++] = '\n';
+    }
+}
+
+int	main(int argc, char **argv)
+{
+    const t_newline_impl	*impls;
+    size_t					n_impls;
+    size_t					size;
+    char					*data;
+    size_t					*offsets;
+    size_t					expected;
+    size_t					got;
+    double					t;
+    double					best_count;
+    double					best_scan;
+
+    size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1024) << 20;
+    data = malloc(size);
+    if (data == NULL)
+        return (ERR_MEMORY_ALLOCATION);
+    fill_synthetic(data, size);
+    impls = newline_impls(&n_impls);
+    expected = impls[n_impls - 1].count(data, size);
+    offsets = malloc((expected ? expected : 1) * sizeof(*offsets));
+    if (offsets == NULL)
+        return (ERR_MEMORY_ALLOCATION);
+    printf("synthetic file: %zu MB, %zu lines\n", size >> 20, expected);
+    printf("%-8s %12s %12s\n", "impl", "count GB/s", "scan GB/s");
+    for (size_t i = 0; i < n_impls; i++)
+    {
+        best_count = 1e9;
+        best_scan = 1e9;
+        for (int run = 0; run < BENCH_RUNS; run++)
+        {
+            t = now();
+            got = impls[i].count(data, size);
+            t = now() - t;
+            if (got != expected)
+                printf("%s: count mismatch (%zu != %zu)\n", impls[i].name, got, expected);
+            best_count = t < best_count ? t : best_count;
+            t = now();
+            got = impls[i].scan(data, size, 0, offsets);
+            t = now() - t;
+            if (got != expected)
+                printf("%s: scan mismatch (%zu != %zu)\n", impls[i].name, got, expected);
+            best_scan = t < best_scan ? t : best_scan;
+        }
+        printf("%-8s %12.2f %12.2f\n", impls[i].name,
+            size / best_count / 1e9, size / best_scan / 1e9);
+    }
+    free(offsets);
+    free(data);
+    return (ERR_NO_ERROR);
+}
@@ -0,0 +1,113 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON UTF-8 Validation Benchmark
+ * Builds synthetic text in memory (256 MB by default): pure ASCII code,
+ * mostly ASCII with some accented letters, and CJK text. Every validator
+ * the CPU supports is timed on each, in GB/s.
+ *
+ * Usage: utf8_bench [size_in_mb]
+ */
+
+# define BENCH_RUNS 3 // Best of this many runs is reported
+
+/*
+ * Monotonic clock in seconds
+ */
+static double	now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Fill data with lines made of the given characters, picked at random
+ *
+ * @param chars: UTF-8 characters to pick from, separated by spaces
+ */
+static void	fill_synthetic(char *data, size_t size, const char *chars)
+{
+    const char	*pick[64];
+    size_t		len[64];
+    size_t		count;
+    size_t		n;
+    size_t		i;
+    uint32_t	state;
+
+    count = 0;
+    while (*chars && count < 64)
+    {
+        pick[count] = chars;
+        len[count] = strcspn(chars, " ");
+        chars += len[count] + (chars[len[count]] == ' ');
+        count++;
+    }
+    state = 12345;
+    i = 0;
+    while (i < size)
+    {
+        state = state * 1103515245 + 12345;
+        n = (state >> 16) % (count + 1);
+        if (n == count)
+            data[i++] = ((state >> 8) % 8 == 0) ? '\n' : ' ';
+        else if (i + len[n] <= size)
+        {
+            memcpy(data + i, pick[n], len[n]);
+            i += len[n];
+        }
+        else
+            data[i++] = ' ';
+    }
+}
+
+int	main(int argc, char **argv)
+{
+    static const char	*names[] = {"ascii", "latin", "cjk"};
+    static const char	*sets[] = {
+        "a b c d e f g h i j k l m n o ( ) ; = + x y z 0 1 2",
+        "a b c d e f g h i j k l m n o p r s t u v é è à ü ö ß ç",
+        "中 文 字 符 日 本 語 한 국 어 の は に を 、 。 a"};
+    const t_utf8_impl	*impls;
+    size_t				n_impls;
+    size_t				size;
+    size_t				got;
+    char				*data;
+    double				t;
+    double				best;
+    bool				ascii;
+
+    size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    data = malloc(size);
+    if (data == NULL)
+        return (ERR_MEMORY_ALLOCATION);
+    impls = utf8_impls(&n_impls);
+    printf("synthetic text: %zu MB\n%-8s", size >> 20, "impl");
+    for (size_t s = 0; s < 3; s++)
+        printf(" %10s GB/s", names[s]);
+    printf("\n");
+    for (size_t i = 0; i < n_impls; i++)
+    {
+        printf("%-8s", impls[i].name);
+        for (size_t s = 0; s < 3; s++)
+        {
+            fill_synthetic(data, size, sets[s]);
+            best = 1e9;
+            for (int run = 0; run < BENCH_RUNS; run++)
+            {
+                ascii = true;
+                t = now();
+                got = impls[i].validate(data, size, &ascii);
+                t = now() - t;
+                if (got != size)
+                    printf("\n%s: error reported at %zu\n", impls[i].name, got);
+                best = t < best ? t : best;
+            }
+            printf(" %15.2f", size / best / 1e9);
+        }
+        printf("\n");
+    }
+    free(data);
+    return (ERR_NO_ERROR);
+}
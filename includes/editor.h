@@ -20,7 +20,6 @@ int	main(int argc, char **argv);
  */
 
 // Screen management functions
-void	show_splash_screen(void);      // Display startup screen from verbatron.txt
 void	clear_screen_startup(void);    // Clear screen and hide cursor for startup
 void	reset_screen(void);            // Restore screen and show cursor on exit
 
@@ -29,7 +28,6 @@ void	draw_cursor(t_cursor *cursor); // Position and display cursor on screen
 void	move_cursor(t_cursor *cursor, char c); // Move cursor based on WASD keys
 
 // File operations
-void	save_to_file(const char *filename);  // Write buffer contents to file
 void	load_file(const char *filename);     // Read file contents into buffer
 
 // Command line interface (bottom of screen)
@@ -38,24 +36,334 @@ void	clear_command_prompt(void);                 // Clear the command line
 void	update_command_line(const char *buffer);    // Update command line display
 void	set_cursor_bottom(void);                    // Move cursor to bottom row
 void	print_command_prompt(void);                 // Display the ":" prompt
+void	draw_status_line(t_cursor *cursor);         // Line position and count (input mode)
+void	set_message(const char *fmt, ...);          // Message for the bottom line
+void	clear_message(void);                        // Drop the message on the next key
 
 /*
  * INPUT.C - Input handling and display rendering
  */
 
 // Input processing
-int		read_key(void);                              // Read and decode keyboard input
 void	process_keypress(int c, t_cursor *cursor);  // Handle keys in input mode
 void	process_command(int c, t_cursor *cursor);   // Handle keys in command mode
 void	handle_command(const char *cmd, t_cursor *cursor); // Execute typed commands
+void	handle_index_update(t_cursor *cursor);      // React to background indexing progress
+void	handle_save_finished(void);                 // Show the result of a background save
+void	handle_resize(t_cursor *cursor);            // Adapt to a new terminal size
+void	handle_file_lost(t_cursor *cursor);         // Load a file that shrank under its mapping again
+bool	index_progress(void);                       // Pick up background indexing progress
 
 // Display rendering
 void	draw_text_buffer(t_cursor *cursor);         // Render text with line numbers
 void	draw_screen(t_cursor *cursor);              // Refresh entire screen
+int		gutter_width(void);                         // Columns taken by line numbers
 
 // Special key handlers
 void	backspace_handle(t_cursor *cursor);         // Handle backspace key logic
 
+/*
+ * STARTUP.C - First paint, splash and startup timing (--startup-time)
+ */
+void	startup_begin(void);                        // Start the clock (first thing in main)
+void	startup_measure(void);                      // Report the times and quit (--startup-time)
+void	startup_painted(void);                      // The first frame was sent
+void	startup_check(void);                        // Note when the whole file is indexed
+void	splash_show(void);                          // Splash in the empty document
+void	splash_hide(void);                          // Take it away (first key)
+void	splash_draw(void);                          // Draw it if shown
+
+/*
+ * TABS.C - Open files, each with its own cursor and history
+ */
+bool	tabs_add(const char *filename);             // Open a file later (command line)
+void	tabs_open(const char *filename, t_cursor *cursor); // Show a file, in a new tab if needed
+void	tabs_switch(size_t index, t_cursor *cursor); // Show another tab
+void	tabs_next(int step, t_cursor *cursor);      // Show the next or previous tab
+void	tabs_close(t_cursor *cursor);               // Close the tab shown
+size_t	tabs_count(void);                           // Open tabs
+size_t	tabs_current(void);                         // Index of the tab shown
+const char	*tabs_name(size_t index);               // File name of a tab
+size_t	tabs_modified(void);                        // A tab with unsaved changes
+void	tabs_keep_modified(void);                   // Keep swap files of unsaved tabs
+void	tabs_list(char *out, size_t size);          // Tab names for ":ls"
+
+/*
+ * KEYS.C - Bulk terminal input decoding
+ */
+bool	key_fill(void);                             // Read everything the terminal sent
+int		key_decode(void);                           // Next buffered key, or -1
+size_t	key_feed(const char *data, size_t len);     // Queue bytes as if typed (replay)
+const char	*key_paste(size_t *len);                // Text of the last PASTE key
+const char	*key_text(size_t *len);                 // Bytes of the last UTF8_KEY
+
+/*
+ * LOOP.C - poll()-based event loop (input, signals, wakeups, timers)
+ */
+void	loop_init(void);                            // Self-pipe and signal handlers
+void	loop_wake(void);                            // Wake the main loop (any thread)
+int		loop_timer_add(int delay_ms, void (*fn)(void *), void *arg); // One-shot timer
+void	loop_timer_cancel(int id);                  // Disarm a timer
+void	loop_watch(int fd, int interval_ms, void (*fn)(void *), void *arg); // Poll a descriptor too
+int		loop_wait(void);                            // Sleep until something happens
+
+/*
+ * STATS.C - Latency histograms and syscall counters (":stats", --stats FILE)
+ */
+# if VB_STATS
+uint64_t	stats_now(void);                        // Nanoseconds on the monotonic clock
+void	stats_record(t_stat_timer id, uint64_t ns); // Time a stage took (any thread)
+void	stats_add(t_stat_counter id, uint64_t n);   // Add to a counter (any thread)
+#  define STATS_START(t) ((t) = stats_now())
+#  define STATS_STOP(id, t) stats_record((id), stats_now() - (t))
+#  define STATS_ADD(id, n) stats_add((id), (n))
+# else
+#  define STATS_START(t) ((t) = 0)
+#  define STATS_STOP(id, t) ((void)(t))
+#  define STATS_ADD(id, n) ((void)0)
+# endif
+void	stats_dump_at_exit(const char *path);       // Write them to a file on exit
+void	stats_show(void);                           // Overlay until the next key
+bool	stats_hide(void);                           // Close the overlay (true if it was shown)
+void	stats_draw(void);                           // Draw the overlay if shown
+
+/*
+ * BUFFER.C - Piece table text storage
+ */
+
+// Lifetime
+void	buffer_init(t_buffer *buf, const char *text, size_t len); // Start a buffer from text
+void	buffer_free(t_buffer *buf);                 // Release pieces and sources
+
+// Lazy indexing of memory-mapped files
+int		buffer_map_file(t_buffer *buf, int fd, size_t size); // Map a file without scanning it
+size_t	buffer_index_more(t_buffer *buf, size_t max_bytes); // Scan the next part of the file
+void	buffer_ensure_lines(t_buffer *buf, size_t lines); // Scan until lines are known
+void	buffer_ensure_view(t_buffer *buf, size_t top, size_t rows, size_t cols); // Scan enough to draw a view
+void	buffer_ensure_size(t_buffer *buf, size_t size); // Scan until the document is that long
+void	buffer_index_all(t_buffer *buf);            // Scan the rest of the file
+bool	buffer_fully_indexed(const t_buffer *buf);  // Whole file scanned?
+void	buffer_append_index(t_buffer *buf, const t_index_chunk *chunk); // Apply a scanned chunk
+bool	buffer_drop_index(t_buffer *buf);           // Back to just the mapping, if unedited
+int		buffer_follow(t_buffer *buf, int fd, size_t size); // Take in lines appended to the file
+
+// Snapshots (copy on write)
+void	buffer_snapshot(const t_buffer *buf, t_buffer *snap); // O(1) immutable view
+void	buffer_release_snapshot(t_buffer *snap);    // Drop a view
+
+// Editing
+void	buffer_insert(t_buffer *buf, size_t pos, const char *text, size_t len); // Insert bytes
+void	buffer_delete(t_buffer *buf, size_t pos, size_t len); // Remove bytes
+t_piece	*buffer_adopt(t_buffer *buf, char *data, size_t size); // Take over a block of text
+t_piece	*buffer_splice(t_buffer *buf, size_t pos, size_t len, t_piece *with); // Swap a span for pieces
+void	buffer_release_pieces(t_piece *pieces);     // Drop pieces from buffer_splice()
+
+// Queries
+size_t	buffer_size(const t_buffer *buf);           // Total bytes in document
+bool	buffer_modified(const t_buffer *buf);       // Changed since loaded or saved?
+size_t	buffer_line_count(const t_buffer *buf);     // Number of lines
+size_t	buffer_line_start(const t_buffer *buf, size_t line); // Offset of a line
+size_t	buffer_line_length(const t_buffer *buf, size_t line); // Bytes in a line (no '\n')
+size_t	buffer_offset(const t_buffer *buf, size_t line, size_t col); // (line, col) to offset
+size_t	buffer_line_at(const t_buffer *buf, size_t pos); // Line containing an offset
+size_t	buffer_chunk(const t_buffer *buf, size_t pos, const char **out); // Contiguous run at pos
+size_t	buffer_chunk_before(const t_buffer *buf, size_t pos, const char **out); // Contiguous run ending at pos
+size_t	buffer_read(const t_buffer *buf, size_t pos, char *dst, size_t len); // Copy bytes out
+size_t	buffer_unindexed(const t_buffer *buf, const char **out); // Original bytes not indexed yet
+
+/*
+ * UNDO.C - Undo/redo history (coalescing operation log in an arena)
+ */
+void	undo_record_insert(t_undo_log *log, size_t pos, const char *text, size_t len,
+    bool coalesce);                                 // Record inserted text
+void	undo_record_delete(t_undo_log *log, const t_buffer *buf, size_t pos, size_t len,
+    bool coalesce);                                 // Record text about to be deleted
+void	undo_record_replace(t_undo_log *log, size_t pos, size_t len, t_piece *old); // Record a splice
+void	undo_break(t_undo_log *log);                // Next edit starts a new step
+bool	undo_revert(t_undo_log *log, t_buffer *buf, size_t *pos); // Undo one step
+bool	undo_replay(t_undo_log *log, t_buffer *buf, size_t *pos); // Redo one step
+size_t	undo_step_start(const t_undo_log *log, bool redo); // Where the next step starts
+void	undo_set_budget(t_undo_log *log, size_t budget); // Cap the history's memory
+void	undo_clear(t_undo_log *log);                // Forget all history
+
+/*
+ * SAVE.C - Atomic, streaming file save
+ */
+int		save_buffer(const t_buffer *buf, const char *filename, size_t *written); // Temp file + fsync + rename
+int		save_to_file(const char *filename);         // Save g_buffer and report the result
+void	save_start(const char *filename, bool adopt_name); // Save g_buffer in the background
+int		save_now(const char *filename);             // Save g_buffer in the foreground
+bool	save_poll(void);                            // Report a finished background save
+void	save_wait(void);                            // Wait for the background save
+
+/*
+ * JOURNAL.C - Crash-recovery journal (swap file of edits)
+ */
+t_journal	*journal_open(const char *filename, t_buffer *buf); // Replay a leftover swap file, log edits
+void	journal_insert(t_journal *j, size_t pos, const char *text, size_t len); // Log an insertion
+void	journal_delete(t_journal *j, size_t pos, size_t len); // Log a deletion
+void	journal_splice(t_journal *j, size_t pos, size_t len, const t_piece *with); // Log a replacement
+off_t	journal_mark(t_journal *j);                 // Where a save's records end
+void	journal_saved(t_buffer *buf, const char *filename, off_t mark); // Start afresh after a save
+void	journal_close(t_journal *j, bool keep);     // Stop logging, removing the swap file
+void	journal_close_all(bool keep);               // Every journal, on exit
+
+/*
+ * FOLLOW.C - Follow a file another program appends to (like "tail -f")
+ */
+bool	follow_start(void);                         // Follow the file shown
+void	follow_stop(void);                          // Stop following it
+bool	follow_active(void);                        // Is it followed?
+bool	follow_check(void);                         // Reload at once if it shrank
+bool	follow_pending(void);                       // Grew or reloaded since follow_take()?
+bool	follow_take(size_t *lines, bool *reloaded); // What changed since the last call
+
+/*
+ * SCAN.C - Vectorized newline scanning
+ */
+size_t	newline_count(const char *data, size_t len); // Count '\n' bytes
+size_t	newline_scan(const char *data, size_t len, size_t base, size_t *out); // Record '\n' offsets
+const t_newline_impl	*newline_impls(size_t *count); // Usable implementations, best first
+
+/*
+ * FIND.C - Vectorized substring search
+ */
+size_t	text_find(const char *hay, size_t len, const char *pat, size_t n); // First occurrence
+size_t	text_rfind(const char *hay, size_t len, const char *pat, size_t n); // Last occurrence
+const t_find_impl	*find_impls(size_t *count); // Usable implementations, best first
+
+/*
+ * SEARCH.C - Pattern search over the document
+ */
+void	text_init(t_text *t, const t_buffer *buf);  // View a document and its unindexed tail
+size_t	text_chunk(const t_text *t, size_t pos, const char **out); // Contiguous run at pos
+size_t	text_chunk_before(const t_text *t, size_t pos, const char **out); // Run ending at pos
+size_t	text_find_in(const t_text *t, const char *pat, size_t n, size_t lo, size_t hi,
+    bool backward);                             // Literal starting in [lo, hi)
+size_t	search_find(const t_pattern *pat, size_t from, bool backward, bool *wrapped,
+    size_t *end);                               // Wrapping search
+size_t	search_next(const t_text *t, const t_pattern *pat, size_t lo, size_t hi,
+    size_t *end);                               // First match starting in [lo, hi)
+size_t	search_starts(const t_text *t, const t_pattern *pat, size_t lo, size_t hi,
+    uint64_t *bits);                            // Mark and count every match start
+void	search_begin(size_t origin, bool backward); // Start searching as the pattern is typed
+size_t	search_update(const char *pat, size_t n, bool *wrapped); // Match of the pattern typed so far
+void	search_set_last(const char *pat, size_t n, bool backward, t_regex *re); // Pattern to repeat
+void	search_last(t_pattern *pat, bool *backward); // Last pattern searched for
+
+/*
+ * REGEX.C - Regular expressions compiled to lazy DFAs
+ */
+t_regex	*regex_compile(const char *pattern, const char **error); // Parse and build the automata
+void	regex_free(t_regex *re);                    // Release a compiled expression
+bool	regex_find(t_regex *re, const t_text *t, size_t lo, size_t hi, bool backward,
+    size_t *start, size_t *end);                // Leftmost-longest match starting in [lo, hi)
+void	regex_starts(t_regex *re, const t_text *t, size_t lo, size_t hi, uint64_t *bits);
+                                                // Mark every match start in [lo, hi)
+
+/*
+ * MATCHES.C - Match counting on a pool of worker threads
+ */
+void	matches_start(const t_pattern *pat);       // Count the matches of a pattern
+void	matches_set_current(size_t at);             // Match shown (SIZE_MAX: none)
+void	matches_cancel(void);                       // The buffer changed: drop the count
+void	matches_stop(void);                         // Stop and join the workers
+bool	matches_poll(void);                         // Reap workers that have exited
+int		matches_status(char *out, size_t size);     // "match k of N" for the status line
+
+/*
+ * SUBSTITUTE.C - ":s" substitution built in one pass
+ */
+bool	substitute_is_command(const char *cmd);     // Looks like "[range]s/..."?
+bool	substitute_parse(const char *cmd, size_t line, t_substitute *sub); // Range, pattern, flags
+size_t	substitute_build(t_substitute *sub);        // Find the matches and build the new text
+
+/*
+ * SYNTAX.C - Syntax highlighting (cached lexer states)
+ */
+void	syntax_select(const char *filename);        // Language from a file name
+bool	syntax_set(const char *name);               // Language by name ("off": none)
+const char	*syntax_name(void);                     // Current language, or NULL
+bool	syntax_update(size_t first, size_t last, size_t *from, size_t *to);
+                                                // Re-lex down to the view
+void	syntax_edit(size_t line, size_t removed, size_t added); // Lines were replaced
+void	syntax_invalidate(size_t line);             // Forget states after a line
+size_t	syntax_spans(size_t line, const t_hl_span **spans); // Highlighting of a line
+
+/*
+ * UTF8.C - UTF-8 decoding, display widths and vectorized validation
+ */
+size_t	utf8_decode(const char *s, size_t n, uint32_t *cp); // One character (1 byte if invalid)
+int		utf8_width(uint32_t cp);                    // Display columns: 0, 1 or 2
+bool	utf8_printable(uint32_t cp);                // Drawn as itself (not '?')
+bool	utf8_extends(uint32_t prev, uint32_t cp);   // Part of the character before it?
+size_t	utf8_validate(const char *data, size_t len, bool *ascii); // First invalid byte, or len
+size_t	utf8_validate_range(const char *s, size_t n, size_t from, size_t to, bool *ascii); // Part of s
+const t_utf8_impl	*utf8_impls(size_t *count);     // Available validators, best first
+
+/*
+ * COLUMNS.C - Display columns of lines (cached per line)
+ */
+size_t	columns_col(size_t line, size_t byte);      // Display column of a byte offset
+size_t	columns_byte(size_t line, size_t col, size_t *at); // Character covering a column
+size_t	columns_row_skip(size_t line, size_t *byte, size_t *col, size_t width, size_t rows); // Down rows
+size_t	columns_rows(size_t line, size_t width);    // Screen rows a line wraps to
+size_t	columns_next(size_t line, size_t byte);     // Start of the next character
+size_t	columns_prev(size_t line, size_t byte);     // Start of the previous character
+void	columns_edit(size_t line, size_t byte, size_t removed, size_t added); // Lines changed or moved
+void	columns_invalidate(size_t line, size_t byte); // Everything from a point on changed
+
+/*
+ * WRAP.C - Soft wrap: screen rows of each line (Fenwick tree)
+ */
+bool	wrap_enabled(void);                         // ":set wrap" in effect?
+void	wrap_set(bool on);                          // Turn soft wrap on or off
+int		wrap_width(void);                           // Columns of text in a row
+size_t	wrap_rows(size_t line);                     // Screen rows a line takes
+size_t	wrap_row_start(size_t line, size_t sub, size_t *col); // Where a row of a line starts
+size_t	wrap_sub(size_t line, size_t col);          // Row of a line showing a column
+long	wrap_distance(size_t line, size_t sub, size_t to_line, size_t to_sub, long limit); // Rows between
+size_t	wrap_row_of(size_t line);                   // Rows above a line
+size_t	wrap_line_at(size_t row, size_t *sub);      // Line shown at a row of the document
+size_t	wrap_total(void);                           // Rows of the whole document
+void	wrap_edit(size_t line, size_t byte, size_t removed, size_t added); // Lines replaced
+void	wrap_invalidate(size_t line);               // Lines from here on changed
+
+/*
+ * INDEXER.C - Background line index builder
+ */
+void	indexer_start(t_buffer *buf);               // Scan the rest of a mapped file in a thread
+bool	indexer_poll(t_buffer *buf);                // Apply finished chunks (non-blocking)
+void	indexer_wait(t_buffer *buf);                // Block for the next chunk and apply it
+void	indexer_stop(t_buffer *buf);                // Stop and join the worker
+
+/*
+ * FRAME.C - Output composition (one write per frame)
+ */
+void	frame_append(const char *s, size_t len);    // Append raw bytes
+void	frame_appendf(const char *fmt, ...);        // Append formatted text
+char	*frame_reserve(size_t n);                   // Space to write into directly
+void	frame_commit(size_t n);                     // Keep bytes written after frame_reserve
+void	frame_flush(void);                          // Send the frame with a single writev
+void	frame_set_sync(bool enabled);               // Wrap frames in mode 2026 markers
+void	frame_set_output(ssize_t (*output)(int fd, const struct iovec *iov, int n)); // Sink (benchmarks)
+size_t	frame_length(void);                         // Bytes composed so far
+
+/*
+ * SCREEN.C - Double-buffered screen model with damage tracking
+ */
+void	screen_resize(int rows, int cols);          // Allocate the model (terminal just cleared)
+void	screen_invalidate_rows(int from, int to);   // Rows to compose again
+void	screen_invalidate_span(int row, int lo, int hi); // Columns of a row that changed
+bool	screen_row_dirty(int row);                  // Does a row need composing?
+int		screen_put(int row, int col, const char *s, int len, uint8_t attr); // Write UTF-8 text
+void	screen_put_cells(int row, int col, const t_cell *src, int count); // Copy composed cells
+void	screen_set_attr(int row, int col, int len, uint8_t attr); // Recolor written cells
+void	screen_clear_to_eol(int row, int col);      // Blank the rest of a row
+void	screen_scroll(int top, int bottom, int n);  // Shift rows with a scroll region
+void	screen_set_cursor(int row, int col);        // Cursor position after the frame
+void	screen_flush(void);                         // Emit changed cells and send the frame
+
 /*
  * TERM.C - Terminal management and raw mode control
  */
@@ -64,7 +372,8 @@ void	backspace_handle(t_cursor *cursor);         // Handle backspace key logic
 void	die(const char *message);                   // Error handler with cleanup
 void	disable_raw_mode(void);                     // Restore normal terminal mode
 void	enable_raw_mode(void);                      // Enter raw mode for key capture
-void	sigint_handle(int sig);                     // Handle Ctrl+C interrupts
+void	sigint_handle(int sig);                     // Clean exit on Ctrl+C or SIGTERM
 void	get_window_size(int *rows, int *cols);      // Get current terminal dimensions
+bool	term_query_sync_update(void);               // Does the terminal support mode 2026?
 
 #endif
@@ -27,13 +27,16 @@
 # include <math.h>      // Currently unused but available for future features
 
 // POSIX threads
-# include <pthread.h>   // Currently unused but available for threading
+# include <pthread.h>   // Background indexing, saving and match counting
 
 // POSIX semaphores
 # include <semaphore.h> // Currently unused but available for synchronization
 
+// Polling file descriptors
+# include <poll.h>      // poll() (checking for pending input)
+
 // Signal handling
-# include <signal.h>    // signal(), SIGINT, etc.
+# include <signal.h>    // sigaction(), SIGINT, SIGWINCH, etc.
 
 // Variable argument lists
 # include <stdarg.h>    // va_list, va_start(), etc. (for printf-like functions)
@@ -59,9 +62,18 @@
 // Terminal I/O control
 # include <sys/ioctl.h> // ioctl(), TIOCGWINSZ (for getting window size)
 
+// File change notification
+# include <sys/inotify.h> // inotify_init1(), inotify_add_watch() (follow mode)
+
+// Memory mapping
+# include <sys/mman.h>  // mmap(), munmap(), madvise() (lazy file loading)
+
 // File status
 # include <sys/stat.h>  // stat(), chmod(), file permissions
 
+// Scatter/gather I/O
+# include <sys/uio.h>   // writev() (one syscall per rendered frame)
+
 // System types
 # include <sys/types.h> // ssize_t, pid_t, etc.
 
@@ -72,7 +84,7 @@
 # include <termios.h>   // tcgetattr(), tcsetattr(), raw mode control
 
 // Time functions
-# include <time.h>      // time(), sleep() (used for splash screen)
+# include <time.h>      // clock_gettime() (timers, startup times)
 
 // POSIX API
 # include <unistd.h>    // read(), write(), close(), STDIN_FILENO, etc.
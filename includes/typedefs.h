@@ -8,31 +8,966 @@
  * the code more maintainable and prevents circular dependencies.
  */
 
-// Buffer dimensions - these define the maximum size of text the editor can handle
-# define MAX_ROWS 1000 // Maximum number of lines (buffer size, not screen size)
-# define MAX_COLS 120  // Maximum characters per line
+// Piece table tuning - the add buffer grows in blocks that never move in memory
+# define ADD_BLOCK_SIZE 65536 // Bytes per add-buffer block (larger inserts get their own)
+# define PIECE_POOL_BLOCK 1024 // Piece nodes carved at once from the pool shared by all buffers
+
+// Lazy line indexing of memory-mapped files
+# define INDEX_STEP 65536        // Bytes scanned per step while filling the viewport
+# define INDEX_IDLE_STEP 4194304 // Bytes scanned per idle step between keystrokes
+# define INDEX_CHUNK 4194304     // Bytes per chunk published by the indexer thread
+# define SCAN_BLOCK 65536        // Bytes counted then scanned while still in cache
+
+// How long to wait for the terminal to answer a capability query
+# define TERM_QUERY_TIMEOUT_MS 100
+
+// Initial size of the frame composition buffer (grows as needed)
+# define FRAME_INITIAL_SIZE 16384
+
+// Display - tabs are expanded to the next multiple of TAB_STOP columns
+# define TAB_STOP 4
+
+// UTF-8
+# define UTF8_INVALID 0xFFFFFFFFu // Decoded value of a byte that does not start a valid sequence
+# define UTF8_ZWJ 0x200D          // Zero width joiner: joins the next character to the cluster
+# define CELL_BYTES 15            // UTF-8 bytes a screen cell holds (a character and its marks)
+# define COLUMN_CACHE_LINES 128   // Lines whose columns are remembered (more than a screen)
+# define COLUMN_CHECKPOINT 4096   // Bytes between remembered (byte, column) points of a line
+# define WRAP_IDLE_LINES 4096     // Lines measured per idle step for the soft-wrap map
+# define WRAP_CACHE_LINES 128     // Lines whose row starts are remembered (more than a screen)
+# define WRAP_ROW_STEP 16         // Rows between remembered row starts of a line
 
 // Command buffer size for storing user commands in command mode
 # define CMD_BUF_SIZE 256
 
+// Regular expressions
+# define REGEX_MAX_NODES 2048    // Syntax tree nodes (after expanding {m,n})
+# define REGEX_MAX_STATES 16384  // NFA states ('.' alone takes 28)
+# define REGEX_CACHE_STATES 1024 // DFA states kept per automaton before the cache is flushed
+# define REGEX_MAX_REPEAT 255    // Largest count allowed in {m,n}
+# define REGEX_MAX_RANGES 64     // Runs of non-ASCII characters in one [class]
+
+// Match counting - the text is split into chunks searched by a pool of threads
+# define MATCH_CHUNK 4194304    // Bytes of text per task handed to a worker
+# define MATCH_MAX_WORKERS 64   // Upper bound on worker threads
+# define MATCH_CHUNK_KEEP 4096  // Match offsets kept per chunk (the rest are only counted)
+
+// Substitution
+# define SUBST_OUT_BLOCK 1048576 // First allocation for a substitution's output (doubles as needed)
+
+// Syntax highlighting
+# define SYNTAX_MAX_LINE 65536   // Longer lines are shown plain (and do not change the lexer state)
+# define SYNTAX_SYNC_GAP 100000  // Lines lexed at once to extend the state cache up to the view
+# define SYNTAX_SYNC_LINES 1000  // Further away, lexing starts this many lines above the line shown
+# define SYNTAX_HASH_SIZE 512    // Slots in the keyword table (a power of two)
+# define SYNTAX_WORD_LISTS 4     // Word lists (keywords, types, ...) per language
+
+// Pieces handed to a single writev() when saving (IOV_MAX on Linux)
+# define SAVE_IOV_BATCH 1024
+
+// Crash-recovery journal (swap file next to the file: ".name.vbswp")
+# define JOURNAL_MAGIC "VBSWP001"    // First bytes of a swap file
+# define JOURNAL_IDLE_MS 300         // Quiet time after an edit before the journal is committed
+# define JOURNAL_MAX_DELAY_MS 2000   // Longest an edit waits for a commit while typing goes on
+# define JOURNAL_DIRECT_SIZE 65536   // Records at least this long skip the pending buffer
+
+// Follow mode (":follow", -f): a file another program appends to
+# define FOLLOW_INTERVAL_MS 50          // Least time between two looks at the file
+# define FOLLOW_RETRY_MS 1000           // How often a file moved away is looked for again
+# define FOLLOW_STEP 4194304            // Appended bytes taken in per look (more on the next pass)
+# define FOLLOW_RESERVE 4294967296ULL   // Address space mapped past the end, so growing seldom remaps
+
+// Undo history
+# define UNDO_BLOCK_SIZE 65536        // Arena block for recorded bytes (larger edits get their own)
+# define UNDO_DEFAULT_BUDGET 67108864 // Bytes of history kept before the oldest is dropped (64 MB)
+
+// Instrumentation (":stats", --stats FILE); "make STATS=0" compiles it out
+# ifndef VB_STATS
+#  define VB_STATS 1
+# endif
+# define STATS_SUB_BITS 3        // Histogram buckets per power of two: 1 << STATS_SUB_BITS
+# define STATS_SUB_BUCKETS 8     // The same (durations are kept within 12.5%)
+# define STATS_BUCKETS 320       // Buckets in all: nanoseconds up to about half an hour
+
 // Custom key codes for arrow keys (since they send escape sequences)
 // We use values > 255 to avoid conflicts with regular ASCII characters
 # define ARROW_UP 1000
 # define ARROW_DOWN 1001
 # define ARROW_RIGHT 1002
 # define ARROW_LEFT 1003
+# define HOME_KEY 1004
+# define END_KEY 1005
+# define PAGE_UP 1006
+# define PAGE_DOWN 1007
+# define DEL_KEY 1008
+# define PASTE 1009    // Bracketed paste; the text is in key_paste()
+# define UTF8_KEY 1010 // A non-ASCII character; its bytes are in key_text()
+
+// Modifier flags or'ed into a key code (Shift+Up = ARROW_UP | KEY_SHIFT)
+# define KEY_SHIFT 0x10000
+# define KEY_ALT 0x20000
+# define KEY_CTRL 0x40000
+# define KEY_MODS (KEY_SHIFT | KEY_ALT | KEY_CTRL)
+
+// Terminal input decoding
+# define INPUT_BUF_SIZE 65536   // Bytes taken from stdin by one read()
+# define ESC_TIMEOUT_MS 25      // Wait for the rest of an escape sequence
+# define PASTE_TIMEOUT_MS 1000  // Give up on a paste whose end marker never comes
+
+// Event loop - what woke loop_wait() up (flags, or'ed together)
+# define EVENT_INPUT 0x01    // The terminal sent bytes
+# define EVENT_WAKE 0x02     // A worker thread finished something (loop_wake)
+# define EVENT_RESIZE 0x04   // SIGWINCH: the terminal changed size
+# define EVENT_QUIT 0x08     // SIGINT (Ctrl+C): quit
+# define EVENT_TIMER 0x10    // At least one timer ran
+# define EVENT_HANGUP 0x20   // SIGTERM or SIGHUP, or the terminal went away: quit, keeping swap files
+# define EVENT_WATCH 0x40    // The watched descriptor was ready (loop_watch)
+# define EVENT_LOST 0x80     // SIGBUS: pages of a mapped file are gone (it shrank)
+# define LOOP_MAX_TIMERS 16  // Timers armed at the same time
+
+/*
+ * One-shot timer run by the event loop
+ */
+typedef struct s_timer
+{
+    bool        active;
+    uint64_t    due_ms;             // CLOCK_MONOTONIC deadline in milliseconds
+    void        (*fn)(void *arg);   // Called from the main loop once due
+    void        *arg;
+}				t_timer;
+
+/*
+ * Descriptor the event loop polls besides stdin and its self-pipe
+ */
+typedef struct s_watch
+{
+    int         fd;                 // -1 when nothing is watched
+    int         interval_ms;        // Least time between two calls of fn
+    uint64_t    next_ms;            // Not polled before this time (CLOCK_MONOTONIC)
+    void        (*fn)(void *arg);   // Called from the main loop when fd is readable
+    void        *arg;
+}				t_watch;
+
+/*
+ * Stages of the editor that are timed (":stats")
+ */
+typedef enum e_stat_timer
+{
+    STAT_READ,      // Reading what the terminal sent (key_fill)
+    STAT_DECODE,    // Turning bytes into one key (key_decode)
+    STAT_KEY,       // Handling a key (process_keypress, process_command)
+    STAT_DRAW,      // Composing the text rows (draw_text_buffer)
+    STAT_FRAME,     // A whole frame, from composing to the write
+    STAT_LOAD,      // Opening a file (load_file)
+    STAT_SAVE,      // Writing a file out (foreground or background save)
+    STAT_TIMERS
+}				t_stat_timer;
+
+/*
+ * Things that are counted (":stats")
+ */
+typedef enum e_stat_counter
+{
+    STAT_TERM_WRITES,   // writev() calls to the terminal
+    STAT_TERM_BYTES,    // Bytes the terminal took
+    STAT_INPUT_READS,   // read() calls on stdin
+    STAT_INPUT_BYTES,   // Bytes read from stdin
+    STAT_POLLS,         // poll() calls (event loop, escape sequence waits)
+    STAT_FILE_WRITES,   // write(), writev() and pwrite() calls on files (saves, journal)
+    STAT_FILE_BYTES,    // Bytes written to files
+    STAT_FILE_SYNCS,    // fsync() and fdatasync() calls
+    STAT_COUNTERS
+}				t_stat_counter;
+
+/*
+ * Latency histogram: log-linear buckets of nanoseconds, as in HDR
+ * histograms - the first STATS_SUB_BUCKETS hold one value each, then every
+ * power of two is split in STATS_SUB_BUCKETS equal parts
+ */
+typedef struct s_histogram
+{
+    uint64_t    count;
+    uint64_t    total_ns;
+    uint64_t    max_ns;
+    uint64_t    buckets[STATS_BUCKETS];
+}				t_histogram;
+
+/*
+ * Text source - an immutable run of bytes that pieces point into.
+ * The original file is one source; the add buffer is a chain of sources
+ * (blocks) that only ever grow at the end. Each source keeps a sorted
+ * table of its newline offsets so line lookups never rescan text.
+ */
+typedef struct s_source
+{
+    char                *data;     // Raw bytes (address only changes in buffer_follow())
+    size_t              size;      // Bytes in use
+    size_t              capacity;  // Bytes allocated
+    size_t              *nl;       // Sorted offsets of every '\n' in data
+    size_t              nl_count;  // Number of entries used in nl
+    size_t              nl_cap;    // Number of entries allocated in nl
+    bool                mapped;    // data is an mmap of a file (munmap, don't free)
+    struct s_source     *next;     // Next source owned by the same buffer
+}				t_source;
+
+/*
+ * Newline scanner implementation (scalar, SSE2, AVX2, ...)
+ * count() returns the number of '\n' bytes; scan() also stores base + offset
+ * of each one into out
+ */
+typedef struct s_newline_impl
+{
+    const char  *name;
+    size_t      (*count)(const char *data, size_t len);
+    size_t      (*scan)(const char *data, size_t len, size_t base, size_t *out);
+}				t_newline_impl;
+
+/*
+ * Substring search implementation (scalar, SSE2, AVX2, ...)
+ * find() returns the offset of the first occurrence of pat in hay, rfind()
+ * that of the last one; both return SIZE_MAX if there is none
+ */
+typedef struct s_find_impl
+{
+    const char  *name;
+    size_t      (*find)(const char *hay, size_t len, const char *pat, size_t n);
+    size_t      (*rfind)(const char *hay, size_t len, const char *pat, size_t n);
+}				t_find_impl;
+
+/*
+ * UTF-8 validator implementation (scalar, SSE2, AVX2, ...)
+ * validate() returns the offset of the first byte that does not belong to
+ * a valid UTF-8 sequence (len if there is none) and clears *ascii if it
+ * saw a byte >= 0x80
+ */
+typedef struct s_utf8_impl
+{
+    const char  *name;
+    size_t      (*validate)(const char *data, size_t len, bool *ascii);
+}				t_utf8_impl;
+
+/*
+ * Chunk of newline offsets published by the indexer thread
+ */
+typedef struct s_index_chunk
+{
+    size_t                  end;   // Original offset where the chunk stops
+    size_t                  *nl;   // Newline offsets inside the chunk
+    size_t                  count; // Entries in nl
+    size_t                  bad_utf8; // First offset that is not valid UTF-8, or SIZE_MAX
+    bool                    non_ascii; // Some byte is >= 0x80
+    struct s_index_chunk    *next; // Next published chunk
+}				t_index_chunk;
+
+/*
+ * Background indexer - a worker thread scanning the rest of a mapped file
+ * Everything below lock is shared with the worker
+ */
+typedef struct s_indexer
+{
+    pthread_t           thread;
+    const char          *data;     // Mapped file (read-only, shared)
+    size_t              from;      // Where the worker started
+    size_t              size;      // File size
+    pthread_mutex_t     lock;      // Protects the fields below
+    pthread_cond_t      ready;     // Signalled when a chunk is published or the scan ends
+    t_index_chunk       *head;     // Published chunks not yet applied
+    t_index_chunk       *tail;
+    bool                done;      // Worker has finished
+    bool                stop;      // Main thread asked the worker to stop
+}				t_indexer;
+
+/*
+ * Piece - a node of the piece table. Pieces are kept in a treap ordered
+ * by document position, and every node caches the byte and newline totals
+ * of its subtree so offset and line lookups are O(log n). Nodes are
+ * reference counted so snapshots can share them (copy on write).
+ */
+typedef struct s_piece
+{
+    t_source            *src;      // Source holding the bytes
+    size_t              start;     // Offset of the piece inside src
+    size_t              len;       // Length of the piece in bytes
+    size_t              lf;        // Newlines inside this piece
+    size_t              sum_len;   // Bytes in this subtree
+    size_t              sum_lf;    // Newlines in this subtree
+    uint32_t            prio;      // Treap heap priority
+    int                 refs;      // Trees sharing this node (buffer, snapshots)
+    struct s_piece      *left;     // Pieces before this one
+    struct s_piece      *right;    // Pieces after this one
+}				t_piece;
+
+/*
+ * Text buffer - piece table over the original file plus an append-only
+ * add buffer. Memory grows with the edits, not with the file's shape.
+ */
+typedef struct s_buffer
+{
+    t_piece             *root;     // Treap of pieces in document order
+    t_source            *sources;  // Every source owned by this buffer
+    t_source            *add;      // Add block currently being appended to
+    t_source            *original; // Original file bytes
+    size_t              indexed;   // Bytes of original already scanned and in the treap
+    t_indexer           *indexer;  // Background scan of the rest, or NULL
+    size_t              bad_utf8;  // First byte of the original (as far as indexed) that is not UTF-8, or SIZE_MAX
+    bool                non_ascii; // Some byte of the document may be >= 0x80 (false: pure ASCII)
+    struct s_journal    *journal;  // Swap file the edits are logged to, or NULL
+    size_t              edits;     // Changes made to the document so far
+    size_t              saved;     // Value of edits when the document last matched its file
+}				t_buffer;
+
+/*
+ * Read-only view of the text to search: the document, followed - while a
+ * mapped file is still being indexed - by the rest of the file
+ */
+typedef struct s_text
+{
+    const t_buffer      *buf;      // Document
+    size_t              size;      // Bytes in the document
+    const char          *tail;     // Unindexed bytes that follow it
+    size_t              length;    // size + unindexed bytes
+}				t_text;
 
 // Global text buffer - the main storage for all text content
 // External declaration means it's defined in main.c but used everywhere
-extern char		text_buffer[MAX_ROWS][MAX_COLS];
+extern t_buffer	g_buffer;
+
+/*
+ * Undo arena block - recorded bytes are appended here and never move.
+ * Blocks are released from the front as old history is dropped and from
+ * the back as undone edits are discarded.
+ */
+typedef struct s_undo_block
+{
+    struct s_undo_block *prev;     // Older block
+    struct s_undo_block *next;     // Newer block
+    size_t              used;      // Bytes taken
+    size_t              size;      // Bytes available in data
+    char                data[];
+}				t_undo_block;
+
+typedef enum e_undo_type
+{
+    UNDO_INSERT,   // bytes were inserted at pos
+    UNDO_DELETE,   // bytes were deleted from pos
+    UNDO_REPLACE   // len bytes at pos replaced the text held in pieces
+}				t_undo_type;
+
+/*
+ * One recorded edit. Consecutive typing grows the newest op instead of
+ * adding one per key; ops sharing a step are undone together. A bulk
+ * replacement keeps the pieces of the text it replaced rather than a copy
+ * of its bytes, and undoing or redoing it swaps the two texts over.
+ */
+typedef struct s_undo_op
+{
+    size_t              pos;       // Document offset of the edit
+    size_t              len;       // Bytes inserted or deleted (replace: now in the document)
+    char                *bytes;    // Those bytes, in the arena
+    t_piece             *pieces;   // UNDO_REPLACE: the text to swap back in
+    t_undo_block        *block;    // Arena block holding bytes
+    uint32_t            step;      // Undo step the op belongs to
+    t_undo_type         type;
+}				t_undo_op;
+
+/*
+ * Undo/redo history - ops[0, applied) are in the document, ops[applied,
+ * count) were undone and can be redone until the next edit
+ */
+typedef struct s_undo_log
+{
+    t_undo_op           *ops;      // Oldest first
+    size_t              count;     // Ops recorded
+    size_t              applied;   // Ops currently in the document
+    size_t              cap;       // Ops allocated
+    t_undo_block        *head;     // Oldest arena block
+    t_undo_block        *tail;     // Block being appended to
+    size_t              memory;    // Bytes of history held (recorded bytes + op records)
+    size_t              budget;    // Oldest steps are dropped once memory exceeds this
+    uint32_t            step;      // Step of the newest op
+    bool                coalesce;  // The next typed edit may join the newest op
+}				t_undo_log;
+
+// Edit history of g_buffer (defined in main.c)
+extern t_undo_log	g_undo;
+
+/*
+ * Regular expression syntax tree (only used while compiling)
+ */
+typedef enum e_re_op
+{
+    RE_EMPTY,   // Matches the empty string
+    RE_CLASS,   // One byte out of a set
+    RE_CAT,     // left then right
+    RE_ALT,     // left or right
+    RE_STAR,    // left, any number of times
+    RE_PLUS,    // left, at least once
+    RE_QUEST,   // left, optionally
+    RE_BOL,     // ^ - start of a line
+    RE_EOL      // $ - end of a line
+}				t_re_op;
+
+typedef struct s_re_node
+{
+    t_re_op             op;
+    int                 left;      // Operand nodes (-1 if unused)
+    int                 right;
+    int                 cls;       // Byte set of an RE_CLASS
+}				t_re_node;
+
+/*
+ * Characters of a class while it is parsed: ASCII ones as bits, the others
+ * as code point ranges (one spare for negating)
+ */
+typedef struct s_re_set
+{
+    uint64_t            ascii[2];
+    uint32_t            ranges[REGEX_MAX_RANGES + 1][2];
+    int                 n_ranges;
+}				t_re_set;
+
+typedef struct s_re_parser
+{
+    const char          *p;        // Next character of the pattern
+    t_re_node           *nodes;
+    int                 n_nodes;
+    struct s_regex      *re;       // Receives the byte sets
+    const char          *error;    // First problem found, or NULL
+}				t_re_parser;
+
+/*
+ * NFA state (Thompson construction)
+ */
+typedef enum e_nfa_op
+{
+    NFA_CLASS,  // Consume a byte of cls, go to out
+    NFA_SPLIT,  // Go to out and out1 without consuming
+    NFA_BOL,    // Go to out if at the start of a line
+    NFA_EOL,    // Go to out if at the end of a line
+    NFA_MATCH   // Accept
+}				t_nfa_op;
+
+typedef struct s_nfa_state
+{
+    t_nfa_op            op;
+    int                 out;
+    int                 out1;      // Second branch of a split (-1 if none)
+    int                 cls;
+}				t_nfa_state;
+
+/*
+ * Part of an NFA under construction: its entry state and the list of
+ * dangling exits, threaded through the unset out fields (state * 2 + 1 for
+ * out1, -1 ends the list)
+ */
+typedef struct s_nfa_frag
+{
+    int                 start;
+    int                 holes;
+}				t_nfa_frag;
+
+typedef struct s_nfa_builder
+{
+    const t_re_node     *nodes;
+    t_nfa_state         *states;
+    int                 count;
+    bool                reverse;   // Build the NFA for the pattern read backwards
+    const char          *error;
+}				t_nfa_builder;
+
+/*
+ * DFA state built on demand: the set of NFA states active after some input
+ * Transitions are filled in the first time each byte is seen
+ */
+typedef struct s_dfa_state
+{
+    int                 *set;       // Active NFA states, sorted
+    int                 count;
+    uint32_t            hash;
+    bool                bol;        // Set was entered at the start of a line
+    bool                match;      // A match ends here
+    bool                match_eol;  // A match ends here if a line ends here too
+    int                 next[256];  // Byte offset of the state after each byte in
+                                    // the state array (-1 = not built yet)
+}				t_dfa_state;
+
+/*
+ * Lazily built DFA over one NFA, with a bounded cache of states
+ */
+typedef struct s_dfa
+{
+    const t_nfa_state   *nfa;
+    int                 n_nfa;
+    int                 start;      // NFA start state
+    bool                floating;   // A match may begin at any position
+    uint64_t            (*classes)[4];
+    t_dfa_state         *states;    // Cache of built states
+    int                 count;
+    int                 cap;
+    int                 flushes;    // Times the cache was emptied
+    int                 *table;     // Hash table of state indices (-1 = empty)
+    int                 *mark;      // Per NFA state: generation it was last added in
+    int                 generation;
+    int                 *stack;     // Closure work list
+    int                 *scratch;   // Set being built
+}				t_dfa;
+
+/*
+ * Compiled regular expression
+ * Matches never span lines: '.' and negated classes do not match '\n'
+ */
+typedef struct s_regex
+{
+    uint64_t            (*classes)[4];  // Byte sets, 256 bits each
+    int                 n_classes;
+    t_nfa_state         *forward;       // NFA for the pattern
+    int                 n_forward;
+    t_nfa_state         *reverse;       // NFA for the pattern read backwards
+    int                 n_reverse;
+    t_dfa               anchored;       // Forward, from a given start
+    t_dfa               floating;       // Forward, matches may start anywhere
+    t_dfa               backward;       // Backwards, matches may end anywhere
+    char                prefix[CMD_BUF_SIZE]; // Literal every match starts with
+    size_t              prefix_len;
+}				t_regex;
+
+/*
+ * Something to search for: a literal or a compiled regular expression
+ */
+typedef struct s_pattern
+{
+    const char          *text;     // Literal bytes, or the source of re
+    size_t              len;
+    t_regex             *re;       // NULL for a literal
+}				t_pattern;
+
+/*
+ * Search state - the pattern being typed after "/" or "?" with the match
+ * found for each of its prefixes, and the last pattern searched for
+ */
+typedef struct s_search
+{
+    char                pattern[CMD_BUF_SIZE];  // Pattern typed so far
+    size_t              len;                    // Its length
+    size_t              found[CMD_BUF_SIZE];    // Match of pattern[0, k), SIZE_MAX if none
+    bool                wrapped[CMD_BUF_SIZE];  // found[k] lies past the end of the text
+    size_t              origin;                 // Cursor offset when the search began
+    bool                backward;               // "?" search
+    char                last[CMD_BUF_SIZE];     // Pattern to repeat (Ctrl+N/Ctrl+P)
+    size_t              last_len;
+    bool                last_backward;
+    t_regex             *last_re;               // Compiled last pattern, if a regex
+}				t_search;
 
 // Current filename being edited (empty string if new file)
-extern char		current_filename[256];
+extern char		current_filename[PATH_MAX];
 
 // Dynamic window size variables - updated when terminal is resized
 extern int		g_window_rows;  // Current terminal height
 extern int		g_window_cols;  // Current terminal width
 
+/*
+ * Swap file header: the file the journal's records apply to
+ */
+typedef struct s_journal_header
+{
+    char                magic[8];           // JOURNAL_MAGIC
+    uint64_t            pid;                // Editor writing the journal
+    uint64_t            size;               // The file's size, mtime, inode and device
+    uint64_t            mtime_ns;           // when it was loaded (all 0: no such file)
+    uint64_t            ino;
+    uint64_t            dev;
+}				t_journal_header;
+
+typedef enum e_journal_type
+{
+    JOURNAL_INSERT = 0x49,  // Text was inserted at pos
+    JOURNAL_DELETE = 0x44,  // len bytes were deleted at pos
+    JOURNAL_REPLACE = 0x52  // len bytes at pos were replaced by text
+}				t_journal_type;
+
+/*
+ * Journal record as written (followed by its text)
+ */
+typedef struct s_journal_record
+{
+    uint64_t            type;               // t_journal_type
+    uint64_t            pos;                // Document offset
+    uint64_t            len;                // Bytes removed
+    uint64_t            size;               // Bytes of text put in their place (they follow)
+}				t_journal_record;
+
+/*
+ * Background save - a writer thread streaming a snapshot of the buffer
+ * Everything below lock is shared with the writer
+ */
+typedef struct s_save_job
+{
+    pthread_t           thread;
+    t_buffer            snapshot;           // Immutable view being written
+    char                filename[PATH_MAX]; // Target as typed by the user
+    bool                adopt_name;         // Becomes the current filename on success
+    pthread_mutex_t     lock;               // Protects the fields below
+    bool                done;               // Writer has finished
+    int                 error;              // errno of the failure, 0 on success
+    size_t              written;            // Bytes written
+    off_t               journal_mark;       // Journal records up to here are in the snapshot
+}				t_save_job;
+
+/*
+ * Crash-recovery journal of a document - every change made to its buffer,
+ * appended to a swap file so it can be replayed over the file after a crash
+ * Records pile up in memory and are written and flushed to disk together
+ * once editing pauses. The swap file is created by the first edit.
+ */
+typedef struct s_journal
+{
+    char                path[PATH_MAX];     // Swap file
+    int                 fd;                 // Open swap file, or -1 before the first edit
+    off_t               size;               // Bytes in the swap file
+    t_journal_header    header;             // Identifies the file the records apply to
+    char                *pending;           // Records not written yet
+    size_t              len;                // Bytes in pending
+    size_t              cap;                // Allocated size of pending
+    size_t              last;               // Offset of the newest pending record (SIZE_MAX: none)
+    bool                direct;             // Record being written straight to the file
+    bool                broken;             // Writing failed: nothing more is logged
+    uint64_t            first_ms;           // When the oldest pending record was made
+    uint64_t            last_ms;            // When the newest one was
+    int                 timer;              // Commit timer, or -1
+    bool                syncing;            // The sync thread has been started (not joined)
+    pthread_t           thread;             // Runs fdatasync() off the main thread
+    pthread_mutex_t     lock;               // Protects synced
+    bool                synced;             // The sync thread has finished
+    struct s_journal    *next;              // Every open journal (kept or removed at exit)
+}				t_journal;
+
+/*
+ * The file shown being followed (follow.c)
+ */
+typedef struct s_follow
+{
+    bool                active;    // A file is followed
+    int                 fd;        // The file, open for reading (the same file if renamed)
+    int                 notify;    // inotify instance watching it
+    int                 timer;     // Next look when not waiting for the file to change, or -1
+    bool                changed;   // Grew or was loaded again since follow_take()
+    bool                reloaded;  // Loaded again (truncated, or another file took its name)
+    size_t              lines;     // Line count before it grew (0: show the end anyway)
+}				t_follow;
+
+/*
+ * Matches found in one chunk of the text by a search worker
+ */
+typedef struct s_match_chunk
+{
+    size_t              count;     // Matches starting in the chunk
+    size_t              *at;       // Offsets of the first MATCH_CHUNK_KEEP, in order
+    size_t              kept;
+    bool                done;      // Searched (count and at are final)
+}				t_match_chunk;
+
+/*
+ * Background count of every match of a pattern - worker threads take
+ * chunks in turn and search a snapshot of the buffer
+ * Everything below lock is shared with the workers
+ */
+typedef struct s_match_job
+{
+    pthread_t           threads[MATCH_MAX_WORKERS];
+    int                 n_threads;
+    t_buffer            snapshot;           // Immutable view being searched
+    t_text              text;               // The snapshot and the unindexed tail
+    char                pattern[CMD_BUF_SIZE];
+    size_t              len;
+    t_regex             *re;                // Main thread's copy (NULL for a literal)
+    bool                stale;              // The buffer changed: results are void
+    size_t              current;            // Offset of the match shown, or SIZE_MAX
+    size_t              rank_at;            // Last match ranked, and its rank
+    size_t              rank;
+    size_t              n_chunks;
+    t_match_chunk       *chunks;
+    pthread_mutex_t     lock;               // Protects the fields below
+    size_t              next;               // Next chunk to hand out
+    int                 running;            // Workers that have not exited
+    bool                stop;               // Workers should give up
+}				t_match_job;
+
+/*
+ * Substitution - a parsed ":[range]s/pattern/replacement/[flags]" command
+ * and the text it builds: everything from the first match replaced to the
+ * end of the last one, rewritten, so one splice puts it in the document
+ */
+typedef struct s_substitute
+{
+    size_t              first;              // First line of the range (0-based)
+    size_t              last;               // Last line of the range
+    t_pattern           pat;                // What to replace (the last search pattern)
+    const char          *rep;               // Replacement as typed ('&' is the match)
+    size_t              rep_len;
+    bool                global;             // 'g': every match on a line, not just the first
+    bool                count_only;         // 'n': count the matches, change nothing
+    char                pattern[CMD_BUF_SIZE]; // Pattern with the delimiter unescaped
+    char                error[128];         // Why the command was rejected
+    char                *out;               // The rewritten text (malloc)
+    size_t              size;               // Bytes in out
+    size_t              cap;                // Bytes allocated for out
+    size_t              lo;                 // Span of the document out replaces
+    size_t              hi;
+    size_t              count;              // Matches replaced (or counted)
+    size_t              lines;              // Lines they are on
+    size_t              last_at;            // Offset of the last replacement once applied
+}				t_substitute;
+
+/*
+ * Lexer state at the start of a line - what an earlier line left open
+ * HL_STRING + i is a string opened by the i-th quote of the language;
+ * HL_PREPROC is or'ed in while a preprocessor line is continued
+ */
+enum
+{
+    HL_NORMAL = 0,
+    HL_COMMENT = 1,    // Inside a block comment
+    HL_STRING = 2,     // Inside a string (up to 4 kinds of quotes)
+    HL_PREPROC = 0x80  // Inside a preprocessor directive
+};
+
+// Language flags (t_syntax.flags)
+# define SYN_PREPROC 0x01       // '#' first on a line starts a preprocessor directive
+# define SYN_STRING_LINES 0x02  // Strings run on over line ends (otherwise only after a backslash)
+# define SYN_VARIABLES 0x04     // $name, ${...} and $1 are variables, also inside "..."
+# define SYN_KEYS 0x08          // A string followed by ':' is a key
+# define SYN_LINE_LOCAL 0x10    // Nothing carries over from one line to the next
+# define SYN_WORD_COMMENT 0x20  // The line comment only starts at the start of a word
+
+// Character classes of the lexer (t_highlight.cls)
+# define CC_SPACE 0x01       // Blank
+# define CC_WORD 0x02        // Part of a word
+# define CC_WORD_START 0x04  // Starts a word
+# define CC_DIGIT 0x08       // Starts a number
+# define CC_QUOTE 0x10       // Opens a string
+
+/*
+ * Words a language colors, and how
+ */
+typedef struct s_syntax_words
+{
+    const char *const   *words;   // NULL-terminated
+    uint8_t             attr;     // ATTR_* for them
+}				t_syntax_words;
+
+/*
+ * Language description - a table read by the one lexer in syntax.c
+ */
+typedef struct s_syntax
+{
+    const char          *name;         // As given to :syntax
+    const char          *extensions;   // File name endings, space separated
+    const char          *interpreters; // Names after "#!" in the first line, space separated
+    t_syntax_words      words[SYNTAX_WORD_LISTS];
+    const char          *line_comment; // Comment to the end of the line, or NULL
+    const char          *block_open;   // Block comment delimiters, or NULL
+    const char          *block_close;
+    const char          *quotes;       // String delimiters
+    int                 flags;         // SYN_* flags
+}				t_syntax;
+
+/*
+ * Highlighted run of a line: bytes up to end (from the end of the span
+ * before) have attribute attr
+ */
+typedef struct s_hl_span
+{
+    uint32_t            end;
+    uint8_t             attr;
+}				t_hl_span;
+
+/*
+ * Keyword table slot
+ */
+typedef struct s_hl_word
+{
+    const char          *word;    // NULL for an empty slot
+    uint8_t             len;
+    uint8_t             attr;
+}				t_hl_word;
+
+/*
+ * Highlighter - the current language and the lexer state cached at the
+ * start of each line. states[0, good) are up to date; the entries after
+ * that are from before the latest edits and become valid again once the
+ * lexer, past the edited lines, arrives at a line in the same state.
+ */
+typedef struct s_highlight
+{
+    const t_syntax      *syntax;       // Language, or NULL for plain text
+    bool                detect;        // Still to look at the first line for "#!"
+    uint8_t             cls[256];      // Character classes (CC_*)
+    t_hl_word           words[SYNTAX_HASH_SIZE]; // Keywords by hash
+    uint8_t             *states;       // State at the start of each line
+    size_t              known;         // Entries in states
+    size_t              cap;           // Entries allocated
+    size_t              good;          // Entries known to be up to date
+    size_t              edited_end;    // Lines before this changed since states were lexed
+    size_t              memo_line;     // Past the cache: a line whose state is memo_state
+    uint8_t             memo_state;
+    char                *line;         // Copy of a line split across pieces
+    size_t              line_cap;
+    t_hl_span           *spans;        // Spans of the line last highlighted
+    size_t              n_spans;
+    size_t              spans_cap;
+    bool                emit;          // The lexer records spans, not just the end state
+}				t_highlight;
+
+/*
+ * Known character start of a line and its display column
+ */
+typedef struct s_column_mark
+{
+    size_t              byte;     // Offset in the line
+    size_t              col;      // Display column
+}				t_column_mark;
+
+/*
+ * Remembered display columns of one line: bytes [0, plain) are each one
+ * column wide, marks are checkpoints about COLUMN_CHECKPOINT bytes apart
+ * past that, and (byte, col) is the furthest point measured so far
+ */
+typedef struct s_column_line
+{
+    size_t              line;     // Line (SIZE_MAX: unused)
+    size_t              len;      // Length of the line when it was measured
+    size_t              plain;    // Length of the one-column-per-byte prefix
+    size_t              byte;     // Furthest character start measured...
+    size_t              col;      // ...and its display column
+    t_column_mark       *marks;   // Checkpoints between plain and byte, ascending
+    size_t              count;    // Entries in marks
+    size_t              cap;      // Allocated entries
+    uint64_t            used;     // When it was last used (for eviction)
+}				t_column_line;
+
+/*
+ * Remembered row starts of one line under soft wrap: starts[i] is where
+ * row i * WRAP_ROW_STEP begins, the rows between are found from there
+ */
+typedef struct s_wrap_line
+{
+    size_t              line;     // Line number (SIZE_MAX: free)
+    size_t              len;      // Its length in bytes when laid out
+    size_t              rows;     // Rows it takes (0: not laid out to the end)
+    t_column_mark       *starts;  // Every WRAP_ROW_STEP-th row start, from row 0
+    size_t              count;    // Entries in starts
+    size_t              cap;      // Allocated entries
+    uint64_t            used;     // When it was last used (for eviction)
+}				t_wrap_line;
+
+/*
+ * Soft-wrap map: the screen rows each line takes at the current text width
+ * (a character that does not fit on a row starts the next). rows[i] is 0
+ * until line i has been measured, and counts as one row meanwhile; tree is
+ * a Fenwick tree over the counts, so the row a line starts on and the line
+ * shown on a row are both found in O(log n)
+ */
+typedef struct s_wrap
+{
+    bool                on;       // ":set wrap" in effect
+    bool                armed;    // Idle measuring step scheduled
+    int                 width;    // Text columns the rows were counted for
+    uint32_t            *rows;    // Rows of each line (0: not measured yet)
+    size_t              *tree;    // Fenwick tree: tree[i - 1] sums (i - lowbit(i), i]
+    size_t              count;    // Lines covered
+    size_t              cap;      // Allocated entries
+    size_t              scan;     // Lines before this one are all measured
+}				t_wrap;
+
+/*
+ * Pending terminal input - bytes read from stdin but not decoded yet, and
+ * the text of the last bracketed paste
+ */
+typedef struct s_input
+{
+    char    data[INPUT_BUF_SIZE];
+    size_t  start;      // First byte not decoded yet
+    size_t  end;        // End of the bytes read
+    char    *paste;     // Last pasted text (newlines normalized to '\n')
+    size_t  paste_len;
+    size_t  paste_cap;
+    char    text[4];    // Bytes of the last UTF8_KEY
+    size_t  text_len;
+}				t_input;
+
+/*
+ * Frame - output composed for one screen update, flushed with one writev()
+ */
+typedef struct s_frame
+{
+    char    *data;  // Escape sequences and text of the frame
+    size_t  len;    // Bytes used
+    size_t  cap;    // Bytes allocated
+    bool    sync;   // Wrap frames in synchronized-update markers (mode 2026)
+    ssize_t (*output)(int fd, const struct iovec *iov, int n); // writev(), or a benchmark's sink
+}				t_frame;
+
+/*
+ * Cell attributes - how a screen cell is colored
+ */
+enum
+{
+    ATTR_NORMAL,   // Default colors
+    ATTR_GUTTER,   // Line numbers (grey)
+    ATTR_MATCH,    // Current search match (reverse video)
+    ATTR_KEYWORD,  // Syntax highlighting: language keywords
+    ATTR_TYPE,     // Type names
+    ATTR_STRING,   // String and character literals
+    ATTR_NUMBER,   // Numbers
+    ATTR_COMMENT,  // Comments
+    ATTR_PREPROC,  // Preprocessor directives
+    ATTR_CONSTANT, // Built-in constants (NULL, true, ...)
+    ATTR_VARIABLE, // Shell variables
+    ATTR_ERROR,    // Log lines: error levels
+    ATTR_WARNING,  // Log lines: warning levels
+    ATTR_COUNT
+};
+
+// Unchanged cells shorter than this are rewritten instead of jumped over
+# define SCREEN_SKIP_GAP 6
+
+/*
+ * Screen cell - one character position on the terminal
+ * ch holds the UTF-8 bytes of the character, padded with NULs; the right
+ * half of a double-width character is a cell whose ch[0] is NUL
+ */
+typedef struct s_cell
+{
+    char    ch[CELL_BYTES]; // Character shown
+    uint8_t attr;           // ATTR_* value
+}				t_cell;
+
+/*
+ * Span of columns [lo, hi) that changed in one row (empty when lo >= hi)
+ */
+typedef struct s_span
+{
+    int lo;
+    int hi;
+}				t_span;
+
+/*
+ * Screen model - double-buffered cells plus per-row damage
+ */
+typedef struct s_screen
+{
+    int     rows;           // Terminal height
+    int     cols;           // Terminal width
+    t_cell  *front;         // What the terminal currently shows
+    t_cell  *back;          // Frame being composed
+    t_span  *dirty;         // Per row: columns to compose and compare
+    int     cursor_row;     // Cursor position at end of frame (-1 = hidden)
+    int     cursor_col;
+    bool    cursor_moved;   // Cursor position changed since the last flush
+    uint8_t attr;           // Attribute currently active on the terminal
+}				t_screen;
+
 /*
  * Error codes for consistent error handling throughout the application
  * Using an enum ensures type safety and makes debugging easier
@@ -70,8 +1005,27 @@ typedef struct s_cursor
 {
     int cx;       // Cursor column (1-based, position in current line)
     int cy;       // Cursor row (1-based, line number)
-    int scroll_x; // Horizontal scroll offset (for long lines)
+    int rx;       // Cursor display column (1-based, tabs expanded)
+    int scroll_x; // Horizontal scroll offset in display columns (for long lines)
     int scroll_y; // Vertical scroll offset (for many lines)
+    int scroll_row; // Rows of line scroll_y above the screen (soft wrap)
 }				t_cursor;
 
+/*
+ * An open file (tab). The shown tab's document lives in g_buffer, g_undo,
+ * current_filename and the main cursor, and its entry here is only brought
+ * up to date when another tab is shown. A file not shown that was never
+ * edited keeps only its mapping (buffer_drop_index())
+ */
+typedef struct s_tab
+{
+    t_buffer    buffer;         // Document
+    t_undo_log  undo;           // Its history
+    t_cursor    cursor;         // Cursor and scroll position
+    char        filename[PATH_MAX]; // File name (empty for a new file)
+    char        syntax[16];     // Language (syntax_name(), or "off")
+    bool        loaded;         // Opened yet (files named on the command line wait until shown)
+    bool        follow;         // Followed when shown (":follow")
+}				t_tab;
+
 #endif /* TYPEDEFS_H */
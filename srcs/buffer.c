@@ -0,0 +1,1131 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Text Buffer (piece table)
+ * The document is described by a sequence of pieces, each pointing into an
+ * immutable source: the original file bytes or one block of the append-only
+ * add buffer. Pieces live in a treap keyed implicitly by document position;
+ * every node caches its subtree byte and newline totals, so inserting,
+ * deleting and finding the start of a line all take O(log n) time.
+ *
+ * Files are mapped read-only and indexed lazily: only the scanned prefix of
+ * the original is part of the treap, and the rest is appended as the scan
+ * proceeds - by the indexer thread (indexer.c), or in idle steps when no
+ * thread could be started.
+ */
+
+static t_piece	*g_free_pieces = NULL; // Unused nodes of the shared pool, linked through right
+
+/*
+ * Small xorshift generator for treap priorities
+ * Quality does not matter here, only that priorities look random
+ *
+ * @return: Next pseudo-random 32-bit value
+ */
+static uint32_t	next_priority(void)
+{
+    static uint32_t	state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return (state);
+}
+
+/*
+ * Index of the first newline in src whose offset is >= pos
+ * Binary search over the source's sorted newline table
+ *
+ * @param src: Source to search
+ * @param pos: Offset inside the source
+ * @return: Index into src->nl
+ */
+static size_t	nl_lower_bound(const t_source *src, size_t pos)
+{
+    size_t	lo;
+    size_t	hi;
+    size_t	mid;
+
+    lo = 0;
+    hi = src->nl_count;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (src->nl[mid] < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo);
+}
+
+/*
+ * Count newlines in src between [start, start + len)
+ */
+static size_t	count_newlines(const t_source *src, size_t start, size_t len)
+{
+    return (nl_lower_bound(src, start + len) - nl_lower_bound(src, start));
+}
+
+/*
+ * Create a new source with room for capacity bytes and link it to buf
+ *
+ * @param buf: Buffer that will own the source
+ * @param capacity: Bytes to allocate
+ * @return: The new source (exits on allocation failure)
+ */
+static t_source	*source_new(t_buffer *buf, size_t capacity)
+{
+    t_source	*src;
+
+    src = calloc(1, sizeof(*src));
+    if (src == NULL)
+        die("calloc");
+    src->data = malloc(capacity ? capacity : 1);
+    if (src->data == NULL)
+        die("malloc");
+    src->capacity = capacity;
+    src->next = buf->sources;
+    buf->sources = src;
+    return (src);
+}
+
+/*
+ * Make room for extra more entries in a source's newline table
+ */
+static void	source_reserve_nl(t_source *src, size_t extra)
+{
+    if (src->nl_count + extra <= src->nl_cap)
+        return ;
+    src->nl_cap = src->nl_cap ? src->nl_cap * 2 : 64;
+    if (src->nl_cap < src->nl_count + extra)
+        src->nl_cap = src->nl_count + extra;
+    src->nl = realloc(src->nl, src->nl_cap * sizeof(*src->nl));
+    if (src->nl == NULL)
+        die("realloc");
+}
+
+/*
+ * Record the offset of every newline in src->data[from, to)
+ */
+static void	source_index(t_source *src, size_t from, size_t to)
+{
+    size_t	block;
+
+    while (from < to)
+    {
+        block = (to - from < SCAN_BLOCK) ? to - from : SCAN_BLOCK;
+        source_reserve_nl(src, newline_count(src->data + from, block));
+        src->nl_count += newline_scan(src->data + from, block, from,
+            src->nl + src->nl_count);
+        from += block;
+    }
+}
+
+/*
+ * Append bytes to a source, recording the offset of every newline
+ * Caller guarantees there is enough capacity left
+ */
+static void	source_append(t_source *src, const char *text, size_t len)
+{
+    memcpy(src->data + src->size, text, len);
+    source_index(src, src->size, src->size + len);
+    src->size += len;
+}
+
+/*
+ * Take a node from the piece pool shared by every buffer, carving a new
+ * block of PIECE_POOL_BLOCK nodes when it is empty
+ * Nodes go back to the pool, not to the system: those given up by one
+ * buffer (a closed tab, a dropped index, an undone edit) are reused by the
+ * next, so open files do not each keep a heap of their own. Like every
+ * edit, this only runs on the main thread
+ */
+static t_piece	*piece_alloc(void)
+{
+    t_piece	*block;
+    t_piece	*p;
+
+    if (g_free_pieces == NULL)
+    {
+        block = malloc(PIECE_POOL_BLOCK * sizeof(*block));
+        if (block == NULL)
+            die("malloc");
+        for (size_t i = PIECE_POOL_BLOCK; i > 0; i--)
+        {
+            block[i - 1].right = g_free_pieces;
+            g_free_pieces = &block[i - 1];
+        }
+    }
+    p = g_free_pieces;
+    g_free_pieces = p->right;
+    return (p);
+}
+
+/*
+ * Allocate a piece node and compute its newline count
+ */
+static t_piece	*piece_new(t_source *src, size_t start, size_t len)
+{
+    t_piece	*p;
+
+    p = piece_alloc();
+    p->src = src;
+    p->start = start;
+    p->len = len;
+    p->lf = count_newlines(src, start, len);
+    p->sum_len = len;
+    p->sum_lf = p->lf;
+    p->prio = next_priority();
+    p->refs = 1;
+    p->left = NULL;
+    p->right = NULL;
+    return (p);
+}
+
+/*
+ * Make a node safe to modify
+ * A node shared with a snapshot is copied (the copy takes over the caller's
+ * reference and shares the children); an unshared node is returned as is.
+ * Every edit goes through here on its way down the tree, so only the path
+ * to the change is ever copied.
+ *
+ * @return: Node the caller may modify
+ */
+static t_piece	*piece_own(t_piece *t)
+{
+    t_piece	*copy;
+
+    if (t->refs == 1)
+        return (t);
+    copy = piece_alloc();
+    *copy = *t;
+    copy->refs = 1;
+    if (copy->left)
+        copy->left->refs++;
+    if (copy->right)
+        copy->right->refs++;
+    t->refs--;
+    return (copy);
+}
+
+/*
+ * Recompute the cached subtree totals of a node from its children
+ */
+static void	piece_update(t_piece *p)
+{
+    p->sum_len = p->len;
+    p->sum_lf = p->lf;
+    if (p->left)
+    {
+        p->sum_len += p->left->sum_len;
+        p->sum_lf += p->left->sum_lf;
+    }
+    if (p->right)
+    {
+        p->sum_len += p->right->sum_len;
+        p->sum_lf += p->right->sum_lf;
+    }
+}
+
+/*
+ * Drop one reference to a subtree, freeing the nodes nobody else shares
+ */
+static void	piece_release(t_piece *p)
+{
+    if (p == NULL || --p->refs > 0)
+        return ;
+    piece_release(p->left);
+    piece_release(p->right);
+    p->right = g_free_pieces;
+    g_free_pieces = p;
+}
+
+/*
+ * Join two treaps where every byte of l comes before every byte of r
+ *
+ * @return: Root of the merged treap
+ */
+static t_piece	*piece_merge(t_piece *l, t_piece *r)
+{
+    if (l == NULL)
+        return (r);
+    if (r == NULL)
+        return (l);
+    if (l->prio > r->prio)
+    {
+        l = piece_own(l);
+        l->right = piece_merge(l->right, r);
+        piece_update(l);
+        return (l);
+    }
+    r = piece_own(r);
+    r->left = piece_merge(l, r->left);
+    piece_update(r);
+    return (r);
+}
+
+/*
+ * Split a treap so that *l holds the first pos bytes and *r the rest
+ * A piece straddling pos is cut in two
+ */
+static void	piece_split(t_piece *t, size_t pos, t_piece **l, t_piece **r)
+{
+    size_t	left_len;
+    t_piece	*tail;
+
+    if (t == NULL)
+    {
+        *l = NULL;
+        *r = NULL;
+        return ;
+    }
+    t = piece_own(t);
+    left_len = t->left ? t->left->sum_len : 0;
+    if (pos <= left_len)
+    {
+        piece_split(t->left, pos, l, &t->left);
+        piece_update(t);
+        *r = t;
+    }
+    else if (pos >= left_len + t->len)
+    {
+        piece_split(t->right, pos - left_len - t->len, &t->right, r);
+        piece_update(t);
+        *l = t;
+    }
+    else
+    {
+        // Cut this piece: t keeps the head, tail takes over t's right subtree
+        tail = piece_new(t->src, t->start + (pos - left_len), t->len - (pos - left_len));
+        tail->right = t->right;
+        t->len = pos - left_len;
+        t->lf -= tail->lf;
+        t->right = NULL;
+        piece_update(t);
+        piece_update(tail);
+        *l = t;
+        *r = tail;
+    }
+}
+
+/*
+ * Whether the piece that ends exactly at pos also ends at src_off in src,
+ * so bytes appended there can grow it instead of adding a piece
+ */
+static bool	piece_can_extend(const t_piece *t, size_t pos, const t_source *src,
+    size_t src_off)
+{
+    size_t	left_len;
+
+    while (t != NULL)
+    {
+        left_len = t->left ? t->left->sum_len : 0;
+        if (pos <= left_len)
+            t = t->left;
+        else if (pos > left_len + t->len)
+        {
+            pos -= left_len + t->len;
+            t = t->right;
+        }
+        else
+            return (pos == left_len + t->len && t->src == src
+                && t->start + t->len == src_off);
+    }
+    return (false);
+}
+
+/*
+ * Grow the piece ending at pos by len bytes holding lf newlines
+ *
+ * @return: New root of the subtree (nodes on the path may have been copied)
+ */
+static t_piece	*piece_grow(t_piece *t, size_t pos, size_t len, size_t lf)
+{
+    size_t	left_len;
+
+    t = piece_own(t);
+    left_len = t->left ? t->left->sum_len : 0;
+    if (pos <= left_len)
+        t->left = piece_grow(t->left, pos, len, lf);
+    else if (pos > left_len + t->len)
+        t->right = piece_grow(t->right, pos - left_len - t->len, len, lf);
+    else
+    {
+        t->len += len;
+        t->lf += lf;
+    }
+    t->sum_len += len;
+    t->sum_lf += lf;
+    return (t);
+}
+
+/*
+ * Grow the piece that ends exactly at pos, if it also ends at src_off in
+ * src. Turns a run of typed characters into a single piece.
+ *
+ * @return: true if a piece was extended
+ */
+static bool	piece_extend(t_piece **root, size_t pos, t_source *src, size_t src_off,
+    size_t len, size_t lf)
+{
+    if (!piece_can_extend(*root, pos, src, src_off))
+        return (false);
+    *root = piece_grow(*root, pos, len, lf);
+    return (true);
+}
+
+/*
+ * Note whether text added to the document has bytes >= 0x80 (the column
+ * and cursor code skips UTF-8 decoding for documents that are pure ASCII)
+ */
+static void	note_non_ascii(t_buffer *buf, const char *text, size_t len)
+{
+    bool	ascii;
+
+    if (buf->non_ascii)
+        return ;
+    ascii = true;
+    utf8_validate(text, len, &ascii);
+    buf->non_ascii = !ascii;
+}
+
+/*
+ * Initialize a buffer holding a copy of text (may be empty)
+ *
+ * @param buf: Buffer to initialize (previous contents are not freed)
+ * @param text: Initial contents, or NULL
+ * @param len: Length of text
+ */
+void	buffer_init(t_buffer *buf, const char *text, size_t len)
+{
+    t_source	*original;
+    bool		ascii;
+
+    buf->root = NULL;
+    buf->sources = NULL;
+    buf->add = NULL;
+    original = source_new(buf, len);
+    if (len > 0)
+    {
+        source_append(original, text, len);
+        buf->root = piece_new(original, 0, len);
+    }
+    buf->original = original;
+    buf->indexed = len;
+    buf->indexer = NULL;
+    buf->journal = NULL;
+    buf->edits = 0;
+    buf->saved = 0;
+    buf->bad_utf8 = SIZE_MAX;
+    buf->non_ascii = false;
+    if (len > 0)
+    {
+        ascii = true;
+        buf->bad_utf8 = utf8_validate(text, len, &ascii);
+        if (buf->bad_utf8 == len)
+            buf->bad_utf8 = SIZE_MAX;
+        buf->non_ascii = !ascii;
+    }
+}
+
+/*
+ * Initialize a buffer over a memory-mapped file
+ * Nothing is scanned yet; lines become available through buffer_ensure_lines()
+ * and buffer_index_more(), so this is constant time whatever the file size
+ *
+ * @param buf: Buffer to initialize (previous contents are not freed)
+ * @param fd: Open file descriptor of a regular file
+ * @param size: File size in bytes (must be > 0)
+ * @return: 0 on success, -1 if the file could not be mapped
+ */
+int	buffer_map_file(t_buffer *buf, int fd, size_t size)
+{
+    void		*map;
+    t_source	*original;
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return (-1);
+    buf->root = NULL;
+    buf->sources = NULL;
+    buf->add = NULL;
+    original = calloc(1, sizeof(*original));
+    if (original == NULL)
+        die("calloc");
+    original->data = map;
+    original->size = size;
+    original->capacity = size;
+    original->mapped = true;
+    buf->sources = original;
+    buf->original = original;
+    buf->indexed = 0;
+    buf->indexer = NULL;
+    buf->journal = NULL;
+    buf->edits = 0;
+    buf->saved = 0;
+    buf->bad_utf8 = SIZE_MAX;
+    buf->non_ascii = false;
+    return (0);
+}
+
+/*
+ * Scan the next part of the original file for newlines and append it to
+ * the document, checking on the way that it is UTF-8. Scanned pages are
+ * dropped from memory again so resident size tracks what is actually
+ * displayed, not what has been indexed.
+ *
+ * @param buf: Buffer being indexed
+ * @param max_bytes: Upper bound on bytes scanned by this call
+ * @return: Number of bytes added (0 once the whole file is indexed)
+ */
+size_t	buffer_index_more(t_buffer *buf, size_t max_bytes)
+{
+    t_source	*src;
+    size_t		from;
+    size_t		to;
+    size_t		nl_before;
+    size_t		page;
+    size_t		bad;
+    bool		ascii;
+
+    src = buf->original;
+    from = buf->indexed;
+    if (src == NULL || from >= src->size)
+        return (0);
+    to = from + max_bytes < src->size ? from + max_bytes : src->size;
+    nl_before = src->nl_count;
+    source_index(src, from, to);
+    ascii = true;
+    bad = utf8_validate_range(src->data, src->size, from, to, &ascii);
+    if (bad < buf->bad_utf8)
+        buf->bad_utf8 = bad;
+    buf->non_ascii |= !ascii;
+    buf->indexed = to;
+    if (!piece_extend(&buf->root, buffer_size(buf), src, from, to - from,
+            src->nl_count - nl_before))
+        buf->root = piece_merge(buf->root, piece_new(src, from, to - from));
+    if (src->mapped)
+    {
+        page = sysconf(_SC_PAGESIZE);
+        madvise(src->data + from / page * page, to - from / page * page, MADV_DONTNEED);
+    }
+    return (to - from);
+}
+
+/*
+ * Append a chunk of the original scanned elsewhere (the indexer thread)
+ * The original file up to the chunk's end becomes part of the document
+ *
+ * @param buf: Buffer being indexed
+ * @param chunk: Newline offsets and UTF-8 findings for the range from
+ *               buf->indexed to chunk->end
+ */
+void	buffer_append_index(t_buffer *buf, const t_index_chunk *chunk)
+{
+    t_source	*src;
+    size_t		from;
+
+    src = buf->original;
+    from = buf->indexed;
+    source_reserve_nl(src, chunk->count);
+    memcpy(src->nl + src->nl_count, chunk->nl, chunk->count * sizeof(*chunk->nl));
+    src->nl_count += chunk->count;
+    buf->indexed = chunk->end;
+    if (chunk->bad_utf8 < buf->bad_utf8)
+        buf->bad_utf8 = chunk->bad_utf8;
+    buf->non_ascii |= chunk->non_ascii;
+    if (!piece_extend(&buf->root, buffer_size(buf), src, from, chunk->end - from, chunk->count))
+        buf->root = piece_merge(buf->root, piece_new(src, from, chunk->end - from));
+}
+
+/*
+ * Index the original file until at least lines complete lines are known
+ * Used to fill the viewport without scanning the whole file; waits for the
+ * indexer thread if one is running, otherwise scans in small steps
+ *
+ * @param buf: Buffer being indexed
+ * @param lines: Number of complete lines needed
+ */
+void	buffer_ensure_lines(t_buffer *buf, size_t lines)
+{
+    while ((buf->root ? buf->root->sum_lf : 0) < lines && !buffer_fully_indexed(buf))
+    {
+        if (buf->indexer != NULL)
+            indexer_wait(buf);
+        else
+            buffer_index_more(buf, INDEX_STEP);
+    }
+}
+
+/*
+ * Index the original file until the lines of a view are known, or enough of
+ * it to fill the view: a longer line is drawn as far as it is indexed and
+ * the indexer brings in the rest. Unlike buffer_ensure_lines() this takes
+ * the same time whatever the file holds - one without newlines is not
+ * scanned to its end before it can be shown
+ *
+ * @param buf: Buffer being indexed
+ * @param top: First line in view
+ * @param rows: Rows in view
+ * @param cols: Display columns from the start of the lines to the right edge
+ */
+void	buffer_ensure_view(t_buffer *buf, size_t top, size_t rows, size_t cols)
+{
+    size_t	known;
+
+    while (!buffer_fully_indexed(buf))
+    {
+        known = buf->root ? buf->root->sum_lf : 0;
+        // A column holds at most 4 bytes of UTF-8 (marks aside)
+        if (known >= top + rows || (known >= top
+                && buffer_size(buf) - buffer_line_start(buf, top) >= rows * cols * 4))
+            break ;
+        if (buf->indexer != NULL)
+            indexer_wait(buf);
+        else
+            buffer_index_more(buf, INDEX_STEP);
+    }
+}
+
+/*
+ * Index the original file until the document is at least size bytes long
+ * (or the whole file is in)
+ *
+ * @param buf: Buffer being indexed
+ * @param size: Document size needed
+ */
+void	buffer_ensure_size(t_buffer *buf, size_t size)
+{
+    while (buffer_size(buf) < size && !buffer_fully_indexed(buf))
+    {
+        if (buf->indexer != NULL)
+            indexer_wait(buf);
+        else
+            buffer_index_more(buf, INDEX_IDLE_STEP);
+    }
+}
+
+/*
+ * Finish indexing the original file
+ */
+void	buffer_index_all(t_buffer *buf)
+{
+    while (!buffer_fully_indexed(buf))
+    {
+        if (buf->indexer != NULL)
+            indexer_wait(buf);
+        else
+            buffer_index_more(buf, INDEX_IDLE_STEP);
+    }
+}
+
+/*
+ * Whether every byte of the original file is part of the document
+ */
+bool	buffer_fully_indexed(const t_buffer *buf)
+{
+    return (buf->original == NULL || buf->indexed >= buf->original->size);
+}
+
+/*
+ * Let the original file grow as another program appends to it (follow
+ * mode): the bytes up to its new size that end a line become the
+ * unindexed tail of the original, joining the document through the usual
+ * lazy indexing. A line still being written waits for its end, unless
+ * FOLLOW_STEP bytes came without one. The file is mapped again with
+ * FOLLOW_RESERVE bytes of address space to spare, so that happens once in
+ * a while only; its data moves then, so no snapshot may be in use
+ *
+ * @param buf: Buffer whose original is the file (mapped, or empty)
+ * @param fd: Open file descriptor of the file
+ * @param size: File size now (not less than the size of the original)
+ * @return: 0 on success, -1 if the file could not be mapped
+ */
+int	buffer_follow(t_buffer *buf, int fd, size_t size)
+{
+    t_source	*src;
+    void		*map;
+    size_t		end;
+
+    src = buf->original;
+    if (src == NULL || size < src->size || (!src->mapped && src->size > 0))
+        return (-1);
+    if (size == src->size)
+        return (0);
+    if (!src->mapped || size > src->capacity)
+    {
+        map = mmap(NULL, size + FOLLOW_RESERVE, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            return (-1);
+        indexer_stop(buf);
+        if (src->mapped)
+            munmap(src->data, src->capacity);
+        else
+            free(src->data);
+        src->data = map;
+        src->capacity = size + FOLLOW_RESERVE;
+        src->mapped = true;
+    }
+    end = size;
+    while (end > src->size && src->data[end - 1] != '\n')
+        end--;
+    if (end > src->size || size - src->size >= FOLLOW_STEP)
+        src->size = (end > src->size) ? end : size;
+    return (0);
+}
+
+/*
+ * Release every piece and source owned by a buffer
+ */
+void	buffer_free(t_buffer *buf)
+{
+    t_source	*src;
+    t_source	*next;
+
+    indexer_stop(buf);
+    piece_release(buf->root);
+    src = buf->sources;
+    while (src != NULL)
+    {
+        next = src->next;
+        if (src->mapped)
+            munmap(src->data, src->capacity);
+        else
+            free(src->data);
+        free(src->nl);
+        free(src);
+        src = next;
+    }
+    buf->root = NULL;
+    buf->sources = NULL;
+    buf->add = NULL;
+    buf->original = NULL;
+    buf->indexed = 0;
+}
+
+/*
+ * Forget the line index of a mapped file that was never edited, keeping
+ * only the mapping (without its pages): the buffer is back where
+ * buffer_map_file() left it, and is indexed again when it is next needed
+ * (for the files of tabs that are not shown)
+ *
+ * @param buf: Buffer to shrink
+ * @return: false, with nothing changed, if the document is not the file
+ */
+bool	buffer_drop_index(t_buffer *buf)
+{
+    t_source	*src;
+
+    src = buf->original;
+    // Nothing inserted, and as long as the part of the file indexed
+    if (src == NULL || buf->sources != src || src->next != NULL
+        || buffer_size(buf) != buf->indexed)
+        return (false);
+    indexer_stop(buf);
+    piece_release(buf->root);
+    buf->root = NULL;
+    free(src->nl);
+    src->nl = NULL;
+    src->nl_count = 0;
+    src->nl_cap = 0;
+    madvise(src->data, src->size, MADV_DONTNEED); // Pages that were shown
+    buf->indexed = 0;
+    buf->bad_utf8 = SIZE_MAX;
+    buf->non_ascii = false;
+    return (true);
+}
+
+/*
+ * Take an immutable view of the document in O(1)
+ * The view shares every piece with buf. Later edits copy the nodes they
+ * would change instead of changing them, so the view stays valid - and may
+ * be read from another thread - until buffer_release_snapshot(). Sources
+ * are shared too: buf must not be freed while the view is in use.
+ *
+ * @param buf: Buffer to capture
+ * @param snap: Receives the view (only for reading and releasing)
+ */
+void	buffer_snapshot(const t_buffer *buf, t_buffer *snap)
+{
+    *snap = *buf;
+    snap->add = NULL;
+    snap->indexer = NULL;
+    snap->journal = NULL;
+    if (snap->root)
+        snap->root->refs++;
+}
+
+/*
+ * Give back the pieces held by a view from buffer_snapshot()
+ * Must run on the thread that edits the buffer
+ */
+void	buffer_release_snapshot(t_buffer *snap)
+{
+    piece_release(snap->root);
+    snap->root = NULL;
+}
+
+/*
+ * Insert text at a document offset
+ *
+ * @param buf: Buffer to edit
+ * @param pos: Byte offset (clamped to the document size)
+ * @param text: Bytes to insert
+ * @param len: Number of bytes
+ */
+void	buffer_insert(t_buffer *buf, size_t pos, const char *text, size_t len)
+{
+    t_source	*src;
+    size_t		start;
+    size_t		nl_before;
+    t_piece		*l;
+    t_piece		*r;
+
+    if (len == 0)
+        return ;
+    if (pos > buffer_size(buf))
+        pos = buffer_size(buf);
+    journal_insert(buf->journal, pos, text, len);
+    buf->edits++;
+    src = buf->add;
+    if (src == NULL || src->capacity - src->size < len)
+    {
+        // Start a new block; oversized inserts get a block of their own
+        src = source_new(buf, len > ADD_BLOCK_SIZE ? len : ADD_BLOCK_SIZE);
+        buf->add = src;
+    }
+    start = src->size;
+    nl_before = src->nl_count;
+    source_append(src, text, len);
+    note_non_ascii(buf, text, len);
+    if (piece_extend(&buf->root, pos, src, start, len, src->nl_count - nl_before))
+        return ;
+    piece_split(buf->root, pos, &l, &r);
+    buf->root = piece_merge(piece_merge(l, piece_new(src, start, len)), r);
+}
+
+/*
+ * Delete len bytes starting at a document offset
+ */
+void	buffer_delete(t_buffer *buf, size_t pos, size_t len)
+{
+    t_piece	*l;
+    t_piece	*mid;
+    t_piece	*r;
+
+    if (len == 0 || pos >= buffer_size(buf))
+        return ;
+    if (len > buffer_size(buf) - pos)
+        len = buffer_size(buf) - pos;
+    journal_delete(buf->journal, pos, len);
+    buf->edits++;
+    piece_split(buf->root, pos, &l, &r);
+    piece_split(r, len, &mid, &r);
+    piece_release(mid);
+    buf->root = piece_merge(l, r);
+}
+
+/*
+ * Turn a block of text into a source of its own, without copying it
+ * Meant for large generated text (a substitution's output): the newlines
+ * are indexed once, and the result is spliced in with buffer_splice()
+ *
+ * @param buf: Buffer that will own the text
+ * @param data: Bytes from malloc(); the buffer frees them
+ * @param size: Number of bytes
+ * @return: A one-piece tree holding the text, or NULL if it is empty
+ */
+t_piece	*buffer_adopt(t_buffer *buf, char *data, size_t size)
+{
+    t_source	*src;
+
+    if (size == 0)
+    {
+        free(data);
+        return (NULL);
+    }
+    src = calloc(1, sizeof(*src));
+    if (src == NULL)
+        die("calloc");
+    src->data = data;
+    src->capacity = size;
+    src->size = size;
+    source_index(src, 0, size);
+    note_non_ascii(buf, data, size);
+    src->next = buf->sources;
+    buf->sources = src;
+    return (piece_new(src, 0, size));
+}
+
+/*
+ * Replace a span of the document with a tree of pieces in O(log n)
+ * The pieces taken out are handed back whole, so putting them back later
+ * (undo) restores the text without having copied any of it
+ *
+ * @param buf: Buffer to edit
+ * @param pos: Start of the span
+ * @param len: Bytes in the span
+ * @param with: Pieces to put there (the buffer takes the reference), or NULL
+ * @return: The pieces removed (the caller owns the reference), or NULL
+ */
+t_piece	*buffer_splice(t_buffer *buf, size_t pos, size_t len, t_piece *with)
+{
+    t_piece	*l;
+    t_piece	*mid;
+    t_piece	*r;
+
+    journal_splice(buf->journal, pos, len, with);
+    buf->edits++;
+    piece_split(buf->root, pos, &l, &r);
+    piece_split(r, len, &mid, &r);
+    buf->root = piece_merge(piece_merge(l, with), r);
+    return (mid);
+}
+
+/*
+ * Drop a reference to pieces returned by buffer_splice()
+ * Must run on the thread that edits the buffer
+ */
+void	buffer_release_pieces(t_piece *pieces)
+{
+    piece_release(pieces);
+}
+
+/*
+ * Has the document changed since it was loaded or last saved?
+ */
+bool	buffer_modified(const t_buffer *buf)
+{
+    return (buf->edits != buf->saved);
+}
+
+/*
+ * Total number of bytes in the document
+ */
+size_t	buffer_size(const t_buffer *buf)
+{
+    return (buf->root ? buf->root->sum_len : 0);
+}
+
+/*
+ * Number of lines in the document (a trailing newline starts an empty line)
+ */
+size_t	buffer_line_count(const t_buffer *buf)
+{
+    return ((buf->root ? buf->root->sum_lf : 0) + 1);
+}
+
+/*
+ * Byte offset where a line starts
+ *
+ * @param buf: Buffer to query
+ * @param line: 0-based line number (clamped to the last line)
+ * @return: Offset of the first byte of that line
+ */
+size_t	buffer_line_start(const t_buffer *buf, size_t line)
+{
+    const t_piece	*t;
+    size_t			offset;
+    size_t			left_lf;
+    size_t			left_len;
+
+    if (line == 0 || buf->root == NULL)
+        return (0);
+    if (line > buf->root->sum_lf)
+        return (buffer_size(buf));
+    // Find the piece containing the line-th newline
+    t = buf->root;
+    offset = 0;
+    while (t != NULL)
+    {
+        left_lf = t->left ? t->left->sum_lf : 0;
+        left_len = t->left ? t->left->sum_len : 0;
+        if (line <= left_lf)
+            t = t->left;
+        else if (line <= left_lf + t->lf)
+        {
+            line -= left_lf;
+            return (offset + left_len
+                + t->src->nl[nl_lower_bound(t->src, t->start) + line - 1]
+                - t->start + 1);
+        }
+        else
+        {
+            line -= left_lf + t->lf;
+            offset += left_len + t->len;
+            t = t->right;
+        }
+    }
+    return (offset);
+}
+
+/*
+ * Length of a line in bytes, not counting its newline
+ */
+size_t	buffer_line_length(const t_buffer *buf, size_t line)
+{
+    size_t	start;
+    size_t	end;
+
+    start = buffer_line_start(buf, line);
+    if (line + 1 < buffer_line_count(buf))
+        end = buffer_line_start(buf, line + 1) - 1;
+    else
+        end = buffer_size(buf);
+    return (end - start);
+}
+
+/*
+ * Contiguous run of document bytes starting at pos
+ * Lets callers walk the document piece by piece without copying
+ *
+ * @param buf: Buffer to read
+ * @param pos: Document offset
+ * @param out: Receives a pointer to the bytes at pos
+ * @return: Number of contiguous bytes available at *out (0 at end of document)
+ */
+size_t	buffer_chunk(const t_buffer *buf, size_t pos, const char **out)
+{
+    const t_piece	*t;
+    size_t			left_len;
+
+    t = buf->root;
+    while (t != NULL)
+    {
+        left_len = t->left ? t->left->sum_len : 0;
+        if (pos < left_len)
+            t = t->left;
+        else if (pos < left_len + t->len)
+        {
+            *out = t->src->data + t->start + (pos - left_len);
+            return (t->len - (pos - left_len));
+        }
+        else
+        {
+            pos -= left_len + t->len;
+            t = t->right;
+        }
+    }
+    *out = NULL;
+    return (0);
+}
+
+/*
+ * Contiguous run of document bytes ending at pos - buffer_chunk() in
+ * reverse, for walking the document backwards
+ *
+ * @param buf: Buffer to read
+ * @param pos: Document offset the run ends at (exclusive)
+ * @param out: Receives a pointer to the first byte of the run
+ * @return: Number of bytes in the run (0 at the start of the document)
+ */
+size_t	buffer_chunk_before(const t_buffer *buf, size_t pos, const char **out)
+{
+    const t_piece	*t;
+    size_t			left_len;
+
+    t = buf->root;
+    while (t != NULL && pos > 0)
+    {
+        left_len = t->left ? t->left->sum_len : 0;
+        if (pos <= left_len)
+            t = t->left;
+        else if (pos <= left_len + t->len)
+        {
+            *out = t->src->data + t->start;
+            return (pos - left_len);
+        }
+        else
+        {
+            pos -= left_len + t->len;
+            t = t->right;
+        }
+    }
+    *out = NULL;
+    return (0);
+}
+
+/*
+ * Part of the original file that has not been indexed yet
+ * It comes after the last byte of the document and is not part of it until
+ * indexed, but it can be read as is (e.g. to save without waiting for the scan)
+ *
+ * @param buf: Buffer to read
+ * @param out: Receives a pointer to the unindexed bytes
+ * @return: Number of unindexed bytes (0 once fully indexed)
+ */
+size_t	buffer_unindexed(const t_buffer *buf, const char **out)
+{
+    if (buffer_fully_indexed(buf))
+    {
+        *out = NULL;
+        return (0);
+    }
+    *out = buf->original->data + buf->indexed;
+    return (buf->original->size - buf->indexed);
+}
+
+/*
+ * Copy document bytes into dst
+ *
+ * @return: Number of bytes copied (short at end of document)
+ */
+size_t	buffer_read(const t_buffer *buf, size_t pos, char *dst, size_t len)
+{
+    const char	*chunk;
+    size_t		avail;
+    size_t		copied;
+
+    copied = 0;
+    while (copied < len)
+    {
+        avail = buffer_chunk(buf, pos + copied, &chunk);
+        if (avail == 0)
+            break ;
+        if (avail > len - copied)
+            avail = len - copied;
+        memcpy(dst + copied, chunk, avail);
+        copied += avail;
+    }
+    return (copied);
+}
+
+/*
+ * Byte offset of a (line, column) position, both 0-based
+ */
+size_t	buffer_offset(const t_buffer *buf, size_t line, size_t col)
+{
+    return (buffer_line_start(buf, line) + col);
+}
+
+/*
+ * Line (0-based) containing a document offset - the inverse of
+ * buffer_line_start(); counts newlines before pos in O(log n)
+ */
+size_t	buffer_line_at(const t_buffer *buf, size_t pos)
+{
+    const t_piece	*t;
+    size_t			line;
+    size_t			left_len;
+    size_t			left_lf;
+
+    t = buf->root;
+    line = 0;
+    while (t != NULL)
+    {
+        left_len = t->left ? t->left->sum_len : 0;
+        left_lf = t->left ? t->left->sum_lf : 0;
+        if (pos < left_len)
+            t = t->left;
+        else if (pos < left_len + t->len)
+            return (line + left_lf + count_newlines(t->src, t->start, pos - left_len));
+        else
+        {
+            line += left_lf + t->lf;
+            pos -= left_len + t->len;
+            t = t->right;
+        }
+    }
+    return (line);
+}
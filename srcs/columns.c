@@ -0,0 +1,591 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Display Columns
+ * Maps byte offsets inside a line to display columns and back. A
+ * character (a base plus any marks or joined characters after it) takes
+ * the width of its base: 2 for wide characters, the distance to the next
+ * tab stop for a tab, 1 otherwise. The columns of the last lines used are
+ * remembered: the prefix in which every byte is one column (the whole line,
+ * for most code) is answered without reading it, and past it a checkpoint
+ * is kept every COLUMN_CHECKPOINT bytes. Any column of a line measured once
+ * is then found with a binary search and a walk of at most a checkpoint
+ * interval, so scrolling along or editing a line of tens of megabytes does
+ * not rescan it from column 0.
+ */
+
+# define COLUMN_WINDOW 4096 // Bytes of a line read at a time
+
+static t_column_line	g_lines[COLUMN_CACHE_LINES];
+static uint64_t			g_clock = 0;
+static bool				g_ready = false;
+
+// Bytes of the line being measured, starting at document offset g_win_start
+static char		g_win[COLUMN_WINDOW];
+static size_t	g_win_start;
+static size_t	g_win_len;
+
+/*
+ * Bytes from document offset pos on (at least a whole character unless
+ * end comes first)
+ *
+ * @param end: Document offset where the line ends
+ * @param avail: Receives how many bytes can be read
+ */
+static const char	*window(size_t pos, size_t end, size_t *avail)
+{
+    size_t	need;
+
+    need = (end - pos < 4) ? end - pos : 4;
+    if (pos < g_win_start || pos + need > g_win_start + g_win_len)
+    {
+        g_win_start = pos;
+        g_win_len = buffer_read(&g_buffer, pos,
+            g_win, (end - pos < COLUMN_WINDOW) ? end - pos : COLUMN_WINDOW);
+    }
+    *avail = g_win_start + g_win_len - pos;
+    if (*avail > end - pos)
+        *avail = end - pos;
+    return (g_win + (pos - g_win_start));
+}
+
+/*
+ * Length and width of the character at byte b of a line
+ *
+ * @param start: Document offset of the line
+ * @param len: Length of the line
+ * @param b: Byte offset of the character in the line
+ * @param col: Its display column (for tabs)
+ * @param width: Receives the columns it takes
+ * @return: Bytes it takes (base and marks)
+ */
+static size_t	character(size_t start, size_t len, size_t b, size_t col, size_t *width)
+{
+    const char	*p;
+    size_t		avail;
+    size_t		n;
+    size_t		total;
+    uint32_t	cp;
+    uint32_t	next;
+
+    p = window(start + b, start + len, &avail);
+    n = utf8_decode(p, avail, &cp);
+    if (cp == '\t')
+        *width = TAB_STOP - col % TAB_STOP;
+    else if (utf8_printable(cp) && utf8_width(cp) > 0)
+        *width = utf8_width(cp);
+    else
+        *width = 1; // Shown as '?', or a mark with nothing to sit on
+    if (!g_buffer.non_ascii)
+        return (1);
+    total = n;
+    while (b + total < len)
+    {
+        p = window(start + b + total, start + len, &avail);
+        if ((unsigned char)p[0] < 0x80)
+            break ;
+        n = utf8_decode(p, avail, &next);
+        if (!utf8_extends(cp, next))
+            break ;
+        total += n;
+        cp = next;
+    }
+    return (total);
+}
+
+/*
+ * Whether the 8 bytes at p are ASCII other than tabs
+ */
+static bool	plain_word(const char *p)
+{
+    uint64_t	w;
+    uint64_t	t;
+
+    memcpy(&w, p, 8);
+    t = w ^ 0x0909090909090909ull; // Zero bytes where there are tabs
+    return (((w | ((t - 0x0101010101010101ull) & ~t)) & 0x8080808080808080ull) == 0);
+}
+
+/*
+ * Length of the run of one-column characters at p (ASCII other than tabs
+ * and not followed by a mark), at most max
+ *
+ * @param avail: Bytes readable at p
+ * @param last: The byte after p[avail - 1] ends the line
+ */
+static size_t	plain_run(const char *p, size_t avail, size_t max, bool last)
+{
+    size_t	i;
+
+    i = 0;
+    while (i + 9 <= avail && i + 8 <= max && plain_word(p + i)
+        && (unsigned char)p[i + 8] < 0x80)
+        i += 8;
+    while (i < max && i < avail && (unsigned char)p[i] < 0x80 && p[i] != '\t'
+        && (i + 1 < avail ? (unsigned char)p[i + 1] < 0x80 : last))
+        i++;
+    return (i);
+}
+
+/*
+ * Record how far a line has been measured: the plain prefix grows while
+ * nothing else has been met, and checkpoints are dropped along the way
+ */
+static void	extend(t_column_line *entry, size_t b, size_t col, bool plain)
+{
+    t_column_mark	*grown;
+    size_t			last;
+
+    if (b <= entry->byte)
+        return ;
+    if (plain && entry->plain == entry->byte)
+        entry->plain = b;
+    else
+    {
+        last = entry->count ? entry->marks[entry->count - 1].byte : entry->plain;
+        if (b - last >= COLUMN_CHECKPOINT)
+        {
+            if (entry->count == entry->cap)
+            {
+                entry->cap = entry->cap ? entry->cap * 2 : 16;
+                grown = realloc(entry->marks, entry->cap * sizeof(*grown));
+                if (grown == NULL)
+                    die("realloc");
+                entry->marks = grown;
+            }
+            entry->marks[entry->count++] = (t_column_mark){b, col};
+        }
+    }
+    entry->byte = b;
+    entry->col = col;
+}
+
+/*
+ * Walk a line one character at a time from (*b, *col), a character start,
+ * stopping before the first character that does not end by stop_byte or
+ * does not end by display column stop_col; what is learned past the
+ * furthest point measured is recorded in entry, when the walk starts
+ * within what is known
+ * The window must have been emptied since the buffer last changed
+ */
+static void	walk(t_column_line *entry, size_t start, size_t *b, size_t *col,
+    size_t stop_byte, size_t stop_col)
+{
+    const char	*p;
+    size_t		avail;
+    size_t		run;
+    size_t		n;
+    size_t		w;
+    bool		known;
+
+    known = *b <= entry->byte;
+    while (*b < stop_byte)
+    {
+        p = window(start + *b, start + entry->len, &avail);
+        run = stop_byte - *b;
+        if (stop_col - *col < run)
+            run = stop_col - *col;
+        run = plain_run(p, avail, run, *b + avail == entry->len);
+        if (run > 0)
+        {
+            *b += run;
+            *col += run;
+            if (known)
+                extend(entry, *b, *col, true);
+            continue ;
+        }
+        n = character(start, entry->len, *b, *col, &w);
+        if (*b + n > stop_byte || *col + w > stop_col)
+            break ;
+        *b += n;
+        *col += w;
+        if (known)
+            extend(entry, *b, *col, false);
+    }
+}
+
+/*
+ * Forget what is known of a line from a byte on (the bytes before it are
+ * unchanged)
+ */
+static void	truncate_at(t_column_line *entry, size_t byte)
+{
+    // The last plain byte may now be followed by a mark
+    if (entry->plain >= byte)
+        entry->plain = (byte > 0) ? byte - 1 : 0;
+    while (entry->count > 0 && entry->marks[entry->count - 1].byte >= byte)
+        entry->count--;
+    if (entry->byte >= byte)
+    {
+        entry->byte = entry->count ? entry->marks[entry->count - 1].byte : entry->plain;
+        entry->col = entry->count ? entry->marks[entry->count - 1].col : entry->plain;
+        if (entry->byte < entry->plain)
+        {
+            entry->byte = entry->plain;
+            entry->col = entry->plain;
+        }
+    }
+}
+
+/*
+ * Remembered columns of a line (the least recently used entry makes room)
+ * A line that grew since it was measured (the indexer reached more of it)
+ * keeps what is known of its old part
+ */
+static t_column_line	*line_entry(size_t line)
+{
+    t_column_line	*entry;
+    size_t			len;
+
+    if (!g_ready)
+        columns_invalidate(0, 0);
+    len = buffer_line_length(&g_buffer, line);
+    entry = &g_lines[0];
+    for (int i = 0; i < COLUMN_CACHE_LINES; i++)
+    {
+        if (g_lines[i].line == line)
+        {
+            entry = &g_lines[i];
+            if (entry->len != len)
+                truncate_at(entry, entry->len < len ? entry->len : len);
+            entry->len = len;
+            entry->used = ++g_clock;
+            return (entry);
+        }
+        if (g_lines[i].used < entry->used)
+            entry = &g_lines[i];
+    }
+    entry->line = line;
+    entry->len = len;
+    entry->plain = 0;
+    entry->byte = 0;
+    entry->col = 0;
+    entry->count = 0;
+    entry->used = ++g_clock;
+    return (entry);
+}
+
+/*
+ * Last checkpoint at or before a byte (by_col false) or a display column
+ * (by_col true); the start of the line if there is none
+ */
+static t_column_mark	checkpoint(const t_column_line *entry, size_t key, bool by_col)
+{
+    size_t	lo;
+    size_t	hi;
+    size_t	mid;
+
+    if (by_col ? entry->col <= key : entry->byte <= key)
+        return ((t_column_mark){entry->byte, entry->col});
+    lo = 0;
+    hi = entry->count;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if ((by_col ? entry->marks[mid].col : entry->marks[mid].byte) <= key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return ((t_column_mark){entry->plain, entry->plain});
+    return (entry->marks[lo - 1]);
+}
+
+/*
+ * Display column (0-based) where a byte of a line is drawn
+ * A byte inside a character gives the column of that character
+ *
+ * @param line: 0-based line number
+ * @param byte: Byte offset inside the line (up to its length)
+ * @return: Display column
+ */
+size_t	columns_col(size_t line, size_t byte)
+{
+    t_column_line	*entry;
+    t_column_mark	from;
+
+    entry = line_entry(line);
+    if (byte > entry->len)
+        byte = entry->len;
+    if (byte <= entry->plain)
+        return (byte);
+    g_win_len = 0;
+    from = checkpoint(entry, byte, false);
+    walk(entry, buffer_line_start(&g_buffer, line), &from.byte, &from.col, byte, SIZE_MAX);
+    return (from.col);
+}
+
+/*
+ * Character of a line drawn at a display column
+ * Past the end of the line, the end of the line
+ *
+ * @param line: 0-based line number
+ * @param col: Display column (0-based)
+ * @param at: Receives the column where that character starts
+ * @return: Byte offset of the character inside the line
+ */
+size_t	columns_byte(size_t line, size_t col, size_t *at)
+{
+    t_column_line	*entry;
+    t_column_mark	from;
+
+    entry = line_entry(line);
+    if (col < entry->plain)
+    {
+        *at = col;
+        return (col);
+    }
+    g_win_len = 0;
+    from = checkpoint(entry, col, true);
+    walk(entry, buffer_line_start(&g_buffer, line), &from.byte, &from.col, entry->len, col);
+    *at = from.col;
+    return (from.byte);
+}
+
+/*
+ * End of the screen row that starts at character b of a line (display
+ * column *col), for rows of width columns: the first character that does
+ * not end inside the row starts the next one, and a character wider than
+ * a row has one to itself
+ *
+ * @param col: Column of b; receives the column of the next row
+ * @return: Byte offset of the next row (the line length for the last row)
+ */
+static size_t	row_end(t_column_line *entry, size_t start, size_t b, size_t *col,
+    size_t width)
+{
+    size_t	from;
+    size_t	w;
+
+    if (b + width <= entry->plain)
+    {
+        *col += width; // One column per byte there
+        return (b + width);
+    }
+    from = b;
+    walk(entry, start, &b, col, entry->len, *col + width);
+    if (b == from && b < entry->len)
+    {
+        b += character(start, entry->len, b, *col, &w);
+        *col += w;
+    }
+    return (b);
+}
+
+/*
+ * Move down the screen rows of a line (rows of width columns, see row_end())
+ *
+ * @param line: 0-based line number
+ * @param byte: Start of a row; receives the start of the row reached
+ * @param col: Its display column; receives that of the row reached
+ * @param width: Columns of a row
+ * @param rows: Rows to move down
+ * @return: Rows moved (fewer if the last row of the line came first)
+ */
+size_t	columns_row_skip(size_t line, size_t *byte, size_t *col, size_t width, size_t rows)
+{
+    t_column_line	*entry;
+    size_t			start;
+    size_t			next;
+    size_t			c;
+    size_t			n;
+
+    if (rows == 0)
+        return (0);
+    entry = line_entry(line);
+    start = buffer_line_start(&g_buffer, line);
+    g_win_len = 0;
+    for (n = 0; n < rows; n++)
+    {
+        c = *col;
+        next = row_end(entry, start, *byte, &c, width);
+        if (next >= entry->len)
+            break ; // *byte starts the last row
+        *byte = next;
+        *col = c;
+    }
+    return (n);
+}
+
+/*
+ * Screen rows a line takes (rows of width columns, see row_end())
+ * A line that is not remembered is measured without taking the place of
+ * one that is, so a pass over many lines keeps the columns of the screen's
+ *
+ * @param line: 0-based line number
+ * @param width: Columns of a row
+ * @return: Rows (at least one)
+ */
+size_t	columns_rows(size_t line, size_t width)
+{
+    static t_column_line	scratch = {.line = SIZE_MAX};
+    t_column_line			*entry;
+    size_t					start;
+    size_t					b;
+    size_t					col;
+    size_t					rows;
+
+    if (!g_ready)
+        columns_invalidate(0, 0);
+    entry = &scratch;
+    for (int i = 0; i < COLUMN_CACHE_LINES; i++)
+    {
+        if (g_lines[i].line == line)
+            entry = line_entry(line);
+    }
+    if (entry == &scratch)
+    {
+        scratch.len = buffer_line_length(&g_buffer, line);
+        scratch.plain = 0;
+        scratch.byte = 0;
+        scratch.col = 0;
+        scratch.count = 0;
+    }
+    start = buffer_line_start(&g_buffer, line);
+    g_win_len = 0;
+    b = 0;
+    col = 0;
+    rows = 1;
+    while ((b = row_end(entry, start, b, &col, width)) < entry->len)
+        rows++;
+    return (rows);
+}
+
+/*
+ * Start of the character after the one at a byte of a line
+ *
+ * @param line: 0-based line number
+ * @param byte: Byte offset inside the line
+ * @return: Byte offset of the next character (the line length at the end)
+ */
+size_t	columns_next(size_t line, size_t byte)
+{
+    size_t	start;
+    size_t	len;
+    size_t	w;
+
+    len = buffer_line_length(&g_buffer, line);
+    if (byte >= len)
+        return (len);
+    if (!g_buffer.non_ascii)
+        return (byte + 1);
+    start = buffer_line_start(&g_buffer, line);
+    g_win_len = 0;
+    return (byte + character(start, len, byte, 0, &w));
+}
+
+/*
+ * Character that ends at byte p of a line (p > 0)
+ *
+ * @param cp: Receives it (UTF8_INVALID for a stray byte)
+ * @return: Byte offset where it starts
+ */
+static size_t	before(size_t start, size_t p, uint32_t *cp)
+{
+    char	bytes[4];
+    size_t	k;
+
+    k = (p < 4) ? p : 4;
+    buffer_read(&g_buffer, start + p - k, bytes, k);
+    // Back over continuation bytes to the lead byte
+    for (size_t i = 1; i < k; i++)
+    {
+        if (((unsigned char)bytes[k - i] & 0xC0) != 0x80)
+            break ;
+        if (((unsigned char)bytes[k - i - 1] & 0xC0) != 0x80)
+        {
+            if (utf8_decode(bytes + k - i - 1, i + 1, cp) == i + 1)
+                return (p - i - 1);
+            break ;
+        }
+    }
+    utf8_decode(bytes + k - 1, 1, cp);
+    return (p - 1);
+}
+
+/*
+ * Start of the character before a byte of a line
+ *
+ * @param line: 0-based line number
+ * @param byte: Byte offset inside the line
+ * @return: Byte offset of the previous character (0 at the start)
+ */
+size_t	columns_prev(size_t line, size_t byte)
+{
+    size_t		start;
+    size_t		q;
+    size_t		r;
+    uint32_t	cp;
+    uint32_t	prev;
+
+    if (byte == 0)
+        return (0);
+    if (!g_buffer.non_ascii)
+        return (byte - 1);
+    start = buffer_line_start(&g_buffer, line);
+    q = before(start, byte, &cp);
+    // Marks and joined characters belong to the character before them
+    while (q > 0)
+    {
+        r = before(start, q, &prev);
+        if (!utf8_extends(prev, cp))
+            break ;
+        q = r;
+        cp = prev;
+    }
+    return (q);
+}
+
+/*
+ * Adjust the remembered lines after an edit (line numbers as for
+ * syntax_edit())
+ *
+ * @param line: Line where the edit starts
+ * @param byte: Offset in that line where it starts
+ * @param removed: Line breaks the edit removed
+ * @param added: Line breaks the edit added
+ */
+void	columns_edit(size_t line, size_t byte, size_t removed, size_t added)
+{
+    for (int i = 0; i < COLUMN_CACHE_LINES; i++)
+    {
+        if (g_lines[i].line == SIZE_MAX || g_lines[i].line < line)
+            continue ;
+        if (g_lines[i].line == line)
+            truncate_at(&g_lines[i], byte);
+        else if (g_lines[i].line <= line + removed)
+        {
+            g_lines[i].line = SIZE_MAX;
+            g_lines[i].used = 0;
+        }
+        else
+            g_lines[i].line = g_lines[i].line - removed + added;
+    }
+}
+
+/*
+ * Forget the remembered lines from a point of the document on (an edit
+ * whose extent is not known, such as an undo step)
+ *
+ * @param line: First line that may have changed
+ * @param byte: Offset in that line where the change may start
+ */
+void	columns_invalidate(size_t line, size_t byte)
+{
+    for (int i = 0; i < COLUMN_CACHE_LINES; i++)
+    {
+        if (!g_ready)
+            g_lines[i].line = SIZE_MAX;
+        if (g_lines[i].line == SIZE_MAX || g_lines[i].line < line)
+            continue ;
+        if (g_lines[i].line == line)
+            truncate_at(&g_lines[i], byte);
+        else
+        {
+            g_lines[i].line = SIZE_MAX;
+            g_lines[i].used = 0;
+        }
+    }
+    g_ready = true;
+}
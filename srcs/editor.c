@@ -5,19 +5,19 @@
 /*
  * VERBATRON Core Editor Functions
  * This file contains the main editor functionality including screen management,
- * cursor control, file I/O, and the splash screen. These are the core operations
- * that make VERBATRON function as a text editor.
+ * cursor control and file I/O. These are the core operations that make
+ * VERBATRON function as a text editor.
  */
 
 /*
  * Clear screen and hide cursor for clean startup
- * Used when entering the main editor after splash screen
+ * Goes out with the first frame, in the same write
  */
 void	clear_screen_startup(void)
 {
-    write(STDOUT_FILENO, "\x1b[2J", 4);   // ANSI: Clear entire screen
-    write(STDOUT_FILENO, "\x1b[H", 3);    // ANSI: Move cursor to top-left (1,1)
-    write(STDOUT_FILENO, "\x1b[?25l", 6); // ANSI: Hide cursor during drawing
+    frame_append("\x1b[2J", 4);   // ANSI: Clear entire screen
+    frame_append("\x1b[H", 3);    // ANSI: Move cursor to top-left (1,1)
+    frame_append("\x1b[?25l", 6); // ANSI: Hide cursor during drawing
 }
 
 /*
@@ -61,88 +61,33 @@ void	draw_cursor(t_cursor *cursor)
     int		visible_rows;   // Number of rows available for text
     int		visible_y;      // Cursor's screen position (row)
     int		visible_x;      // Cursor's screen position (column)
-    char	cursor_str[30]; // Buffer for ANSI escape sequence
-    int		len;           // Length of escape sequence
+    int		gutter;         // Width of the line numbers
+    size_t	sub;            // Row of its line the cursor is on (soft wrap)
+    size_t	left;           // Display column where that row starts
 
-    visible_rows = g_window_rows - 1;               // Reserve bottom row for commands
-    visible_y = cursor->cy - cursor->scroll_y;      // Cursor row relative to scroll
-    visible_x = cursor->cx - cursor->scroll_x + 5;  // +5 to account for line numbers
-
-    // Only show cursor if it's within the visible area
-    if (visible_y >= 1 && visible_y <= visible_rows && 
-        visible_x >= 6 && visible_x <= g_window_cols)
+    gutter = gutter_width();
+    visible_rows = g_window_rows - 1;                   // Reserve bottom row for commands
+    visible_y = cursor->cy - cursor->scroll_y;          // Cursor row relative to scroll
+    visible_x = cursor->rx - cursor->scroll_x + gutter; // Shift right past line numbers
+    if (wrap_enabled())
     {
-        write(STDOUT_FILENO, "\x1b[?25h", 6);        // Show cursor
-        len = sprintf(cursor_str, "\x1b[%d;%dH", visible_y, visible_x);
-        write(STDOUT_FILENO, cursor_str, len);       // Position cursor
+        // Rows from the top of the view down to the cursor's, and its place in that row
+        sub = wrap_sub(cursor->cy - 1, cursor->rx - 1);
+        visible_y = (int)wrap_distance(cursor->scroll_y, cursor->scroll_row,
+            cursor->cy - 1, sub, visible_rows) + 1;
+        wrap_row_start(cursor->cy - 1, sub, &left);
+        visible_x = cursor->rx - (int)left;
+        if (visible_x > wrap_width())
+            visible_x = wrap_width(); // Past a full last row: stays on its last column
+        visible_x += gutter;
     }
-}
-
-/*
- * Save current text buffer to a file
- * Only saves lines that contain non-space characters
- * Handles proper line endings and removes trailing empty lines
- * 
- * @param filename: Path to file to save
- */
-void	save_to_file(const char *filename)
-{
-    int	fd;               // File descriptor
-    int	last_char_pos;    // Position of last non-space character in line
-    int	has_content_after; // Flag: are there non-empty lines after this one?
-    int y, x;             // Loop counters
-
-    // Open file for writing (create if doesn't exist, truncate if does)
-    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd == -1)
-    {
-        // TODO: Better error handling (show message to user)
-        return ;
-    }
-
-    // Process each line in the buffer
-    for (y = 0; y < MAX_ROWS; y++)
-    {
-        // Find the rightmost non-space character in this line
-        last_char_pos = -1;
-        for (x = 0; x < MAX_COLS; x++)
-        {
-            if (text_buffer[y][x] != ' ')
-                last_char_pos = x;
-        }
 
-        // If line has content, write it
-        if (last_char_pos >= 0)
-        {
-            write(fd, text_buffer[y], last_char_pos + 1); // Write up to last char
-            write(fd, "\n", 1);                           // Add newline
-        }
-        // Handle empty lines (all spaces)
-        else
-        {
-            // Check if there are any non-empty lines after this one
-            has_content_after = 0;
-            for (int check_y = y + 1; check_y < MAX_ROWS; check_y++)
-            {
-                for (int check_x = 0; check_x < MAX_COLS; check_x++)
-                {
-                    if (text_buffer[check_y][check_x] != ' ')
-                    {
-                        has_content_after = 1;
-                        break ;
-                    }
-                }
-                if (has_content_after)
-                    break ;
-            }
-            
-            // Only write empty line if there's content after it
-            // This prevents trailing empty lines in saved files
-            if (has_content_after)
-                write(fd, "\n", 1);
-        }
-    }
-    close(fd);
+    // Only show cursor if it's within the visible area
+    if (visible_y >= 1 && visible_y <= visible_rows &&
+        visible_x > gutter && visible_x <= g_window_cols)
+        screen_set_cursor(visible_y - 1, visible_x - 1);
+    else
+        screen_set_cursor(-1, 0);
 }
 
 /*
@@ -161,28 +106,66 @@ void	move_cursor_to(int row, int col)
     move_cursor(&cursor, 0); // Call with dummy character
 }
 
+// Last message for the user (save result, errors); empty when none
+static char	g_message[CMD_BUF_SIZE];
+
+/*
+ * Set the message shown on the bottom line until the next key press
+ *
+ * @param fmt: printf-style format
+ */
+void	set_message(const char *fmt, ...)
+{
+    va_list	ap;
+
+    va_start(ap, fmt);
+    vsnprintf(g_message, sizeof(g_message), fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Forget the current message (called when a key is pressed)
+ */
+void	clear_message(void)
+{
+    g_message[0] = '\0';
+}
+
+/*
+ * Blank the bottom row of the screen
+ */
+static void	clear_bottom_row(void)
+{
+    screen_clear_to_eol(g_window_rows - 1, 0);
+    screen_invalidate_rows(g_window_rows - 1, g_window_rows);
+}
+
 /*
  * Clear the command prompt line at bottom of screen
- * Used when entering/exiting command mode
+ * Used when entering/exiting command mode; a pending message stays visible
  */
 void	clear_command_prompt(void)
 {
-    move_cursor_to(MAX_ROWS - 1, 0);        // Move to bottom-left
-    write(STDOUT_FILENO, "\033[K", 3);      // ANSI: Clear line from cursor to end
+    clear_bottom_row();
+    screen_put(g_window_rows - 1, 0, g_message, strlen(g_message), ATTR_NORMAL);
 }
 
 /*
  * Update the command line with current command text
- * Shows the ":" prompt followed by what user is typing
+ * Shows the ":" prompt followed by what user is typing ("/" and "?"
+ * searches are shown as they are)
  * 
  * @param cmd: Command text to display
  */
 void	update_command_line(const char *cmd)
 {
-    clear_command_prompt();
-    move_cursor_to(MAX_ROWS - 1, 0);       // Move to bottom-left
-    write(STDOUT_FILENO, ":", 1);          // Show command prompt
-    write(STDOUT_FILENO, cmd, strlen(cmd)); // Show command text
+    int	col;
+
+    clear_bottom_row();
+    col = 0;
+    if (cmd[0] != '/' && cmd[0] != '?') // A search shows its own prompt
+        screen_put(g_window_rows - 1, col++, ":", 1, ATTR_NORMAL); // Show command prompt
+    screen_put(g_window_rows - 1, col, cmd, strlen(cmd), ATTR_NORMAL); // Show command text
 }
 
 /*
@@ -190,7 +173,7 @@ void	update_command_line(const char *cmd)
  */
 void	set_cursor_bottom(void)
 {
-    move_cursor_to(MAX_ROWS - 1, 0);
+    move_cursor_to(g_window_rows, 0);
 }
 
 /*
@@ -199,76 +182,92 @@ void	set_cursor_bottom(void)
  */
 void	print_command_prompt(void)
 {
-    char	prompt_str[20]; // Buffer for ANSI escape sequence
-    int		len;           // Length of escape sequence
-
-    // Position cursor at bottom-left and show prompt
-    len = sprintf(prompt_str, "\x1b[%d;1H:", g_window_rows);
-    write(STDOUT_FILENO, prompt_str, len);
+    // Replace the status line with an empty prompt
+    update_command_line("");
 }
 
 /*
- * Display startup splash screen from verbatron.txt
- * Shows for 1 second then clears screen
- * If verbatron.txt doesn't exist, shows simple fallback text
+ * Draw the status line (bottom row, input mode only)
+ * Shows the last message on the left and, on the right, the cursor line and
+ * the line count, which keeps growing while the
+ * file is still being indexed in the background (preceded by a warning
+ * once bytes that are not UTF-8 have been seen, and a mark while the file
+ * is followed)
+ *
+ * @param cursor: Current cursor position
  */
-void	show_splash_screen(void)
+void	draw_status_line(t_cursor *cursor)
 {
-    int		fd;          // File descriptor for verbatron.txt
-    char	buffer[1024]; // Read buffer
-    ssize_t	bytes_read;  // Number of bytes read
+    char	status[128]; // Status text
+    char	count[80];   // Rank of the search match shown, UTF-8 warning
+    int		len;         // Length of status text
+    int		col;         // Column where the status starts (right-aligned, 0-based)
+    int		msg_len;     // Part of the message that fits
 
-    // Clear screen and position cursor for splash
-    write(STDOUT_FILENO, "\x1b[2J", 4); // Clear entire screen
-    write(STDOUT_FILENO, "\x1b[H", 3);  // Move cursor to top-left
-
-    // Try to open and display verbatron.txt
-    fd = open("verbatron.txt", O_RDONLY);
-    if (fd != -1)
-    {
-        // Read and display file contents
-        while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0)
-        {
-            write(STDOUT_FILENO, buffer, bytes_read);
-        }
-        close(fd);
-    }
+    if (current_mode != MODE_INPUT)
+        return ;
+    if (matches_status(count, sizeof(count)) > 0)
+        strcat(count, "  ");
     else
-    {
-        // Fallback if file doesn't exist
-        write(STDOUT_FILENO, "VERBATRON\n", 10);
-        write(STDOUT_FILENO, "Text Editor\n", 12);
-        write(STDOUT_FILENO, "Version 1.0\n", 12);
-    }
-
-    sleep(1);  // Display splash for 1 second
-
-    // Clear screen after splash
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+        count[0] = '\0';
+    if (g_buffer.bad_utf8 != SIZE_MAX) // Shown byte by byte, invalid ones as '?'
+        strcat(count, "[not UTF-8]  ");
+    if (follow_active())
+        strcat(count, "[follow]  ");
+    if (tabs_count() > 1)
+        snprintf(count + strlen(count), sizeof(count) - strlen(count), "Tab %zu/%zu  ",
+            tabs_current() + 1, tabs_count());
+    if (buffer_fully_indexed(&g_buffer))
+        len = snprintf(status, sizeof(status), "%sLn %d/%zu", count, cursor->cy,
+            buffer_line_count(&g_buffer));
+    else
+        len = snprintf(status, sizeof(status), "%sLn %d/%zu+ (indexing %d%%)",
+            count, cursor->cy, buffer_line_count(&g_buffer),
+            (int)(g_buffer.indexed * 100 / g_buffer.original->size));
+    col = g_window_cols - len;
+    if (col < 0)
+        col = 0;
+    // A message goes on the left, cut short where the status begins
+    clear_bottom_row();
+    msg_len = strlen(g_message);
+    if (msg_len > col - 1)
+        msg_len = (col > 1) ? col - 1 : 0;
+    screen_put(g_window_rows - 1, 0, g_message, msg_len, ATTR_NORMAL);
+    screen_put(g_window_rows - 1, col, status, len, ATTR_GUTTER);
 }
 
 /*
  * Load a file into the text buffer
- * Handles character conversion and proper line/column management
+ * Regular files are memory-mapped and only the first screen is indexed here;
+ * the rest of the line index is built by a background thread.
+ * Bytes are kept as they are - tabs and control characters are handled
+ * when lines are displayed. Edits a crash left in the file's swap file
+ * are replayed, and from then on every edit is logged there.
  * 
  * @param filename: Path to file to load
  */
 void	load_file(const char *filename)
 {
-    int		fd;          // File descriptor
-    char	buffer[1024]; // Read buffer
-    ssize_t	bytes_read;  // Number of bytes read
-    int		row, col;    // Current position in text buffer
+    int			fd;          // File descriptor
+    struct stat	st;          // File size and type
+    char		buffer[1024]; // Read buffer (non-mappable files)
+    ssize_t		bytes_read;  // Number of bytes read
+    uint64_t	start;       // When loading began (":stats")
 
-    row = 0;
-    col = 0;
-
-    // Store filename for future save operations
-    strcpy(current_filename, filename);
+    STATS_START(start);
+    // Store filename for future save operations (tabs_add() and tabs_open()
+    // turn away names that would not fit)
+    snprintf(current_filename, sizeof(current_filename), "%s", filename);
 
-    // Clear the text buffer (fill with spaces)
-    memset(text_buffer, ' ', sizeof(text_buffer));
+    // Drop the previous document (a background save may still be reading it)
+    save_wait();
+    matches_stop(); // Match counting reads it too
+    journal_close(g_buffer.journal, false);
+    buffer_free(&g_buffer);
+    undo_clear(&g_undo);  // Its history does not apply to the new file
+    syntax_select(filename);
+    columns_invalidate(0, 0);
+    wrap_invalidate(0);
 
     // Try to open the file
     fd = open(filename, O_RDONLY);
@@ -276,36 +275,25 @@ void	load_file(const char *filename)
     {
         // File doesn't exist - start with empty buffer but keep filename
         // This allows saving new files with the specified name
-        return ;
+        buffer_init(&g_buffer, NULL, 0);
     }
-
-    // Read file in chunks and process character by character
-    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0)
+    // Map regular files and index just enough for the first screen
+    else if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && buffer_map_file(&g_buffer, fd, st.st_size) == 0)
     {
-        for (ssize_t i = 0; i < bytes_read && row < MAX_ROWS; i++)
-        {
-            if (buffer[i] == '\n')
-            {
-                // End of line: fill rest with spaces and move to next line
-                while (col < MAX_COLS)
-                    text_buffer[row][col++] = ' ';
-                row++;
-                col = 0;
-            }
-            else if (buffer[i] == '\t')
-            {
-                // Convert tabs to 4 spaces for consistent display
-                for (int j = 0; j < 4 && col < MAX_COLS; j++)
-                    text_buffer[row][col++] = ' ';
-            }
-            else if (col < MAX_COLS && buffer[i] >= 32 && buffer[i] <= 126)
-            {
-                // Only store printable ASCII characters
-                // This filters out control characters that could mess up display
-                text_buffer[row][col++] = buffer[i];
-            }
-            // Non-printable characters are silently ignored
-        }
+        close(fd);
+        buffer_ensure_view(&g_buffer, 0, g_window_rows, g_window_cols);
+        indexer_start(&g_buffer);  // Build the rest of the index in the background
+    }
+    else
+    {
+        // Pipes, devices and empty files are read the old way
+        buffer_init(&g_buffer, NULL, 0);
+        while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0)
+            buffer_insert(&g_buffer, buffer_size(&g_buffer), buffer, bytes_read);
+        close(fd);
     }
-    close(fd);
+    g_buffer.saved = g_buffer.edits; // As read; edits recovered below count as changes
+    g_buffer.journal = journal_open(filename, &g_buffer); // Recover, then log the edits
+    STATS_STOP(STAT_LOAD, start);
 }
@@ -0,0 +1,261 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Substring Search
+ * Literal search over a contiguous run of bytes. The vector versions test
+ * 16 (SSE2) or 32 (AVX2) candidate positions at once: a position can only
+ * match if the pattern's first byte is there and its last byte is at
+ * position + len - 1, so both are compared for the whole block and only
+ * the surviving candidates are checked with memcmp. On text this rejects
+ * almost every position without touching the middle of the pattern.
+ * As with the newline scanner, the best version is picked once at run time.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define FIND_HAVE_X86 1
+#else
+# define FIND_HAVE_X86 0
+#endif
+
+/*
+ * Scalar fallback: memchr for the first byte, then compare the rest
+ */
+static size_t	find_scalar(const char *hay, size_t len, const char *pat, size_t n)
+{
+    const char	*p;
+    const char	*last;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? 0 : SIZE_MAX);
+    p = hay;
+    last = hay + len - n;
+    while (p <= last && (p = memchr(p, pat[0], last - p + 1)) != NULL)
+    {
+        if (p[n - 1] == pat[n - 1] && memcmp(p + 1, pat + 1, n - 1) == 0)
+            return (p - hay);
+        p++;
+    }
+    return (SIZE_MAX);
+}
+
+/*
+ * Scalar fallback, searching backwards
+ */
+static size_t	rfind_scalar(const char *hay, size_t len, const char *pat, size_t n)
+{
+    size_t	i;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? len : SIZE_MAX);
+    i = len - n + 1;
+    while (i-- > 0)
+    {
+        if (hay[i] == pat[0] && hay[i + n - 1] == pat[n - 1]
+            && memcmp(hay + i + 1, pat + 1, n - 1) == 0)
+            return (i);
+    }
+    return (SIZE_MAX);
+}
+
+#if FIND_HAVE_X86
+
+/*
+ * SSE2: candidates where both the first and last pattern bytes line up
+ */
+__attribute__((target("sse2")))
+static uint32_t	candidates_sse2(const char *p, size_t n, __m128i first, __m128i last)
+{
+    return (_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), first),
+        _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + n - 1)), last))));
+}
+
+__attribute__((target("sse2")))
+static size_t	find_sse2(const char *hay, size_t len, const char *pat, size_t n)
+{
+    const __m128i	first = _mm_set1_epi8(pat[0]);
+    const __m128i	last = _mm_set1_epi8(pat[n ? n - 1 : 0]);
+    size_t			i;
+    size_t			at;
+    uint32_t		mask;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? 0 : SIZE_MAX);
+    for (i = 0; i + n - 1 + 16 <= len; i += 16)
+    {
+        mask = candidates_sse2(hay + i, n, first, last);
+        while (mask)
+        {
+            at = i + __builtin_ctz(mask);
+            if (memcmp(hay + at + 1, pat + 1, n - 1) == 0)
+                return (at);
+            mask &= mask - 1;
+        }
+    }
+    at = find_scalar(hay + i, len - i, pat, n);
+    return (at == SIZE_MAX ? at : i + at);
+}
+
+__attribute__((target("sse2")))
+static size_t	rfind_sse2(const char *hay, size_t len, const char *pat, size_t n)
+{
+    const __m128i	first = _mm_set1_epi8(pat[0]);
+    const __m128i	last = _mm_set1_epi8(pat[n ? n - 1 : 0]);
+    size_t			end;
+    size_t			at;
+    uint32_t		mask;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? len : SIZE_MAX);
+    // Candidates [end - 16, end) are tested per step, last block first
+    end = len - n + 1;
+    while (end >= 16)
+    {
+        mask = candidates_sse2(hay + end - 16, n, first, last);
+        while (mask)
+        {
+            at = end - 16 + 31 - __builtin_clz(mask);
+            if (memcmp(hay + at + 1, pat + 1, n - 1) == 0)
+                return (at);
+            mask &= ~(1u << (at - (end - 16)));
+        }
+        end -= 16;
+    }
+    return (rfind_scalar(hay, end + n - 1, pat, n));
+}
+
+/*
+ * AVX2: 32 candidates per step
+ */
+__attribute__((target("avx2,bmi")))
+static uint32_t	candidates_avx2(const char *p, size_t n, __m256i first, __m256i last)
+{
+    return (_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), first),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + n - 1)), last))));
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t	find_avx2(const char *hay, size_t len, const char *pat, size_t n)
+{
+    const __m256i	first = _mm256_set1_epi8(pat[0]);
+    const __m256i	last = _mm256_set1_epi8(pat[n ? n - 1 : 0]);
+    size_t			i;
+    size_t			at;
+    uint32_t		mask;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? 0 : SIZE_MAX);
+    for (i = 0; i + n - 1 + 32 <= len; i += 32)
+    {
+        mask = candidates_avx2(hay + i, n, first, last);
+        while (mask)
+        {
+            at = i + __builtin_ctz(mask);
+            if (memcmp(hay + at + 1, pat + 1, n - 1) == 0)
+                return (at);
+            mask &= mask - 1;
+        }
+    }
+    at = find_scalar(hay + i, len - i, pat, n);
+    return (at == SIZE_MAX ? at : i + at);
+}
+
+__attribute__((target("avx2,bmi")))
+static size_t	rfind_avx2(const char *hay, size_t len, const char *pat, size_t n)
+{
+    const __m256i	first = _mm256_set1_epi8(pat[0]);
+    const __m256i	last = _mm256_set1_epi8(pat[n ? n - 1 : 0]);
+    size_t			end;
+    size_t			at;
+    uint32_t		mask;
+
+    if (n == 0 || n > len)
+        return (n == 0 ? len : SIZE_MAX);
+    end = len - n + 1;
+    while (end >= 32)
+    {
+        mask = candidates_avx2(hay + end - 32, n, first, last);
+        while (mask)
+        {
+            at = end - 32 + 31 - __builtin_clz(mask);
+            if (memcmp(hay + at + 1, pat + 1, n - 1) == 0)
+                return (at);
+            mask &= ~(1u << (at - (end - 32)));
+        }
+        end -= 32;
+    }
+    return (rfind_scalar(hay, end + n - 1, pat, n));
+}
+
+#endif
+
+// Every implementation this binary was built with, best first
+static const t_find_impl	g_impls[] = {
+#if FIND_HAVE_X86
+    {"avx2", find_avx2, rfind_avx2},
+    {"sse2", find_sse2, rfind_sse2},
+#endif
+    {"scalar", find_scalar, rfind_scalar},
+};
+
+static const t_find_impl	*g_best = NULL;
+static pthread_once_t		g_best_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Pick the fastest implementation the CPU supports (runs once)
+ */
+static void	select_best(void)
+{
+    size_t	i;
+
+    i = 0;
+#if FIND_HAVE_X86
+    __builtin_cpu_init();
+    if (!(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi")))
+        i++;
+    if (i == 1 && !__builtin_cpu_supports("sse2"))
+        i++;
+#endif
+    g_best = &g_impls[i];
+}
+
+/*
+ * List the substring searchers usable on this CPU, best first
+ * Used by the benchmark to compare implementations
+ *
+ * @param count: Receives the number of entries
+ * @return: Array of implementations
+ */
+const t_find_impl	*find_impls(size_t *count)
+{
+    size_t	first;
+
+    pthread_once(&g_best_once, select_best);
+    first = g_best - g_impls;
+    *count = sizeof(g_impls) / sizeof(g_impls[0]) - first;
+    return (g_best);
+}
+
+/*
+ * Offset of the first occurrence of pat[0, n) in hay[0, len)
+ *
+ * @return: Offset, or SIZE_MAX if there is none
+ */
+size_t	text_find(const char *hay, size_t len, const char *pat, size_t n)
+{
+    pthread_once(&g_best_once, select_best);
+    return (g_best->find(hay, len, pat, n));
+}
+
+/*
+ * Offset of the last occurrence of pat[0, n) in hay[0, len)
+ *
+ * @return: Offset, or SIZE_MAX if there is none
+ */
+size_t	text_rfind(const char *hay, size_t len, const char *pat, size_t n)
+{
+    pthread_once(&g_best_once, select_best);
+    return (g_best->rfind(hay, len, pat, n));
+}
@@ -0,0 +1,255 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Follow Mode
+ * ":follow" (or -f on the command line) keeps showing a file another
+ * program appends to, like "tail -f". inotify tells when the file changes;
+ * the event loop then lets it be looked at no more than every
+ * FOLLOW_INTERVAL_MS however fast it is written, and each look indexes the
+ * bytes appended since the last one and nothing else - up to the end of
+ * the last whole line, so lines never change once they are drawn. The
+ * mapping keeps FOLLOW_RESERVE bytes of address space past the end of the
+ * file, so growing seldom maps it again and never reads it again.
+ * The view stays at the end while the cursor is on the last line. A file
+ * that shrinks (truncated) or whose name now belongs to another file
+ * (rotated logs) is loaded again from its name.
+ */
+
+static t_follow	g_follow = {.fd = -1, .notify = -1, .timer = -1};
+
+/*
+ * Stop watching the file and close it
+ */
+static void	close_files(void)
+{
+    loop_watch(-1, 0, NULL, NULL);
+    loop_timer_cancel(g_follow.timer);
+    g_follow.timer = -1;
+    if (g_follow.fd >= 0)
+        close(g_follow.fd);
+    if (g_follow.notify >= 0)
+        close(g_follow.notify);
+    g_follow.fd = -1;
+    g_follow.notify = -1;
+}
+
+/*
+ * Take in the lines appended since the last look
+ * The caches of the old last line are told it was edited (it may have
+ * grown) and lines were added after it, as for any insertion at the end
+ *
+ * @param st: The file's status now
+ * @return: true if more was appended than one look takes in
+ */
+static bool	take_in(const struct stat *st)
+{
+    t_source	*src;
+    size_t		size;
+    size_t		lines;
+    size_t		byte;
+    size_t		before;
+    bool		more;
+
+    src = g_buffer.original;
+    size = (size_t)st->st_size;
+    more = (size - src->size > FOLLOW_STEP);
+    if (more)
+        size = src->size + FOLLOW_STEP;
+    if (!src->mapped || size > src->capacity)
+    {
+        // The file is mapped again: nothing may be reading it meanwhile
+        save_wait();
+        matches_stop();
+    }
+    lines = buffer_line_count(&g_buffer);
+    before = buffer_size(&g_buffer);
+    byte = before - buffer_line_start(&g_buffer, lines - 1);
+    if (buffer_follow(&g_buffer, g_follow.fd, size) != 0)
+    {
+        set_message("Can't follow %s: %s", current_filename, strerror(errno));
+        follow_stop();
+        return (false);
+    }
+    buffer_index_all(&g_buffer);
+    if (buffer_size(&g_buffer) != before)
+    {
+        syntax_edit(lines - 1, 0, buffer_line_count(&g_buffer) - lines);
+        columns_edit(lines - 1, byte, 0, buffer_line_count(&g_buffer) - lines);
+        wrap_edit(lines - 1, byte, 0, buffer_line_count(&g_buffer) - lines);
+        if (!g_follow.changed)
+            g_follow.lines = lines;
+        g_follow.changed = true;
+    }
+    return (more);
+}
+
+/*
+ * Open the file shown and watch it for changes
+ *
+ * @return: false (errno set) if it cannot be followed
+ */
+static bool	open_files(void)
+{
+    struct stat	st;
+
+    g_follow.fd = open(current_filename, O_RDONLY | O_CLOEXEC);
+    if (g_follow.fd == -1)
+        return (false);
+    errno = EINVAL; // Unless fstat() fails: pipes and devices are read once, when loaded
+    if (fstat(g_follow.fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close_files();
+        return (false);
+    }
+    g_follow.notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g_follow.notify == -1 || inotify_add_watch(g_follow.notify, current_filename,
+            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) == -1)
+    {
+        close_files();
+        return (false);
+    }
+    return (true);
+}
+
+/*
+ * Look at the file: called when it changed (at most every
+ * FOLLOW_INTERVAL_MS), and by a timer while there is more to take in or
+ * while its name is gone
+ */
+static void	look(void *arg)
+{
+    char		events[4096];
+    char		name[sizeof(current_filename)];
+    struct stat	st;
+    struct stat	named;
+    bool		gone;
+
+    (void)arg;
+    loop_timer_cancel(g_follow.timer);
+    g_follow.timer = -1;
+    while (read(g_follow.notify, events, sizeof(events)) > 0)
+        ; // The file is looked at as it is now, whatever happened to it
+    if (fstat(g_follow.fd, &st) != 0)
+        return ;
+    gone = (stat(current_filename, &named) != 0);
+    if ((size_t)st.st_size < g_buffer.original->size
+        || (!gone && (named.st_ino != st.st_ino || named.st_dev != st.st_dev)))
+    {
+        // Truncated, or another file has its name: start over from that
+        strcpy(name, current_filename);
+        close_files();
+        load_file(name);
+        if (!open_files())
+        {
+            g_follow.active = false;
+            set_message("Can't follow %s: %s", name, strerror(errno));
+            return ;
+        }
+        loop_watch(g_follow.notify, FOLLOW_INTERVAL_MS, look, NULL);
+        g_follow.changed = true;
+        g_follow.reloaded = true;
+        g_follow.lines = 0;
+        set_message("%s was truncated or replaced: loaded again", name);
+        return ;
+    }
+    if (!buffer_fully_indexed(&g_buffer))
+        g_follow.timer = loop_timer_add(FOLLOW_INTERVAL_MS, look, NULL); // Indexing first
+    else if (take_in(&st))
+        g_follow.timer = loop_timer_add(0, look, NULL); // The rest after pending keys
+    else if (gone && g_follow.active)
+        g_follow.timer = loop_timer_add(FOLLOW_RETRY_MS, look, NULL); // Until a new file comes
+}
+
+/*
+ * Look at the followed file at once if it shrank, before anything reads the
+ * document: the pages past its new end are gone, and looks prompted by
+ * changes wait up to FOLLOW_INTERVAL_MS (one fstat(), every pass of the
+ * main loop)
+ *
+ * @return: true if it was loaded again (for handle_index_update())
+ */
+bool	follow_check(void)
+{
+    struct stat	st;
+
+    if (g_follow.fd < 0 || fstat(g_follow.fd, &st) != 0
+        || (size_t)st.st_size >= g_buffer.original->size)
+        return (false);
+    look(NULL);
+    return (follow_pending());
+}
+
+/*
+ * Follow the file shown: take in what is appended to it from now on and
+ * show its end
+ *
+ * @return: false (with a message) if it cannot be followed
+ */
+bool	follow_start(void)
+{
+    if (g_follow.active)
+        return (true);
+    if (current_filename[0] == '\0')
+    {
+        set_message("No file to follow");
+        return (false);
+    }
+    if (!open_files())
+    {
+        set_message("Can't follow %s: %s", current_filename, strerror(errno));
+        return (false);
+    }
+    loop_watch(g_follow.notify, FOLLOW_INTERVAL_MS, look, NULL);
+    g_follow.active = true;
+    g_follow.changed = true; // Show the end
+    g_follow.reloaded = false;
+    g_follow.lines = 0;
+    g_follow.timer = loop_timer_add(0, look, NULL); // What was appended since it was loaded
+    return (true);
+}
+
+/*
+ * Stop following the file shown (it stays as it is)
+ */
+void	follow_stop(void)
+{
+    close_files();
+    g_follow.active = false;
+    g_follow.changed = false;
+}
+
+/*
+ * Whether the file shown is followed
+ */
+bool	follow_active(void)
+{
+    return (g_follow.active);
+}
+
+/*
+ * Whether the followed file grew or was loaded again since follow_take()
+ */
+bool	follow_pending(void)
+{
+    return (g_follow.changed);
+}
+
+/*
+ * Report what happened to the followed file since the last call
+ *
+ * @param lines: Receives the line count before it grew (0 if the view
+ *               should go to the end anyway)
+ * @param reloaded: Receives whether it was loaded again (nothing on
+ *                  screen applies)
+ * @return: false if nothing happened
+ */
+bool	follow_take(size_t *lines, bool *reloaded)
+{
+    if (!g_follow.changed)
+        return (false);
+    *lines = g_follow.lines;
+    *reloaded = g_follow.reloaded;
+    g_follow.changed = false;
+    g_follow.reloaded = false;
+    return (true);
+}
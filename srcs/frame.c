@@ -0,0 +1,158 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Frame Composition
+ * Everything drawn while handling a key - text rows, line numbers, status
+ * line, command prompt, cursor - is appended to one reusable output buffer
+ * and sent to the terminal with a single writev() when the frame is done.
+ * On terminals that support synchronized updates (DEC private mode 2026)
+ * the frame is wrapped in begin/end markers so it is displayed atomically.
+ */
+
+# define SYNC_BEGIN "\x1b[?2026h" // Terminal holds rendering from here...
+# define SYNC_END "\x1b[?2026l"   // ...until here
+
+static t_frame	g_frame = {NULL, 0, 0, false, writev};
+
+/*
+ * Grow the frame buffer so that n more bytes fit
+ */
+static void	frame_grow(size_t n)
+{
+    size_t	cap;
+
+    if (g_frame.len + n <= g_frame.cap)
+        return ;
+    cap = g_frame.cap ? g_frame.cap * 2 : FRAME_INITIAL_SIZE;
+    while (cap < g_frame.len + n)
+        cap *= 2;
+    g_frame.data = realloc(g_frame.data, cap);
+    if (g_frame.data == NULL)
+        die("realloc");
+    g_frame.cap = cap;
+}
+
+/*
+ * Enable or disable synchronized-update markers around each frame
+ *
+ * @param enabled: true if the terminal supports mode 2026
+ */
+void	frame_set_sync(bool enabled)
+{
+    g_frame.sync = enabled;
+}
+
+/*
+ * Send frames somewhere other than the terminal (a headless benchmark
+ * counts them in memory)
+ *
+ * @param output: Called as writev() would be on STDOUT_FILENO, or NULL
+ *                for writev() itself
+ */
+void	frame_set_output(ssize_t (*output)(int fd, const struct iovec *iov, int n))
+{
+    g_frame.output = (output != NULL) ? output : writev;
+}
+
+/*
+ * Append raw bytes to the current frame
+ */
+void	frame_append(const char *s, size_t len)
+{
+    frame_grow(len);
+    memcpy(g_frame.data + g_frame.len, s, len);
+    g_frame.len += len;
+}
+
+/*
+ * Append printf-style formatted text to the current frame
+ */
+void	frame_appendf(const char *fmt, ...)
+{
+    va_list	ap;
+    int		len;
+
+    frame_grow(64);
+    va_start(ap, fmt);
+    len = vsnprintf(g_frame.data + g_frame.len, g_frame.cap - g_frame.len, fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return ;
+    if ((size_t)len >= g_frame.cap - g_frame.len)
+    {
+        frame_grow(len + 1);
+        va_start(ap, fmt);
+        vsnprintf(g_frame.data + g_frame.len, g_frame.cap - g_frame.len, fmt, ap);
+        va_end(ap);
+    }
+    g_frame.len += len;
+}
+
+/*
+ * Get space for up to n bytes written directly into the frame
+ * Call frame_commit() with the number of bytes actually used
+ *
+ * @return: Pointer to at least n writable bytes
+ */
+char	*frame_reserve(size_t n)
+{
+    frame_grow(n);
+    return (g_frame.data + g_frame.len);
+}
+
+/*
+ * Keep n bytes written after frame_reserve()
+ */
+void	frame_commit(size_t n)
+{
+    g_frame.len += n;
+}
+
+/*
+ * Bytes composed so far in the current frame
+ */
+size_t	frame_length(void)
+{
+    return (g_frame.len);
+}
+
+/*
+ * Send the composed frame to the terminal and start a new one
+ * One writev() per frame; it only loops if the terminal accepts a partial write
+ */
+void	frame_flush(void)
+{
+    struct iovec	iov[3];
+    int				n;
+    int				first;
+    ssize_t			written;
+
+    if (g_frame.len == 0)
+        return ;
+    n = 0;
+    if (g_frame.sync)
+        iov[n++] = (struct iovec){SYNC_BEGIN, sizeof(SYNC_BEGIN) - 1};
+    iov[n++] = (struct iovec){g_frame.data, g_frame.len};
+    if (g_frame.sync)
+        iov[n++] = (struct iovec){SYNC_END, sizeof(SYNC_END) - 1};
+    first = 0;
+    while (first < n)
+    {
+        written = g_frame.output(STDOUT_FILENO, iov + first, n - first);
+        STATS_ADD(STAT_TERM_WRITES, 1);
+        if (written < 0 && errno == EINTR)
+            continue ;
+        if (written < 0)
+            break ;
+        STATS_ADD(STAT_TERM_BYTES, written);
+        // Skip whatever the terminal already took
+        while (first < n && (size_t)written >= iov[first].iov_len)
+            written -= iov[first++].iov_len;
+        if (first < n)
+        {
+            iov[first].iov_base = (char *)iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
+    }
+    g_frame.len = 0;
+}
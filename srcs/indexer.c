@@ -0,0 +1,241 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Background Line Indexer
+ * After the first screen has been indexed, a worker thread scans the rest
+ * of the memory-mapped file with the vectorized newline scanner. It never
+ * touches the piece table: each finished chunk of newline offsets is put
+ * on a queue and the event loop is woken (loop_wake), so the main loop
+ * applies queued chunks between keystrokes.
+ * The line count and "go to line" therefore grow while the user keeps
+ * typing, and nothing blocks on the scan.
+ */
+
+/*
+ * Scan one chunk of the file into a freshly allocated chunk record
+ * Works in SCAN_BLOCK pieces so each block is counted, scanned and checked
+ * for UTF-8 while it is still in cache
+ *
+ * @param data: Start of the mapped file
+ * @param size: Size of the file (a character may run past the chunk)
+ * @param from: First offset to scan
+ * @param to: Offset where the chunk ends
+ * @return: Chunk holding the newline offsets found
+ */
+static t_index_chunk	*scan_chunk(const char *data, size_t size, size_t from, size_t to)
+{
+    t_index_chunk	*chunk;
+    size_t			*grown;
+    size_t			block;
+    size_t			n;
+    size_t			cap;
+    bool			ascii;
+
+    chunk = calloc(1, sizeof(*chunk));
+    if (chunk == NULL)
+        return (NULL);
+    chunk->end = to;
+    chunk->bad_utf8 = SIZE_MAX;
+    ascii = true;
+    cap = 0;
+    while (from < to)
+    {
+        block = (to - from < SCAN_BLOCK) ? to - from : SCAN_BLOCK;
+        n = newline_count(data + from, block);
+        if (chunk->count + n > cap)
+        {
+            cap = (chunk->count + n) * 2;
+            grown = realloc(chunk->nl, cap * sizeof(*chunk->nl));
+            if (grown == NULL)
+            {
+                free(chunk->nl);
+                free(chunk);
+                return (NULL);
+            }
+            chunk->nl = grown;
+        }
+        chunk->count += newline_scan(data + from, block, from, chunk->nl + chunk->count);
+        // After the first error only the first one matters (and it was not ASCII)
+        if (chunk->bad_utf8 == SIZE_MAX)
+            chunk->bad_utf8 = utf8_validate_range(data, size, from, from + block, &ascii);
+        from += block;
+    }
+    chunk->non_ascii = !ascii;
+    return (chunk);
+}
+
+/*
+ * Worker thread body: scan the file chunk by chunk and publish results
+ */
+static void	*indexer_main(void *arg)
+{
+    t_indexer		*ix;
+    t_index_chunk	*chunk;
+    size_t			pos;
+    size_t			end;
+    size_t			page;
+
+    ix = arg;
+    pos = ix->from;
+    page = sysconf(_SC_PAGESIZE);
+    while (pos < ix->size)
+    {
+        pthread_mutex_lock(&ix->lock);
+        if (ix->stop)
+        {
+            pthread_mutex_unlock(&ix->lock);
+            break ;
+        }
+        pthread_mutex_unlock(&ix->lock);
+        end = (ix->size - pos < INDEX_CHUNK) ? ix->size : pos + INDEX_CHUNK;
+        chunk = scan_chunk(ix->data, ix->size, pos, end);
+        if (chunk == NULL)
+            break ;
+        // The scanned pages are not needed again until they are displayed
+        madvise((char *)ix->data + pos / page * page, end - pos / page * page,
+            MADV_DONTNEED);
+        pthread_mutex_lock(&ix->lock);
+        if (ix->tail)
+            ix->tail->next = chunk;
+        else
+            ix->head = chunk;
+        ix->tail = chunk;
+        pthread_cond_signal(&ix->ready);
+        pthread_mutex_unlock(&ix->lock);
+        loop_wake();
+        pos = end;
+    }
+    pthread_mutex_lock(&ix->lock);
+    ix->done = true;
+    pthread_cond_signal(&ix->ready);
+    pthread_mutex_unlock(&ix->lock);
+    loop_wake();
+    return (NULL);
+}
+
+/*
+ * Start indexing the unscanned part of buf's file in the background
+ * If the thread cannot be created the buffer keeps indexing in idle steps
+ *
+ * @param buf: Buffer whose original file should be indexed
+ */
+void	indexer_start(t_buffer *buf)
+{
+    t_indexer	*ix;
+
+    if (buf->indexer != NULL || buffer_fully_indexed(buf))
+        return ;
+    ix = calloc(1, sizeof(*ix));
+    if (ix == NULL)
+        return ;
+    ix->data = buf->original->data;
+    ix->from = buf->indexed;
+    ix->size = buf->original->size;
+    pthread_mutex_init(&ix->lock, NULL);
+    pthread_cond_init(&ix->ready, NULL);
+    if (pthread_create(&ix->thread, NULL, indexer_main, ix) != 0)
+    {
+        pthread_mutex_destroy(&ix->lock);
+        pthread_cond_destroy(&ix->ready);
+        free(ix);
+        return ;
+    }
+    buf->indexer = ix;
+}
+
+/*
+ * Free the indexer once its thread has been joined
+ */
+static void	indexer_destroy(t_buffer *buf)
+{
+    t_indexer		*ix;
+    t_index_chunk	*chunk;
+
+    ix = buf->indexer;
+    pthread_join(ix->thread, NULL);
+    while (ix->head != NULL)
+    {
+        chunk = ix->head;
+        ix->head = chunk->next;
+        free(chunk->nl);
+        free(chunk);
+    }
+    pthread_mutex_destroy(&ix->lock);
+    pthread_cond_destroy(&ix->ready);
+    free(ix);
+    buf->indexer = NULL;
+}
+
+/*
+ * Apply every chunk the worker has published so far
+ * Once the worker has finished, its thread is joined and the indexer freed
+ *
+ * @param buf: Buffer being indexed
+ * @param wait: Block until at least one chunk is available (or the worker ends)
+ */
+static void	indexer_drain(t_buffer *buf, bool wait)
+{
+    t_indexer		*ix;
+    t_index_chunk	*list;
+    t_index_chunk	*chunk;
+    bool			done;
+
+    ix = buf->indexer;
+    pthread_mutex_lock(&ix->lock);
+    while (wait && ix->head == NULL && !ix->done)
+        pthread_cond_wait(&ix->ready, &ix->lock);
+    list = ix->head;
+    ix->head = NULL;
+    ix->tail = NULL;
+    done = ix->done;
+    pthread_mutex_unlock(&ix->lock);
+    while (list != NULL)
+    {
+        chunk = list;
+        list = chunk->next;
+        buffer_append_index(buf, chunk);
+        free(chunk->nl);
+        free(chunk);
+    }
+    // A worker that gave up early (out of memory) leaves the rest to idle steps
+    if (done)
+        indexer_destroy(buf);
+}
+
+/*
+ * Non-blocking: pick up whatever the worker has finished
+ *
+ * @return: true if new lines became available
+ */
+bool	indexer_poll(t_buffer *buf)
+{
+    size_t	before;
+
+    if (buf->indexer == NULL)
+        return (false);
+    before = buf->indexed;
+    indexer_drain(buf, false);
+    return (buf->indexed != before || buf->indexer == NULL);
+}
+
+/*
+ * Block until the worker publishes its next chunk, then apply it
+ */
+void	indexer_wait(t_buffer *buf)
+{
+    if (buf->indexer != NULL)
+        indexer_drain(buf, true);
+}
+
+/*
+ * Stop the worker and discard anything it had not published
+ */
+void	indexer_stop(t_buffer *buf)
+{
+    if (buf->indexer == NULL)
+        return ;
+    pthread_mutex_lock(&buf->indexer->lock);
+    buf->indexer->stop = true;
+    pthread_mutex_unlock(&buf->indexer->lock);
+    indexer_destroy(buf);
+}
@@ -7,271 +7,1392 @@
  * input mode (typing) and command mode (vim-like commands).
  */
 
+// Line requested by ":N" that the indexer has not reached yet (0 = none)
+static size_t	pending_goto = 0;
+// ":N%" waiting for the whole file to be indexed (SIZE_MAX = none)
+static size_t	pending_percent = SIZE_MAX;
+
+// Viewport the screen model was last composed for (see draw_text_buffer)
+static int		drawn_scroll_x = -1;
+static int		drawn_scroll_y = -1;
+static int		drawn_scroll_row = 0;
+static int		drawn_gutter = 0;
+static size_t	drawn_lines = 0;
+static size_t	drawn_indexed = 0; // Bytes of the file indexed (the last line may have grown)
+
+// Search match shown highlighted (line SIZE_MAX = none)
+static size_t	match_line = SIZE_MAX;
+static size_t	match_col = 0;
+static size_t	match_len = 0;
+
+// Global variables for command mode
+char	command_buffer[128] = {0}; // Buffer to store typed command
+int		command_length = 0;       // Current length of command
+
+// Search typed after "/" or "?": the cursor goes back here if it is cancelled
+static bool		searching = false;
+static bool		search_wrapped = false; // The match shown lies past the end of the text
+static t_cursor	search_saved;
+
 /*
- * Read a single keypress from stdin and decode special keys
- * Handles escape sequences for arrow keys and returns custom codes
- * 
- * @return: Integer representing the key pressed (ASCII or custom code)
+ * Idle-time indexing step, used when no indexer thread is running
+ * Scans one INDEX_IDLE_STEP and re-arms itself as a zero-delay timer, so
+ * the event loop handles any pending key between two steps
+ */
+static void	index_step(void *arg)
+{
+    bool	*armed;
+
+    armed = arg;
+    *armed = false;
+    if (g_buffer.indexer != NULL || buffer_fully_indexed(&g_buffer))
+        return ;
+    buffer_index_more(&g_buffer, INDEX_IDLE_STEP);
+    if (!buffer_fully_indexed(&g_buffer))
+        *armed = loop_timer_add(0, index_step, armed) >= 0;
+}
+
+/*
+ * Pick up background indexing progress
+ * Normally this just applies chunks published by the indexer thread; if no
+ * thread is running the file is scanned in idle steps instead (index_step).
+ * Progress made elsewhere (e.g. while drawing the viewport) is reported too,
+ * and so are lines taken in from a followed file.
+ *
+ * @return: true if more lines became available since the last report
  */
-int	read_key(void)
+bool	index_progress(void)
 {
-    char	c;      // Current character read
-    char	seq[2]; // Buffer for escape sequence characters
+    static size_t	reported = 0;     // Indexed size at the last report
+    static bool		step_armed = false;
 
-    // Wait for a character to be available (blocking read)
-    while (read(STDIN_FILENO, &c, 1) != 1)
-        ;
+    if (g_buffer.indexer != NULL)
+        indexer_poll(&g_buffer);
+    if (g_buffer.indexer == NULL && !buffer_fully_indexed(&g_buffer) && !step_armed)
+        step_armed = loop_timer_add(0, index_step, &step_armed) >= 0;
+    if (g_buffer.indexed == reported && !follow_pending())
+        return (false);
+    reported = g_buffer.indexed;
+    return (true);
+}
 
-    // Handle escape sequences (arrow keys, function keys, etc.)
-    if (c == '\x1b')  // ESC character starts an escape sequence
+/*
+ * Bytes of a line from a document offset on (a whole character unless the
+ * line ends first, even where it straddles two pieces)
+ *
+ * @param tmp: Room for a character copied out of the buffer
+ * @param avail: Receives the number of bytes
+ */
+static const char	*line_bytes(size_t pos, size_t end, char *tmp, size_t *avail)
+{
+    const char	*chunk;
+    size_t		len;
+
+    len = buffer_chunk(&g_buffer, pos, &chunk);
+    if (len > end - pos)
+        len = end - pos;
+    if (len >= 4 || len == end - pos)
     {
-        // Try to read the next character of the sequence
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return ('\x1b');  // Just ESC if no more chars
+        *avail = len;
+        return (chunk);
+    }
+    *avail = buffer_read(&g_buffer, pos, tmp, (end - pos < 4) ? end - pos : 4);
+    return (tmp);
+}
 
-        // Try to read the third character
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return ('\x1b');  // Just ESC if incomplete sequence
+/*
+ * Render the visible part of a line as UTF-8 text for screen_put()
+ * Tabs are expanded to spaces, and a tab or wide character cut by the left
+ * edge leaves blanks; marks stay with the character they belong to.
+ * Control characters and invalid bytes are passed on (screen_put() shows
+ * them as '?')
+ *
+ * @param line: 0-based line number
+ * @param start_col: First display column to render (horizontal scroll)
+ * @param out: Destination for at most cap bytes
+ * @param attrs: Receives the attribute of each byte (syntax colors)
+ * @param width: Number of display columns available
+ * @param cap: Size of out (width * CELL_BYTES or more)
+ * @return: Number of bytes written to out
+ */
+static int	render_line(size_t line, int start_col, char *out, uint8_t *attrs,
+    int width, int cap)
+{
+    const t_hl_span	*spans;
+    size_t			n_spans;
+    size_t			span;
+    size_t			pos;
+    size_t			start;
+    size_t			end;
+    size_t			avail;
+    size_t			at;
+    size_t			len;
+    const char		*p;
+    char			tmp[4];
+    uint32_t		cp;
+    uint32_t		prev;
+    uint8_t			attr;
+    bool			shown;
+    int				col;
+    int				n;
+    int				w;
 
-        // Parse arrow key sequences: ESC [ A/B/C/D
-        if (seq[0] == '[')
+    n = 0;
+    span = 0;
+    attr = ATTR_NORMAL;
+    prev = 0;
+    shown = true;
+    n_spans = syntax_spans(line, &spans);
+    start = buffer_line_start(&g_buffer, line);
+    end = start + buffer_line_length(&g_buffer, line);
+    pos = start + columns_byte(line, start_col, &at);
+    col = (int)at;
+    while (pos < end && col < start_col + width && n + TAB_STOP + 4 <= cap)
+    {
+        p = line_bytes(pos, end, tmp, &avail);
+        len = utf8_decode(p, avail, &cp);
+        if (pos > start && utf8_extends(prev, cp))
+        {
+            // A mark: goes out with its character, in the same color
+            if (shown)
+            {
+                memcpy(out + n, p, len);
+                memset(attrs + n, attr, len);
+                n += (int)len;
+            }
+            prev = cp;
+            pos += len;
+            continue ;
+        }
+        while (span < n_spans && spans[span].end <= pos - start)
+            span++;
+        attr = (span < n_spans) ? spans[span].attr : ATTR_NORMAL;
+        if (cp == '\t')
+            w = TAB_STOP - col % TAB_STOP;
+        else
+            w = (utf8_printable(cp) && utf8_width(cp) > 0) ? utf8_width(cp) : 1;
+        shown = (col >= start_col && cp != '\t');
+        if (!shown)
         {
-            switch (seq[1])
+            // A tab, or a character only partly visible: blank columns
+            for (int k = (col < start_col ? start_col : col); k < col + w; k++)
             {
-            case 'A':
-                return (ARROW_UP);     // ESC[A = Up arrow
-            case 'B':
-                return (ARROW_DOWN);   // ESC[B = Down arrow
-            case 'C':
-                return (ARROW_RIGHT);  // ESC[C = Right arrow
-            case 'D':
-                return (ARROW_LEFT);   // ESC[D = Left arrow
+                attrs[n] = attr;
+                out[n++] = ' ';
             }
         }
-        return ('\x1b');  // Unknown escape sequence, return ESC
+        else
+        {
+            memcpy(out + n, p, len);
+            memset(attrs + n, attr, len);
+            n += (int)len;
+        }
+        prev = cp;
+        pos += len;
+        col += w;
+    }
+    return (n);
+}
+
+/*
+ * Width of the line-number gutter: the largest line number plus a space,
+ * never narrower than the classic four digits
+ *
+ * @return: Number of screen columns before the text starts
+ */
+int	gutter_width(void)
+{
+    size_t	count;
+    int		digits;
+
+    count = buffer_line_count(&g_buffer);
+    digits = 1;
+    while (count >= 10)
+    {
+        count /= 10;
+        digits++;
     }
-    return ((int)c);  // Regular character
+    return ((digits < 4 ? 4 : digits) + 1);
+}
+
+/*
+ * Highlight the search match on a composed row
+ *
+ * @param y: Screen row showing match_line
+ * @param gutter: Width of the line numbers
+ * @param scroll_x: First display column shown
+ */
+static void	draw_match(int y, int gutter, int scroll_x)
+{
+    int	from;
+    int	to;
+
+    from = (int)columns_col(match_line, match_col) - scroll_x;
+    to = (int)columns_col(match_line, match_col + match_len) - scroll_x;
+    if (from < 0)
+        from = 0;
+    if (to > from)
+        screen_set_attr(y, gutter + from, to - from, ATTR_MATCH);
+}
+
+/*
+ * Screen row where a line starts, in the view whose top is row top_row of
+ * line top: negative above it, visible_rows or more below it
+ */
+static int	view_row(size_t top, size_t top_row, size_t line)
+{
+    int		visible_rows;
+    long	y;
+
+    visible_rows = g_window_rows - 1;
+    if (!wrap_enabled())
+        y = (long)line - (long)top;
+    else
+        y = wrap_distance(top, top_row, line, 0, visible_rows);
+    if (y > visible_rows)
+        return (visible_rows);
+    return ((y < -1) ? -1 : (int)y);
 }
 
 /*
  * Render the text buffer with line numbers and scrolling
- * This is the main display function that draws all visible text
+ * This is the main display function that draws all visible text.
+ * Only rows marked dirty are composed into the screen model; screen_flush()
+ * then sends the cells that differ from what the terminal already shows.
+ * Vertical scrolling shifts the rows already on screen; a horizontal scroll
+ * or a change of gutter width dirties every row. With soft wrap a line
+ * takes wrap_rows() rows, its number shown on the first one.
  * 
  * @param cursor: Current cursor position and scroll offsets
  */
 void	draw_text_buffer(t_cursor *cursor)
 {
-    int		buffer_row;        // Which row in text_buffer we're drawing
-    char	move_cursor_str[20]; // ANSI escape sequence buffer
-    int		len;              // Length of escape sequence
-    int		start_col;        // Starting column for text display
+    static char		*text = NULL;   // One rendered row (grows with the window)
+    static uint8_t	*attrs = NULL;  // Attribute of each byte of the row
+    static int		text_cap = 0;
+    char			number[24];     // Line number column
+    size_t			buffer_row;     // Which line of the buffer we're drawing
+    size_t			count;          // Lines in the buffer
+    size_t			from;           // Lines whose highlighting changed
+    size_t			to;
+    size_t			sub;            // Row of the line being drawn (soft wrap)
+    size_t			row_col;        // Display column where that row starts
+    long			shift;          // Rows the view moved by
+    bool			wrapped;        // Soft wrap on
+    int				gutter;         // Width of the line numbers
+    int				left;           // Display column at the left edge of the text
+    int				n;              // Bytes rendered for the row
+    int				run;            // Start of a run of one attribute
+    int				col;            // Columns of the row filled so far
 
     int visible_rows = g_window_rows - 1; // Reserve bottom row for commands
 
-    // Draw each visible row
-    for (int y = 0; y < visible_rows; y++)
+    // Make sure what is on screen has been indexed (a long line only as far as it shows)
+    buffer_ensure_view(&g_buffer, cursor->scroll_y, visible_rows, cursor->scroll_x + g_window_cols);
+    count = buffer_line_count(&g_buffer);
+    gutter = gutter_width();
+    int text_cols = g_window_cols - gutter; // Account for line numbers
+    if (text_cols * CELL_BYTES > text_cap)
     {
-        buffer_row = y + cursor->scroll_y;  // Account for vertical scrolling
-        char line_num_str[32]; // Buffer for line number with color codes
+        text_cap = text_cols * CELL_BYTES;
+        text = realloc(text, text_cap);
+        attrs = realloc(attrs, text_cap);
+        if (text == NULL || attrs == NULL)
+            die("realloc");
+    }
 
-        // Move cursor to beginning of current line
-        len = sprintf(move_cursor_str, "\x1b[%d;1H", y + 1);
-        write(STDOUT_FILENO, move_cursor_str, len);
+    // Work out which rows can no longer be trusted
+    wrapped = wrap_enabled();
+    if (cursor->scroll_x != drawn_scroll_x || gutter != drawn_gutter)
+        screen_invalidate_rows(0, visible_rows);
+    else if (cursor->scroll_y != drawn_scroll_y || cursor->scroll_row != drawn_scroll_row)
+    {
+        // Reuse the rows still on screen; only the exposed ones are drawn
+        if (wrapped)
+            shift = wrap_distance(drawn_scroll_y, drawn_scroll_row, cursor->scroll_y,
+                cursor->scroll_row, visible_rows);
+        else
+            shift = cursor->scroll_y - drawn_scroll_y;
+        if (shift > visible_rows || shift < -visible_rows)
+            shift = visible_rows;
+        screen_scroll(0, visible_rows, (int)shift);
+    }
+    if (count != drawn_lines || g_buffer.indexed != drawn_indexed)
+    {
+        from = (count < drawn_lines) ? count : drawn_lines;
+        screen_invalidate_rows(view_row(cursor->scroll_y, cursor->scroll_row,
+            (from > 0) ? from - 1 : 0), visible_rows);
+    }
+    drawn_scroll_x = cursor->scroll_x;
+    drawn_scroll_y = cursor->scroll_y;
+    drawn_scroll_row = cursor->scroll_row;
+    drawn_gutter = gutter;
+    drawn_lines = count;
+    drawn_indexed = g_buffer.indexed;
 
-        // Print line number with grey color
-        if (buffer_row < MAX_ROWS)
+    // Lines further down can change colors when an edit opens or closes a comment
+    if (syntax_update(cursor->scroll_y, cursor->scroll_y + visible_rows - 1, &from, &to))
+        screen_invalidate_rows(view_row(cursor->scroll_y, cursor->scroll_row, from),
+            view_row(cursor->scroll_y, cursor->scroll_row, to));
+
+    // Compose each dirty row
+    buffer_row = cursor->scroll_y;
+    sub = cursor->scroll_row;
+    for (int y = 0; y < visible_rows; y++, sub++)
+    {
+        // Account for vertical scrolling: the next line starts when this one is shown
+        if (y > 0 && buffer_row < count && sub >= (wrapped ? wrap_rows(buffer_row) : 1))
         {
-            // \x1b[90m = bright black (grey), \x1b[0m = reset color
-            len = sprintf(line_num_str, "\x1b[90m%4d \x1b[0m", buffer_row + 1);
-            write(STDOUT_FILENO, line_num_str, len);
+            buffer_row++;
+            sub = 0;
         }
-        else
+        if (!screen_row_dirty(y))
+            continue ;
+        if (buffer_row >= count)
         {
-            // Beyond buffer - show grey empty space
-            write(STDOUT_FILENO, "\x1b[90m     \x1b[0m", 11);
+            // Beyond buffer - empty row
+            screen_clear_to_eol(y, 0);
+            continue ;
         }
-
-        // Print text content (normal color)
-        if (buffer_row < MAX_ROWS)
+        // Line number in grey (right-aligned), then the visible portion of the line
+        memset(number, ' ', sizeof(number));
+        n = gutter - 1;
+        for (size_t v = buffer_row + 1; v > 0 && n > 0 && sub == 0; v /= 10)
+            number[--n] = '0' + v % 10;
+        screen_put(y, 0, number, gutter, ATTR_GUTTER);
+        left = cursor->scroll_x;
+        if (wrapped)
+        {
+            wrap_row_start(buffer_row, sub, &row_col);
+            left = (int)row_col;
+        }
+        n = (text_cols > 0) ? render_line(buffer_row, left, text, attrs,
+            text_cols, text_cap) : 0;
+        col = 0;
+        for (int x = 0; x < n; x = run)
         {
-            start_col = cursor->scroll_x;  // Account for horizontal scrolling
-            int chars_to_write = g_window_cols - 5; // Account for line numbers (5 chars)
+            for (run = x + 1; run < n && attrs[run] == attrs[x]; run++)
+                ;
+            col += screen_put(y, gutter + col, text + x, run - x, attrs[x]);
+        }
+        // Blank the rest of the row to prevent artifacts
+        screen_clear_to_eol(y, gutter + col);
+        if (buffer_row == match_line)
+            draw_match(y, gutter, left);
+    }
+}
+
+/*
+ * Mark the screen rows showing lines [from, to) as changed
+ * Rows are those of the viewport the model was last composed for: several
+ * keys may be handled before the next frame, and the view may scroll in
+ * between (draw_text_buffer then shifts the damage along with the rows)
+ *
+ * @param from: First changed line (0-based)
+ * @param to: End of the changed lines, or SIZE_MAX for "through the end"
+ */
+static void	mark_lines_dirty(size_t from, size_t to)
+{
+    size_t	top;
 
-            // Don't write beyond buffer bounds
-            if (start_col + chars_to_write > MAX_COLS)
-                chars_to_write = MAX_COLS - start_col;
+    if (drawn_scroll_y < 0)
+        return ; // Nothing composed yet: every row is dirty anyway
+    if (wrap_enabled())
+    {
+        screen_invalidate_rows(view_row(drawn_scroll_y, drawn_scroll_row, from),
+            (to == SIZE_MAX) ? g_window_rows : view_row(drawn_scroll_y, drawn_scroll_row, to));
+        return ;
+    }
+    top = drawn_scroll_y;
+    if (to <= top)
+        return ;
+    if (to - top > (size_t)g_window_rows)
+        to = top + g_window_rows;
+    if (from < top)
+        from = top;
+    screen_invalidate_rows((int)(from - top), (int)(to - top));
+}
 
-            // Write the visible portion of this line
-            if (chars_to_write > 0 && start_col < MAX_COLS)
-                write(STDOUT_FILENO, &text_buffer[buffer_row][start_col], chars_to_write);
-        }
+/*
+ * Mark the part of a line's row from a display column onward as changed
+ * Everything right of an edit shifts, so the span runs to the right edge
+ * (coordinates as in mark_lines_dirty); with soft wrap it also flows into
+ * the rows below, and the line may take more or fewer of them, so every
+ * row after it is redrawn
+ *
+ * @param line: Edited line (0-based)
+ * @param col: Display column (0-based) where the change starts
+ */
+static void	mark_span_dirty(size_t line, int col)
+{
+    size_t	sub;
+    size_t	left;
+    long	y;
+    int		x;
+
+    if (drawn_scroll_y < 0 || line < (size_t)drawn_scroll_y)
+        return ;
+    if (wrap_enabled())
+    {
+        sub = wrap_sub(line, col);
+        y = wrap_distance(drawn_scroll_y, drawn_scroll_row, line, sub, g_window_rows);
+        if (y >= g_window_rows)
+            return ;
+        wrap_row_start(line, sub, &left);
+        if (y >= 0)
+            screen_invalidate_span((int)y, gutter_width() + col - (int)left, g_window_cols);
+        screen_invalidate_rows((y < 0) ? 0 : (int)y + 1, g_window_rows - 1);
+        return ;
+    }
+    x = col - drawn_scroll_x;
+    screen_invalidate_span((int)(line - drawn_scroll_y),
+        gutter_width() + (x < 0 ? 0 : x), g_window_cols);
+}
+
+/*
+ * Length of the line the cursor is on
+ */
+static int	cursor_line_length(t_cursor *cursor)
+{
+    return ((int)buffer_line_length(&g_buffer, cursor->cy - 1));
+}
+
+/*
+ * Byte offset of the cursor inside the buffer
+ */
+static size_t	cursor_offset(t_cursor *cursor)
+{
+    return (buffer_offset(&g_buffer, cursor->cy - 1, cursor->cx - 1));
+}
+
+/*
+ * Insert text into the document and record it for undo
+ *
+ * @param pos: Byte offset of the insertion
+ * @param text: Bytes to insert
+ * @param len: Number of bytes
+ * @param typed: Part of a run of typing (joins the previous undo step)
+ */
+static void	edit_insert(size_t pos, const char *text, size_t len, bool typed)
+{
+    size_t	line;
+    size_t	added;
+
+    line = buffer_line_at(&g_buffer, pos);
+    added = newline_count(text, len);
+    syntax_edit(line, 0, added);
+    columns_edit(line, pos - buffer_line_start(&g_buffer, line), 0, added);
+    wrap_edit(line, pos - buffer_line_start(&g_buffer, line), 0, added);
+    buffer_insert(&g_buffer, pos, text, len);
+    undo_record_insert(&g_undo, pos, text, len, typed);
+    matches_cancel(); // Match offsets counted so far no longer apply
+}
+
+/*
+ * Delete bytes from the document, recording them for undo first
+ *
+ * @param pos: Byte offset of the first deleted byte
+ * @param len: Number of bytes
+ * @param typed: Backspace/Delete key (joins a run of deletions)
+ */
+static void	edit_delete(size_t pos, size_t len, bool typed)
+{
+    size_t	line;
+
+    if (pos >= buffer_size(&g_buffer))
+        return ;
+    if (len > buffer_size(&g_buffer) - pos)
+        len = buffer_size(&g_buffer) - pos;
+    line = buffer_line_at(&g_buffer, pos);
+    syntax_edit(line, buffer_line_at(&g_buffer, pos + len) - line, 0);
+    columns_edit(line, pos - buffer_line_start(&g_buffer, line),
+        buffer_line_at(&g_buffer, pos + len) - line, 0);
+    wrap_edit(line, pos - buffer_line_start(&g_buffer, line),
+        buffer_line_at(&g_buffer, pos + len) - line, 0);
+    undo_record_delete(&g_undo, &g_buffer, pos, len, typed);
+    buffer_delete(&g_buffer, pos, len);
+    matches_cancel();
+}
+
+/*
+ * Replace a span of the document with a block of text in one edit
+ * The block becomes a source of the buffer as it is; the old span is kept
+ * by the undo history as pieces, not copied
+ *
+ * @param pos: Start of the span
+ * @param len: Bytes in the span
+ * @param text: New text, from malloc() (the buffer takes it over)
+ * @param size: Bytes in text
+ */
+static void	edit_replace(size_t pos, size_t len, char *text, size_t size)
+{
+    t_piece	*old;
+    size_t	line;
+
+    line = buffer_line_at(&g_buffer, pos);
+    syntax_invalidate(line);
+    columns_invalidate(line, pos - buffer_line_start(&g_buffer, line));
+    wrap_invalidate(line);
+    old = buffer_splice(&g_buffer, pos, len, buffer_adopt(&g_buffer, text, size));
+    undo_record_replace(&g_undo, pos, size, old);
+    matches_cancel();
+}
+
+/*
+ * Keep the cursor column inside its line after a vertical move
+ */
+static void	clamp_cursor(t_cursor *cursor)
+{
+    if (cursor->cx > cursor_line_length(cursor) + 1)
+        cursor->cx = cursor_line_length(cursor) + 1;
+}
+
+/*
+ * Keep the row the cursor is on inside the view when lines are wrapped
+ * A cursor below the view brings its row to the bottom one
+ *
+ * @param visible_rows: Rows of text on screen
+ */
+static void	scroll_wrapped(t_cursor *cursor, int visible_rows)
+{
+    size_t	line;
+    size_t	sub;
+    long	y;
+    long	left;
+
+    cursor->scroll_x = 0;
+    if (cursor->scroll_row >= (int)wrap_rows(cursor->scroll_y))
+        cursor->scroll_row = (int)wrap_rows(cursor->scroll_y) - 1; // The top line got shorter
+    line = cursor->cy - 1;
+    sub = wrap_sub(line, cursor->rx - 1);
+    y = wrap_distance(cursor->scroll_y, cursor->scroll_row, line, sub, visible_rows);
+    if (y < 0)
+    {
+        cursor->scroll_y = (int)line;
+        cursor->scroll_row = (int)sub;
+    }
+    if (y < visible_rows)
+        return ;
+    // Walk up visible_rows - 1 rows from the cursor's
+    left = visible_rows - 1;
+    while (left > (long)sub && line > 0)
+    {
+        left -= sub + 1;
+        line--;
+        sub = wrap_rows(line) - 1;
+    }
+    cursor->scroll_y = (int)line;
+    cursor->scroll_row = (left > (long)sub) ? 0 : (int)(sub - left);
+}
+
+/*
+ * Adjust scroll offsets so the cursor stays inside the visible area
+ */
+static void	scroll_to_cursor(t_cursor *cursor)
+{
+    int visible_rows = g_window_rows - 1; // Reserve bottom row for commands
+
+    cursor->rx = (int)columns_col(cursor->cy - 1, cursor->cx - 1) + 1;
+    if (wrap_enabled())
+    {
+        scroll_wrapped(cursor, visible_rows);
+        return ;
+    }
+
+    // Scroll up if cursor goes above visible area
+    if (cursor->cy <= cursor->scroll_y)
+        cursor->scroll_y = cursor->cy - 1;
+    // Scroll down if cursor goes below visible area
+    if (cursor->cy > cursor->scroll_y + visible_rows)
+        cursor->scroll_y = cursor->cy - visible_rows;
+    // Scroll left if cursor goes left of visible area
+    if (cursor->rx <= cursor->scroll_x)
+        cursor->scroll_x = cursor->rx - 1;
+    // Scroll right if cursor goes right of visible area (accounting for line numbers)
+    if (cursor->rx > cursor->scroll_x + g_window_cols - gutter_width())
+        cursor->scroll_x = cursor->rx - (g_window_cols - gutter_width());
+    if (cursor->scroll_x < 0)
+        cursor->scroll_x = 0;
+    if (cursor->scroll_y < 0)
+        cursor->scroll_y = 0;
+}
+
+/*
+ * Move the cursor with an arrow key, staying inside the text
+ * Left and right step over whole characters (with their marks); up and
+ * down keep the display column, landing on the character drawn there
+ *
+ * @param c: ARROW_UP/DOWN/LEFT/RIGHT
+ * @param cursor: Cursor position to modify
+ */
+static void	move_cursor_arrow(int c, t_cursor *cursor)
+{
+    size_t	col;
+    size_t	at;
+
+    buffer_ensure_lines(&g_buffer, cursor->cy + 1);
+    col = columns_col(cursor->cy - 1, cursor->cx - 1);
+    if (c == ARROW_UP && cursor->cy > 1)
+        cursor->cy--;
+    else if (c == ARROW_DOWN && cursor->cy < (int)buffer_line_count(&g_buffer))
+        cursor->cy++;
+    else if (c == ARROW_LEFT && cursor->cx > 1)
+        cursor->cx = (int)columns_prev(cursor->cy - 1, cursor->cx - 1) + 1;
+    else if (c == ARROW_RIGHT && cursor->cx <= cursor_line_length(cursor))
+        cursor->cx = (int)columns_next(cursor->cy - 1, cursor->cx - 1) + 1;
+    if (c == ARROW_UP || c == ARROW_DOWN)
+        cursor->cx = (int)columns_byte(cursor->cy - 1, col, &at) + 1;
+    clamp_cursor(cursor);
+}
+
+/*
+ * Whether the byte at a 0-based column of the cursor line is part of a word
+ * (letters, digits, '_' and non-ASCII characters; nothing outside the line is)
+ */
+static bool	is_word_at(t_cursor *cursor, int col)
+{
+    char	ch;
+
+    if (col < 0 || col >= cursor_line_length(cursor))
+        return (false);
+    buffer_read(&g_buffer, buffer_offset(&g_buffer, cursor->cy - 1, col), &ch, 1);
+    return (isalnum((unsigned char)ch) || ch == '_' || (unsigned char)ch >= 0x80);
+}
+
+/*
+ * Move to the start of the next or previous word (Ctrl+Right/Left)
+ * At either end of a line the cursor wraps to the neighbouring line
+ *
+ * @param cursor: Cursor position to modify
+ * @param forward: true for the next word
+ */
+static void	move_cursor_word(t_cursor *cursor, bool forward)
+{
+    int	col;
+    int	len;
+
+    buffer_ensure_lines(&g_buffer, cursor->cy + 1);
+    col = cursor->cx - 1;
+    len = cursor_line_length(cursor);
+    if (forward && col >= len && cursor->cy < (int)buffer_line_count(&g_buffer))
+    {
+        cursor->cy++;
+        cursor->cx = 1;
+        return ;
+    }
+    if (!forward && col == 0 && cursor->cy > 1)
+    {
+        cursor->cy--;
+        cursor->cx = cursor_line_length(cursor) + 1;
+        return ;
+    }
+    if (forward)
+    {
+        // Skip the rest of this word, then the gap before the next one
+        while (col < len && is_word_at(cursor, col))
+            col++;
+        while (col < len && !is_word_at(cursor, col))
+            col++;
+    }
+    else
+    {
+        // Skip the gap before the cursor, then back to the word's start
+        while (col > 0 && !is_word_at(cursor, col - 1))
+            col--;
+        while (col > 0 && is_word_at(cursor, col - 1))
+            col--;
+    }
+    cursor->cx = col + 1;
+}
+
+/*
+ * Move the cursor and the view by a page of wrapped rows
+ * Rows are numbered through the whole document by the soft-wrap map, so
+ * this costs the same anywhere in any file; the cursor keeps its place in
+ * its row
+ *
+ * @param cursor: Cursor position to modify
+ * @param down: true for Page Down
+ * @param rows: Rows in a page
+ */
+static void	move_page_wrapped(t_cursor *cursor, bool down, size_t rows)
+{
+    size_t	top;
+    size_t	at;
+    size_t	sub;
+    size_t	line;
+    size_t	left;
+    size_t	x;
+
+    sub = wrap_sub(cursor->cy - 1, cursor->rx - 1);
+    wrap_row_start(cursor->cy - 1, sub, &x);
+    x = cursor->rx - 1 - x;
+    top = wrap_row_of(cursor->scroll_y) + cursor->scroll_row;
+    at = wrap_row_of(cursor->cy - 1) + sub;
+    if (down)
+    {
+        top += rows;
+        at = (at + rows < wrap_total()) ? at + rows : wrap_total() - 1;
+        if (top > at)
+            top = at;
+    }
+    else
+    {
+        top = (top > rows) ? top - rows : 0;
+        at = (at > rows) ? at - rows : 0;
+    }
+    line = wrap_line_at(at, &sub);
+    cursor->cy = (int)line + 1;
+    wrap_row_start(line, sub, &left);
+    cursor->cx = (int)columns_byte(line, left + x, &x) + 1;
+    line = wrap_line_at(top, &sub);
+    cursor->scroll_y = (int)line;
+    cursor->scroll_row = (int)sub;
+}
+
+/*
+ * Move the cursor by a screen page, scrolling the view with it
+ *
+ * @param cursor: Cursor position to modify
+ * @param down: true for Page Down
+ */
+static void	move_cursor_page(t_cursor *cursor, bool down)
+{
+    int	rows;
+    int	count;
+
+    rows = g_window_rows - 1;
+    if (wrap_enabled())
+    {
+        if (down)
+            buffer_ensure_lines(&g_buffer, cursor->cy + rows + 1);
+        move_page_wrapped(cursor, down, rows);
+        return ;
+    }
+    if (down)
+    {
+        buffer_ensure_lines(&g_buffer, cursor->cy + rows + 1);
+        count = (int)buffer_line_count(&g_buffer);
+        cursor->cy = (cursor->cy + rows < count) ? cursor->cy + rows : count;
+        cursor->scroll_y += rows;
+        if (cursor->scroll_y > cursor->cy - 1)
+            cursor->scroll_y = cursor->cy - 1;
+    }
+    else
+    {
+        cursor->cy = (cursor->cy > rows) ? cursor->cy - rows : 1;
+        cursor->scroll_y = (cursor->scroll_y > rows) ? cursor->scroll_y - rows : 0;
+    }
+    clamp_cursor(cursor);
+}
+
+/*
+ * Jump to a 1-based line number
+ * Lines the background indexer has not reached yet are remembered and the
+ * jump completes in handle_index_update(); meanwhile the cursor goes as far
+ * as is known
+ *
+ * @param cursor: Cursor position to modify
+ * @param line: Target line (1-based)
+ */
+static void	goto_line(t_cursor *cursor, size_t line)
+{
+    size_t	count;
+
+    count = buffer_line_count(&g_buffer);
+    pending_goto = 0;
+    pending_percent = SIZE_MAX;
+    if (line > count && !buffer_fully_indexed(&g_buffer))
+    {
+        pending_goto = line;
+        line = count;
+    }
+    if (line > count)
+        line = count;
+    if (line < 1)
+        line = 1;
+    cursor->cy = (int)line;
+    cursor->cx = 1;
+    scroll_to_cursor(cursor);
+}
+
+/*
+ * Jump to a point a percentage of the way through the document: a line in
+ * proportion to the line count, or with soft wrap a row in proportion to
+ * the rows of the document (a O(log n) lookup in the soft-wrap map)
+ * Until the whole file is indexed the jump waits, to complete in
+ * handle_index_update()
+ *
+ * @param cursor: Cursor position to modify
+ * @param percent: 0 to 100
+ */
+static void	goto_percent(t_cursor *cursor, size_t percent)
+{
+    size_t	line;
+    size_t	sub;
+    size_t	at;
+
+    if (percent > 100)
+        percent = 100;
+    if (!buffer_fully_indexed(&g_buffer))
+    {
+        pending_goto = 0;
+        pending_percent = percent;
+        return ;
+    }
+    if (!wrap_enabled())
+    {
+        goto_line(cursor, (buffer_line_count(&g_buffer) * percent + 99) / 100);
+        return ;
+    }
+    pending_percent = SIZE_MAX;
+    line = wrap_line_at(wrap_total() * percent / 100, &sub);
+    cursor->cy = (int)line + 1;
+    cursor->cx = (int)wrap_row_start(line, sub, &at) + 1;
+    scroll_to_cursor(cursor);
+}
+
+/*
+ * Whether a key moves the cursor (arrows, Home/End, Page Up/Down, any modifiers)
+ */
+static bool	is_navigation_key(int c)
+{
+    return ((c & ~KEY_MODS) >= ARROW_UP && (c & ~KEY_MODS) <= PAGE_DOWN);
+}
 
-        // Clear rest of line to prevent artifacts
-        write(STDOUT_FILENO, "\x1b[K", 3);
+/*
+ * Another tab is shown: nothing drawn or pending belongs to its document
+ *
+ * @param cursor: Cursor, already the new tab's
+ */
+static void	tab_shown(t_cursor *cursor)
+{
+    pending_goto = 0;
+    pending_percent = SIZE_MAX;
+    match_line = SIZE_MAX;
+    drawn_scroll_x = -1; // Nothing on screen can be reused
+    screen_invalidate_rows(0, g_window_rows);
+    scroll_to_cursor(cursor);
+}
+
+/*
+ * Apply a navigation key
+ * Shift and Alt do not change what a key does; Ctrl+Left/Right move by
+ * words, Ctrl+Home/End go to the start or end of the document and
+ * Ctrl+Page Up/Down show the previous or next tab
+ *
+ * @param c: Key code from key_decode() (see is_navigation_key())
+ * @param cursor: Cursor position to modify
+ */
+static void	move_cursor_key(int c, t_cursor *cursor)
+{
+    int	key;
+
+    undo_break(&g_undo); // Typing after a move is a new undo step
+    key = c & ~KEY_MODS;
+    if ((c & KEY_CTRL) && (key == ARROW_LEFT || key == ARROW_RIGHT))
+        move_cursor_word(cursor, key == ARROW_RIGHT);
+    else if (key == ARROW_UP || key == ARROW_DOWN || key == ARROW_LEFT || key == ARROW_RIGHT)
+        move_cursor_arrow(key, cursor);
+    else if ((c & KEY_CTRL) && key == HOME_KEY)
+        goto_line(cursor, 1);
+    else if ((c & KEY_CTRL) && key == END_KEY)
+        goto_line(cursor, SIZE_MAX);  // Completes once the file is indexed
+    else if ((c & KEY_CTRL) && (key == PAGE_UP || key == PAGE_DOWN))
+    {
+        tabs_next((key == PAGE_DOWN) ? 1 : -1, cursor);
+        tab_shown(cursor);
+    }
+    else if (key == HOME_KEY)
+        cursor->cx = 1;
+    else if (key == END_KEY)
+        cursor->cx = cursor_line_length(cursor) + 1;
+    else if (key == PAGE_UP || key == PAGE_DOWN)
+        move_cursor_page(cursor, key == PAGE_DOWN);
+}
+
+/*
+ * Handle the Delete key: remove the character under the cursor, joining
+ * the next line at the end of a line
+ *
+ * @param cursor: Cursor position
+ */
+static void	delete_handle(t_cursor *cursor)
+{
+    size_t	offset;
+    bool	joins;
+
+    buffer_ensure_lines(&g_buffer, cursor->cy + 1);
+    offset = cursor_offset(cursor);
+    if (offset >= buffer_size(&g_buffer))
+        return ;
+    joins = cursor->cx > cursor_line_length(cursor); // Deleting the '\n'
+    if (joins)
+        edit_delete(offset, 1, true);
+    else
+        edit_delete(offset, columns_next(cursor->cy - 1, cursor->cx - 1) - (cursor->cx - 1), true);
+    if (joins)
+        mark_lines_dirty(cursor->cy - 1, SIZE_MAX); // Lines below move up
+    else
+        mark_span_dirty(cursor->cy - 1, cursor->rx - 1);
+}
+
+/*
+ * Insert the text of a bracketed paste at the cursor as one edit
+ * The cursor ends up after the pasted text and the screen is redrawn once
+ *
+ * @param cursor: Cursor position to modify
+ */
+static void	paste_handle(t_cursor *cursor)
+{
+    const char	*text;
+    size_t		len;
+    size_t		lines;
+    size_t		last;
+
+    text = key_paste(&len);
+    if (len == 0)
+        return ;
+    edit_insert(cursor_offset(cursor), text, len, false); // Undone on its own
+    lines = newline_count(text, len);
+    if (lines == 0)
+    {
+        mark_span_dirty(cursor->cy - 1, cursor->rx - 1);
+        cursor->cx += (int)len;
+        return ;
     }
-    fflush(stdout);  // Ensure all output is displayed immediately
+    mark_lines_dirty(cursor->cy - 1, SIZE_MAX);
+    last = len;
+    while (text[last - 1] != '\n')
+        last--;
+    cursor->cy += (int)lines;
+    cursor->cx = (int)(len - last) + 1;
 }
 
 /*
  * Handle backspace key logic
- * Manages cursor movement and character deletion, including line wrapping
+ * Deletes the character before the cursor, joining lines at column 1
  * 
  * @param cursor: Cursor position to modify
  */
 void	backspace_handle(t_cursor *cursor)
 {
+    size_t	offset;
+    size_t	prev;
+
+    offset = cursor_offset(cursor);
     if (cursor->cx > 1)
     {
-        // Not at beginning of line - simply move left and clear character
-        cursor->cx--;
-        text_buffer[cursor->cy - 1][cursor->cx - 1] = ' ';
+        // Not at beginning of line - delete the character to the left
+        prev = columns_prev(cursor->cy - 1, cursor->cx - 1);
+        mark_span_dirty(cursor->cy - 1, (int)columns_col(cursor->cy - 1, prev));
+        edit_delete(offset - (cursor->cx - 1 - prev), cursor->cx - 1 - prev, true);
+        cursor->cx = (int)prev + 1;
     }
     else if (cursor->cy > 1)
     {
-        // At beginning of line - move to end of previous line
+        // At beginning of line - join with the end of the previous line
         cursor->cy--;
+        cursor->cx = cursor_line_length(cursor) + 1;
+        edit_delete(offset - 1, 1, true);
+        // Every line below moves up one row
+        mark_lines_dirty(cursor->cy - 1, SIZE_MAX);
+    }
+    // If at position (1,1), do nothing - can't backspace further
+}
 
-        // Find the end of the previous line (last non-space character + 1)
-        cursor->cx = MAX_COLS;
-        while (cursor->cx > 1 && text_buffer[cursor->cy - 1][cursor->cx - 1] == ' ')
-            cursor->cx--;
+/*
+ * Undo or redo one step and put the cursor where it happened
+ * Steps can touch any part of the document, so the text rows are redrawn
+ *
+ * @param cursor: Cursor position to modify
+ * @param redo: Redo instead of undo
+ */
+static void	undo_handle(t_cursor *cursor, bool redo)
+{
+    size_t	pos;
+    size_t	line;
+    bool	done;
 
-        // Position cursor after the last character
-        if (cursor->cx < MAX_COLS)
-            cursor->cx++;
+    pos = undo_step_start(&g_undo, redo);
+    if (pos != SIZE_MAX)
+    {
+        line = buffer_line_at(&g_buffer, pos);
+        syntax_invalidate(line);
+        columns_invalidate(line, pos - buffer_line_start(&g_buffer, line));
+        wrap_invalidate(line);
     }
-    // If at position (1,1), do nothing - can't backspace further
+    if (redo)
+        done = undo_replay(&g_undo, &g_buffer, &pos);
+    else
+        done = undo_revert(&g_undo, &g_buffer, &pos);
+    if (!done)
+    {
+        set_message(redo ? "Already at newest change" : "Already at oldest change");
+        return ;
+    }
+    matches_cancel();
+    line = buffer_line_at(&g_buffer, pos);
+    cursor->cy = (int)line + 1;
+    cursor->cx = (int)(pos - buffer_line_start(&g_buffer, line)) + 1;
+    screen_invalidate_rows(0, g_window_rows - 1);
+    scroll_to_cursor(cursor);
 }
 
 /*
- * Process keypresses in INPUT mode
- * Handles typing, navigation, and mode switching
- * 
- * @param c: Key code from read_key()
+ * Move the search highlight, redrawing the rows it leaves and enters
+ *
+ * @param pos: Document offset of the match, or SIZE_MAX for none
+ * @param len: Length of the match
+ */
+static void	set_match(size_t pos, size_t len)
+{
+    matches_set_current(SIZE_MAX); // Searches that count their matches set it
+    if (match_line != SIZE_MAX)
+        mark_lines_dirty(match_line, match_line + 1);
+    match_line = SIZE_MAX;
+    if (pos == SIZE_MAX)
+        return ;
+    match_line = buffer_line_at(&g_buffer, pos);
+    match_col = pos - buffer_line_start(&g_buffer, match_line);
+    match_len = len;
+    mark_lines_dirty(match_line, match_line + 1);
+}
+
+/*
+ * Put the cursor on a search match and highlight it
+ * A match in the part of the file not indexed yet is indexed first, so its
+ * line number is known
+ *
  * @param cursor: Cursor position to modify
+ * @param pos: Text offset of the match
+ * @param len: Length of the match
  */
-void	process_keypress(int c, t_cursor *cursor)
+static void	goto_match(t_cursor *cursor, size_t pos, size_t len)
 {
-    int visible_rows = g_window_rows - 1; // Reserve bottom row for commands
+    size_t	line;
 
-    if (c == 4) // Ctrl+D to exit (EOF character)
+    buffer_ensure_size(&g_buffer, pos + len);
+    line = buffer_line_at(&g_buffer, pos);
+    cursor->cy = (int)line + 1;
+    cursor->cx = (int)(pos - buffer_line_start(&g_buffer, line)) + 1;
+    pending_goto = 0;
+    scroll_to_cursor(cursor);
+    set_match(pos, len);
+}
+
+/*
+ * Jump to the next match of the last pattern (Ctrl+N), or the previous one
+ * (Ctrl+P); "?" searches run the other way round
+ *
+ * @param cursor: Cursor position to modify
+ * @param reverse: Go against the direction of the last search
+ */
+static void	search_repeat(t_cursor *cursor, bool reverse)
+{
+    t_pattern	pat;
+    size_t		at;
+    size_t		end;
+    bool		backward;
+    bool		wrapped;
+
+    search_last(&pat, &backward);
+    if (pat.len == 0)
     {
-        reset_screen();
-        disable_raw_mode();
-        exit(0);
+        set_message("No previous search pattern");
+        return ;
     }
-    else if (c == ARROW_UP && cursor->cy > 1)
+    backward ^= reverse;
+    undo_break(&g_undo);
+    at = search_find(&pat, cursor_offset(cursor) + (backward ? 0 : 1), backward, &wrapped,
+        &end);
+    if (at == SIZE_MAX)
     {
-        cursor->cy--;
-        // Scroll up if cursor goes above visible area
-        if (cursor->cy <= cursor->scroll_y)
-        {
-            cursor->scroll_y = cursor->cy - 1;
-            if (cursor->scroll_y < 0)
-                cursor->scroll_y = 0;
-        }
+        set_match(SIZE_MAX, 0);
+        set_message("Pattern not found: %s", pat.text);
+        return ;
     }
-    else if (c == ARROW_DOWN && cursor->cy < MAX_ROWS)
+    if (wrapped)
+        set_message(backward ? "search hit TOP, continuing at BOTTOM"
+            : "search hit BOTTOM, continuing at TOP");
+    goto_match(cursor, at, end - at);
+    matches_start(&pat); // "match k of N" (kept if already counted)
+    matches_set_current(at);
+}
+
+/*
+ * Follow the pattern typed after "/" or "?" on the command line
+ * The cursor moves to the match for what has been typed so far; with no
+ * match (or once the "/" is erased) it goes back to where the search began
+ *
+ * @param cursor: Cursor position to modify
+ */
+static void	search_preview(t_cursor *cursor)
+{
+    size_t	at;
+
+    if (command_buffer[0] != '/' && command_buffer[0] != '?')
     {
-        cursor->cy++;
-        // Scroll down if cursor goes below visible area
-        if (cursor->cy > cursor->scroll_y + visible_rows)
+        if (searching)
         {
-            cursor->scroll_y = cursor->cy - visible_rows;
+            searching = false;
+            *cursor = search_saved;
+            set_match(SIZE_MAX, 0);
         }
+        return ;
     }
-    else if (c == ARROW_LEFT && cursor->cx > 1)
+    if (!searching)
     {
-        cursor->cx--;
-        // Scroll left if cursor goes left of visible area
-        if (cursor->cx <= cursor->scroll_x)
-        {
-            cursor->scroll_x = cursor->cx - 1;
-            if (cursor->scroll_x < 0)
-                cursor->scroll_x = 0;
-        }
+        searching = true;
+        search_saved = *cursor;
+        search_begin(cursor_offset(cursor), command_buffer[0] == '?');
     }
-    else if (c == ARROW_RIGHT && cursor->cx < MAX_COLS)
+    at = search_update(command_buffer + 1, command_length - 1, &search_wrapped);
+    if (at != SIZE_MAX)
     {
-        cursor->cx++;
-        // Scroll right if cursor goes right of visible area (accounting for line numbers)
-        if (cursor->cx > cursor->scroll_x + g_window_cols - 5)
-        {
-            cursor->scroll_x = cursor->cx - (g_window_cols - 5);
-        }
+        goto_match(cursor, at, command_length - 1);
+        return ;
+    }
+    *cursor = search_saved;
+    scroll_to_cursor(cursor);
+    set_match(SIZE_MAX, 0);
+}
+
+/*
+ * Run a "/pattern" or "?pattern" command (Enter on the command line)
+ * An empty pattern repeats the last search in the direction given
+ *
+ * @param cmd: Command text, starting with '/' or '?'
+ * @param cursor: Cursor position to modify
+ */
+static void	search_command(const char *cmd, t_cursor *cursor)
+{
+    t_pattern	last;
+    bool		backward;
+
+    current_mode = MODE_INPUT;
+    if (cmd[1] == '\0' || !searching)
+    {
+        // Repeat the last pattern, or search for one that was not typed
+        // key by key, from where the cursor is
+        if (searching)
+            *cursor = search_saved;
+        searching = false;
+        search_last(&last, &backward);
+        if (cmd[1] != '\0')
+            last = (t_pattern){cmd + 1, strlen(cmd + 1), NULL};
+        search_set_last(last.text, last.len, cmd[0] == '?', last.re);
+        search_repeat(cursor, false);
+        return ;
     }
+    searching = false;
+    search_set_last(cmd + 1, strlen(cmd + 1), cmd[0] == '?', NULL);
+    if (match_line == SIZE_MAX)
+    {
+        set_message("Pattern not found: %s", cmd + 1);
+        return ;
+    }
+    if (search_wrapped)
+        set_message(cmd[0] == '?' ? "search hit TOP, continuing at BOTTOM"
+            : "search hit BOTTOM, continuing at TOP");
+    search_last(&last, &backward);
+    matches_start(&last);
+    matches_set_current(cursor_offset(cursor));
+}
+
+/*
+ * Run a ":re pattern" command: search forward for a regular expression
+ * Repeating it (Ctrl+N, Ctrl+P, an empty "/") uses the expression too
+ *
+ * @param src: The expression
+ * @param cursor: Cursor position to modify
+ */
+static void	regex_command(const char *src, t_cursor *cursor)
+{
+    const char	*error;
+    t_regex		*re;
+
+    current_mode = MODE_INPUT;
+    re = regex_compile(src, &error);
+    if (re == NULL)
+    {
+        set_message("Bad pattern: %s", error);
+        return ;
+    }
+    search_set_last(src, strlen(src), false, re);
+    search_repeat(cursor, false);
+}
+
+/*
+ * Run ":[range]s/pattern/replacement/[flags]" and report what it did
+ * The cursor goes to the last replacement
+ *
+ * @param cmd: The command
+ * @param cursor: Cursor position to modify
+ */
+static void	substitute_command(const char *cmd, t_cursor *cursor)
+{
+    t_substitute	sub;
+    size_t			line;
+
+    current_mode = MODE_INPUT;
+    if (!substitute_parse(cmd, cursor->cy - 1, &sub))
+    {
+        set_message("%s", sub.error);
+        return ;
+    }
+    if (substitute_build(&sub) == 0)
+    {
+        set_message("Pattern not found");
+        return ;
+    }
+    set_message("%zu %s on %zu line%s", sub.count,
+        sub.count_only ? (sub.count == 1 ? "match" : "matches")
+        : (sub.count == 1 ? "substitution" : "substitutions"),
+        sub.lines, sub.lines == 1 ? "" : "s");
+    if (sub.count_only)
+        return ;
+    edit_replace(sub.lo, sub.hi - sub.lo, sub.out, sub.size);
+    set_match(SIZE_MAX, 0);
+    line = buffer_line_at(&g_buffer, sub.last_at);
+    cursor->cy = (int)line + 1;
+    cursor->cx = (int)(sub.last_at - buffer_line_start(&g_buffer, line)) + 1;
+    screen_invalidate_rows(0, g_window_rows - 1);
+    scroll_to_cursor(cursor);
+}
+
+/*
+ * Leave the editor (":q", ":wq", Ctrl+D), unless a tab has unsaved
+ * changes: the tab is named and the editor stays
+ *
+ * @param force: Quit anyway (":q!"), dropping the changes and swap files
+ */
+static void	quit(bool force)
+{
+    size_t	tab;
+
+    save_wait();  // Let a background save finish first
+    tab = tabs_modified();
+    if (!force && tab != SIZE_MAX)
+    {
+        set_message("No write since last change in tab %zu \"%s\" (:q! overrides)",
+            tab + 1, tabs_name(tab));
+        return ;
+    }
+    journal_close_all(false);
+    reset_screen();
+    disable_raw_mode();
+    exit(0);
+}
+
+/*
+ * Process keypresses in INPUT mode
+ * Handles typing, navigation, and mode switching
+ * 
+ * @param c: Key code from key_decode()
+ * @param cursor: Cursor position to modify
+ */
+void	process_keypress(int c, t_cursor *cursor)
+{
+    const char	*text;
+    size_t		len;
+    char		ch;
+
+    if (match_line != SIZE_MAX && c != 14 && c != 16)
+        set_match(SIZE_MAX, 0); // The highlight lasts until the next key
+    if (c == 4) // Ctrl+D to exit (EOF character)
+        quit(false);
+    else if (is_navigation_key(c)) // Arrows, Home/End, Page Up/Down
+        move_cursor_key(c, cursor);
     else if (c == 127) // Backspace key (DEL character)
         backspace_handle(cursor);
-    else if (c == '\r' || c == '\n') // Enter key - new line
+    else if ((c & ~KEY_MODS) == DEL_KEY) // Delete key - character under the cursor
+        delete_handle(cursor);
+    else if (c == PASTE) // Bracketed paste - one insert, one redraw
+        paste_handle(cursor);
+    else if (c == 21 || c == 18) // Ctrl+U undo, Ctrl+R redo
+        undo_handle(cursor, c == 18);
+    else if (c == 14 || c == 16) // Ctrl+N next match, Ctrl+P previous match
+        search_repeat(cursor, c == 16);
+    else if (c == '\r' || c == '\n') // Enter key - split the line
     {
+        edit_insert(cursor_offset(cursor), "\n", 1, true);
+        mark_lines_dirty(cursor->cy - 1, SIZE_MAX); // Lines below move down
         cursor->cx = 1;  // Move to beginning of line
-        if (cursor->cy < MAX_ROWS)
-            cursor->cy++;  // Move to next line
+        cursor->cy++;    // Move to next line
     }
     else if (c >= 32 && c <= 126) // Printable ASCII characters
     {
         // Insert character at cursor position
-        text_buffer[cursor->cy - 1][cursor->cx - 1] = (char)c;
+        ch = (char)c;
+        edit_insert(cursor_offset(cursor), &ch, 1, true);
+        mark_span_dirty(cursor->cy - 1, cursor->rx - 1);
         cursor->cx++;
-
-        // Handle line wrapping
-        if (cursor->cx > MAX_COLS)
-        {
-            cursor->cx = 1;    // Wrap to beginning of next line
-            cursor->cy++;
-            if (cursor->cy > MAX_ROWS)
-                cursor->cy = MAX_ROWS;  // Don't go beyond buffer
-        }
+    }
+    else if (c == UTF8_KEY) // Any other character, as UTF-8
+    {
+        text = key_text(&len);
+        edit_insert(cursor_offset(cursor), text, len, true);
+        mark_span_dirty(cursor->cy - 1, cursor->rx - 1);
+        cursor->cx += (int)len;
     }
     else if (c == 27) // ESC key - enter command mode
     {
+        undo_break(&g_undo);
         current_mode = MODE_COMMAND;
         set_cursor_bottom();     // Move to bottom for command entry
         print_command_prompt();  // Show ":" prompt
     }
+    scroll_to_cursor(cursor);
 }
 
 /*
  * Refresh the entire screen
- * Moves cursor to top-left and redraws all content
+ * Moves cursor to top-left and redraws all content, then the splash and
+ * the ":stats" overlay over it if shown
  * 
  * @param cursor: Current cursor state for rendering
  */
 void	draw_screen(t_cursor *cursor)
 {
-    write(STDOUT_FILENO, "\x1b[H", 3); // ANSI: Move cursor to top-left (1,1)
+    uint64_t	start;
+
+    STATS_START(start);
     draw_text_buffer(cursor);
+    STATS_STOP(STAT_DRAW, start);
+    splash_draw();
+    stats_draw();
 }
 
-// Global variables for command mode
-char	command_buffer[128] = {0}; // Buffer to store typed command
-int		command_length = 0;       // Current length of command
-
 /*
  * Process keypresses in COMMAND mode
  * Handles command entry, cursor movement, and command execution
  * 
- * @param c: Key code from read_key()
+ * @param c: Key code from key_decode()
  * @param cursor: Cursor position (for navigation in command mode)
  */
 void	process_command(int c, t_cursor *cursor)
 {
+    size_t		len;   // Length of pasted text
+    size_t		lead;  // Where the last pasted character starts
+    uint32_t	cp;
+
     // Allow cursor movement in command mode (for visual feedback)
-    if (c == ARROW_UP && cursor->cy > 1)
-        cursor->cy--;
-    else if (c == ARROW_DOWN && cursor->cy < MAX_ROWS)
-        cursor->cy++;
-    else if (c == ARROW_LEFT && cursor->cx > 1)
-        cursor->cx--;
-    else if (c == ARROW_RIGHT && cursor->cx < MAX_COLS)
-        cursor->cx++;
+    if (is_navigation_key(c))
+    {
+        move_cursor_key(c, cursor);
+        scroll_to_cursor(cursor);
+    }
     else if (c == 127 && command_length > 0) // Backspace in command
     {
-        // Remove last character from command
+        // Remove last character from command (all of its UTF-8 bytes)
+        while (command_length > 1
+            && ((unsigned char)command_buffer[command_length - 1] & 0xC0) == 0x80)
+            command_length--;
         command_buffer[--command_length] = '\0';
-        // Redraw command line (note: using printf for immediate output)
-        printf("\x1b[%d;1H:%s\x1b[K", g_window_rows, command_buffer);
-        fflush(stdout);
+        // Redraw command line
+        update_command_line(command_buffer);
+        search_preview(cursor);
     }
     else if (c == '\n' || c == '\r') // Enter - execute command
     {
@@ -280,16 +1401,15 @@ void	process_command(int c, t_cursor *cursor)
         command_length = 0;
         command_buffer[0] = '\0';
         // Clear command line but stay in command mode
-        printf("\x1b[%d;1H\x1b[K", g_window_rows);
-        fflush(stdout);
+        clear_command_prompt();
         // Note: handle_command decides whether to switch modes
     }
     else if (c == 27) // ESC - exit command mode without executing
     {
         command_length = 0;
         command_buffer[0] = '\0';
-        printf("\x1b[%d;1H\x1b[K", g_window_rows);
-        fflush(stdout);
+        search_preview(cursor); // A search being typed is cancelled
+        clear_command_prompt();
         current_mode = MODE_INPUT;  // Return to input mode
     }
     else if (c >= 32 && c <= 126 && command_length < 127) // Printable characters
@@ -298,8 +1418,41 @@ void	process_command(int c, t_cursor *cursor)
         command_buffer[command_length++] = (char)c;
         command_buffer[command_length] = '\0';
         // Show updated command
-        printf("\x1b[%d;1H:%s", g_window_rows, command_buffer);
-        fflush(stdout);
+        update_command_line(command_buffer);
+        search_preview(cursor); // "/" and "?" search as the pattern is typed
+    }
+    else if (c == UTF8_KEY) // Non-ASCII character, kept whole or not at all
+    {
+        const char *text = key_text(&len);
+        if (command_length + len <= 127)
+        {
+            memcpy(command_buffer + command_length, text, len);
+            command_length += len;
+            command_buffer[command_length] = '\0';
+            update_command_line(command_buffer);
+            search_preview(cursor);
+        }
+    }
+    else if (c == PASTE) // Pasted text - the printable part of its first line
+    {
+        const char *text = key_paste(&len);
+        for (size_t i = 0; i < len && text[i] != '\n' && command_length < 127; i++)
+        {
+            if ((text[i] >= 32 && text[i] <= 126) || (unsigned char)text[i] >= 0x80)
+                command_buffer[command_length++] = text[i];
+        }
+        // Do not keep half of a character cut off by the length limit
+        lead = command_length;
+        while (lead > 0 && command_length - lead < 3
+            && ((unsigned char)command_buffer[lead - 1] & 0xC0) == 0x80)
+            lead--;
+        if (lead > 0 && (unsigned char)command_buffer[lead - 1] >= 0xC0
+            && utf8_decode(command_buffer + lead - 1, command_length - lead + 1, &cp)
+                != command_length - lead + 1)
+            command_length = lead - 1;
+        command_buffer[command_length] = '\0';
+        update_command_line(command_buffer);
+        search_preview(cursor);
     }
 
     // Update cursor position in command mode (visual feedback)
@@ -309,6 +1462,102 @@ void	process_command(int c, t_cursor *cursor)
     }
 }
 
+/*
+ * React to the background indexer publishing more lines
+ * Finishes a pending ":N" jump once the line is known; the next frame
+ * usually only changes the status line (or the gutter, when the line count
+ * gains a digit). A followed file that grew redraws from its old last line
+ * on, and the view goes along to the end if the cursor was on that line.
+ *
+ * @param cursor: Cursor position (moved if a jump completes)
+ */
+void	handle_index_update(t_cursor *cursor)
+{
+    size_t	lines;     // Line count of a followed file before it grew
+    bool	reloaded;  // It was loaded again
+
+    if (follow_take(&lines, &reloaded))
+    {
+        if (reloaded)
+        {
+            *cursor = (t_cursor){.cx = 1, .cy = 1, .rx = 1}; // As for a file just opened
+            tab_shown(cursor);
+        }
+        else if (lines > 0)
+            mark_lines_dirty(lines - 1, SIZE_MAX);
+        if (lines == 0 || cursor->cy >= (int)lines)
+            goto_line(cursor, SIZE_MAX); // Completes once the file is indexed
+    }
+    if (pending_percent != SIZE_MAX && buffer_fully_indexed(&g_buffer))
+        goto_percent(cursor, pending_percent);
+    if (pending_goto != 0
+        && (pending_goto <= buffer_line_count(&g_buffer) || buffer_fully_indexed(&g_buffer)))
+        goto_line(cursor, pending_goto);
+}
+
+/*
+ * Show the outcome of a background save on the bottom line
+ * A command being typed is left alone; the message then shows up once the
+ * prompt is cleared
+ */
+void	handle_save_finished(void)
+{
+    if (current_mode == MODE_COMMAND && command_length == 0)
+        clear_command_prompt();
+}
+
+/*
+ * Pages of the mapped file were lost: another program shrank it, and what
+ * was past its new end reads as zeros now (SIGBUS, see loop.c). A document
+ * that was not edited is loaded again from its name; edits are kept, with
+ * a warning, so they can still be saved
+ *
+ * @param cursor: Cursor position (back at the top if the file is loaded again)
+ */
+void	handle_file_lost(t_cursor *cursor)
+{
+    char	name[sizeof(current_filename)];
+    bool	follow;
+
+    if (buffer_modified(&g_buffer))
+    {
+        set_message("%s shrank on disk: text past its new end reads as zeros", current_filename);
+        return ;
+    }
+    memcpy(name, current_filename, sizeof(name));
+    follow = follow_active();
+    follow_stop();
+    load_file(name);
+    *cursor = (t_cursor){.cx = 1, .cy = 1, .rx = 1}; // As for a file just opened
+    tab_shown(cursor);
+    if (follow)
+        follow_start(); // Shows the end again
+    set_message("%s shrank on disk: loaded again", name);
+}
+
+/*
+ * Adapt to a new terminal size (SIGWINCH)
+ * The terminal is cleared and the screen model rebuilt, so the next frame
+ * paints everything once for the new dimensions
+ *
+ * @param cursor: Cursor position (the view scrolls to keep it visible)
+ */
+void	handle_resize(t_cursor *cursor)
+{
+    get_window_size(&g_window_rows, &g_window_cols);
+    // Keep at least one text row, the bottom line and a sliver of text
+    if (g_window_rows < 2)
+        g_window_rows = 2;
+    if (g_window_cols < gutter_width() + 1)
+        g_window_cols = gutter_width() + 1;
+    frame_append("\x1b[2J", 4);
+    screen_resize(g_window_rows, g_window_cols);
+    drawn_scroll_x = -1; // Nothing on screen can be reused
+    scroll_to_cursor(cursor);
+    if (current_mode == MODE_COMMAND)
+        update_command_line(command_buffer);
+}
+
 /*
  * Execute typed commands (vim-like command system)
  * Handles file operations, mode switching, and editor control
@@ -318,62 +1567,136 @@ void	process_command(int c, t_cursor *cursor)
  */
 void	handle_command(const char *cmd, t_cursor *cursor)
 {
+    char	list[CMD_BUF_SIZE]; // Tabs for ":ls"
+    size_t	n;
+
     if (strcmp(cmd, "i") == 0 || strcmp(cmd, "input") == 0)
     {
         // Switch to input mode
         current_mode = MODE_INPUT;
     }
-    else if (strncmp(cmd, "o ", 2) == 0) // "o filename" - open file
+    else if (cmd[0] != '\0' && strspn(cmd, "0123456789") == strlen(cmd)) // ":N" - go to line
+    {
+        goto_line(cursor, strtoul(cmd, NULL, 10));
+        current_mode = MODE_INPUT;
+    }
+    else if (strlen(cmd) > 1 && strspn(cmd, "0123456789") == strlen(cmd) - 1
+        && cmd[strlen(cmd) - 1] == '%') // ":N%" - go N% of the way through
+    {
+        goto_percent(cursor, strtoul(cmd, NULL, 10));
+        current_mode = MODE_INPUT;
+    }
+    else if (cmd[0] == '/' || cmd[0] == '?') // Search forward or backward
+        search_command(cmd, cursor);
+    else if (substitute_is_command(cmd)) // ":[range]s/pattern/replacement/[flags]"
+        substitute_command(cmd, cursor);
+    else if (strncmp(cmd, "re ", 3) == 0 || strncmp(cmd, "regex ", 6) == 0)
+        regex_command(strchr(cmd, ' ') + 1, cursor); // Regular expression search
+    else if (strcmp(cmd, "u") == 0 || strcmp(cmd, "undo") == 0)
+        undo_handle(cursor, false);
+    else if (strcmp(cmd, "redo") == 0)
+        undo_handle(cursor, true);
+    else if (strncmp(cmd, "undolimit ", 10) == 0) // "undolimit N" - history cap in MB
+    {
+        undo_set_budget(&g_undo, strtoull(cmd + 10, NULL, 10) << 20);
+        set_message("Undo history limited to %zu MB", g_undo.budget >> 20);
+    }
+    else if (strncmp(cmd, "syntax ", 7) == 0) // "syntax NAME" or "syntax off"
+    {
+        if (!syntax_set(cmd + 7))
+            set_message("Unknown syntax: %s", cmd + 7);
+        else
+        {
+            set_message("Syntax: %s", syntax_name() ? syntax_name() : "off");
+            screen_invalidate_rows(0, g_window_rows); // Every line changes colors
+        }
+    }
+    else if (strcmp(cmd, "set wrap") == 0 || strcmp(cmd, "set nowrap") == 0)
+    {
+        // Soft wrap: long lines continue on the rows below instead of scrolling sideways
+        wrap_set(cmd[4] == 'w');
+        cursor->scroll_x = 0;
+        cursor->scroll_row = 0;
+        screen_invalidate_rows(0, g_window_rows);
+        scroll_to_cursor(cursor);
+    }
+    else if (strncmp(cmd, "o ", 2) == 0) // "o filename" - open file in a tab
     {
         const char *filename = cmd + 2; // Skip "o " prefix
         if (strlen(filename) > 0)
         {
-            load_file(filename);
-            // Reset cursor to top-left after loading file
-            cursor->cx = 1;
-            cursor->cy = 1;
-            cursor->scroll_x = 0;
-            cursor->scroll_y = 0;
+            tabs_open(filename, cursor); // The current file stays open in its tab
+            tab_shown(cursor);
+        }
+    }
+    else if (strcmp(cmd, "bn") == 0 || strcmp(cmd, "bp") == 0) // Next or previous tab
+    {
+        tabs_next((cmd[1] == 'n') ? 1 : -1, cursor);
+        tab_shown(cursor);
+    }
+    else if (strncmp(cmd, "b ", 2) == 0) // "b N" - show tab N
+    {
+        n = strtoul(cmd + 2, NULL, 10);
+        if (n < 1 || n > tabs_count())
+            set_message("No tab %s", cmd + 2);
+        else
+        {
+            tabs_switch(n - 1, cursor);
+            tab_shown(cursor);
         }
     }
+    else if (strcmp(cmd, "bd") == 0 || strcmp(cmd, "bd!") == 0) // Close the tab
+    {
+        save_wait(); // A save still running may be what leaves it unmodified
+        if (cmd[2] != '!' && buffer_modified(&g_buffer))
+            set_message("No write since last change (:bd! overrides)");
+        else
+        {
+            tabs_close(cursor); // "bd!": unsaved changes are dropped
+            tab_shown(cursor);
+        }
+    }
+    else if (strcmp(cmd, "follow") == 0) // Follow the file as it grows, or stop
+    {
+        if (follow_active())
+        {
+            follow_stop();
+            set_message("Stopped following %s", current_filename);
+        }
+        else if (follow_start())
+            set_message("Following %s", current_filename);
+    }
+    else if (strcmp(cmd, "stats") == 0) // Latency histograms and syscall counts
+        stats_show();
+    else if (strcmp(cmd, "ls") == 0) // List the tabs
+    {
+        tabs_list(list, sizeof(list));
+        set_message("%s", list);
+    }
     else if (strncmp(cmd, "w ", 2) == 0) // "w filename" - save to specific file
     {
         const char *filename = cmd + 2; // Skip "w " prefix
         if (strlen(filename) > 0)
-        {
-            save_to_file(filename);
-            strcpy(current_filename, filename); // Update current filename
-        }
+            save_start(filename, true); // Becomes the current filename once saved
     }
     else if (strcmp(cmd, "w") == 0) // Just "w" - save to current file
     {
         if (strlen(current_filename) > 0)
         {
-            save_to_file(current_filename); // Use current filename
+            save_start(current_filename, false); // Use current filename
         }
         else
         {
-            save_to_file("output.txt"); // Fallback if no filename set
+            save_start("output.txt", false); // Fallback if no filename set
         }
     }
-    else if (strcmp(cmd, "q") == 0) // Quit editor
-    {
-        reset_screen();
-        disable_raw_mode();
-        exit(0);
-    }
+    else if (strcmp(cmd, "q") == 0 || strcmp(cmd, "q!") == 0) // Quit editor
+        quit(cmd[1] == '!'); // "q!": unsaved changes are dropped
     else if (strcmp(cmd, "wq") == 0) // Write and quit
     {
-        // Save first
-        if (strlen(current_filename) > 0)
-            save_to_file(current_filename);
-        else
-            save_to_file("output.txt");
-        
-        // Then quit
-        reset_screen();
-        disable_raw_mode();
-        exit(0);
+        // Save first (in the foreground); stay in the editor if that failed
+        if (save_now(strlen(current_filename) > 0 ? current_filename : "output.txt") == 0)
+            quit(false); // Other tabs may still have unsaved changes
     }
     // Unknown commands are silently ignored
 }
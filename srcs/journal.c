@@ -0,0 +1,695 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Crash-Recovery Journal
+ * Every change made to a document's buffer - typing, deletions, undo and
+ * redo, substitutions - is logged as a record (offset, bytes removed, text
+ * put in their place) to a swap file next to the file, ".name.vbswp".
+ * Logging an edit only appends to a buffer in memory, merging with the
+ * record before it while typing goes on. Once editing pauses the records
+ * are written with one pwrite() and flushed with fdatasync() on a thread,
+ * so no key ever waits for the disk.
+ * When a file is loaded and a swap file for that same version of it is
+ * found (left by an editor that is no longer running), its records are
+ * replayed over the file. Saving starts the journal afresh; quitting
+ * removes it. Only a crash, a kill or a lost terminal leaves it behind.
+ */
+
+static t_journal	*g_journals = NULL; // Every open journal
+
+/*
+ * Milliseconds on the monotonic clock
+ */
+static uint64_t	now_ms(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Swap file of a file: ".name.vbswp" in the same directory
+ *
+ * @return: false if the name does not fit
+ */
+static bool	swap_path(const char *filename, char *out, size_t size)
+{
+    const char	*base;
+    int			n;
+
+    base = strrchr(filename, '/');
+    base = (base != NULL) ? base + 1 : filename;
+    n = snprintf(out, size, "%.*s.%s.vbswp", (int)(base - filename), filename, base);
+    return (n > 0 && (size_t)n < size);
+}
+
+/*
+ * Describe the file as it is on disk now (all zeros if it does not exist)
+ *
+ * @return: false for anything but a regular file or a missing one
+ */
+static bool	file_header(const char *filename, t_journal_header *header)
+{
+    struct stat	st;
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+    header->pid = (uint64_t)getpid();
+    if (stat(filename, &st) != 0)
+        return (errno == ENOENT);
+    if (!S_ISREG(st.st_mode))
+        return (false);
+    header->size = (uint64_t)st.st_size;
+    header->mtime_ns = (uint64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    header->ino = (uint64_t)st.st_ino;
+    header->dev = (uint64_t)st.st_dev;
+    return (true);
+}
+
+/*
+ * Whether another running editor is writing a swap file
+ */
+static bool	holder_alive(uint64_t pid)
+{
+    if (pid == 0 || pid == (uint64_t)getpid() || pid > INT_MAX)
+        return (false);
+    return (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+/*
+ * pwrite() all of len bytes at off
+ */
+static bool	write_at(int fd, const void *data, size_t len, off_t off)
+{
+    ssize_t	n;
+
+    while (len > 0)
+    {
+        n = pwrite(fd, data, len, off);
+        STATS_ADD(STAT_FILE_WRITES, 1);
+        if (n < 0 && errno == EINTR)
+            continue ;
+        if (n <= 0)
+            return (false);
+        STATS_ADD(STAT_FILE_BYTES, n);
+        data = (const char *)data + n;
+        len -= n;
+        off += n;
+    }
+    return (true);
+}
+
+/*
+ * Stop logging after a write failed (the document itself is unaffected)
+ */
+static void	fail(t_journal *j)
+{
+    j->broken = true;
+    j->len = 0;
+    j->last = SIZE_MAX;
+    set_message("Can't write swap file \"%s\": %s", j->path, strerror(errno));
+}
+
+/*
+ * Move a swap file found in the way to "NAME.vbswp.old", unless the editor
+ * that writes it is still running
+ *
+ * @return: false if the swap file belongs to a running editor
+ */
+static bool	move_aside(t_journal *j)
+{
+    t_journal_header	old;
+    char				aside[PATH_MAX + 4];
+    ssize_t				n;
+    int					fd;
+
+    n = -1;
+    fd = open(j->path, O_RDONLY | O_CLOEXEC);
+    if (fd != -1)
+    {
+        n = pread(fd, &old, sizeof(old), 0);
+        close(fd);
+    }
+    if (n == (ssize_t)sizeof(old) && memcmp(old.magic, JOURNAL_MAGIC, sizeof(old.magic)) == 0
+        && holder_alive(old.pid))
+    {
+        set_message("Process %lu is editing this file: changes are not journaled",
+            (unsigned long)old.pid);
+        return (false);
+    }
+    snprintf(aside, sizeof(aside), "%s.old", j->path);
+    if (rename(j->path, aside) != 0)
+        return (errno == ENOENT);
+    set_message("Swap file of another version of the file kept as \"%s\"", aside);
+    return (true);
+}
+
+/*
+ * Create the swap file and write its header (on the first edit)
+ */
+static bool	create_file(t_journal *j)
+{
+    for (int tries = 0; tries < 2; tries++)
+    {
+        j->fd = open(j->path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (j->fd != -1 || errno != EEXIST)
+            break ;
+        if (!move_aside(j))
+        {
+            j->broken = true;
+            return (false);
+        }
+    }
+    if (j->fd == -1)
+    {
+        fail(j);
+        return (false);
+    }
+    j->size = sizeof(j->header);
+    if (!write_at(j->fd, &j->header, sizeof(j->header), 0))
+    {
+        fail(j);
+        return (false);
+    }
+    return (true);
+}
+
+/*
+ * Write the pending records to the swap file (creating it if needed)
+ */
+static void	write_pending(t_journal *j)
+{
+    if (j->broken || j->len == 0 || (j->fd == -1 && !create_file(j)))
+        return ;
+    if (!write_at(j->fd, j->pending, j->len, j->size))
+    {
+        fail(j);
+        return ;
+    }
+    j->size += j->len;
+    j->len = 0;
+    j->last = SIZE_MAX;
+}
+
+/*
+ * Sync thread body: flush the swap file to disk
+ */
+static void	*sync_main(void *arg)
+{
+    t_journal	*j;
+
+    j = arg;
+    fdatasync(j->fd);
+    STATS_ADD(STAT_FILE_SYNCS, 1);
+    pthread_mutex_lock(&j->lock);
+    j->synced = true;
+    pthread_mutex_unlock(&j->lock);
+    return (NULL);
+}
+
+/*
+ * Whether a flush started earlier is over (joining its thread if so)
+ *
+ * @param block: Wait for it
+ */
+static bool	sync_done(t_journal *j, bool block)
+{
+    bool	done;
+
+    if (!j->syncing)
+        return (true);
+    pthread_mutex_lock(&j->lock);
+    done = j->synced;
+    pthread_mutex_unlock(&j->lock);
+    if (!done && !block)
+        return (false);
+    pthread_join(j->thread, NULL);
+    j->syncing = false;
+    return (true);
+}
+
+/*
+ * Group commit: write everything logged so far and flush it in the
+ * background
+ *
+ * @return: false if the last flush is still running (try again later)
+ */
+static bool	commit(t_journal *j)
+{
+    write_pending(j);
+    if (j->broken || j->fd == -1)
+        return (true);
+    if (!sync_done(j, false))
+        return (false);
+    j->synced = false;
+    if (pthread_create(&j->thread, NULL, sync_main, j) == 0)
+        j->syncing = true;
+    else
+    {
+        fdatasync(j->fd);
+        STATS_ADD(STAT_FILE_SYNCS, 1);
+    }
+    return (true);
+}
+
+/*
+ * Timer: commit once no edit has come for JOURNAL_IDLE_MS, or when the
+ * oldest pending record has waited JOURNAL_MAX_DELAY_MS
+ */
+static void	commit_due(void *arg)
+{
+    t_journal	*j;
+    uint64_t	now;
+
+    j = arg;
+    j->timer = -1;
+    now = now_ms();
+    if (j->len > 0 && now - j->last_ms < JOURNAL_IDLE_MS
+        && now - j->first_ms < JOURNAL_MAX_DELAY_MS)
+    {
+        // Still typing: wait for a pause
+        j->timer = loop_timer_add(JOURNAL_IDLE_MS - (int)(now - j->last_ms), commit_due, j);
+        if (j->timer != -1)
+            return ;
+    }
+    if (!commit(j))
+        j->timer = loop_timer_add(JOURNAL_IDLE_MS, commit_due, j);
+}
+
+/*
+ * Append bytes to the record being logged: to the pending records, or
+ * straight to the file for a large one
+ */
+static void	put(t_journal *j, const void *data, size_t len)
+{
+    if (j->broken)
+        return ;
+    if (j->direct)
+    {
+        if (!write_at(j->fd, data, len, j->size))
+            fail(j);
+        j->size += len;
+        return ;
+    }
+    if (j->len + len > j->cap)
+    {
+        j->cap = (j->len + len) * 2 > 4096 ? (j->len + len) * 2 : 4096;
+        j->pending = realloc(j->pending, j->cap);
+        if (j->pending == NULL)
+            die("realloc");
+    }
+    memcpy(j->pending + j->len, data, len);
+    j->len += len;
+}
+
+/*
+ * Note that an edit was logged (for the commit timer)
+ */
+static void	touch(t_journal *j)
+{
+    j->last_ms = now_ms();
+    if (j->timer != -1)
+        return ;
+    j->timer = loop_timer_add(JOURNAL_IDLE_MS, commit_due, j);
+    if (j->timer == -1)
+        commit(j); // No timer slot left
+}
+
+/*
+ * Start a record; its text is put() next and end() closes it
+ *
+ * @return: false if nothing is being logged
+ */
+static bool	begin(t_journal *j, const t_journal_record *rec)
+{
+    if (j->broken)
+        return (false);
+    if (j->len == 0)
+        j->first_ms = now_ms();
+    if (rec->size >= JOURNAL_DIRECT_SIZE)
+    {
+        if (j->fd == -1 && !create_file(j))
+            return (false);
+        write_pending(j); // Keeps the records in order
+        j->direct = true;
+        j->last = SIZE_MAX;
+    }
+    else
+        j->last = j->len;
+    put(j, rec, sizeof(*rec));
+    return (!j->broken);
+}
+
+/*
+ * Close the record started by begin()
+ */
+static void	end(t_journal *j)
+{
+    if (j->direct)
+    {
+        j->direct = false;
+        j->last = SIZE_MAX; // Already written: nothing can be merged into it
+    }
+    touch(j);
+}
+
+/*
+ * The newest pending record, if edits can still be merged into it
+ */
+static bool	last_record(t_journal *j, t_journal_record *rec)
+{
+    if (j->broken || j->last == SIZE_MAX)
+        return (false);
+    memcpy(rec, j->pending + j->last, sizeof(*rec));
+    return (true);
+}
+
+/*
+ * Put back the newest pending record after merging an edit into it
+ */
+static void	update_record(t_journal *j, const t_journal_record *rec)
+{
+    memcpy(j->pending + j->last, rec, sizeof(*rec));
+}
+
+/*
+ * Log an insertion (called by buffer_insert())
+ * Typing right after the text of the previous record extends it
+ *
+ * @param j: Journal of the buffer, or NULL
+ */
+void	journal_insert(t_journal *j, size_t pos, const char *text, size_t len)
+{
+    t_journal_record	rec;
+
+    if (j == NULL)
+        return ;
+    if (last_record(j, &rec) && pos == rec.pos + rec.size && len < JOURNAL_DIRECT_SIZE)
+    {
+        rec.size += len;
+        update_record(j, &rec);
+        put(j, text, len);
+        touch(j);
+        return ;
+    }
+    rec = (t_journal_record){JOURNAL_INSERT, pos, 0, len};
+    if (begin(j, &rec))
+        put(j, text, len);
+    end(j);
+}
+
+/*
+ * Log a deletion (called by buffer_delete())
+ * Backspace and Delete over a run merge into one record; backspacing over
+ * text just typed takes it back out of its record
+ *
+ * @param j: Journal of the buffer, or NULL
+ */
+void	journal_delete(t_journal *j, size_t pos, size_t len)
+{
+    t_journal_record	rec;
+
+    if (j == NULL)
+        return ;
+    if (last_record(j, &rec))
+    {
+        if (rec.size >= len && pos + len == rec.pos + rec.size && pos >= rec.pos)
+        {
+            rec.size -= len;
+            j->len -= len; // The text is at the end of the pending records
+            update_record(j, &rec);
+            touch(j);
+            return ;
+        }
+        if (rec.size == 0 && (pos + len == rec.pos || pos == rec.pos))
+        {
+            rec.len += len;
+            rec.pos = pos;
+            update_record(j, &rec);
+            touch(j);
+            return ;
+        }
+    }
+    rec = (t_journal_record){JOURNAL_DELETE, pos, len, 0};
+    begin(j, &rec);
+    end(j);
+}
+
+/*
+ * Put the text of a tree of pieces, in document order
+ */
+static void	put_pieces(t_journal *j, const t_piece *p)
+{
+    if (p == NULL)
+        return ;
+    put_pieces(j, p->left);
+    put(j, p->src->data + p->start, p->len);
+    put_pieces(j, p->right);
+}
+
+/*
+ * Log a span replaced by pieces (called by buffer_splice(): substitutions,
+ * and undoing or redoing them)
+ *
+ * @param j: Journal of the buffer, or NULL
+ */
+void	journal_splice(t_journal *j, size_t pos, size_t len, const t_piece *with)
+{
+    t_journal_record	rec;
+
+    if (j == NULL)
+        return ;
+    rec = (t_journal_record){JOURNAL_REPLACE, pos, len, with ? with->sum_len : 0};
+    if (begin(j, &rec))
+        put_pieces(j, with);
+    end(j);
+}
+
+/*
+ * Apply the records of a swap file to a buffer
+ * Stops at the first record that is cut short or makes no sense (the
+ * editor died while writing it)
+ *
+ * @param data: Swap file contents
+ * @param size: Bytes in data
+ * @param count: Receives the number of records applied
+ * @return: Bytes of data that were valid
+ */
+static size_t	replay(t_buffer *buf, const char *data, size_t size, size_t *count)
+{
+    t_journal_record	rec;
+    size_t				off;
+
+    off = sizeof(t_journal_header);
+    *count = 0;
+    while (size - off >= sizeof(rec))
+    {
+        memcpy(&rec, data + off, sizeof(rec));
+        if ((rec.type != JOURNAL_INSERT && rec.type != JOURNAL_DELETE
+                && rec.type != JOURNAL_REPLACE) || rec.size > size - off - sizeof(rec))
+            break ;
+        if (rec.len < SIZE_MAX - rec.pos)
+            buffer_ensure_size(buf, rec.pos + rec.len);
+        if (rec.pos > buffer_size(buf) || rec.len > buffer_size(buf) - rec.pos)
+            break ;
+        buffer_delete(buf, rec.pos, rec.len);
+        buffer_insert(buf, rec.pos, data + off + sizeof(rec), rec.size);
+        off += sizeof(rec) + rec.size;
+        (*count)++;
+    }
+    return (off);
+}
+
+/*
+ * Replay a swap file left over for this very version of the file, and go
+ * on logging to it
+ *
+ * @param fd: The swap file, open for reading and writing
+ * @return: false if it is not for this file, or is in use
+ */
+static bool	recover(t_journal *j, int fd, t_buffer *buf)
+{
+    t_journal_header	old;
+    struct stat			st;
+    char				*data;
+    size_t				valid;
+    size_t				count;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(old)
+        || pread(fd, &old, sizeof(old), 0) != (ssize_t)sizeof(old)
+        || memcmp(old.magic, JOURNAL_MAGIC, sizeof(old.magic)) != 0 || holder_alive(old.pid)
+        || old.size != j->header.size || old.mtime_ns != j->header.mtime_ns
+        || old.ino != j->header.ino || old.dev != j->header.dev)
+        return (false);
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return (false);
+    valid = replay(buf, data, st.st_size, &count);
+    munmap(data, st.st_size);
+    // Drop a torn last record and take the file over
+    if (ftruncate(fd, valid) != 0 || !write_at(fd, &j->header, sizeof(j->header), 0))
+        return (false);
+    j->fd = fd;
+    j->size = valid;
+    if (count > 0)
+        set_message("Recovered %zu changes from \"%s\" (:w keeps them)", count, j->path);
+    return (true);
+}
+
+/*
+ * Start a journal for a file (nothing is written before the first edit)
+ *
+ * @return: NULL for an unnamed document, or anything but a regular file
+ */
+static t_journal	*journal_new(const char *filename)
+{
+    t_journal	*j;
+
+    if (filename[0] == '\0')
+        return (NULL);
+    j = calloc(1, sizeof(*j));
+    if (j == NULL)
+        die("calloc");
+    if (!swap_path(filename, j->path, sizeof(j->path)) || !file_header(filename, &j->header))
+    {
+        free(j);
+        return (NULL);
+    }
+    j->fd = -1;
+    j->timer = -1;
+    j->last = SIZE_MAX;
+    pthread_mutex_init(&j->lock, NULL);
+    j->next = g_journals;
+    g_journals = j;
+    return (j);
+}
+
+/*
+ * Start logging the edits of a document just loaded, first replaying the
+ * swap file a crash may have left for it
+ *
+ * @param filename: File the document was loaded from
+ * @param buf: The document (not logged to yet)
+ * @return: Journal for buf->journal, or NULL if the document is not logged
+ */
+t_journal	*journal_open(const char *filename, t_buffer *buf)
+{
+    t_journal	*j;
+    int			fd;
+
+    j = journal_new(filename);
+    if (j == NULL)
+        return (NULL);
+    fd = open(j->path, O_RDWR | O_CLOEXEC);
+    if (fd != -1 && !recover(j, fd, buf))
+    {
+        close(fd);
+        if (!move_aside(j))
+            j->broken = true; // Another editor logs this file
+    }
+    return (j);
+}
+
+/*
+ * Everything logged so far is in the document being saved: where the
+ * records that will not be in the saved file start
+ *
+ * @param j: Journal of the buffer, or NULL
+ * @return: Offset in the swap file, for journal_saved()
+ */
+off_t	journal_mark(t_journal *j)
+{
+    if (j == NULL)
+        return (0);
+    write_pending(j);
+    return ((j->fd == -1) ? (off_t)sizeof(j->header) : j->size);
+}
+
+/*
+ * The document was saved as filename: start the journal afresh for the
+ * file as now on disk, keeping only the records made after the save began
+ * (a save in the background may have been overtaken by edits)
+ *
+ * @param buf: The document saved
+ * @param filename: Where it now lives
+ * @param mark: journal_mark() when the save began
+ */
+void	journal_saved(t_buffer *buf, const char *filename, off_t mark)
+{
+    t_journal	*j;
+    t_journal	*fresh;
+    char		*tail;
+    size_t		len;
+
+    j = buf->journal;
+    fresh = journal_new(filename);
+    buf->journal = fresh;
+    if (j == NULL || j->broken || fresh == NULL)
+    {
+        journal_close(j, false);
+        return ;
+    }
+    write_pending(j);
+    len = (j->fd != -1 && j->size > mark) ? j->size - mark : 0;
+    tail = malloc(len + 1);
+    if (tail == NULL)
+        die("malloc");
+    if (len > 0 && pread(j->fd, tail, len, mark) != (ssize_t)len)
+        len = 0;
+    journal_close(j, false);
+    if (len > 0 && create_file(fresh))
+    {
+        if (!write_at(fresh->fd, tail, len, fresh->size))
+            fail(fresh);
+        fresh->size += len;
+        commit(fresh);
+    }
+    free(tail);
+}
+
+/*
+ * Stop logging a document
+ *
+ * @param j: Journal, or NULL
+ * @param keep: Leave the swap file on disk, flushed (for recovery)
+ *              rather than removing it
+ */
+void	journal_close(t_journal *j, bool keep)
+{
+    t_journal	**link;
+
+    if (j == NULL)
+        return ;
+    loop_timer_cancel(j->timer);
+    sync_done(j, true);
+    if (keep)
+        write_pending(j);
+    if (j->fd != -1)
+    {
+        if (keep)
+            fdatasync(j->fd);
+        else
+            unlink(j->path);
+        close(j->fd);
+    }
+    link = &g_journals;
+    while (*link != j)
+        link = &(*link)->next;
+    *link = j->next;
+    pthread_mutex_destroy(&j->lock);
+    free(j->pending);
+    free(j);
+}
+
+/*
+ * Stop logging every document, on the way out
+ *
+ * @param keep: The editor was killed rather than quit: leave every swap
+ *              file for recovery
+ */
+void	journal_close_all(bool keep)
+{
+    while (g_journals != NULL)
+        journal_close(g_journals, keep);
+}
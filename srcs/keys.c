@@ -0,0 +1,407 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Key Decoding
+ * Terminal input is read in bulk - one read() takes everything the terminal
+ * has sent so far - and decoded from that buffer into key codes. Escape
+ * sequences for cursor and editing keys are recognized in their CSI and
+ * SS3 forms, with xterm-style modifiers. With bracketed paste enabled, a
+ * paste arrives between ESC [ 200 ~ and ESC [ 201 ~ and is returned as a
+ * single PASTE key whose text is then inserted in one go. A UTF-8 encoded
+ * character is returned as one UTF8_KEY whose bytes key_text() gives.
+ */
+
+# define PASTE_END "\x1b[201~"
+
+static t_input	g_input;
+
+/*
+ * Move the bytes not decoded yet to the front of the buffer
+ */
+static void	input_compact(void)
+{
+    if (g_input.start > 0)
+    {
+        memmove(g_input.data, g_input.data + g_input.start, g_input.end - g_input.start);
+        g_input.end -= g_input.start;
+        g_input.start = 0;
+    }
+}
+
+/*
+ * Read whatever the terminal has sent, after moving pending bytes to the
+ * front of the buffer
+ *
+ * @param timeout_ms: How long to wait for input with poll(), or -1 to just
+ *                    read() what is already there
+ * @return: true if bytes were read
+ */
+static bool	input_read(int timeout_ms)
+{
+    struct pollfd	pfd;
+    ssize_t			n;
+
+    input_compact();
+    if (g_input.end == sizeof(g_input.data))
+        return (false);
+    if (timeout_ms >= 0)
+    {
+        pfd.fd = STDIN_FILENO;
+        pfd.events = POLLIN;
+        STATS_ADD(STAT_POLLS, 1);
+        if (poll(&pfd, 1, timeout_ms) <= 0)
+            return (false);
+    }
+    n = read(STDIN_FILENO, g_input.data + g_input.end, sizeof(g_input.data) - g_input.end);
+    STATS_ADD(STAT_INPUT_READS, 1);
+    if (n <= 0)
+        return (false);
+    STATS_ADD(STAT_INPUT_BYTES, n);
+    g_input.end += n;
+    return (true);
+}
+
+/*
+ * Take in everything the terminal has sent (never blocks)
+ *
+ * @return: true if new bytes arrived
+ */
+bool	key_fill(void)
+{
+    uint64_t	start;
+    bool		got;
+
+    STATS_START(start);
+    got = input_read(-1);
+    STATS_STOP(STAT_READ, start);
+    return (got);
+}
+
+/*
+ * Queue bytes as if the terminal had sent them (headless replay of a
+ * keystroke script, keys typed while the terminal was being asked)
+ *
+ * @return: Bytes taken: as many as fit next to those not decoded yet
+ */
+size_t	key_feed(const char *data, size_t len)
+{
+    input_compact();
+    if (len > sizeof(g_input.data) - g_input.end)
+        len = sizeof(g_input.data) - g_input.end;
+    memcpy(g_input.data + g_input.end, data, len);
+    g_input.end += len;
+    return (len);
+}
+
+/*
+ * Length of the escape sequence starting at p (p[0] is ESC)
+ * CSI: ESC [ parameters/intermediates final; SS3: ESC O final
+ *
+ * @return: Sequence length, or 0 if more bytes are needed to tell
+ */
+static size_t	sequence_length(const char *p, size_t avail)
+{
+    size_t	i;
+
+    if (avail < 2)
+        return (0);
+    if (p[1] == 'O')
+        return (avail >= 3 ? 3 : 0);
+    i = 2;
+    while (i < avail && p[i] >= 0x20 && p[i] <= 0x3F)
+        i++;
+    return (i < avail ? i + 1 : 0);
+}
+
+/*
+ * Key for a final byte shared by CSI and SS3 (arrows, Home, End)
+ */
+static int	final_key(char final)
+{
+    if (final == 'A')
+        return (ARROW_UP);
+    if (final == 'B')
+        return (ARROW_DOWN);
+    if (final == 'C')
+        return (ARROW_RIGHT);
+    if (final == 'D')
+        return (ARROW_LEFT);
+    if (final == 'H')
+        return (HOME_KEY);
+    if (final == 'F')
+        return (END_KEY);
+    return (-1);
+}
+
+/*
+ * Key for the number of an ESC [ n ~ sequence (vt220 editing keypad)
+ */
+static int	tilde_key(int n)
+{
+    if (n == 1 || n == 7)
+        return (HOME_KEY);
+    if (n == 4 || n == 8)
+        return (END_KEY);
+    if (n == 3)
+        return (DEL_KEY);
+    if (n == 5)
+        return (PAGE_UP);
+    if (n == 6)
+        return (PAGE_DOWN);
+    return (-1);
+}
+
+/*
+ * Decode a complete escape sequence
+ * Modifiers come as a second parameter: 1 + (1 shift, 2 alt, 4 ctrl)
+ *
+ * @return: Key code (with KEY_* flags), PASTE for a paste start marker, or
+ *          -1 for sequences the editor has no use for
+ */
+static int	decode_sequence(const char *p, size_t len)
+{
+    int		n;
+    int		mod;
+    int		key;
+    char	final;
+
+    final = p[len - 1];
+    if (p[1] == 'O')
+        return (final_key(final));
+    // Private sequences (ESC [ ? ..., ESC [ < ...) are reports, not keys
+    if (len > 2 && p[2] >= '<' && p[2] <= '?')
+        return (-1);
+    n = 0;
+    mod = 0;
+    for (size_t i = 2; i < len - 1 && p[i] >= '0' && p[i] <= '9'; i++)
+        n = n * 10 + (p[i] - '0');
+    if (memchr(p, ';', len) != NULL)
+        mod = atoi((const char *)memchr(p, ';', len) + 1) - 1;
+    if (final == '~' && n == 200)
+        return (PASTE);
+    key = (final == '~') ? tilde_key(n) : final_key(final);
+    if (key < 0 || mod < 0)
+        return (key);
+    if (mod & 1)
+        key |= KEY_SHIFT;
+    if (mod & 2)
+        key |= KEY_ALT;
+    if (mod & 4)
+        key |= KEY_CTRL;
+    return (key);
+}
+
+/*
+ * Append bytes to the paste text
+ */
+static void	paste_append(const char *s, size_t len)
+{
+    size_t	cap;
+
+    if (g_input.paste_len + len > g_input.paste_cap)
+    {
+        cap = g_input.paste_cap ? g_input.paste_cap : INPUT_BUF_SIZE;
+        while (cap < g_input.paste_len + len)
+            cap *= 2;
+        g_input.paste = realloc(g_input.paste, cap);
+        if (g_input.paste == NULL)
+            die("realloc");
+        g_input.paste_cap = cap;
+    }
+    memcpy(g_input.paste + g_input.paste_len, s, len);
+    g_input.paste_len += len;
+}
+
+/*
+ * Find the paste end marker in the pending input
+ *
+ * @return: Offset of the marker from g_input.start, or -1
+ */
+static ssize_t	find_paste_end(void)
+{
+    const char	*p;
+    const char	*end;
+
+    p = g_input.data + g_input.start;
+    end = g_input.data + g_input.end;
+    while ((p = memchr(p, '\x1b', end - p)) != NULL)
+    {
+        if ((size_t)(end - p) >= sizeof(PASTE_END) - 1
+            && memcmp(p, PASTE_END, sizeof(PASTE_END) - 1) == 0)
+            return (p - (g_input.data + g_input.start));
+        p++;
+    }
+    return (-1);
+}
+
+/*
+ * Collect pasted text up to the end marker, reading more input as needed
+ * Terminals send line breaks in pastes as '\r'; they become '\n'
+ */
+static void	read_paste(void)
+{
+    ssize_t	at;
+    size_t	keep;
+    size_t	n;
+
+    g_input.paste_len = 0;
+    while ((at = find_paste_end()) < 0)
+    {
+        // Hold back a tail that might be the start of a split end marker
+        keep = g_input.end - g_input.start;
+        if (keep > sizeof(PASTE_END) - 2)
+            keep = sizeof(PASTE_END) - 2;
+        paste_append(g_input.data + g_input.start, g_input.end - g_input.start - keep);
+        g_input.start = g_input.end - keep;
+        if (!input_read(PASTE_TIMEOUT_MS))
+        {
+            at = g_input.end - g_input.start;
+            break ;
+        }
+    }
+    paste_append(g_input.data + g_input.start, at);
+    g_input.start += at;
+    if (g_input.end - g_input.start >= sizeof(PASTE_END) - 1)
+        g_input.start += sizeof(PASTE_END) - 1;
+    // "\r\n" and lone '\r' both become '\n'
+    n = 0;
+    for (size_t i = 0; i < g_input.paste_len; i++)
+    {
+        if (g_input.paste[i] == '\r' && i + 1 < g_input.paste_len
+            && g_input.paste[i + 1] == '\n')
+            continue ;
+        g_input.paste[n++] = (g_input.paste[i] == '\r') ? '\n' : g_input.paste[i];
+    }
+    g_input.paste_len = n;
+}
+
+/*
+ * Take a UTF-8 character from the pending input
+ *
+ * @return: UTF8_KEY, 0 if more bytes are needed, or -1 if the bytes are
+ *          not a valid character
+ */
+static int	take_utf8(const char *p, size_t avail)
+{
+    uint32_t	cp;
+    size_t		need;
+    size_t		len;
+
+    need = ((unsigned char)p[0] < 0xE0) ? 2 : ((unsigned char)p[0] < 0xF0) ? 3 : 4;
+    if (avail < need)
+    {
+        // Wait for the rest unless what came so far is already wrong
+        for (size_t i = 1; i < avail; i++)
+        {
+            if (((unsigned char)p[i] & 0xC0) != 0x80)
+                return (-1);
+        }
+        return (0);
+    }
+    len = utf8_decode(p, avail, &cp);
+    if (cp == UTF8_INVALID)
+        return (-1);
+    memcpy(g_input.text, p, len);
+    g_input.text_len = len;
+    g_input.start += len;
+    return (UTF8_KEY);
+}
+
+/*
+ * Decode the next key from the pending input
+ * A lone ESC is only reported once no sequence follows within
+ * ESC_TIMEOUT_MS; ESC followed by anything that does not start a sequence
+ * is reported as ESC, and the next byte as a key of its own.
+ *
+ * @return: Key code, or -1 if no complete key is pending
+ */
+static int	decode_key(void)
+{
+    const char	*p;
+    size_t		avail;
+    size_t		len;
+    int			key;
+
+    while (g_input.start < g_input.end)
+    {
+        p = g_input.data + g_input.start;
+        avail = g_input.end - g_input.start;
+        if ((unsigned char)p[0] >= 0xC2 && (unsigned char)p[0] <= 0xF4)
+        {
+            key = take_utf8(p, avail);
+            if (key == 0 && input_read(ESC_TIMEOUT_MS))
+                continue ;
+            if (key > 0)
+                return (key);
+        }
+        if (p[0] != '\x1b')
+        {
+            g_input.start++;
+            return ((unsigned char)p[0]);
+        }
+        if (avail == 1 && input_read(ESC_TIMEOUT_MS))
+            continue ;
+        if (avail == 1 || (p[1] != '[' && p[1] != 'O'))
+        {
+            g_input.start++;
+            return ('\x1b');
+        }
+        len = sequence_length(p, avail);
+        if (len == 0)
+        {
+            // Incomplete sequence: wait briefly for the rest
+            if (input_read(ESC_TIMEOUT_MS))
+                continue ;
+            g_input.start++;
+            return ('\x1b');
+        }
+        g_input.start += len;
+        key = decode_sequence(p, len);
+        if (key == PASTE)
+            read_paste();
+        if (key >= 0)
+            return (key);
+    }
+    return (-1);
+}
+
+/*
+ * Decode the next key (see decode_key()), timing it for ":stats"
+ *
+ * @return: Key code, or -1 if no complete key is pending
+ */
+int	key_decode(void)
+{
+    uint64_t	start;
+    int			key;
+
+    STATS_START(start);
+    key = decode_key();
+    if (key >= 0)
+        STATS_STOP(STAT_DECODE, start);
+    return (key);
+}
+
+/*
+ * Text of the last PASTE key
+ *
+ * @param len: Receives its length
+ * @return: Pasted bytes (valid until the next paste)
+ */
+const char	*key_paste(size_t *len)
+{
+    *len = g_input.paste_len;
+    return (g_input.paste);
+}
+
+/*
+ * Bytes of the last UTF8_KEY
+ *
+ * @param len: Receives their count (2 to 4)
+ * @return: The character's UTF-8 bytes (valid until the next key)
+ */
+const char	*key_text(size_t *len)
+{
+    *len = g_input.text_len;
+    return (g_input.text);
+}
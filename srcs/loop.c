@@ -0,0 +1,284 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Event Loop
+ * The editor sleeps in poll() until something happens: the terminal sends
+ * input, a signal arrives, a worker thread finishes a piece of work, a
+ * timer falls due, or a watched descriptor (a followed file) is ready.
+ * Signal handlers and worker threads only write a byte to a self-pipe;
+ * poll() sees it next to stdin and the main loop does the real work,
+ * outside any handler. With nothing to do no timeout is armed, so an
+ * idle editor uses no CPU at all.
+ * Files are read through mappings, and another program may shrink one
+ * while it is open: reading past its new end raises SIGBUS. The handler
+ * maps a page of zeros there, so the read goes on, and the main loop loads
+ * the file again.
+ */
+
+# define WAKE_BYTE 0 // Written by loop_wake(); signals write their number
+
+static int		g_wake_pipe[2] = {-1, -1};
+static long		g_page_size;
+static t_timer	g_timers[LOOP_MAX_TIMERS];
+static t_watch	g_watch = {.fd = -1};
+
+/*
+ * Milliseconds on the monotonic clock
+ */
+static uint64_t	now_ms(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/*
+ * Signal handler: pass the signal number on through the self-pipe
+ * write() is async-signal-safe; errno is preserved for the code interrupted
+ */
+static void	signal_to_pipe(int sig)
+{
+    unsigned char	byte;
+    int				saved_errno;
+
+    saved_errno = errno;
+    byte = (unsigned char)sig;
+    write(g_wake_pipe[1], &byte, 1);
+    errno = saved_errno;
+}
+
+/*
+ * SIGBUS handler: a page of a mapped file past its end was read (the file
+ * shrank). A private page of zeros takes its place, so the read that
+ * faulted goes on when the handler returns, and the main loop hears of it
+ * (any thread may fault: the indexer, a save, match counting)
+ * Other bus errors are not survivable: the default action is put back and
+ * the fault happens again. mmap() is a plain system call, safe here
+ */
+static void	lost_page(int sig, siginfo_t *info, void *context)
+{
+    uintptr_t	page;
+    void		*zeros;
+    int			saved_errno;
+
+    (void)context;
+    saved_errno = errno;
+    page = (uintptr_t)info->si_addr & ~(uintptr_t)(g_page_size - 1);
+    zeros = MAP_FAILED;
+    if (info->si_code == BUS_ADRERR)
+        zeros = mmap((void *)page, g_page_size, PROT_READ,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    errno = saved_errno;
+    if (zeros == MAP_FAILED)
+    {
+        signal(SIGBUS, SIG_DFL);
+        return ;
+    }
+    signal_to_pipe(sig);
+}
+
+/*
+ * Create the self-pipe and route SIGWINCH, SIGINT, SIGTERM, SIGHUP and
+ * SIGBUS to it
+ * Both ends are non-blocking: a full pipe already holds a pending wakeup
+ */
+void	loop_init(void)
+{
+    struct sigaction	sa;
+    int					signals[4] = {SIGWINCH, SIGINT, SIGTERM, SIGHUP};
+
+    if (pipe(g_wake_pipe) == -1)
+        die("pipe");
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(g_wake_pipe[i], F_SETFL, fcntl(g_wake_pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(g_wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signal_to_pipe;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    for (int i = 0; i < 4; i++)
+        sigaction(signals[i], &sa, NULL);
+    g_page_size = sysconf(_SC_PAGESIZE);
+    sa.sa_sigaction = lost_page;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigaction(SIGBUS, &sa, NULL);
+}
+
+/*
+ * Wake the main loop from another thread (e.g. a chunk was indexed)
+ */
+void	loop_wake(void)
+{
+    unsigned char	byte;
+
+    byte = WAKE_BYTE;
+    write(g_wake_pipe[1], &byte, 1);
+}
+
+/*
+ * Run fn from the main loop once delay_ms have passed
+ * A delay of 0 runs it on the next pass, after pending input is handled
+ *
+ * @return: Timer id for loop_timer_cancel(), or -1 if all slots are taken
+ */
+int	loop_timer_add(int delay_ms, void (*fn)(void *), void *arg)
+{
+    for (int i = 0; i < LOOP_MAX_TIMERS; i++)
+    {
+        if (g_timers[i].active)
+            continue ;
+        g_timers[i] = (t_timer){true, now_ms() + delay_ms, fn, arg};
+        return (i);
+    }
+    return (-1);
+}
+
+/*
+ * Disarm a timer that has not run yet
+ */
+void	loop_timer_cancel(int id)
+{
+    if (id >= 0 && id < LOOP_MAX_TIMERS)
+        g_timers[id].active = false;
+}
+
+/*
+ * Run fn from the main loop whenever fd is readable, but no more than once
+ * every interval_ms: a descriptor that keeps firing (a file being written
+ * to) wakes the editor at a bounded rate, and fn handles what piled up.
+ * One descriptor can be watched at a time
+ *
+ * @param fd: Descriptor to watch, or -1 to stop watching
+ */
+void	loop_watch(int fd, int interval_ms, void (*fn)(void *), void *arg)
+{
+    g_watch = (t_watch){fd, interval_ms, 0, fn, arg};
+}
+
+/*
+ * How long poll() may sleep before the next timer is due (or a watched
+ * descriptor may be polled again)
+ *
+ * @return: Milliseconds, or -1 (forever) if no timer is armed
+ */
+static int	next_timeout(uint64_t now)
+{
+    uint64_t	soonest;
+    bool		found;
+
+    found = (g_watch.fd >= 0 && g_watch.next_ms > now);
+    soonest = g_watch.next_ms;
+    for (int i = 0; i < LOOP_MAX_TIMERS; i++)
+    {
+        if (g_timers[i].active && (!found || g_timers[i].due_ms < soonest))
+        {
+            soonest = g_timers[i].due_ms;
+            found = true;
+        }
+    }
+    if (!found)
+        return (-1);
+    if (soonest <= now)
+        return (0);
+    return ((soonest - now > INT_MAX) ? INT_MAX : (int)(soonest - now));
+}
+
+/*
+ * Run every timer that is due
+ * A callback may arm new timers; those wait for the next pass
+ *
+ * @return: true if any timer ran
+ */
+static bool	run_timers(void)
+{
+    t_timer		due[LOOP_MAX_TIMERS];
+    uint64_t	now;
+    int			n;
+
+    now = now_ms();
+    n = 0;
+    for (int i = 0; i < LOOP_MAX_TIMERS; i++)
+    {
+        if (g_timers[i].active && g_timers[i].due_ms <= now)
+        {
+            due[n++] = g_timers[i];
+            g_timers[i].active = false;
+        }
+    }
+    for (int i = 0; i < n; i++)
+        due[i].fn(due[i].arg);
+    return (n > 0);
+}
+
+/*
+ * Drain the self-pipe and turn its bytes into events
+ */
+static int	read_wake_pipe(void)
+{
+    unsigned char	bytes[64];
+    ssize_t			n;
+    int				events;
+
+    events = 0;
+    while ((n = read(g_wake_pipe[0], bytes, sizeof(bytes))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (bytes[i] == SIGWINCH)
+                events |= EVENT_RESIZE;
+            else if (bytes[i] == WAKE_BYTE)
+                events |= EVENT_WAKE;
+            else if (bytes[i] == SIGINT)
+                events |= EVENT_QUIT;
+            else if (bytes[i] == SIGBUS)
+                events |= EVENT_LOST;
+            else
+                events |= EVENT_HANGUP;
+        }
+    }
+    return (events);
+}
+
+/*
+ * Sleep until something happens, then report what did
+ * Due timers and the watch callback are run before returning
+ *
+ * @return: EVENT_* flags (0 if the wait was interrupted with nothing to report)
+ */
+int	loop_wait(void)
+{
+    struct pollfd	pfd[3];
+    uint64_t		now;
+    int				n;
+    int				events;
+
+    pfd[0] = (struct pollfd){STDIN_FILENO, POLLIN, 0};
+    pfd[1] = (struct pollfd){g_wake_pipe[0], POLLIN, 0};
+    now = now_ms();
+    n = 2;
+    if (g_watch.fd >= 0 && g_watch.next_ms <= now)
+        pfd[n++] = (struct pollfd){g_watch.fd, POLLIN, 0}; // Not while it rests
+    events = 0;
+    STATS_ADD(STAT_POLLS, 1);
+    if (poll(pfd, n, next_timeout(now)) > 0)
+    {
+        if (pfd[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+            events |= EVENT_HANGUP; // The terminal is gone
+        else if (pfd[0].revents & POLLIN)
+            events |= EVENT_INPUT;
+        if (pfd[1].revents & POLLIN)
+            events |= read_wake_pipe();
+        if (n > 2 && pfd[2].revents != 0)
+        {
+            g_watch.next_ms = now_ms() + g_watch.interval_ms;
+            g_watch.fn(g_watch.arg);
+            events |= EVENT_WATCH;
+        }
+    }
+    if (run_timers())
+        events |= EVENT_TIMER;
+    return (events);
+}
@@ -9,8 +9,9 @@
 
 // Global variable definitions (declared as extern in typedefs.h)
 t_mode	current_mode = MODE_INPUT;      // Start in input mode
-char	text_buffer[MAX_ROWS][MAX_COLS]; // Main text storage
-char	current_filename[256] = {0};     // Currently opened file
+t_buffer	g_buffer;                       // Main text storage (piece table)
+t_undo_log	g_undo = {.budget = UNDO_DEFAULT_BUDGET}; // Undo/redo history of g_buffer
+char	current_filename[PATH_MAX] = {0};     // Currently opened file
 int		g_window_rows = 24;             // Terminal height (default)
 int		g_window_cols = 80;             // Terminal width (default)
 
@@ -24,71 +25,109 @@ int		g_window_cols = 80;             // Terminal width (default)
  */
 int	main(int argc, char **argv)
 {
-    t_cursor	cursor;     // Cursor position and scroll state
+    t_cursor	cursor;     // Cursor position and scroll state (of the tab shown)
     int			c;          // Current key press
+    int			events;     // What woke the event loop (EVENT_* flags)
+    bool		follow;     // -f: follow the first file as it grows
+    uint64_t	start;      // When handling a key or drawing a frame began (":stats")
 
-    // Show splash screen before entering raw mode (normal terminal behavior)
-    show_splash_screen();
+    // Times to first paint and full index count from here (--startup-time)
+    startup_begin();
     
     // Get actual terminal dimensions (adapts to any terminal size)
     get_window_size(&g_window_rows, &g_window_cols);
     
-    // Handle file loading from command line argument
-    if (argc > 1)
+    // Every file on the command line gets a tab; only the first is loaded now
+    follow = false;
+    for (int i = 1; i < argc; i++)
     {
-        load_file(argv[1]);                    // Load specified file
-        strcpy(current_filename, argv[1]);     // Remember filename for saving
+        if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--follow") == 0)
+            follow = true;
+        else if (strcmp(argv[i], "--startup-time") == 0)
+            startup_measure();                 // Report the times and quit once indexed
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+            stats_dump_at_exit(argv[++i]);
+        else if (!tabs_add(argv[i]))
+        {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(ENAMETOOLONG));
+            exit(ERR_INVALID_ARG);
+        }
     }
-    else
+    if (tabs_count() == 0)
     {
-        // No file specified - start with empty buffer
-        memset(text_buffer, ' ', sizeof(text_buffer));
-        current_filename[0] = '\0';            // Mark as new file
+        tabs_add("");                          // No file specified - a new, unnamed one
+        splash_show();                         // Drawn in it until the first key
     }
-    
-    // Initialize cursor to top-left corner with no scrolling
-    cursor.cx = 1;        // Column 1 (1-based indexing)
-    cursor.cy = 1;        // Row 1 (1-based indexing)
-    cursor.scroll_x = 0;  // No horizontal scroll
-    cursor.scroll_y = 0;  // No vertical scroll
+    loop_init();  // Signals and worker threads wake the main loop from here on
+    tabs_switch(0, &cursor);                   // Map it and index the first screen
     
     // Enter raw mode for immediate key response (no buffering/echo)
     enable_raw_mode();
     clear_screen_startup();
+    screen_resize(g_window_rows, g_window_cols); // Screen model starts out blank
+    if (follow && follow_start())
+        handle_index_update(&cursor);          // Show the end of the file
     
-    // Draw initial screen with file contents (if any)
+    // Draw the first screen right away; the indexer does the rest meanwhile
     draw_screen(&cursor);
+    draw_status_line(&cursor);
     draw_cursor(&cursor);
+    screen_flush();
+    startup_painted();
+    frame_set_sync(term_query_sync_update()); // Later frames drawn atomically if supported
+    loop_wake();  // The first pass takes in indexing done meanwhile (or starts idle steps)
     
     /*
      * Main event loop - runs until user quits
-     * Different key handling based on current mode:
+     * Sleeps until something happens, handles everything that did (all the
+     * keys that arrived, finished background work, a resize), then draws
+     * one frame for the whole batch. Keys are handled by mode:
      * - INPUT mode: typing, navigation, editing
      * - COMMAND mode: command entry and execution
      */
     while (1)
     {
-        c = read_key();  // Get next key press (blocking)
-        
-        if (current_mode == MODE_INPUT)
-        {
-            // Input mode: handle typing and navigation
-            process_keypress(c, &cursor);
-            draw_screen(&cursor);    // Refresh display
-            draw_cursor(&cursor);    // Update cursor position
-        }
-        else if (current_mode == MODE_COMMAND)
+        events = loop_wait();  // Blocks until input, a signal, a wakeup or a timer
+        if (events & EVENT_HANGUP)
+            sigint_handle(SIGHUP);  // SIGTERM, SIGHUP or a lost terminal
+        if (events & EVENT_QUIT)
+            sigint_handle(SIGINT);  // Ctrl+C
+        if (events & EVENT_RESIZE)
+            handle_resize(&cursor);
+        if (events & EVENT_LOST)
+            handle_file_lost(&cursor);  // The mapped file shrank: loaded again
+        if (follow_check())
+            handle_index_update(&cursor);  // A followed file shrank: loaded again before keys read it
+        if (events & EVENT_INPUT)
+            key_fill();  // One read() for everything the terminal sent
+        while ((c = key_decode()) >= 0)
         {
-            // Command mode: handle command entry
-            process_command(c, &cursor);
-            
-            // Only redraw screen for navigation keys in command mode
-            if (c == ARROW_UP || c == ARROW_DOWN || c == ARROW_LEFT || c == ARROW_RIGHT)
-            {
-                draw_screen(&cursor);
-                draw_cursor(&cursor);
-            }
+            clear_message();  // Messages last until the next key
+            splash_hide();
+            if (stats_hide())
+                continue ;  // The key only closes the ":stats" overlay
+            STATS_START(start);
+            if (current_mode == MODE_INPUT)
+                process_keypress(c, &cursor);  // Typing and navigation
+            else
+                process_command(c, &cursor);   // Command entry
+            STATS_STOP(STAT_KEY, start);
         }
+        if (save_poll())
+            handle_save_finished();  // Background save completed or failed
+        matches_poll();  // Join match counting workers that are done
+        if (index_progress())
+            handle_index_update(&cursor);  // Background indexer published more lines
+        startup_check();  // Notes when the whole file is indexed (--startup-time)
+        if (events == 0)
+            continue ;  // Interrupted wait: nothing to redraw
+        // One frame for the whole batch: only rows that changed are composed
+        STATS_START(start);
+        draw_screen(&cursor);
+        draw_status_line(&cursor);
+        draw_cursor(&cursor);
+        screen_flush();  // Send only the cells that changed, in one write
+        STATS_STOP(STAT_FRAME, start);
     }
     return (ERR_NO_ERROR);
 }
@@ -0,0 +1,325 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Match Counting
+ * After a search, every match of the pattern is counted in the background
+ * so the status line can show "match k of N". The text - a snapshot of the
+ * buffer plus the part of the file not indexed yet - is cut into chunks of
+ * MATCH_CHUNK bytes that a pool of worker threads, one per core, takes in
+ * turn. A chunk owns the matches that start inside it; one that runs past
+ * its end is still seen whole, since the search reads on into the next
+ * chunk. Chunks cover the text in order, so their match lists laid end to
+ * end are the ordered list of all matches. The count grows as chunks are
+ * finished (each one wakes the event loop); an edit voids it and the
+ * workers are told to stop.
+ */
+
+static t_match_job	*g_matches = NULL;
+
+/*
+ * Search one chunk and publish its matches
+ *
+ * @param pat: Pattern (with this worker's own automata for a regex)
+ * @param c: Chunk index
+ * @param bits: Scratch bitmap of MATCH_CHUNK bits
+ */
+static void	search_chunk(t_match_job *job, const t_pattern *pat, size_t c, uint64_t *bits)
+{
+    t_match_chunk	*chunk;
+    uint64_t		word;
+    size_t			lo;
+    size_t			hi;
+    size_t			count;
+    size_t			kept;
+    size_t			*at;
+
+    lo = c * MATCH_CHUNK;
+    hi = lo + MATCH_CHUNK;
+    if (c + 1 == job->n_chunks)
+        hi = job->text.length + 1; // An empty match can start at the very end
+    memset(bits, 0, ((hi - lo + 63) >> 6) * sizeof(uint64_t));
+    count = search_starts(&job->text, pat, lo, hi, bits);
+    kept = (count < MATCH_CHUNK_KEEP) ? count : MATCH_CHUNK_KEEP;
+    at = malloc(sizeof(size_t) * (kept ? kept : 1));
+    if (at == NULL)
+        die("malloc");
+    for (size_t i = 0, n = 0; n < kept; i++)
+    {
+        for (word = bits[i]; word != 0 && n < kept; word &= word - 1)
+            at[n++] = lo + (i << 6) + __builtin_ctzll(word);
+    }
+    pthread_mutex_lock(&job->lock);
+    chunk = &job->chunks[c];
+    chunk->count = count;
+    chunk->at = at;
+    chunk->kept = kept;
+    chunk->done = true;
+    pthread_mutex_unlock(&job->lock);
+    loop_wake();
+}
+
+/*
+ * Worker thread body: take chunks until there are none left
+ */
+static void	*matches_main(void *arg)
+{
+    t_match_job	*job;
+    t_pattern	pat;
+    const char	*error;
+    uint64_t	*bits;
+    size_t		c;
+
+    job = arg;
+    pat = (t_pattern){job->pattern, job->len, NULL};
+    if (job->re != NULL)
+        pat.re = regex_compile(job->pattern, &error); // Automata are per thread
+    bits = malloc(MATCH_CHUNK / 8);
+    if (bits == NULL)
+        die("malloc");
+    while (1)
+    {
+        pthread_mutex_lock(&job->lock);
+        c = (job->stop || job->next == job->n_chunks) ? SIZE_MAX : job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (c == SIZE_MAX)
+            break ;
+        search_chunk(job, &pat, c, bits);
+    }
+    free(bits);
+    regex_free(pat.re);
+    pthread_mutex_lock(&job->lock);
+    job->running--;
+    pthread_mutex_unlock(&job->lock);
+    loop_wake();
+    return (NULL);
+}
+
+/*
+ * Join the workers and free a count
+ */
+static void	matches_free(t_match_job *job)
+{
+    for (int i = 0; i < job->n_threads; i++)
+        pthread_join(job->threads[i], NULL);
+    for (size_t c = 0; c < job->n_chunks; c++)
+        free(job->chunks[c].at);
+    free(job->chunks);
+    buffer_release_snapshot(&job->snapshot);
+    regex_free(job->re);
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+}
+
+/*
+ * Start counting the matches of a pattern in the background
+ * A count of the same pattern that is still valid is kept as it is
+ *
+ * @param pat: Literal or regular expression (as in search_find)
+ */
+void	matches_start(const t_pattern *pat)
+{
+    t_match_job	*job;
+    const char	*error;
+    long		workers;
+
+    if (g_matches != NULL && !g_matches->stale && g_matches->len == pat->len
+        && (g_matches->re != NULL) == (pat->re != NULL)
+        && memcmp(g_matches->pattern, pat->text, pat->len) == 0)
+        return ;
+    matches_stop();
+    job = calloc(1, sizeof(*job));
+    if (job == NULL || pat->len == 0 || pat->len >= CMD_BUF_SIZE)
+    {
+        free(job);
+        return ;
+    }
+    memcpy(job->pattern, pat->text, pat->len);
+    job->len = pat->len;
+    if (pat->re != NULL)
+        job->re = regex_compile(job->pattern, &error);
+    job->current = SIZE_MAX;
+    job->rank_at = SIZE_MAX;
+    buffer_snapshot(&g_buffer, &job->snapshot);
+    text_init(&job->text, &job->snapshot);
+    job->n_chunks = job->text.length / MATCH_CHUNK + 1;
+    job->chunks = calloc(job->n_chunks, sizeof(t_match_chunk));
+    if (job->chunks == NULL)
+        die("calloc");
+    pthread_mutex_init(&job->lock, NULL);
+    workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers > MATCH_MAX_WORKERS)
+        workers = MATCH_MAX_WORKERS;
+    if (workers > (long)job->n_chunks)
+        workers = job->n_chunks;
+    if (workers < 1)
+        workers = 1;
+    job->running = workers;
+    while (job->n_threads < workers
+        && pthread_create(&job->threads[job->n_threads], NULL, matches_main, job) == 0)
+        job->n_threads++;
+    pthread_mutex_lock(&job->lock);
+    job->running -= workers - job->n_threads; // Workers that failed to start
+    pthread_mutex_unlock(&job->lock);
+    if (job->n_threads == 0)
+    {
+        matches_free(job); // No threads: the status line just shows no count
+        return ;
+    }
+    g_matches = job;
+}
+
+/*
+ * Set the match the cursor is on, whose rank the status line shows
+ *
+ * @param at: Text offset where it starts, or SIZE_MAX for none
+ */
+void	matches_set_current(size_t at)
+{
+    if (g_matches != NULL)
+        g_matches->current = at;
+}
+
+/*
+ * The buffer changed, so the offsets counted no longer apply
+ * The workers are told to stop; matches_poll() joins them without waiting
+ */
+void	matches_cancel(void)
+{
+    if (g_matches == NULL || g_matches->stale)
+        return ;
+    if (g_matches->n_threads == 0)
+    {
+        matches_stop(); // Nothing running: free it right away
+        return ;
+    }
+    g_matches->stale = true;
+    pthread_mutex_lock(&g_matches->lock);
+    g_matches->stop = true;
+    pthread_mutex_unlock(&g_matches->lock);
+}
+
+/*
+ * Stop counting and wait for the workers to exit
+ * Needed before the buffer they read is freed
+ */
+void	matches_stop(void)
+{
+    if (g_matches == NULL)
+        return ;
+    pthread_mutex_lock(&g_matches->lock);
+    g_matches->stop = true;
+    pthread_mutex_unlock(&g_matches->lock);
+    matches_free(g_matches);
+    g_matches = NULL;
+}
+
+/*
+ * Non-blocking: join workers that have finished, and free a voided count
+ * once nothing is running any more
+ *
+ * @return: true if the workers finished
+ */
+bool	matches_poll(void)
+{
+    int	running;
+
+    if (g_matches == NULL || g_matches->n_threads == 0)
+        return (false);
+    pthread_mutex_lock(&g_matches->lock);
+    running = g_matches->running;
+    pthread_mutex_unlock(&g_matches->lock);
+    if (running > 0)
+        return (false);
+    if (g_matches->stale)
+    {
+        matches_free(g_matches);
+        g_matches = NULL;
+        return (true);
+    }
+    for (int i = 0; i < g_matches->n_threads; i++)
+        pthread_join(g_matches->threads[i], NULL);
+    g_matches->n_threads = 0;
+    return (true);
+}
+
+/*
+ * Number of matches of a finished chunk that start at or before at
+ * Past the offsets the chunk kept, the rest of the way is searched again
+ */
+static size_t	chunk_rank(t_match_job *job, const t_match_chunk *chunk, size_t at)
+{
+    t_pattern	pat;
+    uint64_t	*bits;
+    size_t		lo;
+    size_t		hi;
+    size_t		from;
+
+    if (job->rank_at == at)
+        return (job->rank); // Asked for on every frame
+    lo = 0;
+    hi = chunk->kept;
+    while (lo < hi)
+    {
+        if (chunk->at[(lo + hi) / 2] <= at)
+            lo = (lo + hi) / 2 + 1;
+        else
+            hi = (lo + hi) / 2;
+    }
+    if (lo == chunk->kept && chunk->kept < chunk->count)
+    {
+        from = chunk->kept ? chunk->at[chunk->kept - 1] + 1 : at / MATCH_CHUNK * MATCH_CHUNK;
+        bits = calloc((at + 1 - from + 63) >> 6, sizeof(uint64_t));
+        if (bits == NULL)
+            die("calloc");
+        pat = (t_pattern){job->pattern, job->len, job->re};
+        lo += search_starts(&job->text, &pat, from, at + 1, bits);
+        free(bits);
+    }
+    job->rank_at = at;
+    job->rank = lo;
+    return (lo);
+}
+
+/*
+ * Describe the current match for the status line: "match k of N", with a
+ * "+" while chunks are still being searched and "?" for k until every
+ * chunk before the match is done
+ *
+ * @param out: Receives the text
+ * @param size: Size of out
+ * @return: Length of the text (0 if there is nothing to show)
+ */
+int	matches_status(char *out, size_t size)
+{
+    t_match_job	*job;
+    size_t		c;
+    size_t		total;
+    size_t		before;
+    bool		known;
+    bool		complete;
+
+    job = g_matches;
+    if (job == NULL || job->stale || job->current == SIZE_MAX)
+        return (0);
+    c = job->current / MATCH_CHUNK;
+    total = 0;
+    before = 0;
+    complete = true;
+    known = false;
+    pthread_mutex_lock(&job->lock);
+    for (size_t i = 0; i < job->n_chunks; i++)
+    {
+        complete &= job->chunks[i].done;
+        total += job->chunks[i].count;
+        if (i < c)
+            before += job->chunks[i].count;
+        if (i == c)
+            known = complete; // Every chunk up to the match's own is done
+    }
+    pthread_mutex_unlock(&job->lock);
+    if (!known)
+        return (snprintf(out, size, "match ? of %zu+", total));
+    // A finished chunk is not written to again, so it is read unlocked
+    before += chunk_rank(job, &job->chunks[c], job->current);
+    return (snprintf(out, size, "match %zu of %zu%s", before, total, complete ? "" : "+"));
+}
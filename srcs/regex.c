@@ -0,0 +1,1287 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Regular Expressions
+ * A pattern is parsed into a syntax tree and compiled to two Thompson NFAs,
+ * one reading forwards and one reading backwards. Searching runs DFAs whose
+ * states - sets of NFA states - are only built when the input first leads
+ * to them, and are cached with their transitions; the cache is bounded and
+ * simply emptied when it fills up. Every byte is looked at a fixed number
+ * of times, with no backtracking, so no pattern can make a search blow up.
+ * A match is found in three linear passes: the floating forward DFA finds
+ * where the earliest match ends, the backward DFA finds the leftmost start
+ * on that line, and the anchored DFA extends it to the longest match.
+ * When every match starts with the same literal, candidates are found with
+ * the vectorized literal search instead and checked with the anchored DFA.
+ *
+ * Syntax: . [abc] [^a-z] \d \w \s \D \W \S \t ^ $ ( ) | * + ? {m} {m,} {m,n}
+ * and \ before any other punctuation for the character itself. Matches
+ * never span lines: '.', negated classes and \D \W \S do not match '\n'.
+ * The automata read bytes, but '.', classes and escapes match characters:
+ * their non-ASCII part is compiled to alternatives of UTF-8 byte
+ * sequences, so no match starts or ends inside a character.
+ */
+
+/*
+ * Bit operations on 256-bit byte sets
+ */
+static void	class_set(uint64_t *cls, unsigned char c)
+{
+    cls[c >> 6] |= 1ULL << (c & 63);
+}
+
+static bool	class_has(const uint64_t *cls, unsigned char c)
+{
+    return ((cls[c >> 6] >> (c & 63)) & 1);
+}
+
+static void	class_range(uint64_t *cls, unsigned char lo, unsigned char hi)
+{
+    for (int c = lo; c <= hi; c++)
+        class_set(cls, c);
+}
+
+/*
+ * Add a new node to the syntax tree
+ *
+ * @return: Node index, or -1 (with ps->error set) if the tree is full
+ */
+static int	node_new(t_re_parser *ps, t_re_op op, int left, int right)
+{
+    if (ps->n_nodes == REGEX_MAX_NODES)
+    {
+        ps->error = "pattern too large";
+        return (-1);
+    }
+    ps->nodes[ps->n_nodes] = (t_re_node){op, left, right, -1};
+    return (ps->n_nodes++);
+}
+
+/*
+ * Add an empty byte set and an RE_CLASS node using it
+ *
+ * @param cls: Receives the byte set to fill in
+ * @return: Node index, or -1 on error
+ */
+static int	class_node(t_re_parser *ps, uint64_t **cls)
+{
+    t_regex	*re;
+    int		n;
+
+    re = ps->re;
+    n = node_new(ps, RE_CLASS, -1, -1);
+    if (n < 0)
+        return (-1);
+    re->classes = realloc(re->classes, sizeof(*re->classes) * (re->n_classes + 1));
+    if (re->classes == NULL)
+        die("realloc");
+    memset(re->classes[re->n_classes], 0, sizeof(*re->classes));
+    ps->nodes[n].cls = re->n_classes;
+    *cls = re->classes[re->n_classes++];
+    return (n);
+}
+
+/*
+ * Concatenate two nodes, either of which may be missing (-1)
+ */
+static int	node_cat(t_re_parser *ps, int left, int right)
+{
+    if (left < 0)
+        return (right);
+    if (right < 0)
+        return (left);
+    return (node_new(ps, RE_CAT, left, right));
+}
+
+/*
+ * Join two nodes as alternatives, either of which may be missing (-1)
+ */
+static int	node_alt(t_re_parser *ps, int left, int right)
+{
+    if (left < 0)
+        return (right);
+    if (right < 0)
+        return (left);
+    return (node_new(ps, RE_ALT, left, right));
+}
+
+/*
+ * UTF-8 bytes of a code point
+ *
+ * @return: Number of bytes (1 to 4)
+ */
+static int	utf8_bytes(uint32_t cp, unsigned char *out)
+{
+    if (cp < 0x80)
+    {
+        out[0] = cp;
+        return (1);
+    }
+    if (cp < 0x800)
+    {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return (2);
+    }
+    if (cp < 0x10000)
+    {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return (3);
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return (4);
+}
+
+/*
+ * Compile a range of code points to alternatives of byte sequences, one
+ * byte set per byte: the range is split until its first and last code
+ * points have the same length and differ only in bytes that run over their
+ * whole span ([C2-DF][80-BF], E0[A0-BF][80-BF], ...)
+ *
+ * @return: Node index, or -1 on error
+ */
+static int	range_node(t_re_parser *ps, uint32_t lo, uint32_t hi)
+{
+    static const uint32_t	last[] = {0x7F, 0x7FF, 0xFFFF};
+    unsigned char			a[4];
+    unsigned char			b[4];
+    uint64_t				*cls;
+    uint32_t				m;
+    int						len;
+    int						n;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (lo <= last[i] && hi > last[i])
+            return (node_alt(ps, range_node(ps, lo, last[i]), range_node(ps, last[i] + 1, hi)));
+    }
+    for (int i = 1; i < 4; i++)
+    {
+        m = (1u << (6 * i)) - 1;
+        if ((lo & ~m) == (hi & ~m))
+            continue ;
+        if ((lo & m) != 0)
+            return (node_alt(ps, range_node(ps, lo, lo | m), range_node(ps, (lo | m) + 1, hi)));
+        if ((hi & m) != m)
+            return (node_alt(ps, range_node(ps, lo, (hi & ~m) - 1), range_node(ps, hi & ~m, hi)));
+    }
+    len = utf8_bytes(lo, a);
+    utf8_bytes(hi, b);
+    n = -1;
+    for (int i = 0; i < len && ps->error == NULL; i++)
+    {
+        n = node_cat(ps, n, class_node(ps, &cls));
+        if (ps->error == NULL)
+            class_range(cls, a[i], b[i]);
+    }
+    return (n);
+}
+
+/*
+ * Add the characters lo to hi to a set
+ */
+static void	set_add(t_re_parser *ps, t_re_set *set, uint32_t lo, uint32_t hi)
+{
+    for (uint32_t c = lo; c <= hi && c < 0x80; c++)
+        class_set(set->ascii, c);
+    if (hi < 0x80)
+        return ;
+    if (set->n_ranges == REGEX_MAX_RANGES)
+    {
+        ps->error = "class too large";
+        return ;
+    }
+    set->ranges[set->n_ranges][0] = (lo < 0x80) ? 0x80 : lo;
+    set->ranges[set->n_ranges++][1] = hi;
+}
+
+static int	range_cmp(const void *a, const void *b)
+{
+    return ((*(const uint32_t *)a > *(const uint32_t *)b)
+        - (*(const uint32_t *)a < *(const uint32_t *)b));
+}
+
+/*
+ * Sort the ranges of a set and merge those that touch
+ */
+static void	set_merge(t_re_set *set)
+{
+    int	n;
+
+    qsort(set->ranges, set->n_ranges, sizeof(set->ranges[0]), range_cmp);
+    n = 0;
+    for (int i = 0; i < set->n_ranges; i++)
+    {
+        if (n > 0 && set->ranges[i][0] <= set->ranges[n - 1][1] + 1)
+        {
+            if (set->ranges[i][1] > set->ranges[n - 1][1])
+                set->ranges[n - 1][1] = set->ranges[i][1];
+            continue ;
+        }
+        set->ranges[n][0] = set->ranges[i][0];
+        set->ranges[n++][1] = set->ranges[i][1];
+    }
+    set->n_ranges = n;
+}
+
+/*
+ * Turn a set into every character it does not hold
+ */
+static void	set_negate(t_re_set *set)
+{
+    uint32_t	next;
+    uint32_t	lo;
+    uint32_t	hi;
+    int			n;
+
+    set_merge(set);
+    set->ascii[0] = ~set->ascii[0];
+    set->ascii[1] = ~set->ascii[1];
+    next = 0x80;
+    n = 0;
+    for (int i = 0; i < set->n_ranges; i++)
+    {
+        lo = set->ranges[i][0];
+        hi = set->ranges[i][1];
+        if (lo > next)
+        {
+            set->ranges[n][0] = next;
+            set->ranges[n++][1] = lo - 1;
+        }
+        next = hi + 1;
+    }
+    if (next <= 0x10FFFF)
+    {
+        set->ranges[n][0] = next;
+        set->ranges[n++][1] = 0x10FFFF;
+    }
+    set->n_ranges = n;
+}
+
+/*
+ * Compile a set: a byte set for its ASCII characters, or'ed with the byte
+ * sequences of the others, so that a character is always matched whole
+ * Matches never span lines: '\n' is left out
+ *
+ * @return: Node index, or -1 on error
+ */
+static int	set_node(t_re_parser *ps, t_re_set *set)
+{
+    uint64_t	*cls;
+    int			n;
+
+    set->ascii['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+    set_merge(set);
+    n = -1;
+    if ((set->ascii[0] | set->ascii[1]) != 0 || set->n_ranges == 0)
+    {
+        n = class_node(ps, &cls);
+        if (n >= 0)
+            memcpy(cls, set->ascii, sizeof(set->ascii));
+    }
+    for (int i = 0; i < set->n_ranges && ps->error == NULL; i++)
+        n = node_alt(ps, n, range_node(ps, set->ranges[i][0], set->ranges[i][1]));
+    return (n);
+}
+
+/*
+ * Add the characters of a backslash escape to a set
+ * \d \w \s and their negations, \t, and any punctuation for itself
+ *
+ * @return: false if the escape is unknown
+ */
+static bool	escape_class(t_re_parser *ps, char e, t_re_set *set)
+{
+    uint64_t	bits[2];
+    bool		negate;
+
+    memset(bits, 0, sizeof(bits));
+    negate = (e == 'D' || e == 'W' || e == 'S');
+    if (e == 'd' || e == 'D')
+        class_range(bits, '0', '9');
+    else if (e == 'w' || e == 'W')
+    {
+        class_range(bits, 'a', 'z');
+        class_range(bits, 'A', 'Z');
+        class_range(bits, '0', '9');
+        class_set(bits, '_');
+    }
+    else if (e == 's' || e == 'S')
+    {
+        class_set(bits, ' ');
+        class_range(bits, '\t', '\r');
+    }
+    else if (e == 't')
+        class_set(bits, '\t');
+    else if (ispunct((unsigned char)e))
+        class_set(bits, e);
+    else
+        return (false);
+    for (int i = 0; i < 2; i++)
+        set->ascii[i] |= negate ? ~bits[i] : bits[i];
+    if (negate)
+        set_add(ps, set, 0x80, 0x10FFFF); // Every other character too
+    return (true);
+}
+
+/*
+ * Next character of a bracket expression, decoded from UTF-8
+ *
+ * @return: The code point (0 with ps->error set if it is not valid UTF-8)
+ */
+static uint32_t	bracket_char(t_re_parser *ps)
+{
+    uint32_t	cp;
+    size_t		len;
+
+    len = utf8_decode(ps->p, strnlen(ps->p, 4), &cp);
+    if (len == 1 && (unsigned char)*ps->p >= 0x80)
+        ps->error = "invalid UTF-8 in []";
+    ps->p += len;
+    return (cp);
+}
+
+/*
+ * Parse a bracket expression: [abc], [a-z], [^...], with escapes inside
+ * A ']' right after the '[' (or '[^') stands for itself
+ */
+static int	parse_bracket(t_re_parser *ps)
+{
+    t_re_set	set;
+    uint32_t	lo;
+    uint32_t	hi;
+    bool		negate;
+
+    memset(&set, 0, sizeof(set));
+    negate = (*++ps->p == '^');
+    ps->p += negate;
+    for (bool first = true; *ps->p != '\0' && (*ps->p != ']' || first); first = false)
+    {
+        if (*ps->p == '\\' && ps->p[1] != '\0')
+        {
+            if (!escape_class(ps, ps->p[1], &set))
+                ps->error = "unknown escape";
+            ps->p += 2;
+            continue ;
+        }
+        lo = bracket_char(ps);
+        hi = lo;
+        if (*ps->p == '-' && ps->p[1] != '\0' && ps->p[1] != ']')
+        {
+            ps->p++;
+            hi = bracket_char(ps);
+            if (hi < lo)
+                ps->error = "bad range";
+        }
+        if (ps->error == NULL)
+            set_add(ps, &set, lo, hi);
+    }
+    if (*ps->p != ']')
+        ps->error = "missing ]";
+    else
+        ps->p++;
+    if (negate)
+        set_negate(&set);
+    return (ps->error == NULL ? set_node(ps, &set) : -1);
+}
+
+static int	parse_alt(t_re_parser *ps);
+
+/*
+ * Parse one atom: a group, a class, an anchor, an escape or a character
+ */
+static int	parse_atom(t_re_parser *ps)
+{
+    t_re_set	set;
+    uint64_t	*cls;
+    int			n;
+    char		c;
+
+    c = *ps->p;
+    if (c == '(')
+    {
+        ps->p++;
+        n = parse_alt(ps);
+        if (*ps->p != ')' && ps->error == NULL)
+            ps->error = "missing )";
+        ps->p += (*ps->p == ')');
+        return (n);
+    }
+    if (c == '[')
+        return (parse_bracket(ps));
+    ps->p++;
+    if (c == '^' || c == '$')
+        return (node_new(ps, c == '^' ? RE_BOL : RE_EOL, -1, -1));
+    if (c == '*' || c == '+' || c == '?')
+    {
+        ps->error = "nothing to repeat";
+        return (-1);
+    }
+    if (c == '.' || c == '\\')
+    {
+        memset(&set, 0, sizeof(set));
+        if (c == '.')
+            set_negate(&set); // Any character
+        else if (*ps->p == '\0' || !escape_class(ps, *ps->p, &set))
+            ps->error = "unknown escape";
+        ps->p += (c == '\\' && *ps->p != '\0');
+        return (ps->error == NULL ? set_node(ps, &set) : -1);
+    }
+    if ((n = class_node(ps, &cls)) >= 0)
+        class_set(cls, c);
+    return (n);
+}
+
+/*
+ * Expand atom{m,n} into m copies followed by n - m optional ones (or a
+ * star for {m,}); the copies share the atom's subtree
+ */
+static int	parse_count(t_re_parser *ps, int atom)
+{
+    char	*end;
+    long	m;
+    long	n;
+    int		result;
+
+    m = strtol(ps->p + 1, &end, 10);
+    n = m;
+    if (*end == ',')
+        n = (end[1] == '}') ? -1 : strtol(end + 1, &end, 10);
+    if (*end == ',')
+        end++;
+    if (*end != '}' || m > REGEX_MAX_REPEAT || n > REGEX_MAX_REPEAT || (n >= 0 && n < m))
+    {
+        ps->error = "bad {m,n}";
+        return (-1);
+    }
+    ps->p = end + 1;
+    result = -1;
+    for (long i = 0; i < m && ps->error == NULL; i++)
+        result = node_cat(ps, result, atom);
+    if (n < 0)
+        result = node_cat(ps, result, node_new(ps, RE_STAR, atom, -1));
+    for (long i = m; i < n && ps->error == NULL; i++)
+        result = node_cat(ps, result, node_new(ps, RE_QUEST, atom, -1));
+    return (result < 0 ? node_new(ps, RE_EMPTY, -1, -1) : result);
+}
+
+/*
+ * Parse an atom followed by any number of *, +, ? and {m,n}
+ */
+static int	parse_repeat(t_re_parser *ps)
+{
+    int	n;
+
+    n = parse_atom(ps);
+    while (ps->error == NULL)
+    {
+        if (*ps->p == '*')
+            n = node_new(ps, RE_STAR, n, -1);
+        else if (*ps->p == '+')
+            n = node_new(ps, RE_PLUS, n, -1);
+        else if (*ps->p == '?')
+            n = node_new(ps, RE_QUEST, n, -1);
+        else if (*ps->p == '{' && isdigit((unsigned char)ps->p[1]))
+        {
+            n = parse_count(ps, n);
+            continue ;
+        }
+        else
+            break ;
+        ps->p++;
+    }
+    return (n);
+}
+
+/*
+ * Parse alternatives separated by '|', each a sequence of repeats
+ */
+static int	parse_alt(t_re_parser *ps)
+{
+    int	left;
+    int	right;
+
+    left = -1;
+    right = -1;
+    while (ps->error == NULL)
+    {
+        while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')' && ps->error == NULL)
+            right = node_cat(ps, right, parse_repeat(ps));
+        if (right < 0)
+            right = node_new(ps, RE_EMPTY, -1, -1);
+        left = (left < 0) ? right : node_new(ps, RE_ALT, left, right);
+        right = -1;
+        if (*ps->p != '|')
+            break ;
+        ps->p++;
+    }
+    return (left);
+}
+
+/*
+ * Append a state to the NFA being built
+ *
+ * @return: State index, or -1 (with b->error set) if the NFA is full
+ */
+static int	state_new(t_nfa_builder *b, t_nfa_op op, int out, int out1, int cls)
+{
+    if (b->count == REGEX_MAX_STATES)
+    {
+        b->error = "pattern too large";
+        return (-1);
+    }
+    b->states[b->count] = (t_nfa_state){op, out, out1, cls};
+    return (b->count++);
+}
+
+/*
+ * Field a hole code refers to
+ */
+static int	*hole_slot(t_nfa_builder *b, int hole)
+{
+    if (hole & 1)
+        return (&b->states[hole >> 1].out1);
+    return (&b->states[hole >> 1].out);
+}
+
+/*
+ * Point every exit of a hole list at target
+ */
+static void	patch(t_nfa_builder *b, int holes, int target)
+{
+    int	next;
+
+    while (holes >= 0)
+    {
+        next = *hole_slot(b, holes);
+        *hole_slot(b, holes) = target;
+        holes = next;
+    }
+}
+
+/*
+ * Join two hole lists
+ */
+static int	holes_join(t_nfa_builder *b, int first, int second)
+{
+    int	h;
+
+    if (first < 0)
+        return (second);
+    h = first;
+    while (*hole_slot(b, h) >= 0)
+        h = *hole_slot(b, h);
+    *hole_slot(b, h) = second;
+    return (first);
+}
+
+/*
+ * Compile a syntax tree node into an NFA fragment (Thompson construction)
+ * In reverse mode sequences are built back to front and ^/$ swap roles
+ */
+static t_nfa_frag	build(t_nfa_builder *b, int n)
+{
+    const t_re_node	*node;
+    t_nfa_frag		x;
+    t_nfa_frag		y;
+    int				s;
+
+    node = &b->nodes[n];
+    x = (t_nfa_frag){-1, -1};
+    y = x;
+    if (node->op == RE_CAT)
+    {
+        x = build(b, b->reverse ? node->right : node->left);
+        y = build(b, b->reverse ? node->left : node->right);
+        if (b->error == NULL)
+            patch(b, x.holes, y.start);
+        return ((t_nfa_frag){x.start, y.holes});
+    }
+    if (node->op == RE_ALT || node->op == RE_STAR || node->op == RE_PLUS
+        || node->op == RE_QUEST)
+        x = build(b, node->left);
+    if (node->op == RE_ALT)
+        y = build(b, node->right);
+    if (b->error != NULL)
+        return (x);
+    if (node->op == RE_CLASS)
+        s = state_new(b, NFA_CLASS, -1, -1, node->cls);
+    else if (node->op == RE_BOL || node->op == RE_EOL)
+        s = state_new(b, ((node->op == RE_BOL) != b->reverse) ? NFA_BOL : NFA_EOL, -1, -1, -1);
+    else if (node->op == RE_EMPTY)
+        s = state_new(b, NFA_SPLIT, -1, -1, -1);
+    else if (node->op == RE_ALT)
+        s = state_new(b, NFA_SPLIT, x.start, y.start, -1);
+    else
+        s = state_new(b, NFA_SPLIT, x.start, -1, -1);
+    if (s < 0)
+        return (x);
+    if (node->op == RE_ALT)
+        return ((t_nfa_frag){s, holes_join(b, x.holes, y.holes)});
+    if (node->op == RE_STAR || node->op == RE_PLUS)
+    {
+        patch(b, x.holes, s); // Loop back for another round
+        return ((t_nfa_frag){node->op == RE_STAR ? s : x.start, s * 2 + 1});
+    }
+    if (node->op == RE_QUEST)
+        return ((t_nfa_frag){s, holes_join(b, x.holes, s * 2 + 1)});
+    return ((t_nfa_frag){s, s * 2});
+}
+
+/*
+ * Build the NFA for a whole syntax tree
+ *
+ * @param count: Receives the number of states
+ * @param start: Receives the start state
+ * @param error: Receives a description of the problem, if any
+ * @return: The states, or NULL on error
+ */
+static t_nfa_state	*build_nfa(const t_re_node *nodes, int root, bool reverse, int *count,
+    int *start, const char **error)
+{
+    t_nfa_builder	b;
+    t_nfa_frag		f;
+    int				match;
+
+    b = (t_nfa_builder){nodes, malloc(sizeof(t_nfa_state) * REGEX_MAX_STATES), 0,
+        reverse, NULL};
+    if (b.states == NULL)
+        die("malloc");
+    f = build(&b, root);
+    match = (b.error == NULL) ? state_new(&b, NFA_MATCH, -1, -1, -1) : -1;
+    if (b.error != NULL)
+    {
+        *error = b.error;
+        free(b.states);
+        return (NULL);
+    }
+    patch(&b, f.holes, match);
+    *count = b.count;
+    *start = f.start;
+    return (realloc(b.states, sizeof(t_nfa_state) * b.count));
+}
+
+/*
+ * Collect the literal every match starts with into re->prefix
+ *
+ * @return: true if the node matches exactly that literal, so what follows
+ *          it can extend the prefix
+ */
+static bool	collect_prefix(t_regex *re, const t_re_node *nodes, int n)
+{
+    const t_re_node	*node;
+    int				c;
+    int				found;
+
+    node = &nodes[n];
+    if (node->op == RE_EMPTY)
+        return (true);
+    if (node->op == RE_BOL)
+        return (true); // Zero width: checked by the anchored DFA
+    if (node->op == RE_CAT)
+        return (collect_prefix(re, nodes, node->left)
+            && collect_prefix(re, nodes, node->right));
+    if (node->op == RE_PLUS)
+    {
+        collect_prefix(re, nodes, node->left);
+        return (false);
+    }
+    if (node->op != RE_CLASS || re->prefix_len == CMD_BUF_SIZE)
+        return (false);
+    found = -1;
+    for (c = 0; c < 256; c++)
+    {
+        if (!class_has(re->classes[node->cls], c))
+            continue ;
+        if (found >= 0)
+            return (false); // More than one byte
+        found = c;
+    }
+    if (found < 0)
+        return (false);
+    re->prefix[re->prefix_len++] = (char)found;
+    return (true);
+}
+
+/*
+ * Set up an empty DFA over an NFA
+ */
+static void	dfa_init(t_dfa *d, t_regex *re, const t_nfa_state *nfa, int n_nfa, int start,
+    bool floating)
+{
+    memset(d, 0, sizeof(*d));
+    d->nfa = nfa;
+    d->n_nfa = n_nfa;
+    d->start = start;
+    d->floating = floating;
+    d->classes = re->classes;
+    d->table = malloc(sizeof(int) * REGEX_CACHE_STATES * 2);
+    d->mark = calloc(n_nfa, sizeof(int));
+    d->stack = malloc(sizeof(int) * (n_nfa * 2 + 2));
+    d->scratch = malloc(sizeof(int) * n_nfa);
+    if (d->table == NULL || d->mark == NULL || d->stack == NULL || d->scratch == NULL)
+        die("malloc");
+    memset(d->table, 0xFF, sizeof(int) * REGEX_CACHE_STATES * 2);
+}
+
+/*
+ * Forget every cached state (the cache is full)
+ */
+static void	dfa_flush(t_dfa *d)
+{
+    for (int i = 0; i < d->count; i++)
+        free(d->states[i].set);
+    d->count = 0;
+    d->flushes++;
+    memset(d->table, 0xFF, sizeof(int) * REGEX_CACHE_STATES * 2);
+}
+
+static void	dfa_free(t_dfa *d)
+{
+    dfa_flush(d);
+    free(d->states);
+    free(d->table);
+    free(d->mark);
+    free(d->stack);
+    free(d->scratch);
+}
+
+/*
+ * Start collecting a new set of NFA states
+ */
+static void	dfa_new_set(t_dfa *d)
+{
+    if (++d->generation == INT_MAX)
+    {
+        memset(d->mark, 0, sizeof(int) * d->n_nfa);
+        d->generation = 1;
+    }
+}
+
+/*
+ * Add the states reachable from s without consuming input to the set in
+ * d->scratch. ^ is passed at the start of a line; $ is passed only with
+ * eol, otherwise it stays in the set to be resolved by the next byte.
+ *
+ * @param n: Size of the set so far (updated)
+ */
+static void	closure(t_dfa *d, int s, bool bol, bool eol, int *n)
+{
+    const t_nfa_state	*st;
+    int					top;
+
+    top = 0;
+    d->stack[top++] = s;
+    while (top > 0)
+    {
+        s = d->stack[--top];
+        if (s < 0 || d->mark[s] == d->generation)
+            continue ;
+        d->mark[s] = d->generation;
+        st = &d->nfa[s];
+        if (st->op == NFA_SPLIT)
+        {
+            d->stack[top++] = st->out1;
+            d->stack[top++] = st->out;
+        }
+        else if (st->op == NFA_BOL)
+        {
+            if (bol)
+                d->stack[top++] = st->out;
+        }
+        else if (st->op == NFA_EOL && eol)
+            d->stack[top++] = st->out;
+        else
+            d->scratch[(*n)++] = s;
+    }
+}
+
+static int	int_cmp(const void *a, const void *b)
+{
+    return ((*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b));
+}
+
+/*
+ * Whether a set accepts, now or if a line ended here
+ */
+static void	dfa_accepts(t_dfa *d, t_dfa_state *st)
+{
+    int	n;
+
+    st->match = false;
+    st->match_eol = false;
+    for (int i = 0; i < st->count; i++)
+        st->match |= (d->nfa[st->set[i]].op == NFA_MATCH);
+    dfa_new_set(d);
+    n = 0;
+    for (int i = 0; i < st->count; i++)
+    {
+        if (d->nfa[st->set[i]].op == NFA_EOL)
+            closure(d, d->nfa[st->set[i]].out, st->bol, true, &n);
+    }
+    for (int i = 0; i < n; i++)
+        st->match_eol |= (d->nfa[d->scratch[i]].op == NFA_MATCH);
+    st->match_eol |= st->match;
+}
+
+/*
+ * Find the cached state for the set in d->scratch, or build it
+ * A full cache is emptied first
+ *
+ * @return: State index
+ */
+static int	dfa_intern(t_dfa *d, int n, bool bol)
+{
+    t_dfa_state	*st;
+    uint32_t	hash;
+    int			slot;
+    int			mask;
+
+    qsort(d->scratch, n, sizeof(int), int_cmp);
+    hash = 2166136261u ^ bol;
+    for (int i = 0; i < n; i++)
+        hash = (hash ^ (uint32_t)d->scratch[i]) * 16777619u;
+    mask = REGEX_CACHE_STATES * 2 - 1;
+    for (slot = hash & mask; d->table[slot] >= 0; slot = (slot + 1) & mask)
+    {
+        st = &d->states[d->table[slot]];
+        if (st->hash == hash && st->bol == bol && st->count == n
+            && memcmp(st->set, d->scratch, sizeof(int) * n) == 0)
+            return (d->table[slot]);
+    }
+    if (d->count == REGEX_CACHE_STATES)
+    {
+        dfa_flush(d);
+        slot = hash & mask;
+    }
+    if (d->count == d->cap)
+    {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->states = realloc(d->states, sizeof(t_dfa_state) * d->cap);
+        if (d->states == NULL)
+            die("realloc");
+    }
+    st = &d->states[d->count];
+    st->set = malloc(sizeof(int) * (n ? n : 1));
+    if (st->set == NULL)
+        die("malloc");
+    memcpy(st->set, d->scratch, sizeof(int) * n);
+    st->count = n;
+    st->hash = hash;
+    st->bol = bol;
+    memset(st->next, 0xFF, sizeof(st->next));
+    dfa_accepts(d, st);
+    d->table[slot] = d->count;
+    return (d->count++);
+}
+
+/*
+ * State a scan starts in
+ *
+ * @param bol: The scan starts at the start of a line
+ */
+static int	dfa_start(t_dfa *d, bool bol)
+{
+    int	n;
+
+    dfa_new_set(d);
+    n = 0;
+    closure(d, d->start, bol, false, &n);
+    return (dfa_intern(d, n, bol));
+}
+
+/*
+ * Build the transition of state s on byte c
+ */
+static int	dfa_build_next(t_dfa *d, int s, unsigned char c)
+{
+    const t_nfa_state	*st;
+    int					n;
+    int					next;
+    int					flushes;
+
+    dfa_new_set(d);
+    n = 0;
+    for (int i = 0; i < d->states[s].count; i++)
+    {
+        st = &d->nfa[d->states[s].set[i]];
+        if (st->op == NFA_CLASS && class_has(d->classes[st->cls], c))
+            closure(d, st->out, c == '\n', false, &n);
+    }
+    if (d->floating)
+        closure(d, d->start, c == '\n', false, &n);
+    flushes = d->flushes;
+    next = dfa_intern(d, n, c == '\n');
+    if (d->flushes == flushes) // s is gone if the cache was emptied
+        d->states[s].next[c] = next * (int)sizeof(t_dfa_state);
+    return (next);
+}
+
+/*
+ * Follow the transition of state st on byte c
+ * Transitions are byte offsets, so no multiplication sits in the chain of
+ * dependent loads that a scan is made of
+ */
+static inline const t_dfa_state	*dfa_step(t_dfa *d, const t_dfa_state *st, unsigned char c)
+{
+    int	next;
+
+    next = st->next[c];
+    if (next >= 0)
+        return ((const t_dfa_state *)((const char *)d->states + next));
+    next = dfa_build_next(d, st - d->states, c);
+    return (&d->states[next]); // Only now: building may move the states
+}
+
+/*
+ * Whether pos is at the start of a line (the start of the text counts)
+ */
+static bool	at_line_start(const t_text *t, size_t pos)
+{
+    const char	*chunk;
+    size_t		len;
+
+    if (pos == 0)
+        return (true);
+    len = text_chunk_before(t, pos, &chunk);
+    return (len > 0 && chunk[len - 1] == '\n');
+}
+
+/*
+ * Offset of the '\n' ending the line that holds pos (or the text length)
+ */
+static size_t	line_end(const t_text *t, size_t pos)
+{
+    const char	*chunk;
+    const char	*nl;
+    size_t		len;
+
+    while ((len = text_chunk(t, pos, &chunk)) > 0)
+    {
+        nl = memchr(chunk, '\n', len);
+        if (nl != NULL)
+            return (pos + (nl - chunk));
+        pos += len;
+    }
+    return (pos);
+}
+
+/*
+ * Offset where the line that holds pos starts
+ */
+static size_t	line_begin(const t_text *t, size_t pos)
+{
+    const char	*chunk;
+    size_t		len;
+
+    while ((len = text_chunk_before(t, pos, &chunk)) > 0)
+    {
+        for (size_t i = len; i > 0; i--)
+        {
+            if (chunk[i - 1] == '\n')
+                return (pos - len + i);
+        }
+        pos -= len;
+    }
+    return (0);
+}
+
+/*
+ * Longest match starting exactly at start (anchored DFA)
+ *
+ * @param end: Receives the end of the match
+ * @return: Whether there is one
+ */
+static bool	match_longest(t_regex *re, const t_text *t, size_t start, size_t *end)
+{
+    t_dfa				*d;
+    const t_dfa_state	*st;
+    const char			*chunk;
+    size_t				pos;
+    size_t				len;
+    bool				found;
+    int					s;
+
+    d = &re->anchored;
+    s = dfa_start(d, at_line_start(t, start));
+    st = &d->states[s]; // dfa_start() may move the states
+    found = false;
+    pos = start;
+    while ((len = text_chunk(t, pos, &chunk)) > 0)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (st->match_eol && (st->match || chunk[i] == '\n'))
+            {
+                found = true;
+                *end = pos + i;
+            }
+            if (st->count == 0)
+                return (found); // Nothing can match any more
+            st = dfa_step(d, st, chunk[i]);
+        }
+        pos += len;
+    }
+    if (st->match_eol)
+    {
+        found = true;
+        *end = pos;
+    }
+    return (found);
+}
+
+/*
+ * End of the earliest-ending match that starts at lo or later (floating
+ * DFA). Gives up at the first line break past hi: a match starting before
+ * hi would have ended by then.
+ *
+ * @return: Whether there is one
+ */
+static bool	match_earliest_end(t_regex *re, const t_text *t, size_t lo, size_t hi,
+    size_t *end)
+{
+    t_dfa				*d;
+    const t_dfa_state	*st;
+    const char			*chunk;
+    size_t				pos;
+    size_t				len;
+    int					s;
+
+    d = &re->floating;
+    s = dfa_start(d, at_line_start(t, lo));
+    st = &d->states[s]; // dfa_start() may move the states
+    pos = lo;
+    while ((len = text_chunk(t, pos, &chunk)) > 0)
+    {
+        for (size_t i = 0; i < len; i++)
+        {
+            if (st->match_eol && (st->match || chunk[i] == '\n'))
+            {
+                *end = pos + i;
+                return (true);
+            }
+            if (chunk[i] == '\n' && pos + i >= hi)
+                return (false);
+            st = dfa_step(d, st, chunk[i]);
+        }
+        pos += len;
+    }
+    *end = pos;
+    return (st->match_eol);
+}
+
+/*
+ * Mark a match start in a bitmap of the offsets from lo
+ */
+static void	mark_start(uint64_t *bits, size_t lo, size_t at)
+{
+    if (bits != NULL)
+        bits[(at - lo) >> 6] |= 1ULL << ((at - lo) & 63);
+}
+
+/*
+ * Scan backwards from the end of the line holding `from` with the backward
+ * DFA, which accepts wherever a match starts
+ *
+ * @param lo: Stop here
+ * @param hi: Only starts before hi count
+ * @param first: Stop at the first (rightmost) start found
+ * @param bits: If not NULL, every start found is marked in it
+ * @return: The leftmost start found (or the rightmost with first), or SIZE_MAX
+ */
+static size_t	match_starts(t_regex *re, const t_text *t, size_t from, size_t lo,
+    size_t hi, bool first, uint64_t *bits)
+{
+    t_dfa				*d;
+    const t_dfa_state	*st;
+    const char			*chunk;
+    size_t				pos;
+    size_t				len;
+    size_t				at;
+    size_t				best;
+    int					s;
+
+    d = &re->backward;
+    pos = line_end(t, from);
+    s = dfa_start(d, true);
+    st = &d->states[s]; // dfa_start() may move the states
+    best = SIZE_MAX;
+    if (pos < hi && st->match_eol && (st->match || at_line_start(t, pos)))
+    {
+        best = pos;
+        mark_start(bits, lo, pos);
+    }
+    while (pos > lo && (best == SIZE_MAX || !first)
+        && (len = text_chunk_before(t, pos, &chunk)) > 0)
+    {
+        if (len > pos - lo)
+        {
+            chunk += len - (pos - lo);
+            len = pos - lo;
+        }
+        for (size_t i = len; i-- > 0;)
+        {
+            st = dfa_step(d, st, chunk[i]);
+            at = pos - len + i;
+            if (!st->match_eol || at >= hi || ((unsigned char)chunk[i] & 0xC0) == 0x80)
+                continue ; // Not even an empty match starts inside a character
+            // Going backwards, a line ends where the byte before is '\n'
+            if (st->match || (i > 0 ? chunk[i - 1] == '\n' : at_line_start(t, at)))
+            {
+                best = at;
+                mark_start(bits, lo, at);
+                if (first)
+                    break ;
+            }
+        }
+        pos -= len;
+    }
+    return (best);
+}
+
+/*
+ * Leftmost-longest match of a regular expression starting in [lo, hi), or
+ * the one starting last when searching backwards
+ *
+ * @param re: Compiled expression
+ * @param t: Text to search
+ * @param start: Receives the start of the match
+ * @param end: Receives its end
+ * @return: Whether there is one
+ */
+bool	regex_find(t_regex *re, const t_text *t, size_t lo, size_t hi, bool backward,
+    size_t *start, size_t *end)
+{
+    size_t	at;
+    size_t	first_end;
+
+    if (hi > t->length + 1)
+        hi = t->length + 1; // An empty match can start at the very end
+    if (re->prefix_len > 0)
+    {
+        // Every match starts with the prefix: check each occurrence
+        while ((at = text_find_in(t, re->prefix, re->prefix_len, lo, hi, backward)) != SIZE_MAX)
+        {
+            if (match_longest(re, t, at, end))
+            {
+                *start = at;
+                return (true);
+            }
+            if (backward)
+                hi = at;
+            else
+                lo = at + 1;
+        }
+        return (false);
+    }
+    if (lo >= hi)
+        return (false);
+    if (backward)
+        at = match_starts(re, t, hi - 1, lo, hi, true, NULL);
+    else if (match_earliest_end(re, t, lo, hi, &first_end))
+        // The leftmost match starts on the line where the earliest one ends
+        at = match_starts(re, t, first_end, lo > line_begin(t, first_end) ? lo
+            : line_begin(t, first_end), SIZE_MAX, false, NULL);
+    else
+        at = SIZE_MAX;
+    if (at == SIZE_MAX || at >= hi)
+        return (false);
+    *start = at;
+    return (match_longest(re, t, at, end));
+}
+
+/*
+ * Mark every offset in [lo, hi) where a match starts
+ * Without a literal prefix this is one backward pass over the range (and
+ * the rest of its last line), however many matches there are
+ *
+ * @param bits: Bitmap of the offsets from lo, cleared by the caller
+ */
+void	regex_starts(t_regex *re, const t_text *t, size_t lo, size_t hi, uint64_t *bits)
+{
+    size_t	from;
+    size_t	start;
+    size_t	end;
+
+    if (hi > t->length + 1)
+        hi = t->length + 1;
+    if (lo >= hi)
+        return ;
+    if (re->prefix_len == 0)
+    {
+        match_starts(re, t, hi - 1, lo, hi, false, bits);
+        return ;
+    }
+    // Candidates from the literal search, each checked by the anchored DFA
+    from = lo;
+    while (regex_find(re, t, from, hi, false, &start, &end))
+    {
+        mark_start(bits, lo, start);
+        from = start + 1;
+    }
+}
+
+/*
+ * Compile a regular expression
+ *
+ * @param pattern: NUL-terminated pattern
+ * @param error: Receives a description of what is wrong with it
+ * @return: The compiled expression (free with regex_free), or NULL
+ */
+t_regex	*regex_compile(const char *pattern, const char **error)
+{
+    t_re_parser	ps;
+    t_regex		*re;
+    int			root;
+    int			fwd_start;
+    int			rev_start;
+
+    re = calloc(1, sizeof(*re));
+    ps = (t_re_parser){pattern, malloc(sizeof(t_re_node) * REGEX_MAX_NODES), 0, re, NULL};
+    if (re == NULL || ps.nodes == NULL)
+        die("malloc");
+    root = parse_alt(&ps);
+    if (ps.error == NULL && *ps.p != '\0')
+        ps.error = "unmatched )";
+    if (ps.error == NULL)
+        re->forward = build_nfa(ps.nodes, root, false, &re->n_forward, &fwd_start, &ps.error);
+    if (ps.error == NULL)
+        re->reverse = build_nfa(ps.nodes, root, true, &re->n_reverse, &rev_start, &ps.error);
+    if (ps.error == NULL)
+        collect_prefix(re, ps.nodes, root);
+    free(ps.nodes);
+    if (ps.error != NULL)
+    {
+        *error = ps.error;
+        regex_free(re);
+        return (NULL);
+    }
+    dfa_init(&re->anchored, re, re->forward, re->n_forward, fwd_start, false);
+    dfa_init(&re->floating, re, re->forward, re->n_forward, fwd_start, true);
+    dfa_init(&re->backward, re, re->reverse, re->n_reverse, rev_start, true);
+    return (re);
+}
+
+/*
+ * Release a compiled expression (NULL is ignored)
+ */
+void	regex_free(t_regex *re)
+{
+    if (re == NULL)
+        return ;
+    if (re->anchored.table != NULL)
+    {
+        dfa_free(&re->anchored);
+        dfa_free(&re->floating);
+        dfa_free(&re->backward);
+    }
+    free(re->forward);
+    free(re->reverse);
+    free(re->classes);
+    free(re);
+}
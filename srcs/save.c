@@ -0,0 +1,361 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON File Saving
+ * The document is written in one pass over the piece table: contiguous runs
+ * of bytes are gathered into iovecs and handed to writev() in batches, so a
+ * file costs a handful of syscalls no matter how many lines it has. Output
+ * goes to a temporary file next to the target, which is fsync'ed and then
+ * renamed over it - a crash mid-save leaves either the old file or the new
+ * one, never half of each.
+ * ":w" runs in the background: the writer thread gets an O(1) copy-on-write
+ * snapshot of the buffer, so editing continues while the file is written.
+ */
+
+// Save running in the background, or NULL
+static t_save_job	*g_save_job = NULL;
+
+/*
+ * Write every byte described by iov, continuing after partial writes
+ *
+ * @return: 0 on success, -1 with errno set on failure
+ */
+static int	write_iov(int fd, struct iovec *iov, int count)
+{
+    ssize_t	written;
+
+    while (count > 0)
+    {
+        written = writev(fd, iov, count);
+        STATS_ADD(STAT_FILE_WRITES, 1);
+        if (written < 0 && errno == EINTR)
+            continue ;
+        if (written < 0)
+            return (-1);
+        STATS_ADD(STAT_FILE_BYTES, written);
+        // Skip whatever the kernel already took
+        while (count > 0 && (size_t)written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return (0);
+}
+
+/*
+ * Stream the whole document to fd
+ * The part of a mapped file the indexer has not reached yet is written
+ * straight from the mapping, so saving never waits for the scan
+ *
+ * @param buf: Buffer to write
+ * @param fd: Destination file
+ * @param total: Receives the number of bytes written
+ * @return: 0 on success, -1 with errno set on failure
+ */
+static int	write_buffer(const t_buffer *buf, int fd, size_t *total)
+{
+    struct iovec	iov[SAVE_IOV_BATCH];
+    int				n;
+    size_t			pos;
+    size_t			len;
+    const char		*chunk;
+
+    n = 0;
+    pos = 0;
+    while ((len = buffer_chunk(buf, pos, &chunk)) > 0)
+    {
+        iov[n++] = (struct iovec){(void *)chunk, len};
+        pos += len;
+        if (n == SAVE_IOV_BATCH)
+        {
+            if (write_iov(fd, iov, n) != 0)
+                return (-1);
+            n = 0;
+        }
+    }
+    if ((len = buffer_unindexed(buf, &chunk)) > 0)
+        iov[n++] = (struct iovec){(void *)chunk, len};
+    if (n > 0 && write_iov(fd, iov, n) != 0)
+        return (-1);
+    *total = pos + len;
+    return (0);
+}
+
+/*
+ * Make a completed rename durable by syncing the directory holding it
+ * Best effort: some filesystems refuse to fsync directories
+ */
+static void	sync_parent_dir(const char *path)
+{
+    char		dir[PATH_MAX];
+    const char	*slash;
+    int			fd;
+
+    slash = strrchr(path, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == path)
+        strcpy(dir, "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1)
+        return ;
+    fsync(fd);
+    STATS_ADD(STAT_FILE_SYNCS, 1);
+    close(fd);
+}
+
+/*
+ * Save a buffer to a file, atomically replacing it
+ * Symlinks are followed so the file they point to is the one replaced, and
+ * an existing file keeps its permissions
+ *
+ * @param buf: Buffer to save
+ * @param filename: Path to file to save
+ * @param written: Receives the number of bytes written (may be NULL)
+ * @return: 0 on success, -1 with errno set on failure (the target is untouched)
+ */
+int	save_buffer(const t_buffer *buf, const char *filename, size_t *written)
+{
+    char		target[PATH_MAX];
+    char		tmp[PATH_MAX];
+    struct stat	st;
+    mode_t		mask;
+    size_t		total;
+    int			fd;
+    int			saved_errno;
+
+    if (realpath(filename, target) == NULL)
+    {
+        if (errno != ENOENT)
+            return (-1);
+        // New file: save under the name given
+        if (snprintf(target, sizeof(target), "%s", filename) >= (int)sizeof(target))
+        {
+            errno = ENAMETOOLONG;
+            return (-1);
+        }
+    }
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", target) >= (int)sizeof(tmp))
+    {
+        errno = ENAMETOOLONG;
+        return (-1);
+    }
+    fd = mkstemp(tmp);
+    if (fd == -1)
+        return (-1);
+    if (stat(target, &st) == 0)
+        fchmod(fd, st.st_mode & 07777);
+    else
+    {
+        // Same permissions open(..., 0644) would have given a new file
+        mask = umask(0);
+        umask(mask);
+        fchmod(fd, 0644 & ~mask);
+    }
+    total = 0;
+    STATS_ADD(STAT_FILE_SYNCS, 1); // The fsync() below
+    if (write_buffer(buf, fd, &total) != 0 || fsync(fd) != 0)
+    {
+        saved_errno = errno;
+        close(fd);
+        unlink(tmp);
+        errno = saved_errno;
+        return (-1);
+    }
+    if (close(fd) != 0 || rename(tmp, target) != 0)
+    {
+        saved_errno = errno;
+        unlink(tmp);
+        errno = saved_errno;
+        return (-1);
+    }
+    sync_parent_dir(target);
+    if (written != NULL)
+        *written = total;
+    return (0);
+}
+
+/*
+ * Save the current text buffer to a file and report the outcome on the
+ * command line
+ *
+ * @param filename: Path to file to save
+ * @return: 0 on success, -1 on failure
+ */
+int	save_to_file(const char *filename)
+{
+    size_t		written;
+    uint64_t	start;
+    int			result;
+
+    STATS_START(start);
+    result = save_buffer(&g_buffer, filename, &written);
+    STATS_STOP(STAT_SAVE, start);
+    if (result != 0)
+    {
+        set_message("Can't write \"%s\": %s", filename, strerror(errno));
+        return (-1);
+    }
+    set_message("\"%s\" %zu bytes written", filename, written);
+    return (0);
+}
+
+/*
+ * A save of the document succeeded: take the new name if asked to, and
+ * restart the journal once the document is its file again
+ *
+ * @param mark: journal_mark() when the save began
+ * @param edits: The document's edit count when the save began
+ */
+static void	saved(const char *filename, bool adopt_name, off_t mark, size_t edits)
+{
+    if (adopt_name) // A name that was written to is not longer than PATH_MAX
+        snprintf(current_filename, sizeof(current_filename), "%s", filename);
+    if (strcmp(filename, current_filename) == 0)
+    {
+        journal_saved(&g_buffer, filename, mark);
+        g_buffer.saved = edits; // Edits made while it was written are still unsaved
+    }
+}
+
+/*
+ * Writer thread body: stream the snapshot, then flag completion and wake
+ * the main loop
+ */
+static void	*save_main(void *arg)
+{
+    t_save_job	*job;
+    size_t		written;
+    int			error;
+    uint64_t	start;
+
+    job = arg;
+    written = 0;
+    error = 0;
+    STATS_START(start);
+    if (save_buffer(&job->snapshot, job->filename, &written) != 0)
+        error = errno;
+    STATS_STOP(STAT_SAVE, start);
+    pthread_mutex_lock(&job->lock);
+    job->written = written;
+    job->error = error;
+    job->done = true;
+    pthread_mutex_unlock(&job->lock);
+    loop_wake();
+    return (NULL);
+}
+
+/*
+ * Join a finished (or finishing) writer and report its result
+ */
+static void	save_reap(void)
+{
+    t_save_job	*job;
+
+    job = g_save_job;
+    pthread_join(job->thread, NULL);
+    buffer_release_snapshot(&job->snapshot);
+    if (job->error != 0)
+        set_message("Can't write \"%s\": %s", job->filename, strerror(job->error));
+    else
+    {
+        set_message("\"%s\" %zu bytes written", job->filename, job->written);
+        saved(job->filename, job->adopt_name, job->journal_mark, job->snapshot.edits);
+    }
+    pthread_mutex_destroy(&job->lock);
+    free(job);
+    g_save_job = NULL;
+}
+
+/*
+ * Start saving the current buffer in the background
+ * A save still running is waited for first, so saves land in order. If no
+ * thread can be started the file is saved right away instead.
+ *
+ * @param filename: Path to file to save
+ * @param adopt_name: Make filename the current filename once saved
+ */
+void	save_start(const char *filename, bool adopt_name)
+{
+    t_save_job	*job;
+
+    save_wait();
+    job = calloc(1, sizeof(*job));
+    if (job == NULL || strlen(filename) >= sizeof(job->filename))
+    {
+        free(job);
+        if (save_to_file(filename) == 0)
+            saved(filename, adopt_name, journal_mark(g_buffer.journal), g_buffer.edits);
+        return ;
+    }
+    strcpy(job->filename, filename);
+    job->adopt_name = adopt_name;
+    pthread_mutex_init(&job->lock, NULL);
+    buffer_snapshot(&g_buffer, &job->snapshot);
+    job->journal_mark = journal_mark(g_buffer.journal);
+    if (pthread_create(&job->thread, NULL, save_main, job) != 0)
+    {
+        buffer_release_snapshot(&job->snapshot);
+        pthread_mutex_destroy(&job->lock);
+        free(job);
+        if (save_to_file(filename) == 0)
+            saved(filename, adopt_name, journal_mark(g_buffer.journal), g_buffer.edits);
+        return ;
+    }
+    g_save_job = job;
+    set_message("Writing \"%s\"...", filename);
+}
+
+/*
+ * Save the current buffer in the foreground (":wq"), after a save still
+ * running
+ *
+ * @param filename: Path to file to save
+ * @return: 0 on success (the document counts as saved), -1 on failure
+ */
+int	save_now(const char *filename)
+{
+    save_wait();
+    if (save_to_file(filename) != 0)
+        return (-1);
+    saved(filename, false, journal_mark(g_buffer.journal), g_buffer.edits);
+    return (0);
+}
+
+/*
+ * Non-blocking: report a background save that has finished
+ *
+ * @return: true if a save finished (its result is now the message)
+ */
+bool	save_poll(void)
+{
+    bool	done;
+
+    if (g_save_job == NULL)
+        return (false);
+    pthread_mutex_lock(&g_save_job->lock);
+    done = g_save_job->done;
+    pthread_mutex_unlock(&g_save_job->lock);
+    if (done)
+        save_reap();
+    return (done);
+}
+
+/*
+ * Block until a background save (if any) has finished
+ * Needed before the buffer it reads from is freed or the editor exits
+ */
+void	save_wait(void)
+{
+    if (g_save_job != NULL)
+        save_reap();
+}
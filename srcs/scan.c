@@ -0,0 +1,230 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Newline Scanning
+ * Finding line breaks is the hot loop of loading a file, so it is
+ * vectorized: compare 16 (SSE2) or 64 (AVX2) bytes against '\n' at once,
+ * turn the result into a bit mask and walk the set bits. A scalar memchr
+ * version is used on other CPUs. The best implementation is picked once at
+ * run time, so one binary runs everywhere.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define SCAN_HAVE_X86 1
+#else
+# define SCAN_HAVE_X86 0
+#endif
+
+/*
+ * Scalar fallback: count newlines with memchr
+ */
+static size_t	count_scalar(const char *data, size_t len)
+{
+    const char	*p;
+    const char	*end;
+    size_t		n;
+
+    n = 0;
+    end = data + len;
+    p = memchr(data, '\n', len);
+    while (p != NULL)
+    {
+        n++;
+        p = memchr(p + 1, '\n', end - p - 1);
+    }
+    return (n);
+}
+
+/*
+ * Scalar fallback: record newline offsets with memchr
+ */
+static size_t	scan_scalar(const char *data, size_t len, size_t base, size_t *out)
+{
+    const char	*p;
+    const char	*end;
+    size_t		n;
+
+    n = 0;
+    end = data + len;
+    p = memchr(data, '\n', len);
+    while (p != NULL)
+    {
+        out[n++] = base + (p - data);
+        p = memchr(p + 1, '\n', end - p - 1);
+    }
+    return (n);
+}
+
+#if SCAN_HAVE_X86
+
+/*
+ * SSE2: 16 bytes per compare
+ */
+__attribute__((target("sse2")))
+static size_t	count_sse2(const char *data, size_t len)
+{
+    const __m128i	nl = _mm_set1_epi8('\n');
+    size_t			i;
+    size_t			n;
+
+    n = 0;
+    for (i = 0; i + 16 <= len; i += 16)
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(data + i)), nl)));
+    return (n + count_scalar(data + i, len - i));
+}
+
+__attribute__((target("sse2")))
+static size_t	scan_sse2(const char *data, size_t len, size_t base, size_t *out)
+{
+    const __m128i	nl = _mm_set1_epi8('\n');
+    size_t			i;
+    size_t			n;
+    uint32_t		mask;
+
+    n = 0;
+    for (i = 0; i + 16 <= len; i += 16)
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(data + i)), nl));
+        while (mask)
+        {
+            out[n++] = base + i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return (n + scan_scalar(data + i, len - i, base + i, out + n));
+}
+
+/*
+ * AVX2: two 32-byte compares folded into one 64-bit mask per step
+ */
+__attribute__((target("avx2,popcnt,bmi")))
+static uint64_t	mask64_avx2(const char *p, __m256i nl)
+{
+    uint32_t	lo;
+    uint32_t	hi;
+
+    lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)p), nl));
+    hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+        _mm256_loadu_si256((const __m256i *)(p + 32)), nl));
+    return ((uint64_t)hi << 32 | lo);
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t	count_avx2(const char *data, size_t len)
+{
+    const __m256i	nl = _mm256_set1_epi8('\n');
+    size_t			i;
+    size_t			n;
+
+    n = 0;
+    for (i = 0; i + 64 <= len; i += 64)
+        n += __builtin_popcountll(mask64_avx2(data + i, nl));
+    return (n + count_scalar(data + i, len - i));
+}
+
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t	scan_avx2(const char *data, size_t len, size_t base, size_t *out)
+{
+    const __m256i	nl = _mm256_set1_epi8('\n');
+    size_t			i;
+    size_t			n;
+    uint64_t		mask;
+
+    n = 0;
+    for (i = 0; i + 64 <= len; i += 64)
+    {
+        mask = mask64_avx2(data + i, nl);
+        while (mask)
+        {
+            out[n++] = base + i + __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+    }
+    return (n + scan_scalar(data + i, len - i, base + i, out + n));
+}
+
+#endif
+
+// Every implementation this binary was built with, best first
+static const t_newline_impl	g_impls[] = {
+#if SCAN_HAVE_X86
+    {"avx2", count_avx2, scan_avx2},
+    {"sse2", count_sse2, scan_sse2},
+#endif
+    {"scalar", count_scalar, scan_scalar},
+};
+
+static const t_newline_impl	*g_best = NULL;
+static pthread_once_t		g_best_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Whether the running CPU can execute an implementation
+ */
+static bool	impl_supported(const t_newline_impl *impl)
+{
+#if SCAN_HAVE_X86
+    __builtin_cpu_init();
+    if (strcmp(impl->name, "avx2") == 0)
+        return (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")
+            && __builtin_cpu_supports("bmi"));
+    if (strcmp(impl->name, "sse2") == 0)
+        return (__builtin_cpu_supports("sse2"));
+#endif
+    (void)impl;
+    return (true);
+}
+
+/*
+ * Pick the fastest implementation the CPU supports (runs once)
+ */
+static void	select_best(void)
+{
+    size_t	i;
+
+    i = 0;
+    while (!impl_supported(&g_impls[i]))
+        i++;
+    g_best = &g_impls[i];
+}
+
+/*
+ * List the newline scanners usable on this CPU, best first
+ * Used by the benchmark to compare implementations
+ *
+ * @param count: Receives the number of entries
+ * @return: Array of implementations
+ */
+const t_newline_impl	*newline_impls(size_t *count)
+{
+    size_t	first;
+
+    pthread_once(&g_best_once, select_best);
+    first = g_best - g_impls;
+    *count = sizeof(g_impls) / sizeof(g_impls[0]) - first;
+    return (g_best);
+}
+
+/*
+ * Count '\n' bytes in data[0, len)
+ */
+size_t	newline_count(const char *data, size_t len)
+{
+    pthread_once(&g_best_once, select_best);
+    return (g_best->count(data, len));
+}
+
+/*
+ * Store base + offset of every '\n' in data[0, len) into out
+ * out must have room for newline_count(data, len) entries
+ *
+ * @return: Number of offsets written
+ */
+size_t	newline_scan(const char *data, size_t len, size_t base, size_t *out)
+{
+    pthread_once(&g_best_once, select_best);
+    return (g_best->scan(data, len, base, out));
+}
@@ -0,0 +1,466 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Screen Model
+ * Keeps two grids of cells: front (what the terminal shows now) and back
+ * (the frame being composed). Drawing code only writes into back, and only
+ * for rows marked dirty. screen_flush() compares the dirty spans of back
+ * against front and appends escape sequences for the cells that actually
+ * changed, so typing a character costs a few bytes instead of a full frame.
+ * Vertical scrolling shifts the terminal's own contents with a scroll region
+ * (screen_scroll) so that only the newly exposed lines are drawn.
+ * A cell holds one character as UTF-8 (plus any marks drawn on it); a
+ * double-width character takes its cell and a continuation cell after it,
+ * and the two are always written, compared and emitted together.
+ */
+
+static t_screen	g_screen; // Zero-initialized: empty model, ATTR_NORMAL
+static const t_cell	g_blank = {" ", ATTR_NORMAL};
+
+// SGR sequence selecting each cell attribute
+static const char	*g_attr_sgr[ATTR_COUNT] = {
+    "\x1b[0m",    // ATTR_NORMAL
+    "\x1b[0;90m", // ATTR_GUTTER: bright black (grey)
+    "\x1b[0;7m",  // ATTR_MATCH: reverse video
+    "\x1b[0;35m", // ATTR_KEYWORD: magenta
+    "\x1b[0;36m", // ATTR_TYPE: cyan
+    "\x1b[0;32m", // ATTR_STRING: green
+    "\x1b[0;33m", // ATTR_NUMBER: yellow
+    "\x1b[0;3;90m", // ATTR_COMMENT: grey italics
+    "\x1b[0;34m", // ATTR_PREPROC: blue
+    "\x1b[0;31m", // ATTR_CONSTANT: red
+    "\x1b[0;1;36m", // ATTR_VARIABLE: bold cyan
+    "\x1b[0;1;31m", // ATTR_ERROR: bold red
+    "\x1b[0;1;33m", // ATTR_WARNING: bold yellow
+};
+
+/*
+ * Reset a row of cells to blanks
+ */
+static void	cells_clear(t_cell *cells, int count)
+{
+    for (int i = 0; i < count; i++)
+        cells[i] = g_blank;
+}
+
+/*
+ * Whether two cells show the same thing
+ */
+static bool	cell_equal(const t_cell *a, const t_cell *b)
+{
+    return (memcmp(a, b, sizeof(t_cell)) == 0);
+}
+
+/*
+ * Before cells [lo, hi) of a row are overwritten: a double-width character
+ * cut in half by the edges of the range is replaced by a blank
+ */
+static void	cells_split(t_cell *cells, int lo, int hi)
+{
+    if (lo > 0 && lo < g_screen.cols && cells[lo].ch[0] == '\0')
+        memcpy(cells[lo - 1].ch, g_blank.ch, CELL_BYTES);
+    if (hi < g_screen.cols && cells[hi].ch[0] == '\0')
+        memcpy(cells[hi].ch, g_blank.ch, CELL_BYTES);
+}
+
+/*
+ * (Re)allocate the model for a terminal of rows x cols
+ * Assumes the terminal has just been cleared: front starts out blank and
+ * every row is dirty, so the next flush paints everything once
+ *
+ * @param rows: Terminal height
+ * @param cols: Terminal width
+ */
+void	screen_resize(int rows, int cols)
+{
+    free(g_screen.front);
+    free(g_screen.back);
+    free(g_screen.dirty);
+    g_screen.rows = rows;
+    g_screen.cols = cols;
+    g_screen.front = malloc(sizeof(t_cell) * rows * cols);
+    g_screen.back = malloc(sizeof(t_cell) * rows * cols);
+    g_screen.dirty = malloc(sizeof(t_span) * rows);
+    if (!g_screen.front || !g_screen.back || !g_screen.dirty)
+        die("malloc");
+    cells_clear(g_screen.front, rows * cols);
+    cells_clear(g_screen.back, rows * cols);
+    g_screen.attr = ATTR_NORMAL;
+    screen_invalidate_rows(0, rows);
+}
+
+/*
+ * Mark rows [from, to) as needing to be composed and compared again
+ */
+void	screen_invalidate_rows(int from, int to)
+{
+    if (from < 0)
+        from = 0;
+    if (to > g_screen.rows)
+        to = g_screen.rows;
+    for (int y = from; y < to; y++)
+    {
+        g_screen.dirty[y].lo = 0;
+        g_screen.dirty[y].hi = g_screen.cols;
+    }
+}
+
+/*
+ * Mark columns [lo, hi) of one row as changed
+ * Spans of the same row are merged into their bounding span
+ */
+void	screen_invalidate_span(int row, int lo, int hi)
+{
+    t_span	*span;
+
+    if (row < 0 || row >= g_screen.rows)
+        return ;
+    if (lo < 0)
+        lo = 0;
+    if (hi > g_screen.cols)
+        hi = g_screen.cols;
+    if (lo >= hi)
+        return ;
+    span = &g_screen.dirty[row];
+    if (span->lo >= span->hi)
+    {
+        span->lo = lo;
+        span->hi = hi;
+        return ;
+    }
+    if (lo < span->lo)
+        span->lo = lo;
+    if (hi > span->hi)
+        span->hi = hi;
+}
+
+/*
+ * Whether a row has to be composed for the next frame
+ */
+bool	screen_row_dirty(int row)
+{
+    return (row >= 0 && row < g_screen.rows
+        && g_screen.dirty[row].lo < g_screen.dirty[row].hi);
+}
+
+/*
+ * Write UTF-8 text into the back buffer
+ * Each character takes as many cells as its display width (marks join the
+ * cell before them); control characters and invalid bytes show as '?'.
+ * Text past the right edge is dropped, and a double-width character that
+ * does not fit in the last column is shown as a blank
+ *
+ * @param row: Screen row (0-based)
+ * @param col: Screen column (0-based)
+ * @param s: Text
+ * @param len: Length of s in bytes
+ * @param attr: Attribute for all of it
+ * @return: Columns the text takes (including any dropped past the edge)
+ */
+int	screen_put(int row, int col, const char *s, int len, uint8_t attr)
+{
+    t_cell		*cells;
+    t_cell		*last;
+    uint32_t	cp;
+    uint32_t	prev;
+    size_t		n;
+    size_t		used;
+    int			x;
+    int			width;
+
+    if (row < 0 || row >= g_screen.rows)
+        return (0);
+    cells = g_screen.back + row * g_screen.cols;
+    last = NULL;
+    prev = 0;
+    x = col;
+    for (int i = 0; i < len; i += n)
+    {
+        n = utf8_decode(s + i, len - i, &cp);
+        if (i > 0 && utf8_extends(prev, cp))
+        {
+            // A mark or joined character: drawn on the cell before it, as
+            // long as it fits (a joiner only with room for what it joins)
+            used = last ? strnlen(last->ch, CELL_BYTES) : CELL_BYTES;
+            if (used + n + (cp == UTF8_ZWJ ? 4 : 0) <= CELL_BYTES)
+                memcpy(last->ch + used, s + i, n);
+            else
+                last = NULL; // Drop the rest of the character
+            prev = cp;
+            continue ;
+        }
+        width = utf8_printable(cp) ? utf8_width(cp) : 1;
+        if (width == 0)
+            width = 1; // A mark with nothing to sit on
+        prev = cp;
+        last = NULL;
+        if (x >= 0 && x + width <= g_screen.cols)
+        {
+            cells_split(cells, x, x + width);
+            last = &cells[x];
+            memset(last->ch, 0, CELL_BYTES);
+            if (utf8_printable(cp))
+                memcpy(last->ch, s + i, n);
+            else
+                last->ch[0] = '?';
+            last->attr = attr;
+            if (width == 2)
+                cells[x + 1] = (t_cell){{0}, attr};
+        }
+        else if (x >= 0 && x < g_screen.cols)
+        {
+            cells_split(cells, x, x + 1);
+            cells[x] = (t_cell){" ", attr};
+        }
+        x += width;
+    }
+    return (x - col);
+}
+
+/*
+ * Copy composed cells into the back buffer
+ * Cells past the right edge are dropped; a double-width character whose
+ * right half would be dropped is shown as a blank
+ *
+ * @param row: Screen row (0-based)
+ * @param col: Screen column (0-based)
+ * @param src: Cells (continuation cells right after their character)
+ * @param count: Number of cells
+ */
+void	screen_put_cells(int row, int col, const t_cell *src, int count)
+{
+    t_cell	*cells;
+    int		n;
+
+    if (row < 0 || row >= g_screen.rows || col < 0 || col >= g_screen.cols
+        || count <= 0)
+        return ;
+    n = (count > g_screen.cols - col) ? g_screen.cols - col : count;
+    cells = g_screen.back + row * g_screen.cols;
+    cells_split(cells, col, col + n);
+    memcpy(cells + col, src, sizeof(t_cell) * n);
+    if (cells[col].ch[0] == '\0')
+        memcpy(cells[col].ch, g_blank.ch, CELL_BYTES);
+    if (n < count && src[n].ch[0] == '\0')
+        memcpy(cells[col + n - 1].ch, g_blank.ch, CELL_BYTES);
+}
+
+/*
+ * Change the attribute of cells already written to the back buffer
+ * (e.g. to highlight a search match inside a composed row)
+ *
+ * @param row: Screen row (0-based)
+ * @param col: First screen column (0-based)
+ * @param len: Number of cells
+ * @param attr: New attribute
+ */
+void	screen_set_attr(int row, int col, int len, uint8_t attr)
+{
+    t_cell	*cells;
+
+    if (row < 0 || row >= g_screen.rows)
+        return ;
+    cells = g_screen.back + row * g_screen.cols;
+    for (int i = (col < 0 ? -col : 0); i < len && col + i < g_screen.cols; i++)
+        cells[col + i].attr = attr;
+}
+
+/*
+ * Blank a row of the back buffer from col to the right edge
+ */
+void	screen_clear_to_eol(int row, int col)
+{
+    if (row < 0 || row >= g_screen.rows || col >= g_screen.cols)
+        return ;
+    cells_clear(g_screen.back + row * g_screen.cols + col, g_screen.cols - col);
+}
+
+/*
+ * Where the terminal cursor should be at the end of each frame
+ *
+ * @param row: Screen row (0-based), or -1 to hide the cursor
+ * @param col: Screen column (0-based)
+ */
+void	screen_set_cursor(int row, int col)
+{
+    if (row != g_screen.cursor_row || col != g_screen.cursor_col)
+        g_screen.cursor_moved = true;
+    g_screen.cursor_row = row;
+    g_screen.cursor_col = col;
+}
+
+/*
+ * Switch the terminal to another cell attribute if needed
+ */
+static void	emit_attr(uint8_t attr)
+{
+    if (attr == g_screen.attr)
+        return ;
+    frame_append(g_attr_sgr[attr], strlen(g_attr_sgr[attr]));
+    g_screen.attr = attr;
+}
+
+/*
+ * Move rows of the model within [top, bottom) by n rows; rows moved out are
+ * lost and the rows left behind are blank
+ */
+static void	shift_rows(t_cell *cells, int top, int bottom, int n)
+{
+    int	cols;
+    int	count;
+
+    cols = g_screen.cols;
+    count = (n > 0) ? n : -n;
+    if (n > 0)
+    {
+        memmove(cells + top * cols, cells + (top + count) * cols,
+            sizeof(t_cell) * (bottom - top - count) * cols);
+        cells_clear(cells + (bottom - count) * cols, count * cols);
+    }
+    else
+    {
+        memmove(cells + (top + count) * cols, cells + top * cols,
+            sizeof(t_cell) * (bottom - top - count) * cols);
+        cells_clear(cells + top * cols, count * cols);
+    }
+}
+
+/*
+ * Scroll the terminal rows [top, bottom) by n lines inside a scroll region
+ * The terminal shifts what it already shows (DECSTBM plus index or reverse
+ * index), the model is shifted to match, and only the exposed rows are left
+ * dirty. A shift as tall as the region just repaints it.
+ *
+ * @param top: First row of the region (0-based)
+ * @param bottom: Row after the region
+ * @param n: > 0 moves the content up (view moves down), < 0 moves it down
+ */
+void	screen_scroll(int top, int bottom, int n)
+{
+    int	count;
+
+    count = (n > 0) ? n : -n;
+    if (count == 0)
+        return ;
+    if (count >= bottom - top)
+    {
+        screen_invalidate_rows(top, bottom);
+        return ;
+    }
+    // New lines come in blank with the current colors, so reset them first
+    emit_attr(ATTR_NORMAL);
+    frame_appendf("\x1b[%d;%dr", top + 1, bottom);
+    if (n > 0)
+        frame_appendf("\x1b[%d;1H", bottom);  // IND at the bottom scrolls up
+    else
+        frame_appendf("\x1b[%d;1H", top + 1); // RI at the top scrolls down
+    for (int i = 0; i < count; i++)
+        frame_append(n > 0 ? "\x1b" "D" : "\x1b" "M", 2);
+    frame_append("\x1b[r", 3);                  // Back to the full screen
+    shift_rows(g_screen.front, top, bottom, n);
+    shift_rows(g_screen.back, top, bottom, n);
+    // Pending damage moves with its rows; exposed rows need composing
+    if (n > 0)
+    {
+        memmove(g_screen.dirty + top, g_screen.dirty + top + count,
+            sizeof(t_span) * (bottom - top - count));
+        screen_invalidate_rows(bottom - count, bottom);
+    }
+    else
+    {
+        memmove(g_screen.dirty + top + count, g_screen.dirty + top,
+            sizeof(t_span) * (bottom - top - count));
+        screen_invalidate_rows(top, top + count);
+    }
+}
+
+/*
+ * Emit the changed cells of one row's dirty span and copy them to front
+ * Unchanged runs shorter than a cursor move are rewritten rather than
+ * skipped, and a blank tail is cleared with EL instead of spaces. The
+ * right half of a double-width character goes out with its left half.
+ */
+static void	flush_row(int y)
+{
+    t_cell	*back;
+    t_cell	*front;
+    int		x;
+    int		end;
+    int		blank_from;
+    int		gap;
+
+    back = g_screen.back + y * g_screen.cols;
+    front = g_screen.front + y * g_screen.cols;
+    end = g_screen.dirty[y].hi;
+    // Where the trailing run of plain blanks starts in the new row
+    blank_from = g_screen.cols;
+    while (blank_from > 0 && cell_equal(&back[blank_from - 1], &g_blank))
+        blank_from--;
+    x = g_screen.dirty[y].lo;
+    while (x < end)
+    {
+        if (cell_equal(&back[x], &front[x]))
+        {
+            x++;
+            continue ;
+        }
+        if (x > 0 && back[x].ch[0] == '\0')
+            x--; // Start from the left half of the character
+        frame_appendf("\x1b[%d;%dH", y + 1, x + 1);
+        while (x < end)
+        {
+            if (x >= blank_from && end == g_screen.cols)
+            {
+                // Everything from here is blank: one EL instead of spaces
+                emit_attr(ATTR_NORMAL);
+                frame_append("\x1b[K", 3);
+                memcpy(front + x, back + x, sizeof(t_cell) * (end - x));
+                x = end;
+                break ;
+            }
+            // Stop at a run of unchanged cells long enough to jump over
+            gap = 0;
+            while (x + gap < end && gap < SCREEN_SKIP_GAP
+                && cell_equal(&back[x + gap], &front[x + gap]))
+                gap++;
+            if (gap == SCREEN_SKIP_GAP || x + gap == end)
+                break ;
+            emit_attr(back[x].attr);
+            if (back[x].ch[0] == '\0')
+                frame_append(" ", 1); // Stray right half (never composed)
+            else
+                frame_append(back[x].ch, strnlen(back[x].ch, CELL_BYTES));
+            front[x] = back[x];
+            x++;
+            while (x < g_screen.cols && back[x].ch[0] == '\0')
+            {
+                front[x] = back[x];
+                x++;
+            }
+        }
+    }
+    g_screen.dirty[y].lo = 0;
+    g_screen.dirty[y].hi = 0;
+}
+
+/*
+ * Turn the differences between back and front into terminal output,
+ * position the cursor, and send the frame
+ */
+void	screen_flush(void)
+{
+    for (int y = 0; y < g_screen.rows; y++)
+    {
+        if (screen_row_dirty(y))
+            flush_row(y);
+    }
+    emit_attr(ATTR_NORMAL);
+    // Drawing moved the terminal cursor, so put it back where it belongs
+    if ((frame_length() > 0 || g_screen.cursor_moved) && g_screen.cursor_row >= 0)
+        frame_appendf("\x1b[?25h\x1b[%d;%dH", g_screen.cursor_row + 1,
+            g_screen.cursor_col + 1);
+    else if (g_screen.cursor_moved)
+        frame_append("\x1b[?25l", 6);
+    g_screen.cursor_moved = false;
+    frame_flush();
+}
@@ -0,0 +1,430 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Search
+ * Finds patterns in the document: literals with the vectorized searcher in
+ * find.c, one contiguous run of bytes at a time, and regular expressions
+ * with the automata in regex.c. A match that straddles two
+ * runs is caught by searching the few bytes around their boundary. The part
+ * of a mapped file the indexer has not reached yet is searched straight from
+ * the mapping - it always follows the end of the document - so a search
+ * never waits for the line index. Both are seen through a t_text view.
+ * "/" and "?" search as the pattern is typed: each longer pattern resumes
+ * from the match of the previous one (nothing before it can match), and
+ * erasing a character goes back to the match remembered for the shorter
+ * pattern, so no keystroke rescans text already searched.
+ */
+
+static t_search	g_search;
+
+/*
+ * View the current document, plus the part of its file not indexed yet
+ * The view stays valid until the buffer is edited or indexed further
+ *
+ * @param t: View to fill in
+ * @param buf: Buffer to look at
+ */
+void	text_init(t_text *t, const t_buffer *buf)
+{
+    t->buf = buf;
+    t->size = buffer_size(buf);
+    t->length = t->size + buffer_unindexed(buf, &t->tail);
+}
+
+/*
+ * Contiguous run of text starting at pos (see buffer_chunk)
+ *
+ * @return: Length of the run (0 at the end of the text)
+ */
+size_t	text_chunk(const t_text *t, size_t pos, const char **out)
+{
+    if (pos < t->size)
+        return (buffer_chunk(t->buf, pos, out));
+    if (pos >= t->length)
+        return (0);
+    *out = t->tail + (pos - t->size);
+    return (t->length - pos);
+}
+
+/*
+ * Contiguous run of text ending at pos (see buffer_chunk_before)
+ *
+ * @return: Length of the run (0 at the start of the text)
+ */
+size_t	text_chunk_before(const t_text *t, size_t pos, const char **out)
+{
+    if (pos <= t->size)
+        return (buffer_chunk_before(t->buf, pos, out));
+    *out = t->tail;
+    return (pos - t->size);
+}
+
+/*
+ * Copy text[pos, pos + len) into dst
+ */
+static void	text_read(const t_text *t, size_t pos, char *dst, size_t len)
+{
+    const char	*chunk;
+    size_t		avail;
+
+    while (len > 0 && (avail = text_chunk(t, pos, &chunk)) > 0)
+    {
+        if (avail > len)
+            avail = len;
+        memcpy(dst, chunk, avail);
+        dst += avail;
+        pos += avail;
+        len -= avail;
+    }
+}
+
+/*
+ * Match of pat inside text[from, end) that straddles the run boundary at b
+ * (the runs on either side were searched on their own)
+ */
+static size_t	find_straddling(const t_text *t, const char *pat, size_t n, size_t b,
+    size_t from, size_t end, bool backward)
+{
+    char	window[2 * CMD_BUF_SIZE];
+    size_t	lo;
+    size_t	hi;
+    size_t	at;
+
+    lo = (b - from > n - 1) ? b - (n - 1) : from;
+    hi = (end - b > n - 1) ? b + (n - 1) : end;
+    text_read(t, lo, window, hi - lo);
+    if (backward)
+        at = text_rfind(window, hi - lo, pat, n);
+    else
+        at = text_find(window, hi - lo, pat, n);
+    return (at == SIZE_MAX ? at : lo + at);
+}
+
+/*
+ * First match of pat lying entirely inside text[from, end)
+ *
+ * @return: Offset of the match, or SIZE_MAX
+ */
+static size_t	find_forward(const t_text *t, const char *pat, size_t n, size_t from,
+    size_t end)
+{
+    const char	*chunk;
+    size_t		pos;
+    size_t		len;
+    size_t		at;
+
+    pos = from;
+    while (pos < end && (len = text_chunk(t, pos, &chunk)) > 0)
+    {
+        if (len > end - pos)
+            len = end - pos;
+        at = text_find(chunk, len, pat, n);
+        if (at != SIZE_MAX)
+            return (pos + at);
+        pos += len;
+        if (n > 1 && pos < end)
+        {
+            at = find_straddling(t, pat, n, pos, from, end, false);
+            if (at != SIZE_MAX)
+                return (at);
+        }
+    }
+    return (SIZE_MAX);
+}
+
+/*
+ * Last match of pat lying entirely inside text[from, end)
+ *
+ * @return: Offset of the match, or SIZE_MAX
+ */
+static size_t	find_backward(const t_text *t, const char *pat, size_t n, size_t from,
+    size_t end)
+{
+    const char	*chunk;
+    size_t		pos;
+    size_t		len;
+    size_t		at;
+
+    pos = end;
+    while (pos > from && (len = text_chunk_before(t, pos, &chunk)) > 0)
+    {
+        if (len > pos - from)
+        {
+            chunk += len - (pos - from);
+            len = pos - from;
+        }
+        at = text_rfind(chunk, len, pat, n);
+        if (at != SIZE_MAX)
+            return (pos - len + at);
+        pos -= len;
+        if (n > 1 && pos > from)
+        {
+            at = find_straddling(t, pat, n, pos, from, end, true);
+            if (at != SIZE_MAX)
+                return (at);
+        }
+    }
+    return (SIZE_MAX);
+}
+
+/*
+ * Literal match of pat starting in [lo, hi): the first one, or the last
+ * one when searching backwards
+ *
+ * @param t: Text to search
+ * @param pat: Pattern (at most CMD_BUF_SIZE bytes)
+ * @param n: Pattern length
+ * @return: Offset of the match, or SIZE_MAX
+ */
+size_t	text_find_in(const t_text *t, const char *pat, size_t n, size_t lo, size_t hi,
+    bool backward)
+{
+    size_t	end;
+
+    if (hi > t->length)
+        hi = t->length;
+    if (lo >= hi || n == 0 || n > CMD_BUF_SIZE)
+        return (SIZE_MAX);
+    end = t->length;
+    if (end - hi > n - 1)
+        end = hi + n - 1;
+    if (backward)
+        return (find_backward(t, pat, n, lo, end));
+    return (find_forward(t, pat, n, lo, end));
+}
+
+/*
+ * Match of a literal or regular expression starting in [lo, hi)
+ *
+ * @param end: Receives the end of the match
+ * @return: Start of the match, or SIZE_MAX
+ */
+static size_t	find_starting_in(const t_text *t, const t_pattern *pat, size_t lo,
+    size_t hi, bool backward, size_t *end)
+{
+    size_t	start;
+
+    if (pat->re != NULL)
+    {
+        if (!regex_find(pat->re, t, lo, hi, backward, &start, end))
+            return (SIZE_MAX);
+        return (start);
+    }
+    start = text_find_in(t, pat->text, pat->len, lo, hi, backward);
+    *end = start + pat->len;
+    return (start);
+}
+
+/*
+ * First match of a literal or regular expression starting in [lo, hi)
+ *
+ * @param end: Receives the end of the match
+ * @return: Start of the match, or SIZE_MAX
+ */
+size_t	search_next(const t_text *t, const t_pattern *pat, size_t lo, size_t hi,
+    size_t *end)
+{
+    return (find_starting_in(t, pat, lo, hi, false, end));
+}
+
+/*
+ * Mark every offset in [lo, hi) where a match starts - for a literal, every
+ * occurrence, overlapping ones included - so the matches Ctrl+N would visit
+ * one by one can be counted in a single pass
+ *
+ * @param bits: Bitmap of the offsets from lo, cleared by the caller
+ * @return: Number of matches
+ */
+size_t	search_starts(const t_text *t, const t_pattern *pat, size_t lo, size_t hi,
+    uint64_t *bits)
+{
+    size_t	at;
+    size_t	count;
+
+    if (pat->re != NULL)
+        regex_starts(pat->re, t, lo, hi, bits);
+    else
+    {
+        at = lo;
+        while ((at = text_find_in(t, pat->text, pat->len, at, hi, false)) != SIZE_MAX)
+        {
+            bits[(at - lo) >> 6] |= 1ULL << ((at - lo) & 63);
+            at++;
+        }
+    }
+    count = 0;
+    for (size_t i = 0; hi > lo && i <= (hi - lo - 1) >> 6; i++)
+        count += __builtin_popcountll(bits[i]);
+    return (count);
+}
+
+/*
+ * Search around the text from `from`, wrapping at either end
+ * Forward finds the first match starting at or after from, backward the
+ * last one starting before it; if there is none, the search continues from
+ * the other end of the text
+ *
+ * @param pat: Literal or regular expression to find
+ * @param from: Text offset to start from
+ * @param backward: Search towards the start of the text
+ * @param wrapped: Receives whether the match was found after wrapping
+ * @param end: Receives the end of the match
+ * @return: Offset of the match, or SIZE_MAX if the pattern does not occur
+ */
+size_t	search_find(const t_pattern *pat, size_t from, bool backward, bool *wrapped,
+    size_t *end)
+{
+    t_text	t;
+    size_t	at;
+
+    *wrapped = false;
+    text_init(&t, &g_buffer);
+    if (pat->len == 0 || (pat->re == NULL && pat->len > t.length))
+        return (SIZE_MAX);
+    if (from > t.length)
+        from = t.length;
+    if (backward)
+        at = find_starting_in(&t, pat, 0, from, true, end);
+    else
+        at = find_starting_in(&t, pat, from, t.length + 1, false, end);
+    if (at != SIZE_MAX)
+        return (at);
+    *wrapped = true;
+    if (backward)
+        return (find_starting_in(&t, pat, from, t.length + 1, true, end));
+    return (find_starting_in(&t, pat, 0, from, false, end));
+}
+
+/*
+ * Continue an incremental search for a longer pattern from `at`, where the
+ * shorter one matched - an earlier match of the longer pattern would have
+ * been an earlier match of the shorter one too. Only the part of the cycle
+ * from at back round to the origin is left to search.
+ */
+static size_t	search_resume(const char *pat, size_t n, size_t at, bool *wrapped)
+{
+    t_text	t;
+    size_t	start;
+    size_t	found;
+
+    text_init(&t, &g_buffer);
+    if (n > t.length)
+        return (SIZE_MAX);
+    start = g_search.origin;
+    if (!g_search.backward)
+    {
+        start = (start < t.length) ? start + 1 : t.length;
+        if (*wrapped)
+            return (text_find_in(&t, pat, n, at, start, false));
+        found = text_find_in(&t, pat, n, at, t.length, false);
+        if (found != SIZE_MAX)
+            return (found);
+        *wrapped = true;
+        return (text_find_in(&t, pat, n, 0, start, false));
+    }
+    if (*wrapped)
+        return (text_find_in(&t, pat, n, start, at + 1, true));
+    found = text_find_in(&t, pat, n, 0, at + 1, true);
+    if (found != SIZE_MAX)
+        return (found);
+    *wrapped = true;
+    return (text_find_in(&t, pat, n, start, t.length, true));
+}
+
+/*
+ * Start a search-as-you-type session
+ *
+ * @param origin: Text offset of the cursor when the search began
+ * @param backward: "?" search (towards the start of the text)
+ */
+void	search_begin(size_t origin, bool backward)
+{
+    g_search.origin = origin;
+    g_search.backward = backward;
+    g_search.len = 0;
+    g_search.found[0] = SIZE_MAX;
+    g_search.wrapped[0] = false;
+}
+
+/*
+ * Find the current pattern of a search-as-you-type session
+ * Only what changed since the last call is searched: characters typed at
+ * the end resume from the previous match, erased ones fall back to the
+ * match found for the shorter pattern, and a pattern whose start already
+ * had no match is not searched at all
+ *
+ * @param pat: Pattern typed so far
+ * @param n: Its length
+ * @param wrapped: Receives whether the match lies past the end of the text
+ *                 (relative to the search direction)
+ * @return: Offset of the match, or SIZE_MAX if there is none
+ */
+size_t	search_update(const char *pat, size_t n, bool *wrapped)
+{
+    t_pattern	first;
+    size_t		keep;
+    size_t		end;
+
+    if (n >= CMD_BUF_SIZE)
+        n = CMD_BUF_SIZE - 1;
+    keep = 0;
+    while (keep < n && keep < g_search.len && g_search.pattern[keep] == pat[keep])
+        keep++;
+    memcpy(g_search.pattern, pat, n);
+    for (size_t k = keep + 1; k <= n; k++)
+    {
+        *wrapped = false;
+        if (k == 1)
+        {
+            // First character: a full search from the origin
+            first = (t_pattern){pat, 1, NULL};
+            g_search.found[1] = search_find(&first, g_search.origin
+                + (g_search.backward ? 0 : 1), g_search.backward, wrapped, &end);
+        }
+        else if (g_search.found[k - 1] == SIZE_MAX)
+            g_search.found[k] = SIZE_MAX;
+        else
+        {
+            *wrapped = g_search.wrapped[k - 1];
+            g_search.found[k] = search_resume(pat, k, g_search.found[k - 1], wrapped);
+        }
+        g_search.wrapped[k] = *wrapped;
+    }
+    g_search.len = n;
+    *wrapped = g_search.wrapped[n];
+    return (g_search.found[n]);
+}
+
+/*
+ * Remember a pattern for repeating the search (empty "/", Ctrl+N, Ctrl+P)
+ *
+ * @param pat: Pattern text (a literal, or the source of re)
+ * @param n: Its length
+ * @param backward: Searches with it go backwards
+ * @param re: Compiled regular expression, or NULL for a literal; it now
+ *            belongs to the search state
+ */
+void	search_set_last(const char *pat, size_t n, bool backward, t_regex *re)
+{
+    if (n >= CMD_BUF_SIZE)
+        n = CMD_BUF_SIZE - 1;
+    memmove(g_search.last, pat, n); // pat may be the last pattern itself
+    g_search.last[n] = '\0';
+    g_search.last_len = n;
+    g_search.last_backward = backward;
+    if (g_search.last_re != re)
+        regex_free(g_search.last_re);
+    g_search.last_re = re;
+}
+
+/*
+ * Last pattern searched for
+ *
+ * @param pat: Receives the pattern (length 0 if nothing was searched yet)
+ * @param backward: Receives whether it was a "?" search
+ */
+void	search_last(t_pattern *pat, bool *backward)
+{
+    *pat = (t_pattern){g_search.last, g_search.last_len, g_search.last_re};
+    *backward = g_search.last_backward;
+}
@@ -0,0 +1,198 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Startup
+ * The first screen of a file is drawn as soon as it is indexed - files are
+ * mapped and only the lines in view are scanned before the first frame (a
+ * screenful of bytes at most: a long line is drawn as far as it is in),
+ * the rest by the background indexer - and nothing waits in between: the
+ * splash, shown only when no file is named, is drawn in the empty document
+ * until the first key, and the terminal is asked about synchronized output
+ * after the first frame is out.
+ * --startup-time measures it: the editor quits as soon as the whole file
+ * is indexed and prints how long, from main(), the first frame and the
+ * full index took.
+ */
+
+static struct
+{
+    uint64_t	start_ns;       // main() began
+    uint64_t	painted_ns;     // First frame sent (0 until then)
+    uint64_t	indexed_ns;     // Whole file indexed (0 until then)
+    bool		measure;        // --startup-time: report and quit once indexed
+    bool		splash;         // Splash on screen (until the first key)
+    char		text[4096];     // Splash lines
+}	g_startup;
+
+/*
+ * Nanoseconds on the monotonic clock
+ */
+static uint64_t	now_ns(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Start the clock (first thing in main())
+ */
+void	startup_begin(void)
+{
+    g_startup.start_ns = now_ns();
+}
+
+/*
+ * Print the startup times (run by exit(), after the terminal is restored
+ * and cleared: before enable_raw_mode(), this was registered first)
+ */
+static void	report(void)
+{
+    printf("%s: %zu bytes, %zu lines\n", current_filename[0] ? current_filename : "(new file)",
+        buffer_size(&g_buffer), buffer_line_count(&g_buffer));
+    if (g_startup.painted_ns != 0)
+        printf("first paint    %10.2f ms\n", (g_startup.painted_ns - g_startup.start_ns) / 1e6);
+    if (g_startup.indexed_ns != 0)
+        printf("fully indexed  %10.2f ms\n", (g_startup.indexed_ns - g_startup.start_ns) / 1e6);
+    else
+        printf("fully indexed  not yet (quit first)\n");
+}
+
+/*
+ * Quit once the whole file is indexed, printing the startup times
+ * (--startup-time; before enable_raw_mode())
+ */
+void	startup_measure(void)
+{
+    if (!g_startup.measure)
+        atexit(report);
+    g_startup.measure = true;
+}
+
+/*
+ * Note that the whole file is indexed, the first time it is (called after
+ * the first frame and whenever indexing progressed)
+ */
+void	startup_check(void)
+{
+    if (g_startup.indexed_ns != 0 || g_startup.painted_ns == 0
+        || !buffer_fully_indexed(&g_buffer))
+        return ;
+    g_startup.indexed_ns = now_ns();
+    if (g_startup.measure)
+    {
+        journal_close_all(true); // Nothing was edited: a recovered swap file stays
+        reset_screen();
+        exit(ERR_NO_ERROR);      // The times are printed on the way out
+    }
+}
+
+/*
+ * Note that the first frame was sent
+ */
+void	startup_painted(void)
+{
+    if (g_startup.painted_ns == 0)
+        g_startup.painted_ns = now_ns();
+    startup_check(); // A small file is indexed already
+}
+
+/*
+ * Show the splash in the empty document until the first key
+ * Its text is verbatron.txt next to the executable, or a line of fallback
+ */
+void	splash_show(void)
+{
+    char	path[PATH_MAX];
+    ssize_t	len;
+    char	*slash;
+    int		fd;
+
+    len = readlink("/proc/self/exe", path, sizeof(path) - sizeof("verbatron.txt"));
+    path[(len > 0) ? len : 0] = '\0';
+    slash = strrchr(path, '/');
+    fd = -1;
+    if (slash != NULL)
+    {
+        strcpy(slash + 1, "verbatron.txt");
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    len = (fd != -1) ? read(fd, g_startup.text, sizeof(g_startup.text) - 1) : -1;
+    if (fd != -1)
+        close(fd);
+    if (len <= 0)
+        len = snprintf(g_startup.text, sizeof(g_startup.text), "VERBATRON\nText Editor\n");
+    g_startup.text[len] = '\0';
+    g_startup.splash = true;
+}
+
+/*
+ * Take the splash away (called for every key; the key does what it does)
+ */
+void	splash_hide(void)
+{
+    if (!g_startup.splash)
+        return ;
+    g_startup.splash = false;
+    screen_invalidate_rows(0, g_window_rows - 1); // The text under it
+}
+
+/*
+ * Display columns of a line of the splash
+ */
+static int	text_width(const char *s, size_t len)
+{
+    uint32_t	cp;
+    size_t		n;
+    int			width;
+
+    width = 0;
+    for (size_t i = 0; i < len; i += n)
+    {
+        n = utf8_decode(s + i, len - i, &cp);
+        width += utf8_width(cp);
+    }
+    return (width);
+}
+
+/*
+ * Draw the splash centered over the text rows, if shown (after
+ * draw_text_buffer(), every frame, so a resize centers it again)
+ * The lines are centered as a block, keeping the picture in one piece
+ */
+void	splash_draw(void)
+{
+    const char	*line;
+    const char	*end;
+    int			lines;
+    int			width;
+    int			row;
+    int			col;
+
+    if (!g_startup.splash)
+        return ;
+    lines = 0;
+    width = 0;
+    for (line = g_startup.text; *line != '\0'; line = end + (*end == '\n'))
+    {
+        end = line + strcspn(line, "\n");
+        if (text_width(line, end - line) > width)
+            width = text_width(line, end - line);
+        lines++;
+    }
+    row = (g_window_rows - 1 - lines) / 2;
+    col = (g_window_cols - width) / 2;
+    if (row < 0)
+        row = 0;
+    if (col < 0)
+        col = 0;
+    for (line = g_startup.text; *line != '\0' && row < g_window_rows - 1; row++)
+    {
+        end = line + strcspn(line, "\n");
+        screen_clear_to_eol(row, 0);
+        screen_put(row, col, line, end - line, ATTR_NORMAL);
+        screen_invalidate_rows(row, row + 1);
+        line = end + (*end == '\n');
+    }
+}
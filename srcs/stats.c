@@ -0,0 +1,368 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Statistics
+ * The stages a slow session could be spending its time in - reading and
+ * decoding input, handling keys, drawing, loading and saving files - are
+ * timed on the monotonic clock into fixed-bucket histograms, and the
+ * system calls that move bytes to the terminal and to files are counted.
+ * Recording costs two clock reads and a few additions, and needs no lock
+ * (a save records from its own thread). ":stats" shows everything over
+ * the text until the next key; "--stats FILE" writes it to FILE on exit.
+ * Built with "make STATS=0", the STATS_* macros expand to nothing and only
+ * the stubs at the end of this file are left.
+ */
+
+#if VB_STATS
+
+static struct
+{
+    t_histogram	timers[STAT_TIMERS];
+    uint64_t	counters[STAT_COUNTERS];
+    bool		shown;      // Overlay on screen (until the next key)
+    const char	*dump_path; // Written on exit (--stats), or NULL
+}	g_stats;
+
+static const char	*g_stage_names[STAT_TIMERS] = {
+    "read", "decode", "key", "draw", "frame", "load", "save"
+};
+
+/*
+ * Nanoseconds on the monotonic clock
+ */
+uint64_t	stats_now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Bucket a duration falls in: its power of two, then which of the
+ * STATS_SUB_BUCKETS equal parts of it
+ */
+static size_t	bucket_of(uint64_t ns)
+{
+    int		octave;
+    size_t	index;
+
+    if (ns < STATS_SUB_BUCKETS)
+        return (ns);
+    octave = 63 - __builtin_clzll(ns);
+    index = (size_t)(octave - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS
+        + ((ns >> (octave - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+    return ((index < STATS_BUCKETS) ? index : STATS_BUCKETS - 1);
+}
+
+/*
+ * Smallest duration that falls in a bucket
+ */
+static uint64_t	bucket_low(size_t index)
+{
+    int	octave;
+
+    if (index < STATS_SUB_BUCKETS)
+        return (index);
+    octave = (int)(index / STATS_SUB_BUCKETS) + STATS_SUB_BITS - 1;
+    return ((uint64_t)(STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << (octave - STATS_SUB_BITS));
+}
+
+/*
+ * Record how long a stage took (any thread)
+ *
+ * @param id: Stage
+ * @param ns: Duration in nanoseconds
+ */
+void	stats_record(t_stat_timer id, uint64_t ns)
+{
+    t_histogram	*h;
+    uint64_t	max;
+
+    h = &g_stats.timers[id];
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+    max = __atomic_load_n(&h->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max_ns, &max, ns, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ; // Another thread raised it meanwhile: max now holds its value
+}
+
+/*
+ * Add to a counter (any thread)
+ */
+void	stats_add(t_stat_counter id, uint64_t n)
+{
+    __atomic_fetch_add(&g_stats.counters[id], n, __ATOMIC_RELAXED);
+}
+
+/*
+ * Duration below which a fraction q of the recorded ones are (the top of
+ * the bucket where that rank falls, so at most 12.5% too high)
+ */
+static uint64_t	percentile(const t_histogram *h, double q)
+{
+    uint64_t	rank;
+    uint64_t	seen;
+    size_t		i;
+
+    if (h->count == 0)
+        return (0);
+    rank = (uint64_t)(q * h->count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    seen = 0;
+    for (i = 0; i < STATS_BUCKETS - 1; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            break ;
+    }
+    if (i == STATS_BUCKETS - 1 || bucket_low(i + 1) - 1 > h->max_ns)
+        return (h->max_ns);
+    return (bucket_low(i + 1) - 1);
+}
+
+/*
+ * Format a duration in 8 columns or less: "850ns", "12.3us", "4.56ms", "2.10s"
+ */
+static void	format_ns(char *out, size_t size, uint64_t ns)
+{
+    if (ns < 1000)
+        snprintf(out, size, "%lluns", (unsigned long long)ns);
+    else if (ns < 1000000)
+        snprintf(out, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000)
+        snprintf(out, size, "%.2fms", ns / 1e6);
+    else
+        snprintf(out, size, "%.2fs", ns / 1e9);
+}
+
+/*
+ * Format a byte count: "512 B", "12.0 KB", "3.4 MB", "1.2 GB"
+ */
+static void	format_bytes(char *out, size_t size, uint64_t bytes)
+{
+    if (bytes < 1024)
+        snprintf(out, size, "%llu B", (unsigned long long)bytes);
+    else if (bytes < 1048576)
+        snprintf(out, size, "%.1f KB", bytes / 1024.0);
+    else if (bytes < 1073741824)
+        snprintf(out, size, "%.1f MB", bytes / 1048576.0);
+    else
+        snprintf(out, size, "%.1f GB", bytes / 1073741824.0);
+}
+
+/*
+ * Draw the shape of a histogram in 8 characters, one per power of ten
+ * from under 1us to 1s and more, each as tall as its share of the
+ * fullest one
+ *
+ * @param out: Receives the UTF-8 text (at least 25 bytes)
+ */
+static void	spread(const t_histogram *h, char *out)
+{
+    static const char	*bars[] = {"▁", "▂", "▃", "▄", "▅", "▆", "▇", "█"};
+    uint64_t			decades[8];
+    uint64_t			top;
+    uint64_t			limit;
+    size_t				d;
+
+    memset(decades, 0, sizeof(decades));
+    d = 0;
+    limit = 1000;
+    for (size_t i = 0; i < STATS_BUCKETS; i++)
+    {
+        while (d < 7 && bucket_low(i) >= limit)
+        {
+            d++;
+            limit *= 10;
+        }
+        decades[d] += h->buckets[i];
+    }
+    top = 0;
+    for (d = 0; d < 8; d++)
+        top = (decades[d] > top) ? decades[d] : top;
+    out[0] = '\0';
+    for (d = 0; d < 8; d++)
+    {
+        if (decades[d] == 0)
+            strcat(out, " ");
+        else
+            strcat(out, bars[(decades[d] * 8 - 1) / top]);
+    }
+}
+
+/*
+ * Text of one line of the report (the overlay, and the file written on exit)
+ *
+ * @param line: Line number (0-based)
+ * @param out: Receives the text
+ * @param size: Size of out
+ * @return: false past the last line
+ */
+static bool	describe(int line, char *out, size_t size)
+{
+    const t_histogram	*h;
+    const uint64_t		*c;
+    char				v[5][16];
+    char				shape[32];
+
+    c = g_stats.counters;
+    if (line == 0)
+        snprintf(out, size, "%-8s %9s %8s %8s %8s %8s %8s  %s", "stage", "count",
+            "p50", "p90", "p99", "max", "mean", "1us..1s");
+    else if (line <= STAT_TIMERS)
+    {
+        h = &g_stats.timers[line - 1];
+        format_ns(v[0], sizeof(v[0]), percentile(h, 0.50));
+        format_ns(v[1], sizeof(v[1]), percentile(h, 0.90));
+        format_ns(v[2], sizeof(v[2]), percentile(h, 0.99));
+        format_ns(v[3], sizeof(v[3]), h->max_ns);
+        format_ns(v[4], sizeof(v[4]), h->count ? h->total_ns / h->count : 0);
+        spread(h, shape);
+        snprintf(out, size, "%-8s %9llu %8s %8s %8s %8s %8s  %s", g_stage_names[line - 1],
+            (unsigned long long)h->count, v[0], v[1], v[2], v[3], v[4], shape);
+    }
+    else if (line == STAT_TIMERS + 1)
+        snprintf(out, size, "%s", "");
+    else if (line == STAT_TIMERS + 2)
+    {
+        format_bytes(v[0], sizeof(v[0]), c[STAT_TERM_BYTES]);
+        snprintf(out, size, "terminal %9llu writes  %s", (unsigned long long)c[STAT_TERM_WRITES], v[0]);
+    }
+    else if (line == STAT_TIMERS + 3)
+    {
+        format_bytes(v[0], sizeof(v[0]), c[STAT_INPUT_BYTES]);
+        snprintf(out, size, "input    %9llu reads   %s", (unsigned long long)c[STAT_INPUT_READS], v[0]);
+    }
+    else if (line == STAT_TIMERS + 4)
+    {
+        format_bytes(v[0], sizeof(v[0]), c[STAT_FILE_BYTES]);
+        snprintf(out, size, "files    %9llu writes  %s, %llu syncs",
+            (unsigned long long)c[STAT_FILE_WRITES], v[0], (unsigned long long)c[STAT_FILE_SYNCS]);
+    }
+    else if (line == STAT_TIMERS + 5)
+        snprintf(out, size, "polls    %9llu", (unsigned long long)c[STAT_POLLS]);
+    else if (line == STAT_TIMERS + 6)
+        snprintf(out, size, "syscalls %9llu in all", (unsigned long long)(c[STAT_TERM_WRITES]
+            + c[STAT_INPUT_READS] + c[STAT_POLLS] + c[STAT_FILE_WRITES] + c[STAT_FILE_SYNCS]));
+    else
+        return (false);
+    return (true);
+}
+
+/*
+ * Write the report, then every bucket that holds something, to the file
+ * named with --stats (run by exit())
+ */
+static void	dump(void)
+{
+    const t_histogram	*h;
+    FILE				*f;
+    char				line[256];
+
+    f = fopen(g_stats.dump_path, "w");
+    if (f == NULL)
+        return ;
+    for (int i = 0; describe(i, line, sizeof(line)); i++)
+        fprintf(f, "%s\n", line);
+    for (int t = 0; t < STAT_TIMERS; t++)
+    {
+        h = &g_stats.timers[t];
+        if (h->count == 0)
+            continue ;
+        fprintf(f, "\n%s (ns from, ns to, count)\n", g_stage_names[t]);
+        for (size_t i = 0; i < STATS_BUCKETS; i++)
+        {
+            if (h->buckets[i] != 0)
+                fprintf(f, "%12llu %12llu %9llu\n", (unsigned long long)bucket_low(i),
+                    (unsigned long long)(i + 1 < STATS_BUCKETS ? bucket_low(i + 1) - 1 : UINT64_MAX),
+                    (unsigned long long)h->buckets[i]);
+        }
+    }
+    fclose(f);
+}
+
+/*
+ * Write the statistics to a file when the editor exits (--stats FILE)
+ *
+ * @param path: File name (must stay valid until exit: argv)
+ */
+void	stats_dump_at_exit(const char *path)
+{
+    if (g_stats.dump_path == NULL)
+        atexit(dump);
+    g_stats.dump_path = path;
+}
+
+/*
+ * Show the statistics over the text until the next key (":stats")
+ */
+void	stats_show(void)
+{
+    g_stats.shown = true;
+}
+
+/*
+ * Take the overlay away (called for every key)
+ *
+ * @return: true if it was shown: the key only closes it
+ */
+bool	stats_hide(void)
+{
+    if (!g_stats.shown)
+        return (false);
+    g_stats.shown = false;
+    screen_invalidate_rows(0, g_window_rows - 1); // The text under it
+    return (true);
+}
+
+/*
+ * Draw the overlay over the text rows, if shown (after draw_text_buffer(),
+ * every frame, so the numbers stay current)
+ */
+void	stats_draw(void)
+{
+    char	line[256];
+    int		row;
+
+    if (!g_stats.shown)
+        return ;
+    screen_clear_to_eol(0, 0);
+    screen_put(0, 0, " Statistics (any key closes)", 28, ATTR_GUTTER);
+    for (row = 1; row < g_window_rows - 1 && describe(row - 1, line, sizeof(line)); row++)
+    {
+        screen_clear_to_eol(row, 0);
+        screen_put(row, 1, line, strlen(line), (row == 1) ? ATTR_GUTTER : ATTR_NORMAL);
+    }
+    screen_invalidate_rows(0, row);
+}
+
+#else
+
+/*
+ * Built without statistics: only say so
+ */
+void	stats_dump_at_exit(const char *path)
+{
+    (void)path;
+    set_message("Built without statistics (make STATS=1)");
+}
+
+void	stats_show(void)
+{
+    set_message("Built without statistics (make STATS=1)");
+}
+
+bool	stats_hide(void)
+{
+    return (false);
+}
+
+void	stats_draw(void)
+{
+}
+
+#endif
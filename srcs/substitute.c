@@ -0,0 +1,327 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Substitute
+ * ":[range]s/pattern/replacement/[flags]" replaces the matches of a regular
+ * expression on a range of lines. Replacing match by match would make each
+ * edit pay for the ones before it; instead the whole rewritten text - from
+ * the first match to the end of the last - is built in a single pass over
+ * the document, with the text between matches copied straight out of the
+ * piece table. It becomes one new source that is spliced in for the old
+ * span, so the change is a single edit and a single undo step, and the old
+ * text is kept as pieces rather than copied.
+ */
+
+/*
+ * Make room for n more bytes of output
+ */
+static void	out_reserve(t_substitute *sub, size_t n)
+{
+    if (sub->size + n <= sub->cap || n == 0)
+        return ;
+    sub->cap = sub->cap ? sub->cap * 2 : SUBST_OUT_BLOCK;
+    if (sub->cap < sub->size + n)
+        sub->cap = sub->size + n;
+    sub->out = realloc(sub->out, sub->cap);
+    if (sub->out == NULL)
+        die("realloc");
+}
+
+/*
+ * Append bytes to the output
+ */
+static void	out_append(t_substitute *sub, const char *data, size_t n)
+{
+    if (n == 0)
+        return ;
+    out_reserve(sub, n);
+    memcpy(sub->out + sub->size, data, n);
+    sub->size += n;
+}
+
+/*
+ * Append document text [from, to) to the output
+ */
+static void	out_copy(t_substitute *sub, size_t from, size_t to)
+{
+    if (to == from)
+        return ;
+    out_reserve(sub, to - from);
+    sub->size += buffer_read(&g_buffer, from, sub->out + sub->size, to - from);
+}
+
+/*
+ * Append the replacement for the match [start, end)
+ * '&' and "\0" stand for the match, "\n" and "\t" for a newline and a tab;
+ * any other escaped character is taken as it is ("\&", "\\", "\/")
+ */
+static void	out_replacement(t_substitute *sub, size_t start, size_t end)
+{
+    const char	*rep;
+    size_t		n;
+    size_t		i;
+
+    rep = sub->rep;
+    n = sub->rep_len;
+    while (n > 0)
+    {
+        i = 0;
+        while (i < n && rep[i] != '&' && rep[i] != '\\')
+            i++;
+        out_append(sub, rep, i); // Plain run
+        if (i == n)
+            break ;
+        if (rep[i] == '&' || (i + 1 < n && rep[i + 1] == '0'))
+            out_copy(sub, start, end);
+        else if (i + 1 == n)
+            out_append(sub, "\\", 1); // Trailing backslash
+        else if (rep[i + 1] == 'n' || rep[i + 1] == 't')
+            out_append(sub, rep[i + 1] == 'n' ? "\n" : "\t", 1);
+        else
+            out_append(sub, rep + i + 1, 1);
+        i += (rep[i] == '&' || i + 1 == n) ? 1 : 2;
+        rep += i;
+        n -= i;
+    }
+}
+
+/*
+ * Last line of the document, the whole file scanned: the empty line after
+ * a final '\n' does not count
+ *
+ * @return: The line (0-based)
+ */
+static size_t	last_line(void)
+{
+    size_t	lines;
+
+    buffer_index_all(&g_buffer);
+    lines = buffer_line_count(&g_buffer);
+    if (lines > 1 && buffer_line_length(&g_buffer, lines - 1) == 0)
+        lines--;
+    return (lines - 1);
+}
+
+/*
+ * Parse a line address: N, ".", "$", each optionally followed by +N / -N
+ * (a bare +N / -N is relative to the current line)
+ *
+ * @param s: Text of the command, advanced past the address
+ * @param line: Current line (0-based)
+ * @param out: Receives the line (0-based)
+ * @return: false if there is no address here
+ */
+static bool	parse_address(const char **s, size_t line, size_t *out)
+{
+    long long	at;
+    long long	delta;
+
+    if (**s == '.')
+    {
+        at = (long long)line;
+        (*s)++;
+    }
+    else if (**s == '$')
+    {
+        at = (long long)last_line();
+        (*s)++;
+    }
+    else if (isdigit((unsigned char)**s))
+        at = strtoll(*s, (char **)s, 10) - 1;
+    else if (**s == '+' || **s == '-')
+        at = (long long)line;
+    else
+        return (false);
+    while (**s == '+' || **s == '-')
+    {
+        delta = isdigit((unsigned char)(*s)[1]) ? strtoll(*s + 1, NULL, 10) : 1;
+        at += (**s == '+') ? delta : -delta;
+        (*s)++;
+        while (isdigit((unsigned char)**s))
+            (*s)++;
+    }
+    *out = (at < 0) ? 0 : (size_t)at;
+    return (true);
+}
+
+/*
+ * Parse the line range in front of the command: "%", "A", "A,B" or
+ * nothing (the current line)
+ *
+ * @return: false if it runs past the end of the document
+ */
+static bool	parse_range(const char **s, size_t line, t_substitute *sub)
+{
+    size_t	tmp;
+
+    sub->first = line;
+    sub->last = line;
+    if (**s == '%')
+    {
+        (*s)++;
+        sub->first = 0;
+        sub->last = last_line();
+        return (true);
+    }
+    if (parse_address(s, line, &sub->first))
+    {
+        sub->last = sub->first;
+        if (**s == ',')
+        {
+            (*s)++;
+            if (!parse_address(s, line, &sub->last))
+                return (false);
+        }
+    }
+    if (sub->first > sub->last)
+    {
+        tmp = sub->first;
+        sub->first = sub->last;
+        sub->last = tmp;
+    }
+    buffer_ensure_lines(&g_buffer, sub->last + 1); // The last line must be whole
+    return (sub->last < buffer_line_count(&g_buffer));
+}
+
+/*
+ * Reject the command, saying why
+ *
+ * @return: false
+ */
+static bool	reject(t_substitute *sub, const char *why, const char *detail)
+{
+    snprintf(sub->error, sizeof(sub->error), "%s%s", why, detail);
+    return (false);
+}
+
+/*
+ * Whether a command is a substitution (a range, then "s" and a delimiter)
+ */
+bool	substitute_is_command(const char *cmd)
+{
+    cmd += strspn(cmd, "0123456789.,$%+-");
+    return (cmd[0] == 's' && cmd[1] != '\0' && !isalnum((unsigned char)cmd[1])
+        && !isspace((unsigned char)cmd[1]) && cmd[1] != '\\');
+}
+
+/*
+ * Parse ":[range]s/pattern/replacement/[flags]"
+ * Any punctuation can stand in for '/'; an empty pattern reuses the last
+ * search. Flags: g (every match on a line), n (only count the matches).
+ * The pattern becomes the last search, as if searched for with ":re".
+ *
+ * @param cmd: The command (as accepted by substitute_is_command())
+ * @param line: Cursor line (0-based), the default range
+ * @param sub: Receives the command; sub->error says why if it is rejected
+ * @return: Whether the command is valid
+ */
+bool	substitute_parse(const char *cmd, size_t line, t_substitute *sub)
+{
+    const char	*error;
+    t_regex		*re;
+    size_t		n;
+    char		delim;
+    bool		backward;
+
+    memset(sub, 0, sizeof(*sub));
+    if (!parse_range(&cmd, line, sub))
+        return (reject(sub, "Invalid range", ""));
+    delim = cmd[1];
+    cmd += 2;
+    n = 0;
+    for (; *cmd != '\0' && *cmd != delim; cmd++)
+    {
+        if (*cmd == '\\' && cmd[1] == delim)
+            cmd++; // "\/" is a '/' in the pattern
+        else if (*cmd == '\\' && cmd[1] != '\0')
+            sub->pattern[n++] = *cmd++; // Other escapes belong to the pattern
+        sub->pattern[n++] = *cmd;
+    }
+    sub->rep = (*cmd == delim) ? ++cmd : cmd;
+    while (*cmd != '\0' && *cmd != delim)
+        cmd += (*cmd == '\\' && cmd[1] != '\0') ? 2 : 1;
+    sub->rep_len = cmd - sub->rep;
+    for (cmd += (*cmd == delim); *cmd != '\0'; cmd++)
+    {
+        if (*cmd == 'g')
+            sub->global = true;
+        else if (*cmd == 'n')
+            sub->count_only = true;
+        else
+            return (reject(sub, "Unknown flags: ", cmd));
+    }
+    if (n > 0)
+    {
+        re = regex_compile(sub->pattern, &error);
+        if (re == NULL)
+            return (reject(sub, "Bad pattern: ", error));
+        search_set_last(sub->pattern, n, false, re);
+    }
+    search_last(&sub->pat, &backward);
+    if (sub->pat.len == 0)
+        return (reject(sub, "No previous pattern", ""));
+    return (true);
+}
+
+/*
+ * Find the matches on the range and build the rewritten text
+ * Each matched line is scanned for its end once, so the pass is linear in
+ * the range however many matches there are. The result is sub->out for the
+ * span [sub->lo, sub->hi), unless nothing matched or only counting.
+ *
+ * @param sub: A command from substitute_parse()
+ * @return: Number of matches
+ */
+size_t	substitute_build(t_substitute *sub)
+{
+    t_text	t;
+    size_t	pos;
+    size_t	end;
+    size_t	at;
+    size_t	stop;
+    size_t	line_end;
+    size_t	last_end;
+    char	*shrunk;
+
+    text_init(&t, &g_buffer);
+    pos = buffer_line_start(&g_buffer, sub->first);
+    stop = buffer_line_start(&g_buffer, sub->last) + buffer_line_length(&g_buffer, sub->last);
+    line_end = 0;
+    last_end = SIZE_MAX;
+    while (pos <= stop && (at = search_next(&t, &sub->pat, pos, stop + 1, &end)) != SIZE_MAX)
+    {
+        if (at == end && at == last_end)
+        {
+            pos = at + 1; // No empty match right where the previous one ended
+            continue ;
+        }
+        if (at >= line_end)
+        {
+            sub->lines++;
+            line_end = text_find_in(&t, "\n", 1, at, stop + 1, false);
+            line_end = (line_end == SIZE_MAX) ? stop + 1 : line_end + 1;
+        }
+        if (sub->count++ == 0)
+            sub->lo = at;
+        else if (!sub->count_only)
+            out_copy(sub, sub->hi, at);
+        if (!sub->count_only)
+        {
+            sub->last_at = sub->lo + sub->size;
+            out_replacement(sub, at, end);
+            sub->hi = end;
+        }
+        last_end = end;
+        if (!sub->global)
+            pos = line_end;
+        else
+            pos = (end > at) ? end : at + 1;
+    }
+    if (sub->size < sub->cap && sub->size > 0)
+    {
+        shrunk = realloc(sub->out, sub->size); // Give back the slack
+        if (shrunk != NULL)
+            sub->out = shrunk;
+    }
+    return (sub->count);
+}
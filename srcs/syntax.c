@@ -0,0 +1,789 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Syntax Highlighting
+ * Languages are tables (t_syntax) - word lists, comment and string
+ * delimiters, a few flags - read by a single lexer. A line is lexed from
+ * the state the previous line left open (inside a comment, a string, a
+ * continued directive), and that state is cached for the start of every
+ * line. After an edit, lexing resumes at the edited line, only as far down
+ * as the screen needs, and stops as soon as a line past the edit starts in
+ * the same state as before: from there on nothing changed. A line's
+ * highlighting is a run-length list of spans, so the renderer switches
+ * colors once per span.
+ */
+
+static const char *const	g_c_keywords[] = {"auto", "break", "case", "const",
+    "continue", "default", "do", "else", "enum", "extern", "for", "goto", "if",
+    "inline", "register", "restrict", "return", "sizeof", "static", "struct",
+    "switch", "typedef", "union", "volatile", "while", "_Alignas", "_Alignof",
+    "_Atomic", "_Generic", "_Noreturn", "_Static_assert", "_Thread_local", NULL};
+static const char *const	g_c_types[] = {"bool", "char", "double", "float",
+    "int", "long", "short", "signed", "unsigned", "void", "_Bool", "size_t",
+    "ssize_t", "ptrdiff_t", "intptr_t", "uintptr_t", "off_t", "int8_t",
+    "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t",
+    "uint64_t", "FILE", NULL};
+static const char *const	g_c_constants[] = {"NULL", "true", "false", "EOF",
+    "stdin", "stdout", "stderr", "errno", NULL};
+static const char *const	g_json_constants[] = {"true", "false", "null", NULL};
+static const char *const	g_sh_keywords[] = {"if", "then", "else", "elif", "fi",
+    "case", "esac", "for", "while", "until", "do", "done", "in", "function",
+    "select", "time", "return", "exit", "break", "continue", "local", "export",
+    "readonly", "declare", "typeset", "unset", "shift", "source", "alias",
+    "eval", "exec", "trap", "set", NULL};
+static const char *const	g_sh_constants[] = {"true", "false", NULL};
+static const char *const	g_log_errors[] = {"ERROR", "ERR", "FATAL", "CRIT",
+    "CRITICAL", "PANIC", "SEVERE", "EMERG", "ALERT", "error", "fatal",
+    "critical", "panic", "Error", "Fatal", NULL};
+static const char *const	g_log_warnings[] = {"WARN", "WARNING", "warn",
+    "warning", "Warning", NULL};
+static const char *const	g_log_levels[] = {"INFO", "DEBUG", "TRACE", "NOTICE",
+    "info", "debug", "trace", "notice", NULL};
+
+static const t_syntax	g_syntaxes[] = {
+    {"c", ".c .h", NULL, {{g_c_keywords, ATTR_KEYWORD}, {g_c_types, ATTR_TYPE},
+        {g_c_constants, ATTR_CONSTANT}}, "//", "/*", "*/", "\"'", SYN_PREPROC},
+    {"json", ".json", NULL, {{g_json_constants, ATTR_CONSTANT}},
+        NULL, NULL, NULL, "\"", SYN_KEYS | SYN_LINE_LOCAL},
+    {"sh", ".sh .bash .zsh .ksh", "sh bash zsh ksh dash ash",
+        {{g_sh_keywords, ATTR_KEYWORD}, {g_sh_constants, ATTR_CONSTANT}},
+        "#", NULL, NULL, "\"'`", SYN_STRING_LINES | SYN_VARIABLES | SYN_WORD_COMMENT},
+    {"log", ".log", NULL, {{g_log_errors, ATTR_ERROR},
+        {g_log_warnings, ATTR_WARNING}, {g_log_levels, ATTR_KEYWORD}},
+        NULL, NULL, NULL, "\"", SYN_LINE_LOCAL},
+};
+
+static t_highlight	g_hl = {.memo_line = SIZE_MAX};
+
+/*
+ * Keyword table hash (FNV-1a)
+ */
+static uint32_t	word_hash(const char *word, size_t len)
+{
+    uint32_t	h;
+
+    h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)word[i]) * 16777619u;
+    return (h);
+}
+
+/*
+ * Attribute of a word: its list's if it is in one, fallback otherwise
+ */
+static uint8_t	word_attr(const char *word, size_t len, uint8_t fallback)
+{
+    size_t	i;
+
+    if (len > UINT8_MAX)
+        return (fallback);
+    i = word_hash(word, len) & (SYNTAX_HASH_SIZE - 1);
+    for (; g_hl.words[i].word != NULL; i = (i + 1) & (SYNTAX_HASH_SIZE - 1))
+    {
+        if (g_hl.words[i].len == len && memcmp(g_hl.words[i].word, word, len) == 0)
+            return (g_hl.words[i].attr);
+    }
+    return (fallback);
+}
+
+/*
+ * Fill the character classes and the keyword table for a language
+ */
+static void	build_tables(const t_syntax *syn)
+{
+    const char *const	*w;
+    size_t				i;
+
+    for (int c = 0; c < 256; c++)
+    {
+        g_hl.cls[c] = 0;
+        if (isalpha(c) || c == '_' || c >= 0x80)
+            g_hl.cls[c] = CC_WORD | CC_WORD_START;
+        else if (isdigit(c))
+            g_hl.cls[c] = CC_WORD | CC_DIGIT;
+        else if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+            g_hl.cls[c] = CC_SPACE;
+    }
+    for (const char *q = syn->quotes; *q; q++)
+        g_hl.cls[(unsigned char)*q] = CC_QUOTE;
+    memset(g_hl.words, 0, sizeof(g_hl.words));
+    for (int l = 0; l < SYNTAX_WORD_LISTS && syn->words[l].words; l++)
+    {
+        for (w = syn->words[l].words; *w; w++)
+        {
+            i = word_hash(*w, strlen(*w)) & (SYNTAX_HASH_SIZE - 1);
+            while (g_hl.words[i].word != NULL)
+                i = (i + 1) & (SYNTAX_HASH_SIZE - 1);
+            g_hl.words[i] = (t_hl_word){*w, strlen(*w), syn->words[l].attr};
+        }
+    }
+}
+
+/*
+ * Switch language (NULL: plain text) and forget every cached state
+ */
+static void	syntax_use(const t_syntax *syn)
+{
+    g_hl.syntax = syn;
+    g_hl.detect = false;
+    if (syn != NULL)
+        build_tables(syn);
+    if (g_hl.cap == 0)
+    {
+        g_hl.cap = 1024;
+        g_hl.states = malloc(g_hl.cap);
+        if (g_hl.states == NULL)
+            die("malloc");
+    }
+    g_hl.states[0] = HL_NORMAL;
+    g_hl.known = 1;
+    g_hl.good = 1;
+    g_hl.edited_end = 0;
+    g_hl.memo_line = SIZE_MAX;
+}
+
+/*
+ * Whether word (len bytes) is one of the space-separated words of list
+ */
+static bool	word_listed(const char *list, const char *word, size_t len)
+{
+    size_t	n;
+
+    while (list != NULL && *list != '\0')
+    {
+        n = strcspn(list, " ");
+        if (n == len && memcmp(list, word, len) == 0)
+            return (true);
+        list += n + (list[n] == ' ');
+    }
+    return (false);
+}
+
+/*
+ * Pick the language of a file from the end of its name; files with no
+ * known ending are given a look at their "#!" line once they are loaded
+ *
+ * @param filename: Name of the file being opened
+ */
+void	syntax_select(const char *filename)
+{
+    const char	*ext;
+    size_t		len;
+    size_t		n;
+
+    len = strlen(filename);
+    for (size_t s = 0; s < sizeof(g_syntaxes) / sizeof(g_syntaxes[0]); s++)
+    {
+        for (ext = g_syntaxes[s].extensions; *ext; ext += n + (ext[n] == ' '))
+        {
+            n = strcspn(ext, " ");
+            if (n <= len && memcmp(filename + len - n, ext, n) == 0)
+            {
+                syntax_use(&g_syntaxes[s]);
+                return ;
+            }
+        }
+    }
+    syntax_use(NULL);
+    g_hl.detect = true;
+}
+
+/*
+ * Pick the language from a "#!/bin/sh" or "#!/usr/bin/env bash" first line
+ */
+static void	detect_interpreter(void)
+{
+    char		head[128];
+    size_t		n;
+    const char	*name;
+    size_t		len;
+
+    g_hl.detect = false;
+    n = buffer_read(&g_buffer, 0, head, sizeof(head) - 1);
+    head[n] = '\0';
+    head[strcspn(head, "\n")] = '\0';
+    if (strncmp(head, "#!", 2) != 0)
+        return ;
+    name = head + 2 + strspn(head + 2, " ");
+    len = strcspn(name, " ");
+    for (size_t i = len; i > 0; i--)
+    {
+        if (name[i - 1] == '/')
+        {
+            len -= i;
+            name += i;
+            break ;
+        }
+    }
+    if (len == 3 && memcmp(name, "env", 3) == 0)
+    {
+        name += len + strspn(name + len, " ");
+        len = strcspn(name, " ");
+    }
+    for (size_t s = 0; s < sizeof(g_syntaxes) / sizeof(g_syntaxes[0]); s++)
+    {
+        if (word_listed(g_syntaxes[s].interpreters, name, len))
+            syntax_use(&g_syntaxes[s]);
+    }
+}
+
+/*
+ * Set the language by name ("c", "json", "sh", "log"; "off" for none)
+ *
+ * @return: false if there is no such language
+ */
+bool	syntax_set(const char *name)
+{
+    if (strcmp(name, "off") == 0 || strcmp(name, "none") == 0)
+    {
+        syntax_use(NULL);
+        return (true);
+    }
+    for (size_t s = 0; s < sizeof(g_syntaxes) / sizeof(g_syntaxes[0]); s++)
+    {
+        if (strcmp(g_syntaxes[s].name, name) == 0)
+        {
+            syntax_use(&g_syntaxes[s]);
+            return (true);
+        }
+    }
+    return (false);
+}
+
+/*
+ * Name of the current language, or NULL for plain text
+ */
+const char	*syntax_name(void)
+{
+    return (g_hl.syntax ? g_hl.syntax->name : NULL);
+}
+
+/*
+ * Close the current span at end with attribute attr (runs of the same
+ * attribute are merged)
+ */
+static void	put(size_t end, uint8_t attr)
+{
+    if (!g_hl.emit)
+        return ;
+    if (g_hl.n_spans > 0 && g_hl.spans[g_hl.n_spans - 1].attr == attr)
+        g_hl.spans[g_hl.n_spans - 1].end = end;
+    else
+        g_hl.spans[g_hl.n_spans++] = (t_hl_span){end, attr};
+}
+
+/*
+ * Offset of str in s[i, n), or SIZE_MAX
+ */
+static size_t	find_str(const char *s, size_t n, size_t i, const char *str)
+{
+    const char	*p;
+    size_t		len;
+
+    len = strlen(str);
+    while (i + len <= n && (p = memchr(s + i, str[0], n - i)) != NULL)
+    {
+        i = p - s;
+        if (i + len <= n && memcmp(p, str, len) == 0)
+            return (i);
+        i++;
+    }
+    return (SIZE_MAX);
+}
+
+/*
+ * Whether s[i, n) starts with str
+ */
+static bool	starts_with(const char *s, size_t n, size_t i, const char *str)
+{
+    size_t	len;
+
+    if (str == NULL || s[i] != str[0])
+        return (false);
+    len = strlen(str);
+    return (i + len <= n && memcmp(s + i, str, len) == 0);
+}
+
+/*
+ * End of a shell variable starting with the '$' at i
+ */
+static size_t	variable_end(const char *s, size_t n, size_t i)
+{
+    size_t	j;
+
+    j = i + 1;
+    if (j >= n)
+        return (j);
+    if (s[j] == '{')
+    {
+        while (j < n && s[j] != '}')
+            j++;
+        return (j < n ? j + 1 : n);
+    }
+    if (g_hl.cls[(unsigned char)s[j]] & CC_WORD_START)
+    {
+        while (j < n && (g_hl.cls[(unsigned char)s[j]] & CC_WORD))
+            j++;
+        return (j);
+    }
+    if (isdigit((unsigned char)s[j]) || strchr("@*#?$!-", s[j]) != NULL)
+        return (j + 1);
+    return (j);
+}
+
+/*
+ * Past the closing quote of a string whose contents start at i, or n if
+ * it stays open
+ */
+static size_t	string_end(const char *s, size_t n, size_t i, char quote, bool *closed)
+{
+    bool	escapes;
+
+    // Shell single quotes take backslashes literally
+    escapes = !((g_hl.syntax->flags & SYN_VARIABLES) && quote == '\'');
+    *closed = false;
+    while (i < n)
+    {
+        if (s[i] == '\\' && escapes)
+            i += 2;
+        else if (s[i++] == quote)
+        {
+            *closed = true;
+            return (i);
+        }
+    }
+    return (n);
+}
+
+/*
+ * Emit the string s[from, to); variables inside shell double quotes get
+ * their own color
+ */
+static void	put_string(const char *s, size_t from, size_t to, char quote, uint8_t attr)
+{
+    size_t	end;
+
+    if ((g_hl.syntax->flags & SYN_VARIABLES) && quote == '"')
+    {
+        for (size_t j = from; j < to; j++)
+        {
+            if (s[j] == '\\')
+                j++;
+            else if (s[j] == '$')
+            {
+                end = variable_end(s, to, j);
+                put(j, attr);
+                put(end, ATTR_VARIABLE);
+                j = end - 1;
+            }
+        }
+    }
+    put(to, attr);
+}
+
+/*
+ * State after a line ending inside a string
+ */
+static uint8_t	open_string(const char *s, size_t n, uint8_t state)
+{
+    if ((g_hl.syntax->flags & SYN_STRING_LINES) || (n > 0 && s[n - 1] == '\\'))
+        return (state);
+    return (HL_NORMAL); // Unterminated: it ends with the line
+}
+
+/*
+ * Lex one line
+ *
+ * @param s: The line (without its '\n')
+ * @param n: Its length
+ * @param state: State at its start
+ * @return: State at the start of the next line
+ */
+static uint8_t	lex(const char *s, size_t n, uint8_t state)
+{
+    const t_syntax	*syn;
+    const uint8_t	*cls;
+    uint8_t			pp;
+    uint8_t			base;
+    uint8_t			attr;
+    size_t			i;
+    size_t			j;
+    size_t			k;
+    bool			closed;
+    bool			first;
+
+    syn = g_hl.syntax;
+    cls = g_hl.cls;
+    pp = state & HL_PREPROC;
+    base = pp ? ATTR_PREPROC : ATTR_NORMAL;
+    state &= ~HL_PREPROC;
+    i = 0;
+    if (state == HL_COMMENT)
+    {
+        j = find_str(s, n, 0, syn->block_close);
+        put(j == SIZE_MAX ? n : j + strlen(syn->block_close), ATTR_COMMENT);
+        if (j == SIZE_MAX)
+            return (HL_COMMENT | pp);
+        i = j + strlen(syn->block_close);
+    }
+    else if (state >= HL_STRING)
+    {
+        i = string_end(s, n, 0, syn->quotes[state - HL_STRING], &closed);
+        put_string(s, 0, i, syn->quotes[state - HL_STRING], ATTR_STRING);
+        if (!closed)
+            return (open_string(s, n, state) | pp);
+    }
+    first = (i == 0 && !pp);
+    while (i < n)
+    {
+        if (cls[(unsigned char)s[i]] & CC_SPACE)
+        {
+            for (j = i + 1; j < n && (cls[(unsigned char)s[j]] & CC_SPACE); j++)
+                ;
+            put(j, base);
+            i = j;
+            continue ;
+        }
+        if (starts_with(s, n, i, syn->line_comment) && (!(syn->flags & SYN_WORD_COMMENT)
+            || i == 0 || (cls[(unsigned char)s[i - 1]] & CC_SPACE) || s[i - 1] == ';'))
+        {
+            put(n, ATTR_COMMENT);
+            break ;
+        }
+        if (starts_with(s, n, i, syn->block_open))
+        {
+            j = find_str(s, n, i + strlen(syn->block_open), syn->block_close);
+            put(j == SIZE_MAX ? n : j + strlen(syn->block_close), ATTR_COMMENT);
+            if (j == SIZE_MAX)
+                return (HL_COMMENT | pp); // A directive goes on through a comment
+            i = j + strlen(syn->block_close);
+            continue ;
+        }
+        if (first && s[i] == '#' && (syn->flags & SYN_PREPROC))
+        {
+            pp = HL_PREPROC;
+            base = ATTR_PREPROC;
+        }
+        first = false;
+        if (cls[(unsigned char)s[i]] & CC_QUOTE)
+        {
+            j = string_end(s, n, i + 1, s[i], &closed);
+            attr = ATTR_STRING;
+            if (closed && (syn->flags & SYN_KEYS))
+            {
+                for (k = j; k < n && (cls[(unsigned char)s[k]] & CC_SPACE); k++)
+                    ;
+                if (k < n && s[k] == ':')
+                    attr = ATTR_KEYWORD;
+            }
+            put(i, base);
+            put_string(s, i, j, s[i], attr);
+            if (!closed)
+                return (open_string(s, n, HL_STRING + (strchr(syn->quotes, s[i]) - syn->quotes)) | pp);
+            i = j;
+        }
+        else if (cls[(unsigned char)s[i]] & CC_DIGIT)
+        {
+            for (j = i + 1; j < n && ((cls[(unsigned char)s[j]] & CC_WORD) || s[j] == '.'
+                || ((s[j] == '+' || s[j] == '-') && strchr("eEpP", s[j - 1]))); j++)
+                ;
+            put(j, pp ? base : ATTR_NUMBER);
+            i = j;
+        }
+        else if (cls[(unsigned char)s[i]] & CC_WORD_START)
+        {
+            for (j = i + 1; j < n && (cls[(unsigned char)s[j]] & CC_WORD); j++)
+                ;
+            put(j, pp ? base : word_attr(s + i, j - i, base));
+            i = j;
+        }
+        else if (s[i] == '$' && (syn->flags & SYN_VARIABLES))
+        {
+            j = variable_end(s, n, i);
+            put(j, ATTR_VARIABLE);
+            i = j;
+        }
+        else
+            put(++i, base);
+    }
+    return ((pp && n > 0 && s[n - 1] == '\\') ? HL_PREPROC : HL_NORMAL);
+}
+
+/*
+ * Move past the rest of a line too long to highlight without reading it
+ *
+ * @param start: Document offset of the line
+ * @return: Document offset of the next line
+ */
+static size_t	skip_line(size_t start)
+{
+    size_t	line;
+
+    line = buffer_line_at(&g_buffer, start);
+    if (line + 1 < buffer_line_count(&g_buffer))
+        return (buffer_line_start(&g_buffer, line + 1));
+    return (buffer_size(&g_buffer));
+}
+
+/*
+ * Read the line starting at *pos and move *pos to the next one
+ * The line is used in place when one piece holds it, and copied otherwise;
+ * no more than SYNTAX_MAX_LINE bytes of it are ever looked at
+ *
+ * @param out: Receives the bytes of the line (without its '\n')
+ * @return: Its length, or SIZE_MAX if it is too long to highlight
+ */
+static size_t	next_line(size_t *pos, const char **out)
+{
+    const char	*chunk;
+    const char	*nl;
+    size_t		len;
+    size_t		n;
+
+    n = 0;
+    while ((len = buffer_chunk(&g_buffer, *pos, &chunk)) > 0)
+    {
+        if (len > SYNTAX_MAX_LINE + 1 - n)
+            len = SYNTAX_MAX_LINE + 1 - n;
+        nl = memchr(chunk, '\n', len);
+        if (nl != NULL)
+            len = nl - chunk;
+        if (n == 0 && nl != NULL)
+            *out = chunk; // The whole line is in this piece
+        else if (n + len <= SYNTAX_MAX_LINE)
+        {
+            if (n + len > g_hl.line_cap)
+            {
+                g_hl.line_cap = (n + len) * 2;
+                g_hl.line = realloc(g_hl.line, g_hl.line_cap);
+                if (g_hl.line == NULL)
+                    die("realloc");
+            }
+            memcpy(g_hl.line + n, chunk, len);
+            *out = g_hl.line;
+        }
+        else
+        {
+            *pos = skip_line(*pos - n);
+            return (SIZE_MAX);
+        }
+        n += len;
+        *pos += len + (nl != NULL);
+        if (nl != NULL)
+            break ;
+    }
+    if (n == 0)
+        *out = "";
+    return (n);
+}
+
+/*
+ * Lex the line starting at *pos and move *pos to the next one
+ *
+ * @param state: State at the start of the line
+ * @param emit: Also record the line's spans
+ * @return: State at the start of the next line
+ */
+static uint8_t	lex_line(size_t *pos, uint8_t state, bool emit)
+{
+    const char	*s;
+    size_t		n;
+
+    n = next_line(pos, &s);
+    g_hl.n_spans = 0;
+    g_hl.emit = emit;
+    if (n == SIZE_MAX)
+        return (state); // Too long: shown plain, and the state goes through
+    if (emit && n + 1 > g_hl.spans_cap)
+    {
+        g_hl.spans_cap = n + 64;
+        g_hl.spans = realloc(g_hl.spans, g_hl.spans_cap * sizeof(t_hl_span));
+        if (g_hl.spans == NULL)
+            die("realloc");
+    }
+    return (lex(s, n, state));
+}
+
+/*
+ * State at the start of a line
+ * Lines past the cache are lexed from the nearest known state; beyond
+ * SYNTAX_SYNC_LINES from any, from a guess (nothing open) that far above
+ */
+static uint8_t	state_at(size_t line)
+{
+    size_t	from;
+    size_t	pos;
+    uint8_t	state;
+
+    if (g_hl.syntax->flags & SYN_LINE_LOCAL)
+        return (HL_NORMAL);
+    if (line < g_hl.good)
+        return (g_hl.states[line]);
+    if (g_hl.memo_line <= line && line - g_hl.memo_line <= SYNTAX_SYNC_LINES)
+    {
+        from = g_hl.memo_line; // Rows are drawn top to bottom
+        state = g_hl.memo_state;
+    }
+    else if (line - (g_hl.good - 1) <= SYNTAX_SYNC_LINES)
+    {
+        from = g_hl.good - 1;
+        state = g_hl.states[from];
+    }
+    else
+    {
+        from = line - SYNTAX_SYNC_LINES;
+        state = HL_NORMAL;
+    }
+    pos = buffer_line_start(&g_buffer, from);
+    for (; from < line; from++)
+        state = lex_line(&pos, state, false);
+    g_hl.memo_line = line;
+    g_hl.memo_state = state;
+    return (state);
+}
+
+/*
+ * Bring the cached states up to date down to a line, before drawing
+ * Lexing starts at the first edited line and stops where the states agree
+ * with the ones from before the edit again. When the view is more than
+ * SYNTAX_SYNC_GAP lines past the cache, the cache is left alone and the
+ * lines shown are lexed from a nearby guess instead (see state_at).
+ *
+ * @param first: First line shown
+ * @param last: Last line shown
+ * @param from: Receives the first line shown whose state changed
+ * @param to: Receives the end of the lines shown whose state changed
+ * @return: Whether any line shown changed state (and must be redrawn)
+ */
+bool	syntax_update(size_t first, size_t last, size_t *from, size_t *to)
+{
+    size_t	pos;
+    size_t	count;
+    size_t	limit;
+    uint8_t	state;
+
+    if (g_hl.detect)
+        detect_interpreter();
+    *from = SIZE_MAX;
+    *to = 0;
+    count = buffer_line_count(&g_buffer);
+    if (last >= count)
+        last = count - 1;
+    if (g_hl.syntax == NULL || (g_hl.syntax->flags & SYN_LINE_LOCAL) || g_hl.good > last
+        || (g_hl.good == g_hl.known && last - g_hl.good > SYNTAX_SYNC_GAP))
+        return (false);
+    if (last + 1 > g_hl.cap)
+    {
+        g_hl.cap = (last + 1) * 2;
+        g_hl.states = realloc(g_hl.states, g_hl.cap);
+        if (g_hl.states == NULL)
+            die("realloc");
+    }
+    limit = g_hl.good + SYNTAX_SYNC_GAP; // Bounds the work of one frame
+    pos = buffer_line_start(&g_buffer, g_hl.good - 1);
+    state = g_hl.states[g_hl.good - 1];
+    while (g_hl.good <= last && g_hl.good <= limit)
+    {
+        state = lex_line(&pos, state, false);
+        if (g_hl.good < g_hl.known && g_hl.states[g_hl.good] == state
+            && g_hl.good >= g_hl.edited_end)
+        {
+            // Converged: every state cached after this one is still right
+            g_hl.good = g_hl.known;
+            if (g_hl.good > last)
+                break ;
+            pos = buffer_line_start(&g_buffer, g_hl.good - 1);
+            state = g_hl.states[g_hl.good - 1];
+            continue ;
+        }
+        if (g_hl.good == g_hl.known)
+            g_hl.known++;
+        else if (g_hl.states[g_hl.good] != state && g_hl.good >= first)
+        {
+            *from = (*from < g_hl.good) ? *from : g_hl.good;
+            *to = g_hl.good + 1;
+        }
+        g_hl.states[g_hl.good++] = state;
+    }
+    if (g_hl.good == g_hl.known)
+        g_hl.edited_end = 0;
+    else if (g_hl.edited_end < g_hl.good)
+        g_hl.edited_end = g_hl.good; // States before good are new: none to compare with
+    return (*from < *to);
+}
+
+/*
+ * Lines were replaced: lines [line, line + removed] of the old text are
+ * now [line, line + added]. Cached states after them move along; the ones
+ * from line + 1 on are checked again before they are used.
+ *
+ * @param line: First line touched by the edit
+ * @param removed: Line breaks the edit took out
+ * @param added: Line breaks it put in
+ */
+void	syntax_edit(size_t line, size_t removed, size_t added)
+{
+    size_t	tail;
+
+    g_hl.memo_line = SIZE_MAX;
+    if (g_hl.syntax == NULL || line + 1 >= g_hl.known)
+        return ; // Nothing cached past the edit
+    tail = line + 1 + removed;
+    if (tail >= g_hl.known)
+    {
+        syntax_invalidate(line);
+        return ;
+    }
+    if (g_hl.known + added > g_hl.cap)
+    {
+        g_hl.cap = (g_hl.known + added) * 2;
+        g_hl.states = realloc(g_hl.states, g_hl.cap);
+        if (g_hl.states == NULL)
+            die("realloc");
+    }
+    memmove(g_hl.states + line + 1 + added, g_hl.states + tail, g_hl.known - tail);
+    memset(g_hl.states + line + 1, HL_NORMAL, added); // New lines: lexed before use
+    g_hl.known += added - removed;
+    if (g_hl.edited_end >= tail)
+        g_hl.edited_end += added - removed; // An earlier edit further down
+    if (g_hl.edited_end < line + 1 + added)
+        g_hl.edited_end = line + 1 + added;
+    if (g_hl.good > line + 1)
+        g_hl.good = line + 1;
+}
+
+/*
+ * Something changed from a line on, in ways not worth describing (undo,
+ * a substitution): forget the states cached after it
+ *
+ * @param line: First line that may have changed
+ */
+void	syntax_invalidate(size_t line)
+{
+    g_hl.memo_line = SIZE_MAX;
+    if (g_hl.known > line + 1)
+        g_hl.known = line + 1;
+    if (g_hl.good > g_hl.known)
+        g_hl.good = g_hl.known;
+}
+
+/*
+ * Highlighting of a line
+ *
+ * @param line: 0-based line number
+ * @param spans: Receives the spans (valid until the next call)
+ * @return: Number of spans (0: plain text)
+ */
+size_t	syntax_spans(size_t line, const t_hl_span **spans)
+{
+    size_t	pos;
+
+    if (g_hl.detect)
+        detect_interpreter();
+    if (g_hl.syntax == NULL)
+        return (0);
+    pos = buffer_line_start(&g_buffer, line);
+    lex_line(&pos, state_at(line), true);
+    *spans = g_hl.spans;
+    return (g_hl.n_spans);
+}
@@ -0,0 +1,281 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Tabs
+ * Every open file is a tab with its own document, undo history, cursor and
+ * scroll position. Showing a tab swaps its state with the globals the rest
+ * of the editor works on (g_buffer, g_undo, current_filename, the cursor),
+ * so switching costs the same whatever the files hold. What is derived
+ * from a document - highlighting states, columns, the soft-wrap map - is
+ * kept for the shown tab only and rebuilt for the screen in view.
+ * A file that was never edited gives up its line index when it is hidden
+ * and keeps just its mapping, so memory does not grow with the number of
+ * tabs; files named on the command line are not even opened until shown.
+ */
+
+static t_tab	*g_tabs = NULL;
+static size_t	g_count = 0;
+static size_t	g_cap = 0;
+static size_t	g_current = 0;  // Tab shown (its entry is out of date)
+
+/*
+ * Make room for a tab at index, moving the tabs from there on along
+ */
+static t_tab	*insert_at(size_t index)
+{
+    if (g_count == g_cap)
+    {
+        g_cap = g_cap ? g_cap * 2 : 8;
+        g_tabs = realloc(g_tabs, g_cap * sizeof(*g_tabs));
+        if (g_tabs == NULL)
+            die("realloc");
+    }
+    memmove(g_tabs + index + 1, g_tabs + index, (g_count - index) * sizeof(*g_tabs));
+    g_count++;
+    memset(&g_tabs[index], 0, sizeof(*g_tabs));
+    return (&g_tabs[index]);
+}
+
+/*
+ * Put the shown tab's state back in its entry
+ * An unedited file drops its line index until it is shown again, and a
+ * followed one is no longer watched until then
+ */
+static void	stash(const t_cursor *cursor)
+{
+    t_tab	*tab;
+
+    tab = &g_tabs[g_current];
+    tab->buffer = g_buffer;
+    tab->undo = g_undo;
+    tab->cursor = *cursor;
+    memcpy(tab->filename, current_filename, sizeof(tab->filename));
+    snprintf(tab->syntax, sizeof(tab->syntax), "%s", syntax_name() ? syntax_name() : "off");
+    tab->follow = follow_active();
+    follow_stop();
+    buffer_drop_index(&tab->buffer);
+}
+
+/*
+ * Show a tab whose state is not in the globals (the globals hold nothing
+ * that needs keeping)
+ */
+static void	activate(size_t index, t_cursor *cursor)
+{
+    t_tab	*tab;
+
+    g_current = index;
+    tab = &g_tabs[index];
+    if (!tab->loaded)
+    {
+        g_buffer = (t_buffer){0};
+        g_undo = (t_undo_log){.budget = g_undo.budget};
+        load_file(tab->filename);
+        *cursor = (t_cursor){.cx = 1, .cy = 1, .rx = 1};
+        tab->loaded = true;
+        return ;
+    }
+    g_buffer = tab->buffer;
+    g_undo = tab->undo;
+    *cursor = tab->cursor;
+    memcpy(current_filename, tab->filename, sizeof(current_filename));
+    syntax_set(tab->syntax);
+    columns_invalidate(0, 0);
+    wrap_invalidate(0);
+    // Index the view again if the file dropped its index (as load_file() does)
+    buffer_ensure_view(&g_buffer, cursor->scroll_y, g_window_rows, cursor->scroll_x + g_window_cols);
+    indexer_start(&g_buffer);
+    if (tab->follow)
+        follow_start(); // Takes in what was appended meanwhile, showing the end
+}
+
+/*
+ * Open a file later, in a tab after the others (files named on the
+ * command line; the first one shown is opened by tabs_switch())
+ *
+ * @param filename: File name (empty for a new, unnamed file)
+ * @return: false, with no tab added, if the name is too long to keep
+ */
+bool	tabs_add(const char *filename)
+{
+    t_tab	*tab;
+
+    if (strlen(filename) >= sizeof(tab->filename))
+        return (false);
+    tab = insert_at(g_count);
+    strcpy(tab->filename, filename);
+    return (true);
+}
+
+/*
+ * Show another tab
+ * A save still running is finished first: ":w name" renames the tab it
+ * was started from
+ *
+ * @param index: 0-based tab number
+ * @param cursor: Cursor of the shown tab (replaced by the new tab's)
+ */
+void	tabs_switch(size_t index, t_cursor *cursor)
+{
+    if (index >= g_count || (index == g_current && g_tabs[index].loaded))
+        return ;
+    save_wait();
+    matches_stop(); // Counting reads the document
+    if (g_tabs[g_current].loaded)
+        stash(cursor);
+    activate(index, cursor);
+}
+
+/*
+ * Show a file: the tab it is open in, or a new tab after the shown one
+ *
+ * @param filename: File name as typed
+ * @param cursor: Cursor of the shown tab
+ */
+void	tabs_open(const char *filename, t_cursor *cursor)
+{
+    t_tab	*tab;
+
+    for (size_t i = 0; i < g_count; i++)
+    {
+        if (i != g_current && strcmp(g_tabs[i].filename, filename) == 0)
+        {
+            tabs_switch(i, cursor);
+            return ;
+        }
+    }
+    if (strcmp(current_filename, filename) == 0)
+        return ;
+    if (strlen(filename) >= sizeof(tab->filename))
+    {
+        set_message("Can't open \"%s\": %s", filename, strerror(ENAMETOOLONG));
+        return ;
+    }
+    tab = insert_at(g_current + 1);
+    strcpy(tab->filename, filename);
+    tabs_switch(g_current + 1, cursor);
+}
+
+/*
+ * Show the tab step places after the shown one (before it if negative),
+ * going round at the ends
+ */
+void	tabs_next(int step, t_cursor *cursor)
+{
+    long	index;
+
+    index = ((long)g_current + step) % (long)g_count;
+    if (index < 0)
+        index += g_count;
+    tabs_switch((size_t)index, cursor);
+}
+
+/*
+ * Close the shown tab and show the next one; closing the last tab leaves
+ * an empty, unnamed file. Unsaved changes are dropped, swap file and all:
+ * the caller asks first (":bd" refuses, ":bd!" insists)
+ *
+ * @param cursor: Cursor of the shown tab
+ */
+void	tabs_close(t_cursor *cursor)
+{
+    save_wait();
+    matches_stop();
+    follow_stop();
+    journal_close(g_buffer.journal, false);
+    buffer_free(&g_buffer);
+    undo_clear(&g_undo);
+    memmove(g_tabs + g_current, g_tabs + g_current + 1,
+        (g_count - g_current - 1) * sizeof(*g_tabs));
+    g_count--;
+    if (g_count == 0)
+        tabs_add("");
+    activate((g_current < g_count) ? g_current : g_count - 1, cursor);
+}
+
+/*
+ * Number of open tabs
+ */
+size_t	tabs_count(void)
+{
+    return (g_count);
+}
+
+/*
+ * Index of the shown tab (0-based)
+ */
+size_t	tabs_current(void)
+{
+    return (g_current);
+}
+
+/*
+ * File name of a tab, "(new file)" if it has none
+ */
+const char	*tabs_name(size_t index)
+{
+    const char	*name;
+
+    name = (index == g_current) ? current_filename : g_tabs[index].filename;
+    return (name[0] ? name : "(new file)");
+}
+
+/*
+ * First tab with unsaved changes, the shown one before the others
+ *
+ * @return: Its index, or SIZE_MAX if every tab is saved
+ */
+size_t	tabs_modified(void)
+{
+    if (buffer_modified(&g_buffer))
+        return (g_current);
+    for (size_t i = 0; i < g_count; i++)
+    {
+        if (i != g_current && buffer_modified(&g_tabs[i].buffer))
+            return (i);
+    }
+    return (SIZE_MAX);
+}
+
+/*
+ * On the way out (Ctrl+C): stop logging the tabs with unsaved changes,
+ * leaving their swap files on disk so the edits can be recovered
+ */
+void	tabs_keep_modified(void)
+{
+    t_buffer	*buf;
+
+    for (size_t i = 0; i < g_count; i++)
+    {
+        buf = (i == g_current) ? &g_buffer : &g_tabs[i].buffer;
+        if (buffer_modified(buf))
+        {
+            journal_close(buf->journal, true);
+            buf->journal = NULL;
+        }
+    }
+}
+
+/*
+ * Describe the tabs for ":ls": "1 a.c  [2 b.c]  3 c.c", the shown one in
+ * brackets, cut short to fit
+ *
+ * @param out: Receives the text (NUL-terminated)
+ * @param size: Size of out
+ */
+void	tabs_list(char *out, size_t size)
+{
+    size_t	len;
+    int		n;
+
+    len = 0;
+    out[0] = '\0';
+    for (size_t i = 0; i < g_count && len < size; i++)
+    {
+        n = snprintf(out + len, size - len, (i == g_current) ? "%s[%zu %s]" : "%s%zu %s",
+            (i > 0) ? "  " : "", i + 1, tabs_name(i));
+        if (n < 0)
+            break ;
+        len += (size_t)n;
+    }
+}
@@ -39,6 +39,7 @@ void	disable_raw_mode(void)
         die("tcsetattr");
 
     // Clean up screen state
+    write(STDOUT_FILENO, "\x1b[?2004l", 8); // Bracketed paste off
     write(STDOUT_FILENO, "\x1b[2J", 4);   // ANSI: Clear entire screen
     write(STDOUT_FILENO, "\x1b[?25h", 6); // ANSI: Show cursor
     write(STDOUT_FILENO, "\x1b[H", 3);    // ANSI: Move cursor to top-left
@@ -71,35 +72,134 @@ void	enable_raw_mode(void)
      */
     raw.c_lflag &= ~(ECHO | ICANON);
 
+    /*
+     * - ICRNL: Don't turn '\r' into '\n'. Enter arrives as '\r', and a
+     *   pasted "\r\n" stays one line break (keys.c) instead of two
+     */
+    raw.c_iflag &= ~ICRNL;
+
     /*
      * Set read timeouts:
      * - VMIN: Minimum characters to read (0 = don't wait for specific count)
-     * - VTIME: Timeout in deciseconds (1 = 0.1 seconds)
-     *   This makes read() return immediately if characters are available,
-     *   or after 0.1 seconds if no input (prevents blocking forever)
+     * - VTIME: Timeout in deciseconds (0 = none)
+     *   read() never blocks: it returns whatever is available, possibly
+     *   nothing. Waiting is done in poll() by the event loop (loop.c).
      */
     raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 1;
+    raw.c_cc[VTIME] = 0;
 
-    // Apply the new terminal settings immediately
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    // Apply the new terminal settings immediately, keeping keys typed
+    // while the editor was starting
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    // Bracketed paste: pasted text arrives wrapped in ESC[200~ ... ESC[201~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
 /*
- * Handle Ctrl+C (SIGINT) signal gracefully
- * Ensures proper cleanup even when user force-quits
+ * Handle Ctrl+C (SIGINT) and other termination signals gracefully
+ * Ensures proper cleanup even when user force-quits. Called from the main
+ * loop once the signal has come through the event loop's self-pipe, so it
+ * can safely wait for a background save to finish. Ctrl+C quits without
+ * asking, but the swap files of tabs with unsaved changes stay on disk;
+ * when the editor is killed or loses its terminal every swap file is
+ * left so the edits can be recovered.
  * 
- * @param sig: Signal number (unused but required by signal handler signature)
+ * @param sig: SIGINT, or SIGHUP for a kill or a lost terminal
  */
 void	sigint_handle(int sig)
 {
-    (void)sig;  // Suppress unused parameter warning
-    
+    save_wait();         // Don't leave a half-written temp file behind
+    tabs_keep_modified();  // Unsaved edits stay recoverable
+    journal_close_all(sig != SIGINT);
+    reset_screen();
     disable_raw_mode();  // Restore terminal state
     write(STDOUT_FILENO, "Exiting...\n", 12);  // Friendly exit message
     exit(ERR_NO_ERROR);
 }
 
+/*
+ * Hand keys typed while the terminal was being asked to the key decoder:
+ * everything read but the replies (ESC [ ? digits c, ESC [ ? digits $ y)
+ *
+ * @param reply: Bytes read (NUL-terminated)
+ * @param len: Their number
+ */
+static void	keep_typed(const char *reply, size_t len)
+{
+    char	typed[256];
+    size_t	n;
+    size_t	i;
+    size_t	end;
+
+    n = 0;
+    i = 0;
+    while (i < len)
+    {
+        if (strncmp(reply + i, "\x1b[?", 3) == 0)
+        {
+            end = i + 3 + strspn(reply + i + 3, "0123456789;");
+            if (reply[end] == 'c')
+            {
+                i = end + 1;
+                continue ;
+            }
+            if (reply[end] == '$' && reply[end + 1] == 'y')
+            {
+                i = end + 2;
+                continue ;
+            }
+        }
+        typed[n++] = reply[i++];
+    }
+    if (n > 0 && key_feed(typed, n) > 0)
+        loop_wake(); // The main loop decodes them as if just read
+}
+
+/*
+ * Ask the terminal whether it supports synchronized updates (mode 2026)
+ * Sends a DECRQM query for the mode followed by a primary device attributes
+ * request. Every terminal answers the latter, so once its reply arrives we
+ * know whether a mode report came first, without waiting for a timeout.
+ * Must be called in raw mode, after loop_init(); keys typed meanwhile are
+ * not lost.
+ *
+ * @return: true if the terminal reported mode 2026 as set or reset
+ */
+bool	term_query_sync_update(void)
+{
+    char			reply[256]; // Everything the terminal answered
+    size_t			len;        // Bytes in reply
+    ssize_t			n;          // Bytes from the last read
+    struct pollfd	pfd;        // Wait for the answer on stdin
+    char			*da;        // Start of the device attributes reply
+
+    write(STDOUT_FILENO, "\x1b[?2026$p\x1b[c", 12);
+    pfd.fd = STDIN_FILENO;
+    pfd.events = POLLIN;
+    len = 0;
+    reply[0] = '\0';
+    while (len < sizeof(reply) - 1 && poll(&pfd, 1, TERM_QUERY_TIMEOUT_MS) > 0)
+    {
+        n = read(STDIN_FILENO, reply + len, sizeof(reply) - 1 - len);
+        if (n <= 0)
+            break ;
+        len += n;
+        reply[len] = '\0';
+        // Device attributes reply looks like ESC [ ? 6 2 ; ... c
+        da = strstr(reply, "\x1b[?");
+        while (da != NULL && strspn(da + 3, "0123456789;") > 0
+            && da[3 + strspn(da + 3, "0123456789;")] != 'c')
+            da = strstr(da + 3, "\x1b[?");
+        if (da != NULL && da[3 + strspn(da + 3, "0123456789;")] == 'c')
+            break ;
+    }
+    keep_typed(reply, len);
+    // Mode report: ESC [ ? 2026 ; Ps $ y with Ps 1 (set) or 2 (reset)
+    return (strstr(reply, "\x1b[?2026;1$y") != NULL
+        || strstr(reply, "\x1b[?2026;2$y") != NULL);
+}
+
 /*
  * Get current terminal window dimensions
  * Uses ioctl system call to query terminal size
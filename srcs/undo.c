@@ -0,0 +1,452 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Undo History
+ * Every edit is recorded as a compact operation - where it happened, and
+ * the bytes that were inserted or deleted - in an append-only log. The
+ * bytes live in an arena of large blocks, so recording a keystroke is a
+ * copy into the current block, and undoing or redoing a change costs time
+ * proportional to the change, never to the document. Consecutive typing
+ * grows a single operation, so a typed word is undone in one step.
+ * The log holds at most `budget` bytes; past that the oldest steps are
+ * dropped.
+ */
+
+/*
+ * Get n bytes at the end of the arena
+ * Oversized requests get a block of their own
+ */
+static char	*arena_alloc(t_undo_log *log, size_t n, t_undo_block **block)
+{
+    t_undo_block	*b;
+    size_t			size;
+
+    b = log->tail;
+    if (b == NULL || b->size - b->used < n)
+    {
+        size = (n > UNDO_BLOCK_SIZE) ? n : UNDO_BLOCK_SIZE;
+        b = malloc(sizeof(*b) + size);
+        if (b == NULL)
+            die("malloc");
+        b->prev = log->tail;
+        b->next = NULL;
+        b->used = 0;
+        b->size = size;
+        if (log->tail)
+            log->tail->next = b;
+        else
+            log->head = b;
+        log->tail = b;
+    }
+    *block = b;
+    b->used += n;
+    return (b->data + b->used - n);
+}
+
+/*
+ * Give the arena back from `from` onward (in block `block`) - used when
+ * the ops holding those bytes are discarded
+ */
+static void	arena_truncate(t_undo_log *log, t_undo_block *block, const char *from)
+{
+    t_undo_block	*b;
+
+    while (log->tail != block)
+    {
+        b = log->tail;
+        log->tail = b->prev;
+        log->tail->next = NULL;
+        free(b);
+    }
+    block->used = from - block->data;
+}
+
+/*
+ * Free the blocks before `keep` (NULL frees every block)
+ */
+static void	arena_release_front(t_undo_log *log, t_undo_block *keep)
+{
+    t_undo_block	*b;
+
+    while (log->head != NULL && log->head != keep)
+    {
+        b = log->head;
+        log->head = b->next;
+        free(b);
+    }
+    if (log->head == NULL)
+        log->tail = NULL;
+    else
+        log->head->prev = NULL;
+}
+
+/*
+ * Let go of an op's text and say how much of the history it accounted for
+ * A replacement's old text stays in the buffer's sources, so only its
+ * record counts
+ */
+static size_t	op_drop(t_undo_op *op)
+{
+    if (op->type == UNDO_REPLACE)
+    {
+        buffer_release_pieces(op->pieces);
+        op->pieces = NULL;
+        return (sizeof(t_undo_op));
+    }
+    return (op->len + sizeof(t_undo_op));
+}
+
+/*
+ * Forget the whole history (e.g. another file was opened)
+ * The memory budget is kept
+ */
+void	undo_clear(t_undo_log *log)
+{
+    for (size_t i = 0; i < log->count; i++)
+        op_drop(&log->ops[i]);
+    arena_release_front(log, NULL);
+    free(log->ops);
+    log->ops = NULL;
+    log->count = 0;
+    log->applied = 0;
+    log->cap = 0;
+    log->memory = 0;
+    log->coalesce = false;
+}
+
+/*
+ * Drop undone ops: a new edit makes them impossible to redo
+ */
+static void	discard_redo(t_undo_log *log)
+{
+    if (log->applied == log->count)
+        return ;
+    arena_truncate(log, log->ops[log->applied].block, log->ops[log->applied].bytes);
+    for (size_t i = log->applied; i < log->count; i++)
+        log->memory -= op_drop(&log->ops[i]);
+    log->count = log->applied;
+}
+
+/*
+ * Drop the oldest steps until the history fits in its budget again
+ * Trims to 3/4 of the budget so the op array is not shifted on every
+ * edit. The newest step is always kept, however large.
+ */
+static void	trim_history(t_undo_log *log)
+{
+    size_t	target;
+    size_t	k;
+    size_t	end;
+
+    if (log->memory <= log->budget)
+        return ;
+    target = log->budget - log->budget / 4;
+    k = 0;
+    while (log->memory > target && k < log->applied)
+    {
+        end = k;
+        while (end < log->applied && log->ops[end].step == log->ops[k].step)
+            end++;
+        if (end == log->count || log->ops[end - 1].step == log->step)
+            break ; // Only the newest step is left
+        for (; k < end; k++)
+            log->memory -= op_drop(&log->ops[k]);
+    }
+    if (k == 0)
+        return ;
+    memmove(log->ops, log->ops + k, sizeof(t_undo_op) * (log->count - k));
+    log->count -= k;
+    log->applied -= k;
+    arena_release_front(log, log->count ? log->ops[0].block : NULL);
+}
+
+/*
+ * Whether an edit continues the newest op (typing, or a run of Backspace
+ * or Delete presses right next to it)
+ */
+static bool	continues_last(t_undo_log *log, t_undo_type type, size_t pos, size_t len)
+{
+    t_undo_op	*last;
+
+    if (!log->coalesce || log->applied == 0
+        || log->applied != log->count)
+        return (false);
+    last = &log->ops[log->count - 1];
+    if (last->type != type)
+        return (false);
+    if (type == UNDO_INSERT)
+        return (pos == last->pos + last->len);
+    return (pos == last->pos || pos + len == last->pos);
+}
+
+/*
+ * Make room for len more bytes in the newest op
+ * Its bytes are at the end of the arena, so they usually just grow in
+ * place; otherwise they move to a fresh block with room to spare
+ */
+static void	grow_last(t_undo_log *log, size_t len)
+{
+    t_undo_op		*last;
+    t_undo_block	*b;
+    char			*bytes;
+
+    last = &log->ops[log->count - 1];
+    b = last->block;
+    if (b == log->tail && last->bytes + last->len == b->data + b->used
+        && b->size - b->used >= len)
+    {
+        b->used += len;
+        return ;
+    }
+    bytes = arena_alloc(log, (last->len + len) * 2, &b);
+    memcpy(bytes, last->bytes, last->len);
+    b->used -= (last->len + len) * 2 - (last->len + len);
+    // The old copy sits below the new one and stays until its block goes
+    last->bytes = bytes;
+    last->block = b;
+}
+
+/*
+ * Append a new op and reserve its bytes in the arena
+ */
+static t_undo_op	*push_op(t_undo_log *log, t_undo_type type, size_t pos, size_t len)
+{
+    t_undo_op	*op;
+
+    if (log->count == log->cap)
+    {
+        log->cap = log->cap ? log->cap * 2 : 256;
+        log->ops = realloc(log->ops, sizeof(t_undo_op) * log->cap);
+        if (log->ops == NULL)
+            die("realloc");
+    }
+    log->step++;
+    op = &log->ops[log->count++];
+    op->type = type;
+    op->pos = pos;
+    op->len = len;
+    op->step = log->step;
+    op->pieces = NULL;
+    op->bytes = arena_alloc(log, len, &op->block);
+    log->applied = log->count;
+    log->memory += len + sizeof(t_undo_op);
+    return (op);
+}
+
+/*
+ * Record text that was just inserted
+ *
+ * @param log: History to record into
+ * @param pos: Offset of the insertion
+ * @param text: Inserted bytes
+ * @param len: Number of bytes
+ * @param coalesce: Typing - may join the previous insertion
+ */
+void	undo_record_insert(t_undo_log *log, size_t pos, const char *text, size_t len,
+    bool coalesce)
+{
+    t_undo_op	*last;
+
+    if (len == 0)
+        return ;
+    discard_redo(log);
+    if (coalesce && continues_last(log, UNDO_INSERT, pos, len))
+    {
+        last = &log->ops[log->count - 1];
+        grow_last(log, len);
+        memcpy(last->bytes + last->len, text, len);
+        last->len += len;
+        log->memory += len;
+    }
+    else
+        memcpy(push_op(log, UNDO_INSERT, pos, len)->bytes, text, len);
+    log->coalesce = coalesce;
+    trim_history(log);
+}
+
+/*
+ * Record text about to be deleted (call before buffer_delete)
+ * The bytes are copied straight from the buffer into the arena
+ *
+ * @param log: History to record into
+ * @param buf: Buffer the text is deleted from
+ * @param pos: Offset of the deletion
+ * @param len: Number of bytes
+ * @param coalesce: Backspace/Delete key - may join the previous deletion
+ */
+void	undo_record_delete(t_undo_log *log, const t_buffer *buf, size_t pos, size_t len,
+    bool coalesce)
+{
+    t_undo_op	*last;
+
+    if (len == 0)
+        return ;
+    discard_redo(log);
+    if (coalesce && continues_last(log, UNDO_DELETE, pos, len))
+    {
+        last = &log->ops[log->count - 1];
+        grow_last(log, len);
+        if (pos + len == last->pos)
+        {
+            // Backspace: the new bytes come first
+            memmove(last->bytes + len, last->bytes, last->len);
+            buffer_read(buf, pos, last->bytes, len);
+            last->pos = pos;
+        }
+        else
+            buffer_read(buf, pos, last->bytes + last->len, len);
+        last->len += len;
+        log->memory += len;
+    }
+    else
+        buffer_read(buf, pos, push_op(log, UNDO_DELETE, pos, len)->bytes, len);
+    log->coalesce = coalesce;
+    trim_history(log);
+}
+
+/*
+ * Record a span replaced with buffer_splice() (call after the splice)
+ *
+ * @param log: History to record into
+ * @param pos: Start of the span
+ * @param len: Bytes the span holds now
+ * @param old: Pieces buffer_splice() took out; the history keeps them
+ */
+void	undo_record_replace(t_undo_log *log, size_t pos, size_t len, t_piece *old)
+{
+    t_undo_op	*op;
+
+    discard_redo(log);
+    op = push_op(log, UNDO_REPLACE, pos, 0);
+    op->len = len;
+    op->pieces = old;
+    log->coalesce = false;
+    trim_history(log);
+}
+
+/*
+ * Swap the text of a replacement op with what the document holds there
+ */
+static void	swap_replaced(t_undo_op *op, t_buffer *buf)
+{
+    size_t	len;
+
+    len = op->pieces ? op->pieces->sum_len : 0;
+    op->pieces = buffer_splice(buf, op->pos, op->len, op->pieces);
+    op->len = len;
+}
+
+/*
+ * End the current run of typing: the next edit starts a new undo step
+ * (called when the cursor moves or the mode changes)
+ */
+void	undo_break(t_undo_log *log)
+{
+    log->coalesce = false;
+}
+
+/*
+ * Lowest offset the next undo (or redo) step touches, or SIZE_MAX if there
+ * is none - everything before it is left as it is
+ */
+size_t	undo_step_start(const t_undo_log *log, bool redo)
+{
+    size_t		i;
+    size_t		lowest;
+    uint32_t	step;
+
+    if (redo ? log->applied == log->count : log->applied == 0)
+        return (SIZE_MAX);
+    i = redo ? log->applied : log->applied - 1;
+    step = log->ops[i].step;
+    lowest = SIZE_MAX;
+    while (i < log->count && log->ops[i].step == step)
+    {
+        if (log->ops[i].pos < lowest)
+            lowest = log->ops[i].pos;
+        i += redo ? 1 : -1; // Wraps past 0 to stop an undo scan
+    }
+    return (lowest);
+}
+
+/*
+ * Undo the newest step that is still in the document
+ *
+ * @param log: History
+ * @param buf: Buffer the edits were made to
+ * @param pos: Receives the offset where the step started
+ * @return: false if there is nothing to undo
+ */
+bool	undo_revert(t_undo_log *log, t_buffer *buf, size_t *pos)
+{
+    t_undo_op	*op;
+    uint32_t	step;
+
+    if (log->applied == 0)
+        return (false);
+    step = log->ops[log->applied - 1].step;
+    while (log->applied > 0 && log->ops[log->applied - 1].step == step)
+    {
+        op = &log->ops[--log->applied];
+        if (op->type == UNDO_INSERT)
+            buffer_delete(buf, op->pos, op->len);
+        else if (op->type == UNDO_REPLACE)
+            swap_replaced(op, buf);
+        else
+            buffer_insert(buf, op->pos, op->bytes, op->len);
+        *pos = op->pos;
+    }
+    log->coalesce = false;
+    return (true);
+}
+
+/*
+ * Redo the oldest undone step
+ *
+ * @param log: History
+ * @param buf: Buffer the edits were made to
+ * @param pos: Receives the offset where the step's last edit ended
+ * @return: false if there is nothing to redo
+ */
+bool	undo_replay(t_undo_log *log, t_buffer *buf, size_t *pos)
+{
+    t_undo_op	*op;
+    uint32_t	step;
+
+    if (log->applied == log->count)
+        return (false);
+    step = log->ops[log->applied].step;
+    while (log->applied < log->count && log->ops[log->applied].step == step)
+    {
+        op = &log->ops[log->applied++];
+        if (op->type == UNDO_INSERT)
+        {
+            buffer_insert(buf, op->pos, op->bytes, op->len);
+            *pos = op->pos + op->len;
+        }
+        else if (op->type == UNDO_REPLACE)
+        {
+            swap_replaced(op, buf);
+            *pos = op->pos;
+        }
+        else
+        {
+            buffer_delete(buf, op->pos, op->len);
+            *pos = op->pos;
+        }
+    }
+    log->coalesce = false;
+    return (true);
+}
+
+/*
+ * Change the memory budget, dropping old history that no longer fits
+ *
+ * @param log: History
+ * @param budget: Bytes of history to keep
+ */
+void	undo_set_budget(t_undo_log *log, size_t budget)
+{
+    log->budget = budget;
+    trim_history(log);
+}
@@ -0,0 +1,530 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON UTF-8
+ * Text is kept as bytes; UTF-8 is only interpreted to draw it and to move
+ * over it. Decoding is strict (no overlong forms, surrogates or values past
+ * U+10FFFF); a byte that does not start a valid sequence stands for itself
+ * and is shown as '?'. Display widths come from two range tables: marks
+ * and other zero-width characters, and the wide (East Asian, emoji) ones.
+ * Validation of a whole file is vectorized: the AVX2 version checks 32
+ * bytes at a time with the nibble lookup tables of Keiser and Lemire, the
+ * SSE2 one skips runs of ASCII, and the best one is picked at run time.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define UTF8_HAVE_X86 1
+#else
+# define UTF8_HAVE_X86 0
+#endif
+
+// Zero-width characters: combining marks, joiners, variation selectors
+static const uint32_t	g_zero_width[][2] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+    {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+    {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+    {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}, {0x0730, 0x074A},
+    {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x0816, 0x0819}, {0x081B, 0x0823},
+    {0x0825, 0x0827}, {0x0829, 0x082D}, {0x0859, 0x085B}, {0x08D3, 0x08E1},
+    {0x08E3, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948},
+    {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0981, 0x0981},
+    {0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD}, {0x09E2, 0x09E3},
+    {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C}, {0x0A41, 0x0A51}, {0x0A70, 0x0A71},
+    {0x0A75, 0x0A75}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC}, {0x0AC1, 0x0AC8},
+    {0x0ACD, 0x0ACD}, {0x0AE2, 0x0AE3}, {0x0B01, 0x0B01}, {0x0B3C, 0x0B3C},
+    {0x0B3F, 0x0B3F}, {0x0B41, 0x0B44}, {0x0B4D, 0x0B4D}, {0x0B56, 0x0B56},
+    {0x0B62, 0x0B63}, {0x0B82, 0x0B82}, {0x0BC0, 0x0BC0}, {0x0BCD, 0x0BCD},
+    {0x0C00, 0x0C00}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C56}, {0x0C62, 0x0C63},
+    {0x0CBC, 0x0CBC}, {0x0CCC, 0x0CCD}, {0x0CE2, 0x0CE3}, {0x0D00, 0x0D01},
+    {0x0D41, 0x0D44}, {0x0D4D, 0x0D4D}, {0x0D62, 0x0D63}, {0x0DCA, 0x0DCA},
+    {0x0DD2, 0x0DD6}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+    {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x0F18, 0x0F19},
+    {0x0F35, 0x0F35}, {0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E},
+    {0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F8D, 0x0FBC}, {0x0FC6, 0x0FC6},
+    {0x102D, 0x1030}, {0x1032, 0x1037}, {0x1039, 0x103A}, {0x103D, 0x103E},
+    {0x1058, 0x1059}, {0x105E, 0x1060}, {0x1071, 0x1074}, {0x1082, 0x1082},
+    {0x1085, 0x1086}, {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF},
+    {0x135D, 0x135F}, {0x1712, 0x1714}, {0x1732, 0x1734}, {0x1752, 0x1753},
+    {0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6},
+    {0x17C9, 0x17D3}, {0x17DD, 0x17DD}, {0x180B, 0x180E}, {0x18A9, 0x18A9},
+    {0x1920, 0x1922}, {0x1927, 0x1928}, {0x1932, 0x1932}, {0x1939, 0x193B},
+    {0x1A17, 0x1A18}, {0x1A1B, 0x1A1B}, {0x1A56, 0x1A56}, {0x1A58, 0x1A60},
+    {0x1A62, 0x1A62}, {0x1A65, 0x1A6C}, {0x1A73, 0x1A7F}, {0x1AB0, 0x1AFF},
+    {0x1B00, 0x1B03}, {0x1B34, 0x1B34}, {0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C},
+    {0x1B42, 0x1B42}, {0x1B6B, 0x1B73}, {0x1B80, 0x1B81}, {0x1BA2, 0x1BA5},
+    {0x1BA8, 0x1BAD}, {0x1BE6, 0x1BE6}, {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED},
+    {0x1BEF, 0x1BF1}, {0x1C2C, 0x1C33}, {0x1C36, 0x1C37}, {0x1CD0, 0x1CD2},
+    {0x1CD4, 0x1CE0}, {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4},
+    {0x1CF8, 0x1CF9}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E},
+    {0x2060, 0x2064}, {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F},
+    {0x2DE0, 0x2DFF}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xA66F, 0xA672},
+    {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1}, {0xA802, 0xA802},
+    {0xA806, 0xA806}, {0xA80B, 0xA80B}, {0xA825, 0xA826}, {0xA8C4, 0xA8C5},
+    {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D}, {0xA947, 0xA951},
+    {0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD},
+    {0xA9E5, 0xA9E5}, {0xAA29, 0xAA2E}, {0xAA31, 0xAA32}, {0xAA35, 0xAA36},
+    {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C}, {0xAA7C, 0xAA7C}, {0xAAB0, 0xAAB0},
+    {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF}, {0xAAC1, 0xAAC1},
+    {0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5}, {0xABE8, 0xABE8},
+    {0xABED, 0xABED}, {0xD7B0, 0xD7FF}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD},
+    {0x102E0, 0x102E0}, {0x10376, 0x1037A}, {0x10A01, 0x10A0F},
+    {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27},
+    {0x10F46, 0x10F50}, {0x11001, 0x11001}, {0x11038, 0x11046},
+    {0x1107F, 0x11081}, {0x110B3, 0x110B6}, {0x110B9, 0x110BA},
+    {0x11100, 0x11102}, {0x11127, 0x1112B}, {0x1112D, 0x11134},
+    {0x11173, 0x11173}, {0x11180, 0x11181}, {0x111B6, 0x111BE},
+    {0x1D167, 0x1D169}, {0x1D173, 0x1D182}, {0x1D185, 0x1D18B},
+    {0x1D1AA, 0x1D1AD}, {0x1D242, 0x1D244}, {0x1E000, 0x1E02A},
+    {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A}, {0x1F3FB, 0x1F3FF},
+    {0xE0001, 0xE007F}, {0xE0100, 0xE01EF},
+};
+
+// Double-width characters: East Asian wide and fullwidth, emoji
+static const uint32_t	g_wide[][2] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+    {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+    {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+    {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+    {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+    {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+    {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x2E99},
+    {0x2E9B, 0x2EF3}, {0x2F00, 0x2FD5}, {0x2FF0, 0x2FFB}, {0x3000, 0x303E},
+    {0x3041, 0x3096}, {0x3099, 0x30FF}, {0x3105, 0x312F}, {0x3131, 0x318E},
+    {0x3190, 0x31E3}, {0x31F0, 0x321E}, {0x3220, 0x3247}, {0x3250, 0x4DBF},
+    {0x4E00, 0xA48C}, {0xA490, 0xA4C6}, {0xA960, 0xA97C}, {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE52}, {0xFE54, 0xFE66},
+    {0xFE68, 0xFE6B}, {0xFF01, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+    {0x17000, 0x187F7}, {0x18800, 0x18CD5}, {0x1B000, 0x1B11E},
+    {0x1B150, 0x1B152}, {0x1B164, 0x1B167}, {0x1B170, 0x1B2FB},
+    {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E},
+    {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B},
+    {0x1F240, 0x1F248}, {0x1F250, 0x1F251}, {0x1F260, 0x1F265},
+    {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C},
+    {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3},
+    {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E},
+    {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D},
+    {0x1F54B, 0x1F54E}, {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A},
+    {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F},
+    {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+    {0x1F6D5, 0x1F6D7}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC},
+    {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945},
+    {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD},
+    {0x30000, 0x3FFFD},
+};
+
+/*
+ * Whether cp falls in one of the n ranges of a sorted table
+ */
+static bool	in_table(uint32_t cp, const uint32_t (*table)[2], size_t n)
+{
+    size_t	lo;
+    size_t	hi;
+    size_t	mid;
+
+    if (cp < table[0][0] || cp > table[n - 1][1])
+        return (false);
+    lo = 0;
+    hi = n;
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (cp > table[mid][1])
+            lo = mid + 1;
+        else if (cp < table[mid][0])
+            hi = mid;
+        else
+            return (true);
+    }
+    return (false);
+}
+
+/*
+ * Decode the character at the start of s
+ *
+ * @param s: Bytes (at least one)
+ * @param n: Bytes available
+ * @param cp: Receives the code point, or UTF8_INVALID
+ * @return: Bytes it takes (1 for an invalid byte)
+ */
+size_t	utf8_decode(const char *s, size_t n, uint32_t *cp)
+{
+    const unsigned char	*u;
+    size_t				len;
+    uint32_t			c;
+
+    u = (const unsigned char *)s;
+    *cp = u[0];
+    if (u[0] < 0x80)
+        return (1);
+    *cp = UTF8_INVALID;
+    if (u[0] < 0xC2 || u[0] > 0xF4)
+        return (1); // Continuation byte, overlong 2-byte lead or past U+10FFFF
+    len = (u[0] < 0xE0) ? 2 : (u[0] < 0xF0) ? 3 : 4;
+    if (n < len)
+        return (1);
+    for (size_t i = 1; i < len; i++)
+    {
+        if ((u[i] & 0xC0) != 0x80)
+            return (1);
+    }
+    // Second byte limits: no overlong forms, surrogates or values past U+10FFFF
+    if ((u[0] == 0xE0 && u[1] < 0xA0) || (u[0] == 0xED && u[1] > 0x9F)
+        || (u[0] == 0xF0 && u[1] < 0x90) || (u[0] == 0xF4 && u[1] > 0x8F))
+        return (1);
+    c = u[0] & (0x7F >> len);
+    for (size_t i = 1; i < len; i++)
+        c = (c << 6) | (u[i] & 0x3F);
+    *cp = c;
+    return (len);
+}
+
+/*
+ * Columns a character takes on the terminal: 0 for marks and joiners,
+ * 2 for wide characters, 1 for everything else (including control
+ * characters and invalid bytes, which are shown as '?')
+ */
+int	utf8_width(uint32_t cp)
+{
+    if (cp < 0x0300 || cp == UTF8_INVALID)
+        return (1);
+    if (in_table(cp, g_zero_width, sizeof(g_zero_width) / sizeof(g_zero_width[0])))
+        return (0);
+    if (in_table(cp, g_wide, sizeof(g_wide) / sizeof(g_wide[0])))
+        return (2);
+    return (1);
+}
+
+/*
+ * Whether a character is drawn as itself (control characters and invalid
+ * bytes are drawn as '?')
+ */
+bool	utf8_printable(uint32_t cp)
+{
+    return (cp != UTF8_INVALID && cp >= 0x20 && (cp < 0x7F || cp >= 0xA0));
+}
+
+/*
+ * Whether cp belongs to the same user-perceived character as the one
+ * before it (prev): a mark, a variation selector, or a character after a
+ * zero width joiner
+ */
+bool	utf8_extends(uint32_t prev, uint32_t cp)
+{
+    if (cp < 0x0300 || cp == UTF8_INVALID)
+        return (false);
+    return (prev == UTF8_ZWJ || utf8_width(cp) == 0);
+}
+
+/*
+ * Validate from a character boundary one sequence at a time
+ *
+ * @return: Offset of the first invalid byte, or len
+ */
+static size_t	validate_from(const char *data, size_t i, size_t len, bool *ascii)
+{
+    uint32_t	cp;
+
+    while (i < len)
+    {
+        if ((unsigned char)data[i] < 0x80)
+        {
+            i++;
+            continue ;
+        }
+        *ascii = false;
+        i += utf8_decode(data + i, len - i, &cp);
+        if (cp == UTF8_INVALID)
+            return (i - 1);
+    }
+    return (len);
+}
+
+/*
+ * Scalar validator: skip ASCII eight bytes at a time
+ */
+static size_t	validate_scalar(const char *data, size_t len, bool *ascii)
+{
+    uint64_t	word;
+    size_t		i;
+    uint32_t	cp;
+
+    i = 0;
+    while (i < len)
+    {
+        while (i + 8 <= len)
+        {
+            memcpy(&word, data + i, 8);
+            if (word & 0x8080808080808080ull)
+                break ;
+            i += 8;
+        }
+        if (i + 8 > len)
+            return (validate_from(data, i, len, ascii));
+        while ((unsigned char)data[i] < 0x80)
+            i++;
+        *ascii = false;
+        i += utf8_decode(data + i, len - i, &cp);
+        if (cp == UTF8_INVALID)
+            return (i - 1);
+    }
+    return (len);
+}
+
+#if UTF8_HAVE_X86
+
+/*
+ * SSE2 validator: skip ASCII sixteen bytes at a time, decode the rest
+ */
+__attribute__((target("sse2")))
+static size_t	validate_sse2(const char *data, size_t len, bool *ascii)
+{
+    size_t		i;
+    size_t		end;
+    uint32_t	cp;
+
+    i = 0;
+    while (i + 16 <= len)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + i))) == 0)
+        {
+            i += 16;
+            continue ;
+        }
+        *ascii = false;
+        end = i + 16;
+        while (i < end)
+        {
+            if ((unsigned char)data[i] < 0x80)
+            {
+                i++;
+                continue ;
+            }
+            i += utf8_decode(data + i, len - i, &cp);
+            if (cp == UTF8_INVALID)
+                return (i - 1);
+        }
+    }
+    return (validate_from(data, i, len, ascii));
+}
+
+// Error classes of two consecutive bytes (Keiser and Lemire, "Validating
+// UTF-8 in less than one instruction per byte")
+# define U8_TOO_SHORT 0x01  // Lead byte not followed by a continuation
+# define U8_TOO_LONG 0x02   // Continuation after an ASCII byte
+# define U8_OVERLONG_3 0x04
+# define U8_TOO_LARGE 0x08
+# define U8_SURROGATE 0x10
+# define U8_OVERLONG_2 0x20
+# define U8_TOO_LARGE_1000 0x40
+# define U8_OVERLONG_4 0x40
+# define U8_TWO_CONTS 0x80  // Two continuations: fine only inside a 3/4-byte sequence
+# define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+/*
+ * Look each byte's nibble up in a 16-entry table (both lanes)
+ */
+__attribute__((target("avx2")))
+static __m256i	lookup16(__m256i nibbles, const uint8_t *table)
+{
+    return (_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)table)), nibbles));
+}
+
+/*
+ * Errors of the 32 bytes of input given the bytes before them (prev)
+ */
+__attribute__((target("avx2")))
+static __m256i	block_errors_avx2(__m256i input, __m256i prev)
+{
+    static const uint8_t	byte_1_high[16] = {
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        U8_TOO_SHORT | U8_OVERLONG_2, U8_TOO_SHORT,
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4};
+    static const uint8_t	byte_1_low[16] = {
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+        U8_CARRY | U8_OVERLONG_2, U8_CARRY, U8_CARRY,
+        U8_CARRY | U8_TOO_LARGE, U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000};
+    static const uint8_t	byte_2_high[16] = {
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3
+            | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT};
+    __m256i	low;
+    __m256i	shifted;
+    __m256i	prev1;
+    __m256i	prev2;
+    __m256i	prev3;
+    __m256i	special;
+    __m256i	must23;
+
+    low = _mm256_set1_epi8(0x0F);
+    // The last bytes of prev, then input, shifted in by 1, 2 and 3 bytes
+    shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+    prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    prev3 = _mm256_alignr_epi8(input, shifted, 13);
+    special = _mm256_and_si256(_mm256_and_si256(
+        lookup16(_mm256_and_si256(_mm256_srli_epi16(prev1, 4), low), byte_1_high),
+        lookup16(_mm256_and_si256(prev1, low), byte_1_low)),
+        lookup16(_mm256_and_si256(_mm256_srli_epi16(input, 4), low), byte_2_high));
+    // Third and fourth bytes of a sequence must be continuations
+    must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+        _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+    return (_mm256_xor_si256(must23, special));
+}
+
+/*
+ * AVX2 validator: 32 bytes per step with no branch on the data except the
+ * ASCII shortcut; on an error the exact offset is found by decoding the
+ * blocks around it
+ */
+__attribute__((target("avx2")))
+static size_t	validate_avx2(const char *data, size_t len, bool *ascii)
+{
+    static const uint8_t	incomplete_max[32] = {
+        255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+        255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+    __m256i	input;
+    __m256i	prev;
+    __m256i	error;
+    __m256i	incomplete;
+    size_t	i;
+    size_t	back;
+
+    prev = _mm256_setzero_si256();
+    incomplete = _mm256_setzero_si256();
+    i = 0;
+    while (i + 32 <= len)
+    {
+        input = _mm256_loadu_si256((const __m256i *)(data + i));
+        if (_mm256_movemask_epi8(input) == 0)
+            error = incomplete; // A sequence cut short by ASCII
+        else
+        {
+            *ascii = false;
+            error = block_errors_avx2(input, prev);
+        }
+        if (!_mm256_testz_si256(error, error))
+            break ;
+        // Lead bytes in the last three positions need the next block
+        incomplete = _mm256_subs_epu8(input,
+            _mm256_loadu_si256((const __m256i *)incomplete_max));
+        prev = input;
+        i += 32;
+    }
+    // Finish (or find the error) from a character boundary before block i
+    back = (i >= 32) ? i - 32 : 0;
+    while (back > 0 && ((unsigned char)data[back] & 0xC0) == 0x80)
+        back--;
+    return (validate_from(data, back, len, ascii));
+}
+
+#endif
+
+// Every implementation this binary was built with, best first
+static const t_utf8_impl	g_impls[] = {
+#if UTF8_HAVE_X86
+    {"avx2", validate_avx2},
+    {"sse2", validate_sse2},
+#endif
+    {"scalar", validate_scalar},
+};
+
+static const t_utf8_impl	*g_best = NULL;
+static pthread_once_t		g_best_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Pick the fastest implementation the CPU supports (runs once)
+ */
+static void	select_best(void)
+{
+    size_t	i;
+
+    i = 0;
+#if UTF8_HAVE_X86
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+        i++;
+    if (i == 1 && !__builtin_cpu_supports("sse2"))
+        i++;
+#endif
+    g_best = &g_impls[i];
+}
+
+/*
+ * List the UTF-8 validators usable on this CPU, best first
+ * Used by the benchmark to compare implementations
+ *
+ * @param count: Receives the number of entries
+ * @return: Array of implementations
+ */
+const t_utf8_impl	*utf8_impls(size_t *count)
+{
+    size_t	first;
+
+    pthread_once(&g_best_once, select_best);
+    first = g_best - g_impls;
+    *count = sizeof(g_impls) / sizeof(g_impls[0]) - first;
+    return (g_best);
+}
+
+/*
+ * Check that data[0, len) is valid UTF-8
+ *
+ * @param ascii: Cleared if some byte is >= 0x80 (left alone otherwise)
+ * @return: Offset of the first byte not part of a valid sequence, or len
+ */
+size_t	utf8_validate(const char *data, size_t len, bool *ascii)
+{
+    pthread_once(&g_best_once, select_best);
+    return (g_best->validate(data, len, ascii));
+}
+
+/*
+ * Check the range [from, to) of a larger block of size bytes, as one of
+ * several ranges checked separately: a character that starts before from
+ * is checked from its start, and one that runs past to is checked whole
+ *
+ * @param ascii: Cleared if some byte is >= 0x80
+ * @return: Offset (in data) of the first invalid byte, or SIZE_MAX
+ */
+size_t	utf8_validate_range(const char *data, size_t size, size_t from, size_t to,
+    bool *ascii)
+{
+    size_t	start;
+    size_t	end;
+    size_t	bad;
+
+    start = from;
+    while (start > 0 && from - start < 3 && ((unsigned char)data[start] & 0xC0) == 0x80)
+        start--;
+    end = (size - to < 3) ? size : to + 3;
+    bad = start + utf8_validate(data + start, end - start, ascii);
+    // An error before from belongs to the range before; carry on after it
+    while (bad < from)
+        bad = bad + 1 + utf8_validate(data + bad + 1, end - bad - 1, ascii);
+    return (bad < to ? bad : SIZE_MAX);
+}
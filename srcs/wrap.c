@@ -0,0 +1,546 @@
+#include "../includes/editor.h"
+
+/*
+ * VERBATRON Soft Wrap
+ * With ":set wrap" each line is shown on as many screen rows as it needs
+ * at wrap_width() columns a row; a character that does not fit at the end
+ * of a row starts the next one, so wide characters are never cut. Row
+ * starts are remembered every WRAP_ROW_STEP rows for the lines on screen,
+ * which keeps rows deep inside a huge line cheap to find. The rows of every
+ * line are kept in a Fenwick tree, so the document's row of a line and the
+ * line on a row are found in O(log n): page moves and percentage jumps
+ * cost the same in a million-line file as in a short one. Lines are
+ * measured when they are first needed, and the rest of the document in
+ * idle steps; until then a line counts as one row.
+ */
+
+static t_wrap		g_wrap = {0};
+static t_wrap_line	g_maps[WRAP_CACHE_LINES];
+static uint64_t		g_clock = 0;
+static bool			g_ready = false;
+
+/*
+ * Forget the row starts of a line past a byte offset: rows that start
+ * before it only depend on the text before it
+ */
+static void	truncate_map(t_wrap_line *map, size_t byte)
+{
+    while (map->count > 1 && map->starts[map->count - 1].byte >= byte)
+        map->count--;
+    map->rows = 0;
+}
+
+/*
+ * Forget the row starts of lines [line, ...)
+ */
+static void	drop_maps(size_t line)
+{
+    for (int i = 0; i < WRAP_CACHE_LINES; i++)
+    {
+        if (!g_ready)
+            g_maps[i] = (t_wrap_line){.line = SIZE_MAX};
+        else if (g_maps[i].line != SIZE_MAX && g_maps[i].line >= line)
+            g_maps[i].line = SIZE_MAX;
+    }
+    g_ready = true;
+}
+
+/*
+ * Row starts of a line, taking the least recently used entry if it is not
+ * remembered; only row 0 is known in a new entry
+ */
+static t_wrap_line	*row_map(size_t line)
+{
+    t_wrap_line	*map;
+    size_t		len;
+
+    if (!g_ready)
+        drop_maps(0);
+    map = &g_maps[0];
+    for (int i = 0; i < WRAP_CACHE_LINES && map->line != line; i++)
+    {
+        if (g_maps[i].line == line || g_maps[i].used < map->used)
+            map = &g_maps[i];
+    }
+    len = buffer_line_length(&g_buffer, line);
+    if (map->line != line)
+    {
+        if (map->cap == 0)
+        {
+            map->cap = 4;
+            map->starts = malloc(map->cap * sizeof(*map->starts));
+            if (map->starts == NULL)
+                die("malloc");
+        }
+        map->line = line;
+        map->starts[0] = (t_column_mark){0, 0};
+        map->count = 1;
+        map->rows = 0;
+    }
+    else if (map->len != len)
+        truncate_map(map, (map->len < len) ? map->len : len); // Still growing
+    map->len = len;
+    map->used = ++g_clock;
+    return (map);
+}
+
+/*
+ * Lay a line out to its end, remembering row starts on the way
+ *
+ * @return: Rows of the line
+ */
+static size_t	complete(t_wrap_line *map)
+{
+    t_column_mark	at;
+    size_t			moved;
+
+    if (map->rows != 0)
+        return (map->rows);
+    at = map->starts[map->count - 1];
+    for (;;)
+    {
+        moved = columns_row_skip(map->line, &at.byte, &at.col, g_wrap.width, WRAP_ROW_STEP);
+        if (moved < WRAP_ROW_STEP)
+            break ;
+        if (map->count == map->cap)
+        {
+            map->cap *= 2;
+            map->starts = realloc(map->starts, map->cap * sizeof(*map->starts));
+            if (map->starts == NULL)
+                die("realloc");
+        }
+        map->starts[map->count++] = at;
+    }
+    map->rows = (map->count - 1) * WRAP_ROW_STEP + moved + 1;
+    return (map->rows);
+}
+
+/*
+ * Rows of a line as the tree counts them
+ */
+static size_t	value(size_t line)
+{
+    return (g_wrap.rows[line] ? g_wrap.rows[line] : 1);
+}
+
+/*
+ * Recompute the tree entries of lines [from, count)
+ * An entry sums its line and the entries of the lower-bit ranges just
+ * below it, which are final by the time it is reached
+ */
+static void	rebuild(size_t from)
+{
+    size_t	sum;
+
+    for (size_t i = from + 1; i <= g_wrap.count; i++)
+    {
+        sum = value(i - 1);
+        for (size_t k = 1; k < (i & -i); k <<= 1)
+            sum += g_wrap.tree[i - k - 1];
+        g_wrap.tree[i - 1] = sum;
+    }
+}
+
+/*
+ * Rows of lines [0, n)
+ */
+static size_t	prefix(size_t n)
+{
+    size_t	sum;
+
+    sum = 0;
+    for (; n > 0; n -= n & -n)
+        sum += g_wrap.tree[n - 1];
+    return (sum);
+}
+
+/*
+ * Cover lines [0, n) (new lines are not measured yet)
+ */
+static void	cover(size_t n)
+{
+    size_t	old;
+
+    if (n <= g_wrap.count)
+        return ;
+    if (n > g_wrap.cap)
+    {
+        g_wrap.cap = (n > g_wrap.cap * 2) ? n : g_wrap.cap * 2;
+        g_wrap.rows = realloc(g_wrap.rows, g_wrap.cap * sizeof(*g_wrap.rows));
+        g_wrap.tree = realloc(g_wrap.tree, g_wrap.cap * sizeof(*g_wrap.tree));
+        if (g_wrap.rows == NULL || g_wrap.tree == NULL)
+            die("realloc");
+    }
+    old = g_wrap.count;
+    memset(g_wrap.rows + old, 0, (n - old) * sizeof(*g_wrap.rows));
+    g_wrap.count = n;
+    rebuild(old);
+}
+
+/*
+ * Record the rows of a covered line
+ */
+static void	set_rows(size_t line, size_t rows)
+{
+    size_t	old;
+
+    old = value(line);
+    g_wrap.rows[line] = (rows < UINT32_MAX) ? rows : UINT32_MAX;
+    for (size_t i = line + 1; i <= g_wrap.count; i += i & -i)
+        g_wrap.tree[i - 1] += value(line) - old;
+}
+
+/*
+ * Rows a line needs at the current width
+ */
+static size_t	measure(size_t line)
+{
+    return (columns_rows(line, g_wrap.width));
+}
+
+/*
+ * Lines whose rows can be known for good (the last line known may still
+ * grow while the file is being indexed)
+ */
+static size_t	settled(void)
+{
+    size_t	count;
+
+    count = buffer_line_count(&g_buffer);
+    if (!buffer_fully_indexed(&g_buffer) && count > 0)
+        count--;
+    return (count);
+}
+
+/*
+ * Idle-time step: measure the next WRAP_IDLE_LINES lines not measured yet,
+ * so that the rows of the whole document converge to the truth
+ * Re-arms itself as a zero-delay timer until every line is measured
+ */
+static void	wrap_step(void *arg)
+{
+    size_t	count;
+    size_t	done;
+
+    (void)arg;
+    g_wrap.armed = false;
+    if (!g_wrap.on)
+        return ;
+    count = settled();
+    cover(count);
+    done = 0;
+    for (; g_wrap.scan < count && done < WRAP_IDLE_LINES; g_wrap.scan++)
+    {
+        if (g_wrap.rows[g_wrap.scan] != 0)
+            continue ;
+        set_rows(g_wrap.scan, measure(g_wrap.scan));
+        done++;
+    }
+    if (g_wrap.scan < count)
+        g_wrap.armed = loop_timer_add(0, wrap_step, NULL) >= 0;
+}
+
+/*
+ * Follow the text width (the window or the gutter changed size) and start
+ * measuring lines in idle steps if some are left
+ */
+static void	layout(void)
+{
+    int	width;
+
+    width = g_window_cols - gutter_width();
+    if (width < 1)
+        width = 1;
+    if (width != g_wrap.width)
+    {
+        // Every line is cut differently: count them all again
+        g_wrap.width = width;
+        drop_maps(0);
+        if (g_wrap.count > 0)
+            memset(g_wrap.rows, 0, g_wrap.count * sizeof(*g_wrap.rows));
+        rebuild(0);
+        g_wrap.scan = 0;
+    }
+    if (!g_wrap.armed && g_wrap.scan < settled())
+        g_wrap.armed = loop_timer_add(0, wrap_step, NULL) >= 0;
+}
+
+/*
+ * Whether soft wrap is on
+ */
+bool	wrap_enabled(void)
+{
+    return (g_wrap.on);
+}
+
+/*
+ * Turn soft wrap on or off
+ * Turning it off releases the map; it is rebuilt when turned on again
+ *
+ * @param on: true for ":set wrap"
+ */
+void	wrap_set(bool on)
+{
+    if (!on)
+    {
+        free(g_wrap.rows);
+        free(g_wrap.tree);
+        g_wrap = (t_wrap){.armed = g_wrap.armed};
+        for (int i = 0; g_ready && i < WRAP_CACHE_LINES; i++)
+        {
+            free(g_maps[i].starts);
+            g_maps[i] = (t_wrap_line){.line = SIZE_MAX};
+        }
+        return ;
+    }
+    g_wrap.on = true;
+}
+
+/*
+ * Display columns of text on a screen row
+ */
+int	wrap_width(void)
+{
+    layout();
+    return (g_wrap.width);
+}
+
+/*
+ * Screen rows a line takes (at least one)
+ *
+ * @param line: 0-based line number
+ * @return: Rows
+ */
+size_t	wrap_rows(size_t line)
+{
+    size_t	count;
+
+    layout();
+    count = buffer_line_count(&g_buffer);
+    if (line >= count)
+        return (1);
+    if (line + 1 == count && !buffer_fully_indexed(&g_buffer))
+        return (complete(row_map(line))); // Still growing: not counted for good
+    cover(line + 1);
+    if (g_wrap.rows[line] == 0)
+        set_rows(line, complete(row_map(line)));
+    return (g_wrap.rows[line]);
+}
+
+/*
+ * Where a row of a line starts
+ *
+ * @param line: 0-based line number
+ * @param sub: Row within the line (0-based; past the last, the last)
+ * @param col: Receives the display column of the row's first character
+ * @return: Byte offset of that character in the line
+ */
+size_t	wrap_row_start(size_t line, size_t sub, size_t *col)
+{
+    t_wrap_line		*map;
+    t_column_mark	at;
+    size_t			rows;
+
+    rows = wrap_rows(line);
+    if (sub >= rows)
+        sub = rows - 1;
+    map = row_map(line);
+    complete(map);
+    at = map->starts[sub / WRAP_ROW_STEP];
+    columns_row_skip(line, &at.byte, &at.col, g_wrap.width, sub % WRAP_ROW_STEP);
+    *col = at.col;
+    return (at.byte);
+}
+
+/*
+ * Row of a line on which a display column is shown
+ * The end of a line that fills its last row stays on that row
+ *
+ * @param line: 0-based line number
+ * @param col: Display column (0-based)
+ * @return: Row within the line (0-based)
+ */
+size_t	wrap_sub(size_t line, size_t col)
+{
+    t_wrap_line		*map;
+    t_column_mark	at;
+    t_column_mark	next;
+    size_t			lo;
+    size_t			hi;
+    size_t			sub;
+
+    wrap_rows(line);
+    map = row_map(line);
+    complete(map);
+    lo = 0;
+    hi = map->count;
+    while (hi - lo > 1) // Last remembered start at or before col
+    {
+        if (map->starts[lo + (hi - lo) / 2].col <= col)
+            lo += (hi - lo) / 2;
+        else
+            hi = lo + (hi - lo) / 2;
+    }
+    at = map->starts[lo];
+    sub = lo * WRAP_ROW_STEP;
+    while (sub + 1 < map->rows)
+    {
+        next = at;
+        columns_row_skip(line, &next.byte, &next.col, g_wrap.width, 1);
+        if (next.col > col)
+            break ;
+        at = next;
+        sub++;
+    }
+    return (sub);
+}
+
+/*
+ * Rows from row sub of a line to row to_sub of another, counted line by
+ * line: meant for the lines of a screen, beyond which it stops counting
+ *
+ * @param limit: Count no further than about this many rows
+ * @return: Rows (negative if the second row comes first), at least limit
+ * in absolute value if they are that far apart
+ */
+long	wrap_distance(size_t line, size_t sub, size_t to_line, size_t to_sub, long limit)
+{
+    long	rows;
+
+    if (to_line < line || (to_line == line && to_sub < sub))
+        return (-wrap_distance(to_line, to_sub, line, sub, limit));
+    rows = -(long)sub;
+    for (; line < to_line && rows < limit; line++)
+        rows += wrap_rows(line);
+    if (line < to_line)
+        return (rows);
+    return (rows + (long)to_sub);
+}
+
+/*
+ * Rows of the document above a line
+ *
+ * @param line: 0-based line number
+ * @return: Row (0-based) where the line starts
+ */
+size_t	wrap_row_of(size_t line)
+{
+    size_t	count;
+
+    layout();
+    count = buffer_line_count(&g_buffer);
+    cover((line < count) ? line : count);
+    return (prefix((line < count) ? line : count));
+}
+
+/*
+ * Line shown on a row of the document (the last row past the end)
+ *
+ * @param row: 0-based row
+ * @param sub: Receives the row within that line
+ * @return: 0-based line number
+ */
+size_t	wrap_line_at(size_t row, size_t *sub)
+{
+    size_t	pos;
+    size_t	step;
+
+    layout();
+    cover(buffer_line_count(&g_buffer));
+    pos = 0;
+    for (step = 1; step * 2 <= g_wrap.count; step *= 2)
+        ;
+    // Descend the tree: pos lines take no more than the rows left
+    for (; step > 0; step /= 2)
+    {
+        if (pos + step <= g_wrap.count && g_wrap.tree[pos + step - 1] <= row)
+        {
+            pos += step;
+            row -= g_wrap.tree[pos - 1];
+        }
+    }
+    if (pos >= g_wrap.count)
+    {
+        pos = (g_wrap.count > 0) ? g_wrap.count - 1 : 0;
+        row = SIZE_MAX;
+    }
+    if (row >= wrap_rows(pos))
+        row = wrap_rows(pos) - 1; // Measured now, and shorter than it counted
+    *sub = row;
+    return (pos);
+}
+
+/*
+ * Rows of the whole document
+ */
+size_t	wrap_total(void)
+{
+    layout();
+    cover(buffer_line_count(&g_buffer));
+    return (prefix(g_wrap.count));
+}
+
+/*
+ * Lines were replaced: lines [line, line + removed] of the old text are now
+ * [line, line + added] (as for columns_edit()). They are measured again when
+ * needed; the counts after them move along
+ *
+ * @param line: First line touched by the edit
+ * @param byte: Offset in that line where the edit starts
+ * @param removed: Line breaks the edit took out
+ * @param added: Line breaks it put in
+ */
+void	wrap_edit(size_t line, size_t byte, size_t removed, size_t added)
+{
+    size_t	tail;
+
+    for (int i = 0; g_ready && i < WRAP_CACHE_LINES; i++)
+    {
+        if (g_maps[i].line == SIZE_MAX || g_maps[i].line < line)
+            continue ;
+        if (g_maps[i].line == line)
+            truncate_map(&g_maps[i], byte);
+        else if (g_maps[i].line <= line + removed)
+            g_maps[i].line = SIZE_MAX;
+        else
+            g_maps[i].line += added - removed;
+    }
+    if (line >= g_wrap.count)
+        return ;
+    tail = line + 1 + removed;
+    if (tail > g_wrap.count)
+    {
+        wrap_invalidate(line);
+        return ;
+    }
+    if (g_wrap.count + added > g_wrap.cap)
+    {
+        g_wrap.cap = (g_wrap.count + added) * 2;
+        g_wrap.rows = realloc(g_wrap.rows, g_wrap.cap * sizeof(*g_wrap.rows));
+        g_wrap.tree = realloc(g_wrap.tree, g_wrap.cap * sizeof(*g_wrap.tree));
+        if (g_wrap.rows == NULL || g_wrap.tree == NULL)
+            die("realloc");
+    }
+    memmove(g_wrap.rows + line + 1 + added, g_wrap.rows + tail,
+        (g_wrap.count - tail) * sizeof(*g_wrap.rows));
+    memset(g_wrap.rows + line, 0, (1 + added) * sizeof(*g_wrap.rows));
+    g_wrap.count += added - removed;
+    rebuild(line);
+    if (g_wrap.scan > line)
+        g_wrap.scan = line;
+}
+
+/*
+ * Something changed from a line on, in ways not worth describing (undo, a
+ * substitution, another file): forget the counts from that line on
+ *
+ * @param line: First line that may have changed
+ */
+void	wrap_invalidate(size_t line)
+{
+    drop_maps(line);
+    if (g_wrap.count > line)
+        g_wrap.count = line;
+    if (g_wrap.scan > line)
+        g_wrap.scan = line;
+}